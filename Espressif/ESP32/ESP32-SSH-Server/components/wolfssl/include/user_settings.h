@@ -56,7 +56,9 @@
 /* Optionally enable some wolfSSH settings */
 
 #ifdef ESP_ENABLE_WOLFSSH
-    /* The default SSH Windows size is massive for an embedded target. Limit it: */
+    /* The default SSH Windows size is massive for an embedded target. Limit it.
+     * With wolfSSH 1.4.15 or later the server picks each session's window at
+     * run time instead, see SSH_SERVER_WINDOW_SZ in ssh_server_config.h */
     #define DEFAULT_WINDOW_SZ 2000
 
     /* These may be defined in cmake for other examples: */
@@ -94,10 +96,10 @@
 #endif /* ESP_ENABLE_WOLFSSH */
 
 /* when you want to use SINGLE THREAD. Note Default ESP-IDF is FreeRTOS */
-/* TODO: previously saw depth mismatch when disabling SINGLE_THREADED ?
- * (but putty cannot connect: server host key invalid when defined)
- *  fails for both `WOLFSSL_NONBLOCK 0` or `WOLFSSL_NONBLOCK 1` */
-#define SINGLE_THREADED
+/* Each SSH session runs in its own FreeRTOS task (see
+ * SSH_SERVER_MAX_SESSIONS in ssh_server_config.h), so wolfSSL needs its
+ * mutexes. SINGLE_THREADED is only valid with one session. */
+/* #define SINGLE_THREADED */
 
 /* Need to increase pthread stack size when using WOLFSSH_TEST_THREADING */
 /* Minimum defined size should be 20096, but not in SINGLE_THREADED */
@@ -179,6 +181,20 @@
         /* ---- ECDSA / ECC ---- */
         #define HAVE_ECC
         #define HAVE_CURVE25519
+
+        /* Keep the curve parameters loaded instead of parsing them from
+         * hex strings on every ECC operation; about 6 big integers each. */
+        #define ECC_CACHE_CURVE
+
+        /* Optional fixed point cache: precomputed multiples of the base
+         * point make key generation and signing much faster, at a cost of
+         * (1 << FP_LUT) * 3 big integers per entry. With USE_FAST_MATH and
+         * the default FP_MAX_BITS that is about 26KB per curve at FP_LUT 4.
+         * The SSH_SERVER_KEX_WARMUP task fills it at start up.
+        #define FP_ECC
+        #define FP_ENTRIES 2
+        #define FP_LUT     4
+        */
         #define HAVE_ED25519
         /* ED25519 requires SHA512 */
         #undef  WOLFSSL_SHA512
@@ -0,0 +1,166 @@
+/* host_main.c
+ *
+ * Copyright (C) 2014-2024 wolfSSL Inc.
+ *
+ * This file is part of wolfSSH.
+ *
+ * wolfSSH is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfSSH is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wolfSSH.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Linux entry point of the SSH to UART bridge: the same tasks app_main
+ * starts on the ESP32, with the UART on a pseudo-terminal and the server
+ * on the host's network stack. */
+
+#include "ssh_server_config.h"
+#include "ssh_server.h"
+#include "uart_helper.h"
+#include "ssh_trace.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_log.h>
+
+#include <wolfssh/ssh.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static const char* TAG = "SSH Server host";
+
+/* stack sizes are ignored by the host shim, threads get the default */
+#define HOST_TASK_STACK_SIZE (8 * 1024)
+
+/* as in main.c, a pause before server_test is restarted */
+static TickType_t DelayTicks = (1000 / portTICK_PERIOD_MS);
+
+
+static void server_session(void* args)
+{
+    while (1) {
+        server_test(args);
+        vTaskDelay(DelayTicks ? DelayTicks : 1);
+    }
+}
+
+static void usage(const char* name)
+{
+    printf("usage: %s [-d] [-q] [-s] [-l link] [-w bytes] [-p bytes] [-t n]\n"
+           "  -d       debug logging\n"
+           "  -q       log warnings and errors only\n"
+           "  -s       drop UART data sent at another rate, for auto-baud\n"
+           "  -l link  symlink the first UART pty, e.g. to /tmp/ttyUART\n"
+           "  -w bytes fixed SSH channel window, no adapting (%d..%d)\n"
+           "  -p bytes largest SSH packet the client may send\n"
+           "  -t n     log one data path event in n, 0 for none\n"
+           "SSH listens on port %d, connect the UART end with e.g.\n"
+           "  picocom /dev/pts/N\n",
+           name, SSH_SERVER_WINDOW_MIN_SZ, SSH_SERVER_WINDOW_MAX_SZ,
+           SSH_UART_PORT);
+}
+
+int main(int argc, char** argv)
+{
+    const char* link = NULL;
+    const char* pty;
+    uint32_t windowSz = 0;
+    uint32_t maxPacketSz = 0;
+    int adaptive = -1;
+    int port;
+    int ch;
+
+    esp_log_level_set("*", ESP_LOG_INFO);
+
+    while ((ch = getopt(argc, argv, "dqsl:w:p:t:h")) != -1) {
+        switch (ch) {
+            case 'd':
+                esp_log_level_set("*", ESP_LOG_DEBUG);
+                break;
+
+            case 'q':
+                esp_log_level_set("*", ESP_LOG_WARN);
+                break;
+
+            case 's':
+                uart_host_check_speed(true);
+                break;
+
+            case 'l':
+                link = optarg;
+                break;
+
+            case 'w':
+                windowSz = (uint32_t)strtoul(optarg, NULL, 0);
+                adaptive = 0;
+                break;
+
+            case 'p':
+                maxPacketSz = (uint32_t)strtoul(optarg, NULL, 0);
+                break;
+
+            case 't':
+                ssh_trace_set_sample((uint32_t)strtoul(optarg, NULL, 0));
+                break;
+
+            default:
+                usage(argv[0]);
+                return ch == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    if ((windowSz != 0 || maxPacketSz != 0) &&
+        ssh_server_set_window(windowSz, maxPacketSz, adaptive) != 0) {
+        ESP_LOGE(TAG, "window or packet size not supported");
+        return EXIT_FAILURE;
+    }
+
+    init_UART();
+
+    /* -l links the UART of the first route; init_UART logs the others */
+    pty = uart_host_pty_name(uart_route_get(0)->uart);
+    if (pty == NULL) {
+        ESP_LOGE(TAG, "no pty for the UART");
+        return EXIT_FAILURE;
+    }
+    if (link != NULL) {
+        unlink(link);
+        if (symlink(pty, link) != 0) {
+            ESP_LOGE(TAG, "could not link %s to %s", link, pty);
+            return EXIT_FAILURE;
+        }
+        ESP_LOGI(TAG, "%s -> %s", link, pty);
+    }
+
+    if (wolfSSH_Init() != WS_SUCCESS) {
+        ESP_LOGE(TAG, "Couldn't initialize wolfSSH.");
+        return EXIT_FAILURE;
+    }
+
+#ifndef DISABLE_SSH_UART
+    for (port = 0; port < SSH_SERVER_UART_PORTS; port++) {
+        xTaskCreate(uart_rx_task, "uart_rx_task",
+                    HOST_TASK_STACK_SIZE, (void*)(intptr_t)port,
+                    tskIDLE_PRIORITY, NULL);
+
+        xTaskCreate(uart_tx_task, "uart_tx_task",
+                    HOST_TASK_STACK_SIZE, (void*)(intptr_t)port,
+                    tskIDLE_PRIORITY, NULL);
+    }
+#endif
+
+    /* the accept loop runs on the main thread */
+    server_session(NULL);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,154 @@
+/* driver/uart.h
+ *
+ * Copyright (C) 2014-2024 wolfSSL Inc.
+ *
+ * This file is part of wolfSSH.
+ *
+ * wolfSSH is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfSSH is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wolfSSH.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Host shim of the ESP-IDF UART driver: each UART is a pseudo-terminal.
+ * Connect the "device" end with any terminal program, e.g.
+ *     picocom /dev/pts/N
+ * or let a test script talk to it. The line settings are recorded but,
+ * as on a pty, have no effect on the data; see uart_host_check_speed(). */
+
+#ifndef _HOST_DRIVER_UART_H_
+#define _HOST_DRIVER_UART_H_
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "hal/gpio_types.h"
+
+#include <stdbool.h>
+
+typedef enum {
+    UART_NUM_0,
+    UART_NUM_1,
+    UART_NUM_2,
+    UART_NUM_MAX
+} uart_port_t;
+
+typedef enum {
+    UART_DATA_5_BITS,
+    UART_DATA_6_BITS,
+    UART_DATA_7_BITS,
+    UART_DATA_8_BITS
+} uart_word_length_t;
+
+typedef enum {
+    UART_PARITY_DISABLE = 0,
+    UART_PARITY_EVEN    = 2,
+    UART_PARITY_ODD     = 3
+} uart_parity_t;
+
+typedef enum {
+    UART_STOP_BITS_1   = 1,
+    UART_STOP_BITS_1_5 = 2,
+    UART_STOP_BITS_2   = 3
+} uart_stop_bits_t;
+
+typedef enum {
+    UART_HW_FLOWCTRL_DISABLE = 0,
+    UART_HW_FLOWCTRL_RTS     = 1,
+    UART_HW_FLOWCTRL_CTS     = 2,
+    UART_HW_FLOWCTRL_CTS_RTS = 3
+} uart_hw_flowcontrol_t;
+
+typedef enum {
+    UART_SCLK_DEFAULT
+} uart_sclk_t;
+
+typedef struct {
+    int                   baud_rate;
+    uart_word_length_t    data_bits;
+    uart_parity_t         parity;
+    uart_stop_bits_t      stop_bits;
+    uart_hw_flowcontrol_t flow_ctrl;
+    uint8_t               rx_flow_ctrl_thresh;
+    uart_sclk_t           source_clk;
+} uart_config_t;
+
+typedef enum {
+    UART_DATA,
+    UART_BREAK,
+    UART_BUFFER_FULL,
+    UART_FIFO_OVF,
+    UART_FRAME_ERR,
+    UART_PARITY_ERR,
+    UART_DATA_BREAK,
+    UART_PATTERN_DET,
+    UART_EVENT_MAX
+} uart_event_type_t;
+
+typedef struct {
+    uart_event_type_t type;
+    size_t            size;
+    int               timeout_flag;
+} uart_event_t;
+
+#define UART_PIN_NO_CHANGE (-1)
+#define ESP_INTR_FLAG_IRAM (1 << 10)
+
+esp_err_t uart_driver_install(uart_port_t port, int rxBufferSz,
+                              int txBufferSz, int queueSz,
+                              QueueHandle_t* queue, int intrAllocFlags);
+
+esp_err_t uart_driver_delete(uart_port_t port);
+
+esp_err_t uart_param_config(uart_port_t port, const uart_config_t* config);
+
+esp_err_t uart_set_baudrate(uart_port_t port, uint32_t baudRate);
+
+esp_err_t uart_set_word_length(uart_port_t port, uart_word_length_t dataBits);
+
+esp_err_t uart_set_parity(uart_port_t port, uart_parity_t parity);
+
+esp_err_t uart_set_stop_bits(uart_port_t port, uart_stop_bits_t stopBits);
+
+esp_err_t uart_set_pin(uart_port_t port, int txPin, int rxPin, int rtsPin,
+                       int ctsPin);
+
+esp_err_t uart_set_sw_flow_ctrl(uart_port_t port, bool enable,
+                                uint8_t rxThreshXon, uint8_t rxThreshXoff);
+
+esp_err_t uart_set_rx_timeout(uart_port_t port, uint8_t symbols);
+
+esp_err_t uart_enable_pattern_det_baud_intr(uart_port_t port,
+                                            char patternChr,
+                                            uint8_t chrNum, int chrTout,
+                                            int postIdle, int preIdle);
+
+esp_err_t uart_pattern_queue_reset(uart_port_t port, int queueLength);
+
+int uart_pattern_pop_pos(uart_port_t port);
+
+int uart_read_bytes(uart_port_t port, void* buf, uint32_t length,
+                    TickType_t ticks);
+
+int uart_write_bytes(uart_port_t port, const void* src, size_t size);
+
+esp_err_t uart_wait_tx_done(uart_port_t port, TickType_t ticks);
+
+esp_err_t uart_flush_input(uart_port_t port);
+
+/* host only: path of the pty the UART is connected to, NULL if none */
+const char* uart_host_pty_name(uart_port_t port);
+
+/* host only: drop what arrives while the far end of a pty is set to another
+ * rate than the UART, as a framing error; lets auto-baud find the rate a
+ * terminal program was started with, e.g. picocom -b 57600 */
+void uart_host_check_speed(bool enable);
+
+#endif /* _HOST_DRIVER_UART_H_ */
@@ -0,0 +1,79 @@
+/* esp_shim.c
+ *
+ * Copyright (C) 2014-2024 wolfSSL Inc.
+ *
+ * This file is part of wolfSSH.
+ *
+ * wolfSSH is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfSSH is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wolfSSH.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+static esp_log_level_t logLevel = ESP_LOG_INFO;
+static pthread_mutex_t logLock = PTHREAD_MUTEX_INITIALIZER;
+
+void esp_log_level_set(const char* tag, esp_log_level_t level)
+{
+    if (tag != NULL && strcmp(tag, "*") == 0) {
+        logLevel = level;
+    }
+}
+
+void esp_log_write(esp_log_level_t level, const char* tag,
+                   const char* format, ...)
+{
+    static const char letters[] = "NEWIDV";
+    va_list args;
+
+    if (level > logLevel) {
+        return;
+    }
+
+    /* the same layout as on the device: "I (1234) tag: message" */
+    pthread_mutex_lock(&logLock);
+    fprintf(stderr, "%c (%lld) %s: ", letters[level],
+            (long long)(esp_timer_get_time() / 1000), tag);
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fputc('\n', stderr);
+    pthread_mutex_unlock(&logLock);
+}
+
+static struct timespec startTime;
+static pthread_once_t startOnce = PTHREAD_ONCE_INIT;
+
+static void esp_timer_start(void)
+{
+    clock_gettime(CLOCK_MONOTONIC, &startTime);
+}
+
+/* microseconds since the first call, as since boot on the device */
+int64_t esp_timer_get_time(void)
+{
+    struct timespec now;
+
+    pthread_once(&startOnce, esp_timer_start);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (int64_t)(now.tv_sec - startTime.tv_sec) * 1000000 +
+           (now.tv_nsec - startTime.tv_nsec) / 1000;
+}
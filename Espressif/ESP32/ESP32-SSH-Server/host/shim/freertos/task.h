@@ -0,0 +1,59 @@
+/* freertos/task.h
+ *
+ * Copyright (C) 2014-2024 wolfSSL Inc.
+ *
+ * This file is part of wolfSSH.
+ *
+ * wolfSSH is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfSSH is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wolfSSH.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _HOST_FREERTOS_TASK_H_
+#define _HOST_FREERTOS_TASK_H_
+
+#include "freertos/FreeRTOS.h"
+
+#include <sched.h>
+
+typedef struct HostTask* TaskHandle_t;
+typedef void (*TaskFunction_t)(void* arg);
+
+/* Tasks are pthreads with their own (default size) stacks, so the static
+ * buffers are not used. */
+typedef struct StaticTask_t {
+    void* unused;
+} StaticTask_t;
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char* name,
+                       uint32_t stackDepth, void* arg,
+                       UBaseType_t priority, TaskHandle_t* created);
+
+TaskHandle_t xTaskCreateStatic(TaskFunction_t fn, const char* name,
+                               uint32_t stackDepth, void* arg,
+                               UBaseType_t priority, StackType_t* stack,
+                               StaticTask_t* taskBuffer);
+
+/* only a task deleting itself (NULL) is supported */
+void vTaskDelete(TaskHandle_t task);
+
+void vTaskDelay(TickType_t ticks);
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticks);
+
+#define taskYIELD() sched_yield()
+
+#endif /* _HOST_FREERTOS_TASK_H_ */
@@ -0,0 +1,355 @@
+/* freertos_shim.c
+ *
+ * Copyright (C) 2014-2024 wolfSSL Inc.
+ *
+ * This file is part of wolfSSH.
+ *
+ * wolfSSH is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfSSH is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wolfSSH.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static const char* TAG = "freertos_shim";
+
+struct HostTask {
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    uint32_t        notify;
+    TaskFunction_t  fn;
+    void*           arg;
+    char            name[configMAX_TASK_NAME_LEN];
+};
+
+struct HostQueue {
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    UBaseType_t     length;
+    UBaseType_t     itemSize;
+    UBaseType_t     head;
+    UBaseType_t     count;
+    uint8_t*        items;
+};
+
+struct HostMutex {
+    pthread_mutex_t lock;
+};
+
+static __thread struct HostTask* currentTask = NULL;
+
+
+/* absolute CLOCK_MONOTONIC deadline [ticks] from now */
+static void host_deadline(struct timespec* ts, TickType_t ticks)
+{
+    clock_gettime(CLOCK_MONOTONIC, ts);
+    ts->tv_sec  += ticks / 1000;
+    ts->tv_nsec += (long)(ticks % 1000) * 1000000L;
+    if (ts->tv_nsec >= 1000000000L) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000L;
+    }
+}
+
+/* wait on [cond] for at most [ticks]; returns zero on timeout */
+static int host_wait(pthread_cond_t* cond, pthread_mutex_t* lock,
+                     TickType_t ticks, const struct timespec* deadline)
+{
+    if (ticks == 0) {
+        return 0;
+    }
+    if (ticks == portMAX_DELAY) {
+        pthread_cond_wait(cond, lock);
+        return 1;
+    }
+    return pthread_cond_timedwait(cond, lock, deadline) != ETIMEDOUT;
+}
+
+static void host_cond_init(pthread_cond_t* cond)
+{
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+/* the task handle of a thread FreeRTOS did not start, e.g. main */
+static struct HostTask* host_task_new(const char* name)
+{
+    struct HostTask* task = (struct HostTask*)calloc(1, sizeof(*task));
+
+    if (task != NULL) {
+        pthread_mutex_init(&task->lock, NULL);
+        host_cond_init(&task->cond);
+        strncpy(task->name, name, sizeof(task->name) - 1);
+    }
+
+    return task;
+}
+
+static void* host_task_start(void* arg)
+{
+    struct HostTask* task = (struct HostTask*)arg;
+
+    currentTask = task;
+    task->fn(task->arg);
+
+    /* a FreeRTOS task must not return; treat it as deleting itself */
+    ESP_LOGW(TAG, "task %s returned", task->name);
+    return NULL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char* name,
+                       uint32_t stackDepth, void* arg,
+                       UBaseType_t priority, TaskHandle_t* created)
+{
+    struct HostTask* task = host_task_new(name);
+
+    /* host threads get the default stack, 64-bit frames are larger */
+    (void)stackDepth;
+    (void)priority;
+
+    if (task == NULL) {
+        return pdFAIL;
+    }
+    task->fn = fn;
+    task->arg = arg;
+
+    if (pthread_create(&task->thread, NULL, host_task_start, task) != 0) {
+        free(task);
+        return pdFAIL;
+    }
+    pthread_detach(task->thread);
+
+    if (created != NULL) {
+        *created = task;
+    }
+
+    return pdPASS;
+}
+
+TaskHandle_t xTaskCreateStatic(TaskFunction_t fn, const char* name,
+                               uint32_t stackDepth, void* arg,
+                               UBaseType_t priority, StackType_t* stack,
+                               StaticTask_t* taskBuffer)
+{
+    TaskHandle_t task = NULL;
+
+    (void)stack;
+    (void)taskBuffer;
+
+    xTaskCreate(fn, name, stackDepth, arg, priority, &task);
+    return task;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    if (task != NULL && task != currentTask) {
+        ESP_LOGE(TAG, "vTaskDelete of another task is not supported");
+        return;
+    }
+
+    /* the handle may still be held by others, so it is not freed */
+    pthread_exit(NULL);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    struct timespec ts;
+
+    ts.tv_sec = ticks / 1000;
+    ts.tv_nsec = (long)(ticks % 1000) * 1000000L;
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR)
+        ;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    if (currentTask == NULL) {
+        currentTask = host_task_new("main");
+    }
+
+    return currentTask;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    pthread_mutex_lock(&task->lock);
+    task->notify++;
+    pthread_cond_signal(&task->cond);
+    pthread_mutex_unlock(&task->lock);
+
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticks)
+{
+    struct HostTask* task = xTaskGetCurrentTaskHandle();
+    struct timespec deadline;
+    uint32_t value;
+
+    host_deadline(&deadline, ticks);
+
+    pthread_mutex_lock(&task->lock);
+    while (task->notify == 0 &&
+           host_wait(&task->cond, &task->lock, ticks, &deadline))
+        ;
+    value = task->notify;
+    if (value > 0) {
+        task->notify = clearOnExit ? 0 : value - 1;
+    }
+    pthread_mutex_unlock(&task->lock);
+
+    return value;
+}
+
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize)
+{
+    struct HostQueue* queue = (struct HostQueue*)calloc(1, sizeof(*queue));
+
+    if (queue != NULL) {
+        queue->items = (uint8_t*)malloc((size_t)length * itemSize);
+        if (queue->items == NULL) {
+            free(queue);
+            return NULL;
+        }
+        queue->length = length;
+        queue->itemSize = itemSize;
+        pthread_mutex_init(&queue->lock, NULL);
+        host_cond_init(&queue->cond);
+    }
+
+    return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+    if (queue != NULL) {
+        pthread_mutex_destroy(&queue->lock);
+        pthread_cond_destroy(&queue->cond);
+        free(queue->items);
+        free(queue);
+    }
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void* item,
+                      TickType_t ticks)
+{
+    struct timespec deadline;
+    BaseType_t ret = pdFAIL;
+    UBaseType_t tail;
+
+    host_deadline(&deadline, ticks);
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == queue->length &&
+           host_wait(&queue->cond, &queue->lock, ticks, &deadline))
+        ;
+    if (queue->count < queue->length) {
+        tail = (queue->head + queue->count) % queue->length;
+        memcpy(queue->items + (size_t)tail * queue->itemSize, item,
+               queue->itemSize);
+        queue->count++;
+        pthread_cond_broadcast(&queue->cond);
+        ret = pdTRUE;
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    return ret;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void* item, TickType_t ticks)
+{
+    struct timespec deadline;
+    BaseType_t ret = pdFALSE;
+
+    host_deadline(&deadline, ticks);
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == 0 &&
+           host_wait(&queue->cond, &queue->lock, ticks, &deadline))
+        ;
+    if (queue->count > 0) {
+        memcpy(item, queue->items + (size_t)queue->head * queue->itemSize,
+               queue->itemSize);
+        queue->head = (queue->head + 1) % queue->length;
+        queue->count--;
+        pthread_cond_broadcast(&queue->cond);
+        ret = pdTRUE;
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    return ret;
+}
+
+BaseType_t xQueueReset(QueueHandle_t queue)
+{
+    pthread_mutex_lock(&queue->lock);
+    queue->head = 0;
+    queue->count = 0;
+    pthread_cond_broadcast(&queue->cond);
+    pthread_mutex_unlock(&queue->lock);
+
+    return pdPASS;
+}
+
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    struct HostMutex* mutex = (struct HostMutex*)calloc(1, sizeof(*mutex));
+
+    if (mutex != NULL) {
+        pthread_mutex_init(&mutex->lock, NULL);
+    }
+
+    return mutex;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t mutex, TickType_t ticks)
+{
+    struct timespec deadline;
+
+    if (ticks == portMAX_DELAY) {
+        return pthread_mutex_lock(&mutex->lock) == 0 ? pdTRUE : pdFALSE;
+    }
+
+    /* pthread_mutex_timedlock only takes CLOCK_REALTIME */
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec  += ticks / 1000;
+    deadline.tv_nsec += (long)(ticks % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    return pthread_mutex_timedlock(&mutex->lock, &deadline) == 0 ?
+           pdTRUE : pdFALSE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t mutex)
+{
+    return pthread_mutex_unlock(&mutex->lock) == 0 ? pdTRUE : pdFALSE;
+}
@@ -0,0 +1,37 @@
+/* hal/gpio_types.h
+ *
+ * Copyright (C) 2014-2024 wolfSSL Inc.
+ *
+ * This file is part of wolfSSH.
+ *
+ * wolfSSH is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfSSH is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wolfSSH.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _HOST_GPIO_TYPES_H_
+#define _HOST_GPIO_TYPES_H_
+
+/* pin numbers only show up in messages on the host */
+typedef enum {
+    GPIO_NUM_NC = -1,
+    GPIO_NUM_1  = 1,
+    GPIO_NUM_3  = 3,
+    GPIO_NUM_16 = 16,
+    GPIO_NUM_17 = 17,
+    GPIO_NUM_26 = 26,
+    GPIO_NUM_32 = 32,
+    GPIO_NUM_33 = 33,
+    GPIO_NUM_36 = 36
+} gpio_num_t;
+
+#endif /* _HOST_GPIO_TYPES_H_ */
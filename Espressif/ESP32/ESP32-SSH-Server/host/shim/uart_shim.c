@@ -0,0 +1,661 @@
+/* uart_shim.c
+ *
+ * Copyright (C) 2014-2024 wolfSSL Inc.
+ *
+ * This file is part of wolfSSH.
+ *
+ * wolfSSH is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfSSH is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wolfSSH.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* The ESP-IDF UART driver on a pseudo-terminal: a reader thread stands in
+ * for the UART interrupt, filling the receive ring and posting the same
+ * events to the driver queue. With flow control on, it stops reading the
+ * pty while the ring is full, so a writer on the far end blocks, as a
+ * device held off by RTS or XOFF would wait.
+ *
+ * The line settings only matter with uart_host_check_speed(): then what
+ * arrives while the far end has set its pty to another rate is dropped as
+ * a framing error, as a UART at the wrong rate would see it. */
+#define _GNU_SOURCE /* ptsname_r, cfmakeraw */
+
+#include "driver/uart.h"
+#include "esp_log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+static const char* TAG = "uart_shim";
+
+#define UART_HOST_READ_SZ    128 /* the size of the ESP32 hardware FIFO */
+#define UART_HOST_PATTERN_SZ 32
+
+/* the pty of a UART outlives its driver, so a terminal program keeps its
+ * connection when the driver is reinstalled for another ring size */
+typedef struct {
+    int  master;
+    int  slave; /* kept open so the pty survives reconnects */
+    char name[64];
+} UartHostPty;
+
+typedef struct {
+    UartHostPty*    pty;
+    pthread_t       reader;
+    int             stop;    /* set by uart_driver_delete */
+    int             wake[2]; /* a pipe to interrupt the reader's poll() */
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    uint8_t*        ring;
+    uint32_t        ringSz;
+    uint32_t        head;
+    uint32_t        used;
+    QueueHandle_t   queue;
+    int             patternChr;  /* -1 when pattern detection is off */
+    int             patterns[UART_HOST_PATTERN_SZ];
+    int             patternCount;
+    int             swFlowCtrl;
+    uart_config_t   config;
+} UartHost;
+
+static UartHost* uarts[UART_NUM_MAX];
+static UartHostPty ptys[UART_NUM_MAX];
+static int checkSpeed = 0;
+
+/* the termios codes of the rates a terminal program is likely to set */
+static const struct {
+    int     baud;
+    speed_t speed;
+} uartHostSpeeds[] = {
+    { 1200, B1200 },     { 2400, B2400 },     { 4800, B4800 },
+    { 9600, B9600 },     { 19200, B19200 },   { 38400, B38400 },
+    { 57600, B57600 },   { 115200, B115200 }, { 230400, B230400 },
+    { 460800, B460800 }, { 921600, B921600 }
+};
+
+
+static UartHost* uart_host_get(uart_port_t port)
+{
+    if ((unsigned)port >= UART_NUM_MAX) {
+        return NULL;
+    }
+
+    return uarts[port];
+}
+
+static void uart_host_event(UartHost* uart, uart_event_type_t type,
+                            size_t size)
+{
+    uart_event_t event;
+
+    if (uart->queue != NULL) {
+        memset(&event, 0, sizeof(event));
+        event.type = type;
+        event.size = size;
+        /* as from an ISR, never wait for room in the queue */
+        xQueueSend(uart->queue, &event, 0);
+    }
+}
+
+/* whether the far end of the pty is set to the rate of the UART; always
+ * so without uart_host_check_speed() or for a rate termios has no code for */
+static int uart_host_speed_ok(UartHost* uart)
+{
+    struct termios tio;
+    size_t i;
+
+    if (!checkSpeed || tcgetattr(uart->pty->slave, &tio) != 0) {
+        return 1;
+    }
+
+    for (i = 0; i < sizeof(uartHostSpeeds) / sizeof(uartHostSpeeds[0]); i++) {
+        if (uartHostSpeeds[i].baud == uart->config.baud_rate) {
+            return cfgetospeed(&tio) == uartHostSpeeds[i].speed;
+        }
+    }
+
+    return 1;
+}
+
+/* called with the lock held; returns the number of bytes accepted */
+static uint32_t uart_host_push(UartHost* uart, const uint8_t* data,
+                               uint32_t sz)
+{
+    uint32_t i;
+
+    for (i = 0; i < sz && uart->used < uart->ringSz; i++) {
+        if (data[i] == uart->patternChr &&
+            uart->patternCount < UART_HOST_PATTERN_SZ) {
+            /* positions are relative to the data in the ring */
+            uart->patterns[uart->patternCount++] = (int)uart->used;
+        }
+        uart->ring[(uart->head + uart->used) % uart->ringSz] = data[i];
+        uart->used++;
+    }
+
+    return i;
+}
+
+static void* uart_host_reader(void* arg)
+{
+    UartHost* uart = (UartHost*)arg;
+    uint8_t fifo[UART_HOST_READ_SZ];
+    uint32_t accepted;
+    uint32_t patterns;
+    struct pollfd fds[2];
+    ssize_t n;
+
+    fds[0].fd = uart->pty->master;
+    fds[0].events = POLLIN;
+    fds[1].fd = uart->wake[0];
+    fds[1].events = POLLIN;
+
+    for (;;) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ESP_LOGE(TAG, "pty poll failed, errno %d", errno);
+            break;
+        }
+        if (fds[1].revents != 0) {
+            /* uart_driver_delete */
+            break;
+        }
+
+        n = read(uart->pty->master, fifo, sizeof(fifo));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            /* EIO while nothing has the slave open; the slave fd we hold
+             * prevents that, so this is fatal */
+            ESP_LOGE(TAG, "pty read failed, errno %d", errno);
+            break;
+        }
+
+        pthread_mutex_lock(&uart->lock);
+        if (!uart_host_speed_ok(uart)) {
+            pthread_mutex_unlock(&uart->lock);
+            uart_host_event(uart, UART_FRAME_ERR, (size_t)n);
+            continue;
+        }
+        patterns = (uint32_t)uart->patternCount;
+        accepted = uart_host_push(uart, fifo, (uint32_t)n);
+        while ((accepted < (uint32_t)n) && !uart->stop &&
+               (uart->swFlowCtrl ||
+                (uart->config.flow_ctrl & UART_HW_FLOWCTRL_RTS))) {
+            /* the rest waits for uart_read_bytes to make room */
+            pthread_cond_broadcast(&uart->cond);
+            pthread_mutex_unlock(&uart->lock);
+            uart_host_event(uart, UART_BUFFER_FULL, accepted);
+            pthread_mutex_lock(&uart->lock);
+            while ((uart->used == uart->ringSz) && !uart->stop) {
+                pthread_cond_wait(&uart->cond, &uart->lock);
+            }
+            accepted += uart_host_push(uart, fifo + accepted,
+                                       (uint32_t)n - accepted);
+        }
+        if (uart->stop) {
+            pthread_mutex_unlock(&uart->lock);
+            break;
+        }
+        patterns = (uint32_t)uart->patternCount - patterns;
+        pthread_cond_broadcast(&uart->cond);
+        pthread_mutex_unlock(&uart->lock);
+
+        if (accepted < (uint32_t)n) {
+            uart_host_event(uart, UART_BUFFER_FULL, accepted);
+        }
+        else if (patterns > 0) {
+            uart_host_event(uart, UART_PATTERN_DET, accepted);
+        }
+        else {
+            uart_host_event(uart, UART_DATA, accepted);
+        }
+    }
+
+    return NULL;
+}
+
+/* open the pty of [port] the first time its driver is installed */
+static UartHostPty* uart_host_pty(uart_port_t port)
+{
+    UartHostPty* pty = &ptys[port];
+    struct termios tio;
+
+    if (pty->name[0] != '\0') {
+        return pty;
+    }
+
+    pty->slave = -1;
+    pty->master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (pty->master < 0 || grantpt(pty->master) != 0 ||
+        unlockpt(pty->master) != 0 ||
+        ptsname_r(pty->master, pty->name, sizeof(pty->name)) != 0) {
+        ESP_LOGE(TAG, "could not open a pty, errno %d", errno);
+        goto fail;
+    }
+
+    /* the far end is a terminal program or a script: no echo, no line
+     * editing, and no CR/LF translation, just like a real wire */
+    pty->slave = open(pty->name, O_RDWR | O_NOCTTY);
+    if (pty->slave < 0 || tcgetattr(pty->slave, &tio) != 0) {
+        ESP_LOGE(TAG, "could not open %s, errno %d", pty->name, errno);
+        goto fail;
+    }
+    cfmakeraw(&tio);
+    tcsetattr(pty->slave, TCSANOW, &tio);
+
+    return pty;
+
+fail:
+    if (pty->slave >= 0) {
+        close(pty->slave);
+    }
+    if (pty->master >= 0) {
+        close(pty->master);
+    }
+    pty->name[0] = '\0';
+    return NULL;
+}
+
+/* everything of a driver but its pty */
+static void uart_host_free(UartHost* uart)
+{
+    if (uart->queue != NULL) {
+        vQueueDelete(uart->queue);
+    }
+    if (uart->wake[0] >= 0) {
+        close(uart->wake[0]);
+        close(uart->wake[1]);
+    }
+    pthread_cond_destroy(&uart->cond);
+    pthread_mutex_destroy(&uart->lock);
+    free(uart->ring);
+    free(uart);
+}
+
+esp_err_t uart_driver_install(uart_port_t port, int rxBufferSz,
+                              int txBufferSz, int queueSz,
+                              QueueHandle_t* queue, int intrAllocFlags)
+{
+    UartHost* uart;
+
+    (void)txBufferSz;
+    (void)intrAllocFlags;
+
+    if ((unsigned)port >= UART_NUM_MAX || rxBufferSz <= 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (uarts[port] != NULL) {
+        return ESP_FAIL;
+    }
+
+    uart = (UartHost*)calloc(1, sizeof(*uart));
+    if (uart == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    uart->ring = (uint8_t*)malloc((size_t)rxBufferSz);
+    if (uart->ring == NULL) {
+        free(uart);
+        return ESP_ERR_NO_MEM;
+    }
+    uart->ringSz = (uint32_t)rxBufferSz;
+    uart->patternChr = -1;
+    uart->wake[0] = -1;
+    pthread_mutex_init(&uart->lock, NULL);
+    pthread_cond_init(&uart->cond, NULL);
+
+    uart->pty = uart_host_pty(port);
+    if (uart->pty == NULL || pipe(uart->wake) != 0) {
+        goto fail;
+    }
+
+    if (queue != NULL && queueSz > 0) {
+        uart->queue = xQueueCreate((UBaseType_t)queueSz,
+                                   sizeof(uart_event_t));
+        if (uart->queue == NULL) {
+            goto fail;
+        }
+        *queue = uart->queue;
+    }
+
+    uarts[port] = uart;
+    if (pthread_create(&uart->reader, NULL, uart_host_reader, uart) != 0) {
+        uarts[port] = NULL;
+        goto fail;
+    }
+
+    ESP_LOGI(TAG, "UART %d is %s", (int)port, uart->pty->name);
+    return ESP_OK;
+
+fail:
+    uart_host_free(uart);
+    return ESP_FAIL;
+}
+
+esp_err_t uart_driver_delete(uart_port_t port)
+{
+    UartHost* uart = uart_host_get(port);
+
+    if (uart == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    /* wake the reader whether it waits for the pty or for ring room */
+    pthread_mutex_lock(&uart->lock);
+    uart->stop = 1;
+    pthread_cond_broadcast(&uart->cond);
+    pthread_mutex_unlock(&uart->lock);
+    if (write(uart->wake[1], "", 1) != 1) {
+        ESP_LOGE(TAG, "could not stop the UART %d reader", (int)port);
+    }
+    pthread_join(uart->reader, NULL);
+
+    uarts[port] = NULL;
+    uart_host_free(uart);
+
+    return ESP_OK;
+}
+
+esp_err_t uart_param_config(uart_port_t port, const uart_config_t* config)
+{
+    UartHost* uart = uart_host_get(port);
+
+    if (uart == NULL || config == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    uart->config = *config;
+
+    return ESP_OK;
+}
+
+/* the setters of single line settings, recorded as uart_param_config does */
+esp_err_t uart_set_baudrate(uart_port_t port, uint32_t baudRate)
+{
+    UartHost* uart = uart_host_get(port);
+
+    if (uart == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    pthread_mutex_lock(&uart->lock);
+    uart->config.baud_rate = (int)baudRate;
+    pthread_mutex_unlock(&uart->lock);
+
+    return ESP_OK;
+}
+
+esp_err_t uart_set_word_length(uart_port_t port, uart_word_length_t dataBits)
+{
+    UartHost* uart = uart_host_get(port);
+
+    if (uart == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    uart->config.data_bits = dataBits;
+
+    return ESP_OK;
+}
+
+esp_err_t uart_set_parity(uart_port_t port, uart_parity_t parity)
+{
+    UartHost* uart = uart_host_get(port);
+
+    if (uart == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    uart->config.parity = parity;
+
+    return ESP_OK;
+}
+
+esp_err_t uart_set_stop_bits(uart_port_t port, uart_stop_bits_t stopBits)
+{
+    UartHost* uart = uart_host_get(port);
+
+    if (uart == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    uart->config.stop_bits = stopBits;
+
+    return ESP_OK;
+}
+
+esp_err_t uart_set_pin(uart_port_t port, int txPin, int rxPin, int rtsPin,
+                       int ctsPin)
+{
+    (void)txPin;
+    (void)rxPin;
+    (void)rtsPin;
+    (void)ctsPin;
+
+    return uart_host_get(port) != NULL ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t uart_set_sw_flow_ctrl(uart_port_t port, bool enable,
+                                uint8_t rxThreshXon, uint8_t rxThreshXoff)
+{
+    UartHost* uart = uart_host_get(port);
+
+    /* a pty has no FIFO: held off whenever the ring is full */
+    (void)rxThreshXon;
+    (void)rxThreshXoff;
+
+    if (uart == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    pthread_mutex_lock(&uart->lock);
+    uart->swFlowCtrl = enable;
+    pthread_mutex_unlock(&uart->lock);
+
+    return ESP_OK;
+}
+
+esp_err_t uart_set_rx_timeout(uart_port_t port, uint8_t symbols)
+{
+    /* the reader thread reports whatever read() returns at once */
+    (void)symbols;
+
+    return uart_host_get(port) != NULL ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t uart_enable_pattern_det_baud_intr(uart_port_t port,
+                                            char patternChr,
+                                            uint8_t chrNum, int chrTout,
+                                            int postIdle, int preIdle)
+{
+    UartHost* uart = uart_host_get(port);
+
+    /* only single character patterns, the timing has no meaning here */
+    (void)chrTout;
+    (void)postIdle;
+    (void)preIdle;
+
+    if (uart == NULL || chrNum != 1) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    pthread_mutex_lock(&uart->lock);
+    uart->patternChr = (uint8_t)patternChr;
+    uart->patternCount = 0;
+    pthread_mutex_unlock(&uart->lock);
+
+    return ESP_OK;
+}
+
+esp_err_t uart_pattern_queue_reset(uart_port_t port, int queueLength)
+{
+    UartHost* uart = uart_host_get(port);
+
+    (void)queueLength;
+
+    if (uart == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    pthread_mutex_lock(&uart->lock);
+    uart->patternCount = 0;
+    pthread_mutex_unlock(&uart->lock);
+
+    return ESP_OK;
+}
+
+int uart_pattern_pop_pos(uart_port_t port)
+{
+    UartHost* uart = uart_host_get(port);
+    int pos = -1;
+
+    if (uart == NULL) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&uart->lock);
+    if (uart->patternCount > 0) {
+        pos = uart->patterns[0];
+        uart->patternCount--;
+        memmove(uart->patterns, uart->patterns + 1,
+                (size_t)uart->patternCount * sizeof(int));
+    }
+    pthread_mutex_unlock(&uart->lock);
+
+    return pos;
+}
+
+int uart_read_bytes(uart_port_t port, void* buf, uint32_t length,
+                    TickType_t ticks)
+{
+    UartHost* uart = uart_host_get(port);
+    uint8_t* out = (uint8_t*)buf;
+    struct timespec deadline;
+    uint32_t n;
+    uint32_t i;
+    int k;
+
+    if (uart == NULL || buf == NULL) {
+        return -1;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec  += ticks / 1000;
+    deadline.tv_nsec += (long)(ticks % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&uart->lock);
+    /* as the driver does, wait until length bytes are in or time is up */
+    while (uart->used < length && ticks > 0) {
+        if (ticks == portMAX_DELAY) {
+            pthread_cond_wait(&uart->cond, &uart->lock);
+        }
+        else if (pthread_cond_timedwait(&uart->cond, &uart->lock,
+                                        &deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+
+    n = uart->used < length ? uart->used : length;
+    for (i = 0; i < n; i++) {
+        out[i] = uart->ring[(uart->head + i) % uart->ringSz];
+    }
+    uart->head = (uart->head + n) % uart->ringSz;
+    uart->used -= n;
+    if (n > 0) {
+        /* room again for a reader thread held by flow control */
+        pthread_cond_broadcast(&uart->cond);
+    }
+
+    /* pattern positions stay relative to the oldest byte in the ring */
+    for (k = 0; k < uart->patternCount; k++) {
+        uart->patterns[k] -= (int)n;
+        if (uart->patterns[k] < 0) {
+            uart->patterns[k] = -1;
+        }
+    }
+    pthread_mutex_unlock(&uart->lock);
+
+    return (int)n;
+}
+
+int uart_write_bytes(uart_port_t port, const void* src, size_t size)
+{
+    UartHost* uart = uart_host_get(port);
+    const uint8_t* data = (const uint8_t*)src;
+    size_t written = 0;
+    ssize_t n;
+
+    if (uart == NULL || src == NULL) {
+        return -1;
+    }
+
+    while (written < size) {
+        n = write(uart->pty->master, data + written, size - written);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        written += (size_t)n;
+    }
+
+    return (int)written;
+}
+
+esp_err_t uart_wait_tx_done(uart_port_t port, TickType_t ticks)
+{
+    /* uart_write_bytes returns once the pty has taken everything */
+    (void)ticks;
+
+    return uart_host_get(port) != NULL ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t uart_flush_input(uart_port_t port)
+{
+    UartHost* uart = uart_host_get(port);
+
+    if (uart == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    pthread_mutex_lock(&uart->lock);
+    uart->head = 0;
+    uart->used = 0;
+    uart->patternCount = 0;
+    pthread_mutex_unlock(&uart->lock);
+
+    return ESP_OK;
+}
+
+const char* uart_host_pty_name(uart_port_t port)
+{
+    if ((unsigned)port >= UART_NUM_MAX || ptys[port].name[0] == '\0') {
+        return NULL;
+    }
+
+    return ptys[port].name;
+}
+
+void uart_host_check_speed(bool enable)
+{
+    checkSpeed = enable;
+}
@@ -0,0 +1,429 @@
+/* ssh_soak.c
+ *
+ * Copyright (C) 2014-2024 wolfSSL Inc.
+ *
+ * This file is part of wolfSSH.
+ *
+ * wolfSSH is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfSSH is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wolfSSH.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Soak test of the session pool of a running ssh_uart: round after round,
+ * more clients than SSH_SERVER_MAX_SESSIONS connect at once. Each round
+ * the pool must take exactly as many as it has slots, for as long as they
+ * stay, and turn the others away with its busy message; between rounds
+ * the slots must come back. The "stats" exec before, after the first round
+ * and at the end checks the server counted the same, and that the session
+ * arenas were recycled: no allocation went to the heap after the first
+ * round unless one already did in it.
+ * Exits non-zero at the first round that fails, or a count that differs.
+ */
+
+#include "ssh_server_config.h"
+
+#include <wolfssh/ssh.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+/* the example credentials of ssh_server.c */
+#define SOAK_USER     "jill"
+#define SOAK_PASSWORD "upthehill"
+
+/* longest wait for the server's first bytes */
+#define SOAK_GREETING_MS 10000
+
+#define SOAK_STATS_SZ 4096
+
+typedef enum {
+    SOAK_FAILED = 0,
+    SOAK_ADMITTED,
+    SOAK_REJECTED
+} SoakResult;
+
+/* the ssh_metrics values the soak checks */
+typedef struct {
+    unsigned long sessions;
+    unsigned long rejected;
+    unsigned long arenaFallbacks;
+    unsigned long arenaPinned;
+} SoakStats;
+
+static struct {
+    struct sockaddr_in addr;
+    const char* user;
+    const char* password;
+    int clients;
+    int rounds;
+    int holdMs;
+    int pauseMs;
+} config;
+
+static WOLFSSH_CTX* soakCtx = NULL;
+static pthread_barrier_t soakStart;
+
+
+static void soak_sleep_ms(int ms)
+{
+    struct timespec ts;
+
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (long)(ms % 1000) * 1000000L;
+    nanosleep(&ts, NULL);
+}
+
+static int soak_client_auth(byte authType, WS_UserAuthData* authData,
+                            void* ctx)
+{
+    (void)ctx;
+
+    if (authType != WOLFSSH_USERAUTH_PASSWORD) {
+        return WOLFSSH_USERAUTH_FAILURE;
+    }
+    authData->sf.password.password = (byte*)config.password;
+    authData->sf.password.passwordSz = (word32)strlen(config.password);
+
+    return WOLFSSH_USERAUTH_SUCCESS;
+}
+
+/* a test server, any host key will do */
+static int soak_public_key_check(const byte* pubKey, word32 pubKeySz,
+                                 void* ctx)
+{
+    (void)pubKey;
+    (void)pubKeySz;
+    (void)ctx;
+
+    return 0;
+}
+
+/* connect, and tell a session from the busy message by the first bytes:
+ * a slot starts with the SSH version line. Returns the fd, or -1. */
+static int soak_connect(SoakResult* result)
+{
+    struct pollfd pfd;
+    char first[4];
+    int fd;
+
+    *result = SOAK_FAILED;
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr*)&config.addr,
+                sizeof(config.addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    if ((poll(&pfd, 1, SOAK_GREETING_MS) == 1) &&
+        (recv(fd, first, sizeof(first), MSG_PEEK | MSG_WAITALL)
+         == (ssize_t)sizeof(first))) {
+        *result = (memcmp(first, "SSH-", sizeof(first)) == 0) ?
+                  SOAK_ADMITTED : SOAK_REJECTED;
+    }
+
+    return fd;
+}
+
+/* one client of a round: a session held for holdMs, or turned away */
+static void* soak_client(void* arg)
+{
+    SoakResult* result = (SoakResult*)arg;
+    WOLFSSH* ssh;
+    int fd;
+
+    pthread_barrier_wait(&soakStart);
+
+    fd = soak_connect(result);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    if (*result == SOAK_ADMITTED) {
+        ssh = wolfSSH_new(soakCtx);
+        if ((ssh == NULL) ||
+            (wolfSSH_SetUsername(ssh, config.user) != WS_SUCCESS) ||
+            (wolfSSH_set_fd(ssh, fd) != WS_SUCCESS) ||
+            (wolfSSH_connect(ssh) != WS_SUCCESS)) {
+            *result = SOAK_FAILED;
+        }
+        else {
+            soak_sleep_ms(config.holdMs);
+            wolfSSH_shutdown(ssh);
+        }
+        wolfSSH_free(ssh);
+    }
+    close(fd);
+
+    return NULL;
+}
+
+/* the value of "  name = value" in the stats text, or 0 when not shown */
+static unsigned long soak_stat(const char* text, const char* name)
+{
+    char key[48];
+    const char* at;
+
+    snprintf(key, sizeof(key), "  %s = ", name);
+    at = strstr(text, key);
+
+    return (at != NULL) ? strtoul(at + strlen(key), NULL, 10) : 0;
+}
+
+/* run the "stats" exec; returns 0 when it read the counters */
+static int soak_stats(SoakStats* stats)
+{
+    static char text[SOAK_STATS_SZ];
+    SoakResult result;
+    WOLFSSH* ssh = NULL;
+    int len = 0;
+    int ret = -1;
+    int n;
+    int fd;
+
+    fd = soak_connect(&result);
+    if ((fd >= 0) && (result == SOAK_ADMITTED)) {
+        ssh = wolfSSH_new(soakCtx);
+    }
+    if ((ssh != NULL) &&
+        (wolfSSH_SetUsername(ssh, config.user) == WS_SUCCESS) &&
+        (wolfSSH_SetChannelType(ssh, WOLFSSH_SESSION_EXEC,
+                                (byte*)"stats", 5) == WS_SUCCESS) &&
+        (wolfSSH_set_fd(ssh, fd) == WS_SUCCESS) &&
+        (wolfSSH_connect(ssh) == WS_SUCCESS)) {
+        /* until the server closes the channel */
+        do {
+            n = wolfSSH_stream_read(ssh, (byte*)text + len,
+                                    (word32)(sizeof(text) - 1 - len));
+            if (n > 0) {
+                len += n;
+            }
+        } while (((n > 0) || (n == WS_WANT_READ)) &&
+                 (len < (int)sizeof(text) - 1));
+        text[len] = '\0';
+
+        stats->sessions = soak_stat(text, "sessions");
+        stats->rejected = soak_stat(text, "sessions_rejected");
+        stats->arenaFallbacks = soak_stat(text, "arena_fallbacks");
+        stats->arenaPinned = soak_stat(text, "arena_pinned");
+        ret = (strstr(text, "Since boot") != NULL) ? 0 : -1;
+        wolfSSH_shutdown(ssh);
+    }
+    wolfSSH_free(ssh);
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    return ret;
+}
+
+/* one round; returns 0 when the pool took exactly what it could */
+static int soak_round(int round, SoakResult* results, pthread_t* threads,
+                      int* admittedSum, int* rejectedSum)
+{
+    int expect = (config.clients < SSH_SERVER_MAX_SESSIONS) ?
+                 config.clients : SSH_SERVER_MAX_SESSIONS;
+    int admitted = 0;
+    int rejected = 0;
+    int failed = 0;
+    int i;
+
+    pthread_barrier_init(&soakStart, NULL, (unsigned)config.clients);
+    for (i = 0; i < config.clients; i++) {
+        results[i] = SOAK_FAILED;
+        pthread_create(&threads[i], NULL, soak_client, &results[i]);
+    }
+    for (i = 0; i < config.clients; i++) {
+        pthread_join(threads[i], NULL);
+        admitted += (results[i] == SOAK_ADMITTED);
+        rejected += (results[i] == SOAK_REJECTED);
+        failed += (results[i] == SOAK_FAILED);
+    }
+    pthread_barrier_destroy(&soakStart);
+
+    printf("round %d: %d admitted, %d busy, %d failed\n",
+           round, admitted, rejected, failed);
+    *admittedSum += admitted;
+    *rejectedSum += rejected;
+
+    /* the slots go back to the pool as the sessions end */
+    soak_sleep_ms(config.pauseMs);
+
+    return ((failed == 0) && (admitted == expect)) ? 0 : -1;
+}
+
+static void usage(const char* name)
+{
+    printf("usage: %s [-a addr] [-p port] [-u user] [-w password] "
+           "[-c clients] [-r rounds] [-t ms] [-d ms]\n"
+           "  -a addr      of ssh_uart (127.0.0.1)\n"
+           "  -p port      (%d)\n"
+           "  -c clients   connecting at once each round (%d)\n"
+           "  -r rounds    (20)\n"
+           "  -t ms        each session is held (500)\n"
+           "  -d ms        pause between rounds (1000)\n",
+           name, SSH_UART_PORT, 2 * SSH_SERVER_MAX_SESSIONS + 1);
+}
+
+int main(int argc, char** argv)
+{
+    SoakStats before;
+    SoakStats first;
+    SoakStats after;
+    SoakResult* results;
+    pthread_t* threads;
+    const char* addr = "127.0.0.1";
+    int port = SSH_UART_PORT;
+    int admitted = 0;
+    int rejected = 0;
+    int ret = EXIT_SUCCESS;
+    int ch;
+    int i;
+
+    config.user = SOAK_USER;
+    config.password = SOAK_PASSWORD;
+    config.clients = 2 * SSH_SERVER_MAX_SESSIONS + 1;
+    config.rounds = 20;
+    config.holdMs = 500;
+    config.pauseMs = 1000;
+
+    while ((ch = getopt(argc, argv, "a:p:u:w:c:r:t:d:h")) != -1) {
+        switch (ch) {
+            case 'a':
+                addr = optarg;
+                break;
+
+            case 'p':
+                port = atoi(optarg);
+                break;
+
+            case 'u':
+                config.user = optarg;
+                break;
+
+            case 'w':
+                config.password = optarg;
+                break;
+
+            case 'c':
+                config.clients = atoi(optarg);
+                break;
+
+            case 'r':
+                config.rounds = atoi(optarg);
+                break;
+
+            case 't':
+                config.holdMs = atoi(optarg);
+                break;
+
+            case 'd':
+                config.pauseMs = atoi(optarg);
+                break;
+
+            default:
+                usage(argv[0]);
+                return ch == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    memset(&config.addr, 0, sizeof(config.addr));
+    config.addr.sin_family = AF_INET;
+    config.addr.sin_port = htons((uint16_t)port);
+    if ((inet_pton(AF_INET, addr, &config.addr.sin_addr) != 1) ||
+        (config.clients <= 0) || (config.rounds <= 0)) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    results = (SoakResult*)calloc((size_t)config.clients, sizeof(*results));
+    threads = (pthread_t*)calloc((size_t)config.clients, sizeof(*threads));
+    if ((results == NULL) || (threads == NULL) ||
+        (wolfSSH_Init() != WS_SUCCESS) ||
+        ((soakCtx = wolfSSH_CTX_new(WOLFSSH_ENDPOINT_CLIENT, NULL)) == NULL)) {
+        fprintf(stderr, "ssh_soak: out of memory\n");
+        return EXIT_FAILURE;
+    }
+    wolfSSH_SetUserAuth(soakCtx, soak_client_auth);
+    wolfSSH_CTX_SetPublicKeyCheck(soakCtx, soak_public_key_check);
+
+    if (soak_stats(&before) != 0) {
+        fprintf(stderr, "ssh_soak: no stats from %s:%d\n", addr, port);
+        ret = EXIT_FAILURE;
+    }
+
+    for (i = 1; (i <= config.rounds) && (ret == EXIT_SUCCESS); i++) {
+        if (soak_round(i, results, threads, &admitted, &rejected) != 0) {
+            printf("round %d: expected %d sessions and no failure\n", i,
+                   (config.clients < SSH_SERVER_MAX_SESSIONS) ?
+                   config.clients : SSH_SERVER_MAX_SESSIONS);
+            ret = EXIT_FAILURE;
+        }
+        else if ((i == 1) && (soak_stats(&first) != 0)) {
+            ret = EXIT_FAILURE;
+        }
+    }
+
+    if ((ret == EXIT_SUCCESS) && (soak_stats(&after) != 0)) {
+        ret = EXIT_FAILURE;
+    }
+
+    if (ret == EXIT_SUCCESS) {
+        /* the stats sessions before and after the first round count too */
+        printf("server: %lu sessions, %lu busy, %lu arena fallbacks, "
+               "%lu pinned arenas\n", after.sessions - before.sessions,
+               after.rejected - before.rejected,
+               after.arenaFallbacks - before.arenaFallbacks,
+               after.arenaPinned - before.arenaPinned);
+
+        if ((after.sessions - before.sessions !=
+             (unsigned long)admitted + 2) ||
+            (after.rejected - before.rejected != (unsigned long)rejected)) {
+            printf("the server counted %lu sessions and %lu busy, the "
+                   "clients %d and %d\n", after.sessions - before.sessions,
+                   after.rejected - before.rejected, admitted + 2,
+                   rejected);
+            ret = EXIT_FAILURE;
+        }
+        if ((first.arenaFallbacks == before.arenaFallbacks) &&
+            (after.arenaFallbacks != first.arenaFallbacks)) {
+            printf("the session arenas were not recycled: allocations "
+                   "went to the heap after the first round\n");
+            ret = EXIT_FAILURE;
+        }
+    }
+
+    if (ret == EXIT_SUCCESS) {
+        printf("ssh_soak: %d rounds of %d clients passed\n",
+               config.rounds, config.clients);
+    }
+
+    wolfSSH_CTX_free(soakCtx);
+    wolfSSH_Cleanup();
+    free(threads);
+    free(results);
+
+    return ret;
+}
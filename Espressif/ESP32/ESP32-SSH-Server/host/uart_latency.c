@@ -0,0 +1,252 @@
+/* uart_latency.c
+ *
+ * Copyright (C) 2014-2024 wolfSSL Inc.
+ *
+ * This file is part of wolfSSH.
+ *
+ * wolfSSH is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfSSH is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wolfSSH.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Round trip latency of the UART data path on a pty, without SSH: bytes
+ * queued as a session with the write lock would queue them go through
+ * uart_tx_task to the pty, a thread on the far end echoes them as a device
+ * would, and uart_rx_task brings them back through the driver events to
+ * the Tx ring, where this program waits on its reader's eventfd as
+ * server_worker does. Prints the spread of the round trips.
+ * Exits non-zero when a reply is lost, wrong, or the median is over -m.
+ */
+#define _GNU_SOURCE /* cfmakeraw */
+
+#include "ssh_server_config.h"
+#include "tx_rx_buffer.h"
+#include "uart_helper.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+static const char* TAG = "uart_latency";
+
+#define LATENCY_TASK_STACK_SIZE (8 * 1024)
+
+/* the most bytes a round sends */
+#define LATENCY_MAX_SZ 256
+
+/* a reply later than this is lost */
+#define LATENCY_TIMEOUT_MS 1000
+
+/* the session id the write lock is taken as */
+#define LATENCY_SESSION_ID 1
+
+
+/* the device: send back whatever arrives */
+static void* latency_echo(void* arg)
+{
+    int fd = *(int*)arg;
+    char buf[LATENCY_MAX_SZ];
+    ssize_t n;
+
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        if (write(fd, buf, (size_t)n) != n) {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+static int latency_cmp(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+
+    return (x > y) - (x < y);
+}
+
+/* wait for sz bytes from [reader] into buf; returns the bytes read */
+static int latency_wait(ExternalTransmitReader* reader, byte* buf, int sz)
+{
+    struct pollfd pfd;
+    int got = 0;
+    int n;
+
+    pfd.fd = reader->notifyFd;
+    pfd.events = POLLIN;
+
+    while (got < sz) {
+        n = Get_ExternalTransmitBuffer(reader, buf + got, sz - got);
+        if (n > 0) {
+            got += n;
+        }
+        else if (poll(&pfd, 1, LATENCY_TIMEOUT_MS) <= 0) {
+            break;
+        }
+        else {
+            ExternalTransmitBuffer_ClearNotify(reader);
+        }
+    }
+
+    return got;
+}
+
+static void usage(const char* name)
+{
+    printf("usage: %s [-n rounds] [-s bytes] [-m us]\n"
+           "  -n rounds  round trips to time (1000)\n"
+           "  -s bytes   sent in each, 1 for a keystroke (1..%d)\n"
+           "  -m us      fail when the median is over this, 0 for no limit\n",
+           name, LATENCY_MAX_SZ);
+}
+
+int main(int argc, char** argv)
+{
+    ExternalTransmitReader reader;
+    uart_rx_stats_t stats;
+    struct termios tio;
+    pthread_t echo;
+    const char* pty;
+    uint32_t* times;
+    uint32_t limit = 0;
+    int64_t start;
+    byte out[LATENCY_MAX_SZ];
+    byte in[LATENCY_MAX_SZ];
+    int rounds = 1000;
+    int sz = 1;
+    int ret = EXIT_SUCCESS;
+    int port;
+    int fd;
+    int ch;
+    int i;
+    int j;
+
+    while ((ch = getopt(argc, argv, "n:s:m:h")) != -1) {
+        switch (ch) {
+            case 'n':
+                rounds = atoi(optarg);
+                break;
+
+            case 's':
+                sz = atoi(optarg);
+                break;
+
+            case 'm':
+                limit = (uint32_t)strtoul(optarg, NULL, 0);
+                break;
+
+            default:
+                usage(argv[0]);
+                return ch == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if ((rounds <= 0) || (sz <= 0) || (sz > LATENCY_MAX_SZ)) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    esp_log_level_set("*", ESP_LOG_WARN);
+    init_UART();
+
+    for (port = 0; port < SSH_SERVER_UART_PORTS; port++) {
+        xTaskCreate(uart_rx_task, "uart_rx_task",
+                    LATENCY_TASK_STACK_SIZE, (void*)(intptr_t)port,
+                    tskIDLE_PRIORITY, NULL);
+
+        xTaskCreate(uart_tx_task, "uart_tx_task",
+                    LATENCY_TASK_STACK_SIZE, (void*)(intptr_t)port,
+                    tskIDLE_PRIORITY, NULL);
+    }
+
+    /* uart_tx_task registers for the Rx ring notifications as it starts */
+    vTaskDelay(pdMS_TO_TICKS(100));
+
+    /* the device on the far end of the first UART */
+    pty = uart_host_pty_name(uart_route_get(0)->uart);
+    fd = (pty != NULL) ? open(pty, O_RDWR | O_NOCTTY) : -1;
+    if ((fd < 0) || (tcgetattr(fd, &tio) != 0)) {
+        ESP_LOGE(TAG, "no pty for the UART");
+        return EXIT_FAILURE;
+    }
+    cfmakeraw(&tio);
+    tcsetattr(fd, TCSANOW, &tio);
+    pthread_create(&echo, NULL, latency_echo, &fd);
+
+    /* a raw session: nothing translated on the way out */
+    if ((ExternalTransmitBuffer_AddReader(&reader, 0,
+                                ExternalTransmitBuffer_NewNotifyFd(), 0) != 0)
+        || !ExternalBuffers_Attach(0, LATENCY_SESSION_ID, &reader, 1)) {
+        ESP_LOGE(TAG, "could not attach to %s", uart_route_get(0)->name);
+        return EXIT_FAILURE;
+    }
+
+    times = (uint32_t*)malloc(sizeof(uint32_t) * (size_t)rounds);
+    if (times == NULL) {
+        return EXIT_FAILURE;
+    }
+
+    for (i = 0; (i < rounds) && (ret == EXIT_SUCCESS); i++) {
+        for (j = 0; j < sz; j++) {
+            out[j] = (byte)(i + j);
+        }
+
+        start = esp_timer_get_time();
+        if (Set_ExternalReceiveBuffer(0, out, sz) != sz) {
+            printf("round %d: the Rx ring is full\n", i);
+            ret = EXIT_FAILURE;
+        }
+        else if (latency_wait(&reader, in, sz) != sz) {
+            printf("round %d: no reply in %d ms\n", i, LATENCY_TIMEOUT_MS);
+            ret = EXIT_FAILURE;
+        }
+        else if (memcmp(in, out, (size_t)sz) != 0) {
+            printf("round %d: the reply differs\n", i);
+            ret = EXIT_FAILURE;
+        }
+        times[i] = (uint32_t)(esp_timer_get_time() - start);
+    }
+
+    if (ret == EXIT_SUCCESS) {
+        qsort(times, (size_t)rounds, sizeof(uint32_t), latency_cmp);
+        printf("%s: %d round trips of %d bytes, us: min %u, median %u, "
+               "99%% %u, max %u\n", uart_route_get(0)->name, rounds, sz,
+               (unsigned)times[0], (unsigned)times[rounds / 2],
+               (unsigned)times[(rounds * 99) / 100],
+               (unsigned)times[rounds - 1]);
+
+        if (uart_get_rx_stats(&stats) == ESP_OK) {
+            printf("uart_rx_task: %u events, driver to ring us: max %u\n",
+                   (unsigned)stats.events, (unsigned)stats.max_latency_us);
+        }
+
+        if ((limit != 0) && (times[rounds / 2] > limit)) {
+            printf("the median is over %u us\n", (unsigned)limit);
+            ret = EXIT_FAILURE;
+        }
+    }
+
+    free(times);
+    ExternalBuffers_Detach(0, LATENCY_SESSION_ID);
+
+    return ret;
+}
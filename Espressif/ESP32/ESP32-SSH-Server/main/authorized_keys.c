@@ -0,0 +1,433 @@
+/* authorized_keys.c
+ *
+ * Copyright (C) 2014-2024 wolfSSL Inc.
+ *
+ * This file is part of wolfSSH.
+ *
+ * wolfSSH is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfSSH is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wolfSSH.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This file has no RTOS dependencies so that it can also be built on a host */
+#include "authorized_keys.h"
+
+#include <string.h>
+
+enum {
+    AK_LINE = 0,   /* start of a line */
+    AK_SKIP,       /* comment or malformed line, up to the end of it */
+    AK_FIRST,      /* first word: options or the key type */
+    AK_OPTIONS,    /* rest of the options */
+    AK_GAP_TYPE,
+    AK_TYPE,       /* key type after options */
+    AK_GAP_KEY,
+    AK_KEY,        /* base64 key */
+    AK_GAP_NAME,
+    AK_NAME,       /* user name */
+    AK_REST        /* comment after the user name */
+};
+
+/* base64 value of each character, 0xFF if not base64 */
+static byte ak_base64_value(byte c)
+{
+    if (c >= 'A' && c <= 'Z') return (byte)(c - 'A');
+    if (c >= 'a' && c <= 'z') return (byte)(c - 'a' + 26);
+    if (c >= '0' && c <= '9') return (byte)(c - '0' + 52);
+    if (c == '+') return 62;
+    if (c == '/') return 63;
+    return 0xFF;
+}
+
+static int ak_is_space(byte c)
+{
+    return (c == ' ') || (c == '\t') || (c == '\r');
+}
+
+/* the key types sshd knows all start with one of these */
+static int ak_is_key_type(const byte* type, byte typeSz)
+{
+    static const char* const prefixes[] = {
+        "ssh-", "ecdsa-sha2-", "sk-", "rsa-sha2-"
+    };
+    size_t i;
+    size_t len;
+
+    for (i = 0; i < sizeof(prefixes) / sizeof(prefixes[0]); i++) {
+        len = strlen(prefixes[i]);
+        if ((typeSz > len) && (memcmp(type, prefixes[i], len) == 0)) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static void ak_error(AuthorizedKeys* ak)
+{
+    if (ak->shaActive) {
+        wc_Sha256Free(&ak->sha);
+        ak->shaActive = 0;
+    }
+    if (ak->errorLine == 0) {
+        ak->errorLine = ak->line;
+    }
+    ak->errors++;
+    ak->state = AK_SKIP;
+}
+
+static void ak_key_begin(AuthorizedKeys* ak)
+{
+    ak->keyPos = 0;
+    ak->blobTypeSz = 0;
+    ak->quad = 0;
+    ak->quadSz = 0;
+    ak->padSz = 0;
+    ak->outSz = 0;
+
+    if (wc_InitSha256(&ak->sha) != 0) {
+        ak_error(ak);
+    }
+    else {
+        ak->shaActive = 1;
+        ak->state = AK_KEY;
+    }
+}
+
+static void ak_flush(AuthorizedKeys* ak)
+{
+    if (ak->outSz > 0) {
+        wc_Sha256Update(&ak->sha, ak->out, ak->outSz);
+        ak->outSz = 0;
+    }
+}
+
+/* one decoded byte; the blob must start with the same key type as the
+ * line, as a 32-bit length and the name */
+static int ak_key_byte(AuthorizedKeys* ak, byte b)
+{
+    word32 pos = ak->keyPos++;
+
+    if (pos < 4) {
+        ak->blobTypeSz = (ak->blobTypeSz << 8) | b;
+        if ((pos == 3) && (ak->blobTypeSz != ak->typeSz)) {
+            return -1;
+        }
+    }
+    else if (pos < 4 + ak->blobTypeSz) {
+        if (ak->type[pos - 4] != b) {
+            return -1;
+        }
+    }
+
+    ak->out[ak->outSz++] = b;
+    if (ak->outSz == sizeof(ak->out)) {
+        ak_flush(ak);
+    }
+
+    return 0;
+}
+
+static int ak_key_char(AuthorizedKeys* ak, byte c)
+{
+    byte v;
+    int ret = 0;
+
+    if (c == '=') {
+        /* padding only completes a quad of two or three characters */
+        if ((ak->quadSz < 2) || (ak->quadSz + ak->padSz >= 4)) {
+            ret = -1;
+        }
+        else {
+            ak->padSz++;
+        }
+    }
+    else if ((ak->padSz > 0) || ((v = ak_base64_value(c)) == 0xFF)) {
+        ret = -1;
+    }
+    else {
+        ak->quad = (ak->quad << 6) | v;
+        if (++ak->quadSz == 4) {
+            ret = ak_key_byte(ak, (byte)(ak->quad >> 16));
+            if (ret == 0) {
+                ret = ak_key_byte(ak, (byte)(ak->quad >> 8));
+            }
+            if (ret == 0) {
+                ret = ak_key_byte(ak, (byte)ak->quad);
+            }
+            ak->quad = 0;
+            ak->quadSz = 0;
+        }
+    }
+
+    return ret;
+}
+
+static int ak_key_end(AuthorizedKeys* ak)
+{
+    int ret = 0;
+
+    /* a partial quad of two or three characters still holds bytes */
+    if (ak->quadSz == 2) {
+        ret = ak_key_byte(ak, (byte)(ak->quad >> 4));
+    }
+    else if (ak->quadSz == 3) {
+        ret = ak_key_byte(ak, (byte)(ak->quad >> 10));
+        if (ret == 0) {
+            ret = ak_key_byte(ak, (byte)(ak->quad >> 2));
+        }
+    }
+    else if (ak->quadSz == 1) {
+        ret = -1;
+    }
+
+    if ((ak->padSz > 0) && (ak->quadSz + ak->padSz != 4)) {
+        ret = -1;
+    }
+
+    if ((ret == 0) && (ak->keyPos < 4 + (word32)ak->typeSz)) {
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        ak_flush(ak);
+        if (wc_Sha256Final(&ak->sha, ak->digest) != 0) {
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        wc_Sha256Free(&ak->sha);
+        ak->shaActive = 0;
+        ak->state = AK_GAP_NAME;
+    }
+    else {
+        ak_error(ak);
+    }
+
+    return ret;
+}
+
+/* end of a line; returns non-zero if the store is full */
+static int ak_line_end(AuthorizedKeys* ak)
+{
+    int ret = 0;
+
+    if (ak->state == AK_KEY) {
+        ak_key_end(ak);
+    }
+
+    switch (ak->state) {
+        case AK_LINE:
+        case AK_SKIP:
+            break;
+
+        case AK_NAME:
+        case AK_REST:
+            ret = credential_store_add(ak->store, ak->credType,
+                                       ak->name, ak->nameSz, ak->digest);
+            if (ret == 0) {
+                ak->keys++;
+            }
+            break;
+
+        default:
+            /* ends before the key, or there is no user for it */
+            ak_error(ak);
+            break;
+    }
+
+    ak->line++;
+    ak->state = AK_LINE;
+
+    return ret;
+}
+
+int authorized_keys_init(AuthorizedKeys* ak, CredentialStore* store,
+                         byte credType)
+{
+    if ((ak == NULL) || (store == NULL)) {
+        return -1;
+    }
+
+    memset(ak, 0, sizeof(AuthorizedKeys));
+    ak->store = store;
+    ak->credType = credType;
+    ak->line = 1;
+    ak->state = AK_LINE;
+
+    return 0;
+}
+
+int authorized_keys_update(AuthorizedKeys* ak, const byte* data, word32 sz)
+{
+    word32 i;
+    byte c;
+    int ret = 0;
+
+    if ((ak == NULL) || ((data == NULL) && (sz > 0))) {
+        return -1;
+    }
+
+    for (i = 0; (i < sz) && (ret == 0); i++) {
+        c = data[i];
+
+        if (c == '\n') {
+            ret = ak_line_end(ak);
+            continue;
+        }
+
+        switch (ak->state) {
+            case AK_LINE:
+                if (ak_is_space(c)) {
+                    break;
+                }
+                if (c == '#') {
+                    ak->state = AK_SKIP;
+                    break;
+                }
+                ak->typeSz = 0;
+                ak->inQuote = 0;
+                ak->escape = 0;
+                ak->state = AK_FIRST;
+                /* fall through */
+
+            case AK_FIRST:
+                if (ak_is_space(c)) {
+                    if (ak_is_key_type(ak->type, ak->typeSz)) {
+                        ak->state = AK_GAP_KEY;
+                    }
+                    else {
+                        ak->state = AK_GAP_TYPE;
+                    }
+                }
+                else if ((c == '"') || (ak->typeSz == sizeof(ak->type))) {
+                    /* only options quote or run this long */
+                    ak->state = AK_OPTIONS;
+                    ak->inQuote = (c == '"');
+                }
+                else {
+                    ak->type[ak->typeSz++] = c;
+                }
+                break;
+
+            case AK_OPTIONS:
+                if (ak->inQuote) {
+                    if (ak->escape) {
+                        ak->escape = 0;
+                    }
+                    else if (c == '\\') {
+                        ak->escape = 1;
+                    }
+                    else if (c == '"') {
+                        ak->inQuote = 0;
+                    }
+                }
+                else if (ak_is_space(c)) {
+                    ak->state = AK_GAP_TYPE;
+                }
+                else if (c == '"') {
+                    ak->inQuote = 1;
+                }
+                break;
+
+            case AK_GAP_TYPE:
+                if (ak_is_space(c)) {
+                    break;
+                }
+                ak->typeSz = 0;
+                ak->state = AK_TYPE;
+                /* fall through */
+
+            case AK_TYPE:
+                if (ak_is_space(c)) {
+                    if (ak_is_key_type(ak->type, ak->typeSz)) {
+                        ak->state = AK_GAP_KEY;
+                    }
+                    else {
+                        ak_error(ak);
+                    }
+                }
+                else if (ak->typeSz == sizeof(ak->type)) {
+                    ak_error(ak);
+                }
+                else {
+                    ak->type[ak->typeSz++] = c;
+                }
+                break;
+
+            case AK_GAP_KEY:
+                if (ak_is_space(c)) {
+                    break;
+                }
+                ak_key_begin(ak);
+                if (ak->state != AK_KEY) {
+                    break;
+                }
+                /* fall through */
+
+            case AK_KEY:
+                if (ak_is_space(c)) {
+                    ak_key_end(ak);
+                }
+                else if (ak_key_char(ak, c) != 0) {
+                    ak_error(ak);
+                }
+                break;
+
+            case AK_GAP_NAME:
+                if (ak_is_space(c)) {
+                    break;
+                }
+                ak->nameSz = 0;
+                ak->state = AK_NAME;
+                /* fall through */
+
+            case AK_NAME:
+                if (ak_is_space(c)) {
+                    ak->state = AK_REST;
+                }
+                else if (ak->nameSz == sizeof(ak->name)) {
+                    /* longer than the store keeps */
+                    ak_error(ak);
+                }
+                else {
+                    ak->name[ak->nameSz++] = c;
+                }
+                break;
+
+            case AK_REST:
+            case AK_SKIP:
+            default:
+                break;
+        }
+    }
+
+    return ret;
+}
+
+int authorized_keys_final(AuthorizedKeys* ak)
+{
+    int ret;
+
+    if (ak == NULL) {
+        return -1;
+    }
+
+    ret = ak_line_end(ak);
+    if (ak->shaActive) {
+        wc_Sha256Free(&ak->sha);
+        ak->shaActive = 0;
+    }
+
+    return ret;
+}
@@ -0,0 +1,173 @@
+/* credential_store.c
+ *
+ * Copyright (C) 2014-2024 wolfSSL Inc.
+ *
+ * This file is part of wolfSSH.
+ *
+ * wolfSSH is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfSSH is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wolfSSH.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This file has no RTOS dependencies so that it can also be built on a host */
+#include "credential_store.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define CREDENTIAL_NONE 0xFFFFFFFFu
+
+/* FNV-1a; never zero, as zero marks an empty slot */
+static uint32_t credential_hash(const uint8_t* name, uint32_t nameSz)
+{
+    uint32_t hash = 2166136261u;
+
+    while (nameSz--) {
+        hash ^= *name++;
+        hash *= 16777619u;
+    }
+
+    return (hash == 0) ? 1 : hash;
+}
+
+/* constant time, so the time taken does not reveal how much matched */
+static int credential_digest_equal(const uint8_t* a, const uint8_t* b)
+{
+    uint8_t diff = 0;
+    int i;
+
+    for (i = 0; i < CREDENTIAL_DIGEST_SZ; i++) {
+        diff |= a[i] ^ b[i];
+    }
+
+    return diff == 0;
+}
+
+/* the slot of [name], or the empty slot where it belongs */
+static CredentialUser* credential_find(const CredentialStore* store,
+                                       const uint8_t* name, uint32_t nameSz)
+{
+    uint32_t hash = credential_hash(name, nameSz);
+    uint32_t i = hash & store->mask;
+    CredentialUser* user;
+
+    /* the table is never more than half full, so this ends */
+    for (;;) {
+        user = &store->users[i];
+        if ((user->hash == 0) ||
+            ((user->hash == hash) && (user->nameSz == nameSz) &&
+             (memcmp(user->name, name, nameSz) == 0))) {
+            break;
+        }
+        i = (i + 1) & store->mask;
+    }
+
+    return user;
+}
+
+CredentialStore* credential_store_new(uint32_t maxCredentials)
+{
+    CredentialStore* store;
+    uint32_t slots = 2;
+    size_t sz;
+
+    /* at least twice as many user slots as users, a power of two */
+    while (slots < 2 * maxCredentials) {
+        slots <<= 1;
+    }
+
+    sz = sizeof(CredentialStore) +
+         slots * sizeof(CredentialUser) +
+         maxCredentials * sizeof(Credential);
+
+    store = (CredentialStore*)malloc(sz);
+    if (store != NULL) {
+        memset(store, 0, sz);
+        store->mask    = slots - 1;
+        store->credMax = maxCredentials;
+        store->users   = (CredentialUser*)(store + 1);
+        store->creds   = (Credential*)(store->users + slots);
+    }
+
+    return store;
+}
+
+void credential_store_free(CredentialStore* store)
+{
+    if (store != NULL) {
+        /* the digests are secrets too */
+        memset(store->creds, 0, store->credMax * sizeof(Credential));
+        free(store);
+    }
+}
+
+int credential_store_add(CredentialStore* store, uint8_t type,
+                         const uint8_t* name, uint32_t nameSz,
+                         const uint8_t* digest)
+{
+    CredentialUser* user;
+    Credential* cred;
+
+    if ((store == NULL) || (store->credCount >= store->credMax) ||
+        (nameSz > CREDENTIAL_NAME_MAX_SZ)) {
+        return 1;
+    }
+
+    user = credential_find(store, name, nameSz);
+    if (user->hash == 0) {
+        user->hash   = credential_hash(name, nameSz);
+        user->first  = CREDENTIAL_NONE;
+        user->nameSz = (uint8_t)nameSz;
+        memcpy(user->name, name, nameSz);
+    }
+
+    cred = &store->creds[store->credCount];
+    cred->next = user->first;
+    cred->type = type;
+    memcpy(cred->digest, digest, CREDENTIAL_DIGEST_SZ);
+    user->first = store->credCount++;
+
+    return 0;
+}
+
+int credential_store_check(const CredentialStore* store, uint8_t type,
+                           const uint8_t* name, uint32_t nameSz,
+                           const uint8_t* digest)
+{
+    const CredentialUser* user;
+    const Credential* cred;
+    uint32_t i;
+    int ret = CREDENTIAL_NO_USER;
+
+    /* no longer name is ever stored */
+    if ((store == NULL) || (nameSz > CREDENTIAL_NAME_MAX_SZ)) {
+        return ret;
+    }
+
+    user = credential_find(store, name, nameSz);
+    if (user->hash != 0) {
+        ret = CREDENTIAL_NO_TYPE;
+
+        for (i = user->first; i != CREDENTIAL_NONE; i = cred->next) {
+            cred = &store->creds[i];
+            if (cred->type == type) {
+                if (credential_digest_equal(cred->digest, digest)) {
+                    ret = CREDENTIAL_MATCH;
+                    break;
+                }
+                ret = CREDENTIAL_MISMATCH;
+            }
+        }
+    }
+
+    return ret;
+}
@@ -0,0 +1,74 @@
+/* escape_scan.c
+ *
+ * Copyright (C) 2014-2024 wolfSSL Inc.
+ *
+ * This file is part of wolfSSH.
+ *
+ * wolfSSH is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfSSH is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wolfSSH.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This file has no RTOS dependencies so that it can also be built on a host */
+#include "escape_scan.h"
+
+#include <string.h>
+
+typedef unsigned long EscapeWord;
+
+#define ESCAPE_ONES  ((EscapeWord)-1 / 0xff)    /* 0x0101... */
+#define ESCAPE_HIGHS (ESCAPE_ONES * 0x80)       /* 0x8080... */
+
+/* non-zero when a byte of w is below 0x20; the lowest such byte is always
+ * flagged, bytes above it may be flagged by a borrow */
+#define ESCAPE_HAS_CONTROL(w) \
+    (((w) - ESCAPE_ONES * 0x20) & ~(w) & ESCAPE_HIGHS)
+
+static int escape_in_set(uint8_t c, uint32_t set)
+{
+    return (c < 0x20) && ((set >> c) & 1);
+}
+
+size_t escape_scan(const uint8_t* buf, size_t sz, uint32_t set)
+{
+    size_t i = 0;
+    size_t k;
+    EscapeWord w;
+
+    /* up to the first aligned word; Xtensa faults on unaligned loads */
+    while ((i < sz) && (((uintptr_t)(buf + i) % sizeof(EscapeWord)) != 0)) {
+        if (escape_in_set(buf[i], set)) {
+            return i;
+        }
+        i++;
+    }
+
+    for (; i + sizeof(EscapeWord) <= sz; i += sizeof(EscapeWord)) {
+        memcpy(&w, buf + i, sizeof(w));
+        if (ESCAPE_HAS_CONTROL(w)) {
+            /* CR, LF and tab land here too; check the bytes */
+            for (k = 0; k < sizeof(EscapeWord); k++) {
+                if (escape_in_set(buf[i + k], set)) {
+                    return i + k;
+                }
+            }
+        }
+    }
+
+    for (; i < sz; i++) {
+        if (escape_in_set(buf[i], set)) {
+            return i;
+        }
+    }
+
+    return sz;
+}
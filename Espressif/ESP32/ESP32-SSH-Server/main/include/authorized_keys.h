@@ -0,0 +1,95 @@
+/* authorized_keys.h
+ *
+ * Copyright (C) 2014-2024 wolfSSL Inc.
+ *
+ * This file is part of wolfSSH.
+ *
+ * wolfSSH is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfSSH is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wolfSSH.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _AUTHORIZED_KEYS_H_
+#define _AUTHORIZED_KEYS_H_
+
+/* settings.h must come before any other wolfSSL header */
+#include <wolfssl/wolfcrypt/settings.h>
+#include <wolfssl/wolfcrypt/types.h>
+#include <wolfssl/wolfcrypt/sha256.h>
+
+#include "credential_store.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* longest key type name kept, e.g. sk-ecdsa-sha2-nistp256-cert-v01@openssh.com */
+#define AUTHORIZED_KEYS_TYPE_MAX_SZ 64
+
+/*
+ * Incremental authorized_keys parser.
+ *
+ * Lines are in the OpenSSH format
+ *     [options] keytype base64-key user [comment]\n
+ * where the first word after the key names the user it is for. Blank lines
+ * and lines starting with '#' are ignored. The key is base64 decoded and
+ * hashed as it arrives, so the input can be fed in chunks of any size
+ * (flash, NVS, an upload) and the memory used does not depend on the size
+ * of the file or of the keys. The SHA-256 of each decoded key blob, which
+ * is also its OpenSSH fingerprint, goes to the credential store.
+ *
+ * A malformed line, or one whose user name is longer than
+ * CREDENTIAL_NAME_MAX_SZ, is skipped and counted; the remaining lines still
+ * load.
+ */
+typedef struct AuthorizedKeys {
+    CredentialStore* store;
+    wc_Sha256        sha;
+    word32           line;        /* current line, from 1 */
+    word32           keys;        /* keys stored */
+    word32           errors;      /* lines skipped as malformed */
+    word32           errorLine;   /* first line skipped, 0 if none */
+    word32           keyPos;      /* decoded bytes of the current key */
+    word32           blobTypeSz;  /* key type length inside the key blob */
+    word32           quad;        /* base64 bits not yet decoded */
+    byte             quadSz;      /* base64 characters in quad */
+    byte             padSz;       /* '=' seen at the end of the key */
+    byte             state;
+    byte             inQuote;
+    byte             escape;
+    byte             shaActive;
+    byte             credType;
+    byte             typeSz;
+    byte             nameSz;
+    byte             outSz;
+    byte             type[AUTHORIZED_KEYS_TYPE_MAX_SZ];
+    byte             name[CREDENTIAL_NAME_MAX_SZ];
+    byte             out[48];     /* decoded bytes waiting to be hashed */
+    byte             digest[CREDENTIAL_DIGEST_SZ];
+} AuthorizedKeys;
+
+/* start parsing; keys are stored in [store] as credentials of [credType] */
+int authorized_keys_init(AuthorizedKeys* ak, CredentialStore* store,
+                         byte credType);
+
+/* parse the next sz bytes; returns zero, or non-zero once the store is
+ * full. Malformed lines do not fail, see ak->errors. */
+int authorized_keys_update(AuthorizedKeys* ak, const byte* data, word32 sz);
+
+/* end of input, a last line without '\n' is still parsed; returns as
+ * authorized_keys_update */
+int authorized_keys_final(AuthorizedKeys* ak);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _AUTHORIZED_KEYS_H_ */
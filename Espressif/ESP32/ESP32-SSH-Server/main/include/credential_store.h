@@ -0,0 +1,96 @@
+/* credential_store.h
+ *
+ * Copyright (C) 2014-2024 wolfSSL Inc.
+ *
+ * This file is part of wolfSSH.
+ *
+ * wolfSSH is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfSSH is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wolfSSH.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _CREDENTIAL_STORE_H_
+#define _CREDENTIAL_STORE_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* SHA-256 digest of a password or public key */
+#define CREDENTIAL_DIGEST_SZ   32
+
+/* longest user name; longer ones are not stored or looked up */
+#define CREDENTIAL_NAME_MAX_SZ 31
+
+/* results of credential_store_check */
+enum {
+    CREDENTIAL_MATCH = 0,  /* a credential of the user matches the digest */
+    CREDENTIAL_NO_USER,    /* no such user */
+    CREDENTIAL_NO_TYPE,    /* the user has no credential of this type */
+    CREDENTIAL_MISMATCH    /* credentials of this type, none match */
+};
+
+/* one password or public key digest; credentials of the same user are
+ * chained through next */
+typedef struct Credential {
+    uint32_t next;
+    uint8_t  type;
+    uint8_t  digest[CREDENTIAL_DIGEST_SZ];
+} Credential;
+
+/* one slot of the open-addressing user table */
+typedef struct CredentialUser {
+    uint32_t hash;     /* zero marks an empty slot */
+    uint32_t first;    /* index of the newest credential of the user */
+    uint8_t  nameSz;
+    uint8_t  name[CREDENTIAL_NAME_MAX_SZ];
+} CredentialUser;
+
+/*
+ * Users and their credentials, built once at start up and read-only after,
+ * so any number of sessions can look up concurrently without a lock.
+ *
+ * The user table is open-addressing with linear probing, at most half full,
+ * so a lookup is normally one or two slots. The store, its user table and
+ * the credentials are a single allocation sized up front.
+ */
+typedef struct CredentialStore {
+    uint32_t        mask;      /* user table size - 1 */
+    uint32_t        credCount;
+    uint32_t        credMax;
+    CredentialUser* users;
+    Credential*     creds;
+} CredentialStore;
+
+/* returns a store for up to maxCredentials credentials, or NULL */
+CredentialStore* credential_store_new(uint32_t maxCredentials);
+
+void credential_store_free(CredentialStore* store);
+
+/* returns zero on success, non-zero when the store is full or the name is
+ * longer than CREDENTIAL_NAME_MAX_SZ */
+int credential_store_add(CredentialStore* store, uint8_t type,
+                         const uint8_t* name, uint32_t nameSz,
+                         const uint8_t* digest);
+
+/* returns one of the CREDENTIAL_ results, CREDENTIAL_NO_USER for a name
+ * longer than CREDENTIAL_NAME_MAX_SZ */
+int credential_store_check(const CredentialStore* store, uint8_t type,
+                           const uint8_t* name, uint32_t nameSz,
+                           const uint8_t* digest);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _CREDENTIAL_STORE_H_ */
@@ -0,0 +1,46 @@
+/* escape_scan.h
+ *
+ * Copyright (C) 2014-2024 wolfSSL Inc.
+ *
+ * This file is part of wolfSSH.
+ *
+ * wolfSSH is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfSSH is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wolfSSH.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ESCAPE_SCAN_H_
+#define _ESCAPE_SCAN_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* a set of control characters, 0x00 to 0x1f, one bit each */
+#define ESCAPE_BIT(c) ((uint32_t)1 << (c))
+
+/*
+ * Returns the offset of the first byte of buf in set, or sz when there is
+ * none. Scans a machine word at a time: a word with no control character
+ * at all, which is nearly every word of typed or pasted text, costs a few
+ * arithmetic instructions rather than a compare per byte.
+ */
+size_t escape_scan(const uint8_t* buf, size_t sz, uint32_t set);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _ESCAPE_SCAN_H_ */
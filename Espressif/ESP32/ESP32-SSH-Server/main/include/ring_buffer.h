@@ -0,0 +1,120 @@
+/* ring_buffer.h
+ *
+ * Copyright (C) 2014-2024 wolfSSL Inc.
+ *
+ * This file is part of wolfSSH.
+ *
+ * wolfSSH is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfSSH is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wolfSSH.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _RING_BUFFER_H_
+#define _RING_BUFFER_H_
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Wait-free single-producer / single-consumer byte ring.
+ *
+ * head and tail are free-running byte counters; only the producer ever
+ * stores head, and only the consumer ever stores tail. The difference
+ * (head - tail) is the number of bytes pending, so the full size of the
+ * storage is usable and no slot is wasted to tell "full" from "empty".
+ *
+ * The storage size must be a power of two.
+ */
+typedef struct RingBuffer {
+    uint8_t*                  buf;
+    uint32_t                  size;
+    uint32_t                  mask;
+    _Atomic uint32_t          head; /* producer position */
+    _Atomic uint32_t          tail; /* consumer position */
+} RingBuffer;
+
+/* returns zero on success, non-zero if size is not a power of two */
+int ring_buffer_init(RingBuffer* rb, uint8_t* storage, uint32_t size);
+
+/* discard all pending data; only when neither side is active */
+void ring_buffer_reset(RingBuffer* rb);
+
+/* bytes currently pending; a snapshot, safe from either side */
+uint32_t ring_buffer_used(RingBuffer* rb);
+
+/* bytes that can currently be written; a snapshot, safe from either side */
+uint32_t ring_buffer_free(RingBuffer* rb);
+
+/* producer: copy up to sz bytes in, returns the number of bytes written */
+uint32_t ring_buffer_write(RingBuffer* rb, const uint8_t* data, uint32_t sz);
+
+/* consumer: copy up to sz bytes out, returns the number of bytes read */
+uint32_t ring_buffer_read(RingBuffer* rb, uint8_t* data, uint32_t sz);
+
+/* consumer: point [span] at the contiguous readable bytes at the tail,
+ * returns the span length. The data stays in the ring until consumed. */
+uint32_t ring_buffer_peek(RingBuffer* rb, uint8_t** span);
+
+/* consumer: release n bytes previously seen with ring_buffer_peek */
+void ring_buffer_consume(RingBuffer* rb, uint32_t n);
+
+/* producer: point [span] at the contiguous free space at the head, returns
+ * the span length. Nothing is visible to the consumer until committed. */
+uint32_t ring_buffer_reserve(RingBuffer* rb, uint8_t** span);
+
+/* producer: publish n bytes written into the span from ring_buffer_reserve */
+void ring_buffer_commit(RingBuffer* rb, uint32_t n);
+
+/*
+ * Single-producer / multi-consumer broadcast byte ring.
+ *
+ * The producer never waits: it overwrites the oldest data. Each consumer
+ * keeps its own free-running cursor, and a consumer that falls more than
+ * the storage size behind skips ahead to the oldest data still present.
+ * Readers detect data overwritten while they copy it (seqlock style) by
+ * re-checking the reserve counter, which the producer advances before it
+ * overwrites anything.
+ *
+ * The storage size must be a power of two.
+ */
+typedef struct BroadcastRing {
+    uint8_t*                  buf;
+    uint32_t                  size;
+    uint32_t                  mask;
+    _Atomic uint32_t          head;    /* end of the published data */
+    _Atomic uint32_t          reserve; /* end of the data being written */
+} BroadcastRing;
+
+/* returns zero on success, non-zero if size is not a power of two */
+int broadcast_ring_init(BroadcastRing* rb, uint8_t* storage, uint32_t size);
+
+/* current head; a new consumer starting here sees only future data */
+uint32_t broadcast_ring_head(BroadcastRing* rb);
+
+/* producer: append sz bytes, overwriting the oldest data as needed */
+void broadcast_ring_write(BroadcastRing* rb, const uint8_t* data,
+                          uint32_t sz);
+
+/* consumer: copy up to sz bytes from [cursor] and advance it. Bytes the
+ * consumer was too slow to read are added to [skipped]. Returns the number
+ * of bytes copied. */
+uint32_t broadcast_ring_read(BroadcastRing* rb, uint32_t* cursor,
+                             uint8_t* data, uint32_t sz, uint32_t* skipped);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _RING_BUFFER_H_ */
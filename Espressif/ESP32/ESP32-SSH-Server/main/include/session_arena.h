@@ -0,0 +1,90 @@
+/* session_arena.h
+ *
+ * Copyright (C) 2014-2024 wolfSSL Inc.
+ *
+ * This file is part of wolfSSH.
+ *
+ * wolfSSH is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfSSH is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wolfSSH.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _SESSION_ARENA_H_
+#define _SESSION_ARENA_H_
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Per session arena for wolfSSH and wolfCrypt allocations.
+ *
+ * Once installed, the wolfSSL allocator hooks serve every allocation made
+ * by a thread bound to an arena from that arena's fixed storage, so a
+ * session never takes from (or fragments) the shared heap. Blocks are
+ * carved from the top like a stack: freeing the last block rolls the top
+ * back, and freed blocks further down are merged with free neighbours and
+ * reused first fit once the top is full. An allocation that still does not
+ * fit falls back to the heap and is counted. Frees are routed by address,
+ * so any thread may free any block.
+ *
+ * Only the thread bound to an arena changes it. A block freed by another
+ * thread (a wolfCrypt cache, or a CTX buffer, released elsewhere) is put
+ * on the arena's foreign list without a lock, and the bound thread
+ * returns it to the arena at its next allocation or release. One thread
+ * at a time may be bound to an arena.
+ */
+#ifndef SESSION_ARENA_MAX
+    #define SESSION_ARENA_MAX 8 /* arenas that can be initialized at once */
+#endif
+
+typedef struct SessionArena {
+    uint8_t* buf;
+    uint32_t size;
+    uint32_t top;       /* end of the last block */
+    uint32_t last;      /* offset of the last block */
+    uint32_t live;      /* blocks allocated and not yet freed */
+    uint32_t peak;      /* highest top since the last release */
+    uint32_t allocs;    /* since the last release */
+    uint32_t fallbacks; /* allocations that went to the heap instead */
+    _Atomic(void*) foreign; /* blocks freed by other threads, linked
+                             * through their first word */
+} SessionArena;
+
+/* hook the wolfSSL allocators, once, before any thread enters an arena;
+ * returns zero on success */
+int session_arena_install(void);
+
+/* use [storage] of [size] bytes, need not be aligned; returns zero on
+ * success, non-zero if too small or SESSION_ARENA_MAX are in use */
+int session_arena_init(SessionArena* arena, uint8_t* storage, uint32_t size);
+
+/* stop routing frees to [arena]; all of its blocks must be freed */
+void session_arena_deinit(SessionArena* arena);
+
+/* bind [arena] (or NULL for the heap) to the calling thread, returns the
+ * arena bound before so it can be restored */
+SessionArena* session_arena_enter(SessionArena* arena);
+
+/* at the end of a session, by the thread bound to [arena]: when every block
+ * is freed, empty the arena at once and clear its statistics. Returns the
+ * number of blocks still live, which are left in place, in which case only
+ * the statistics restart. */
+uint32_t session_arena_release(SessionArena* arena);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _SESSION_ARENA_H_ */
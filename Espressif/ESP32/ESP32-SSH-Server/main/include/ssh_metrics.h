@@ -0,0 +1,209 @@
+/* ssh_metrics.h
+ *
+ * Copyright (C) 2014-2024 wolfSSL Inc.
+ *
+ * This file is part of wolfSSH.
+ *
+ * wolfSSH is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfSSH is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wolfSSH.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _SSH_METRICS_H_
+#define _SSH_METRICS_H_
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Counters and histograms of the SSH to UART bridge.
+ *
+ * ssh_metrics holds everything since boot: the UART tasks count into it
+ * directly, and each session counts into its own registry, which is
+ * added to ssh_metrics when the session ends. Every value of a session
+ * registry has a single writer, so an update is a plain load and store
+ * with no lock and no read-modify-write; readers in other tasks see a
+ * snapshot that may be a moment old. The values marked shared, which the
+ * tasks of every UART port or several sessions update, and
+ * ssh_metrics_merge use atomic read-modify-writes instead, the _shared
+ * functions below.
+ */
+
+typedef enum {
+    /* UART, shared by the uart_rx_task of every port */
+    SSH_METRIC_UART_EVENTS,         /* driver events handled */
+    SSH_METRIC_UART_RX_BYTES,       /* moved to the Tx ring */
+    SSH_METRIC_UART_RX_DROPPED,     /* overwritten in the Tx ring before a
+                                     * session read it; added by the
+                                     * sessions as they read */
+    SSH_METRIC_UART_FIFO_OVERFLOWS, /* UART_FIFO_OVF: the FIFO overran */
+    SSH_METRIC_UART_BUFFER_FULL,    /* UART_BUFFER_FULL: driver ring full */
+    SSH_METRIC_UART_PATTERN_DETECT, /* UART_PATTERN_DET */
+    SSH_METRIC_UART_FRAME_ERRORS,   /* UART_FRAME_ERR */
+    SSH_METRIC_UART_PARITY_ERRORS,  /* UART_PARITY_ERR */
+    SSH_METRIC_UART_BREAKS,         /* UART_BREAK */
+    SSH_METRIC_UART_FLOW_PAUSES,    /* stopped reading for flow control */
+    SSH_METRIC_UART_LINE_CHANGES,   /* baud rate or framing changed */
+
+    /* UART, shared by the uart_tx_task of every port */
+    SSH_METRIC_UART_TX_BYTES,       /* handed to the driver */
+    SSH_METRIC_UART_TX_WRITES,      /* uart_write_bytes calls */
+
+    /* sessions, written by the session, or merged */
+    SSH_METRIC_SESSIONS,            /* sessions that ended */
+    SSH_METRIC_HANDSHAKE_FAILURES,  /* including timeouts */
+    SSH_METRIC_SSH_RX_BYTES,        /* payload from the client */
+    SSH_METRIC_SSH_RX_READS,        /* wolfSSH_stream_read calls with data */
+    SSH_METRIC_SSH_TX_BYTES,        /* UART output sent to the client */
+    SSH_METRIC_SSH_TX_PACKETS,      /* in this many sends */
+    SSH_METRIC_RX_DROPPED,          /* for the UART, but the ring was full */
+    SSH_METRIC_RX_HELD,             /* stopped reading the client until the
+                                     * ring had room */
+    SSH_METRIC_TX_SKIPPED,          /* UART output the session was too slow
+                                     * to see */
+    SSH_METRIC_LOCK_BUSY,           /* UART write lock held by another */
+    SSH_METRIC_ARENA_FALLBACKS,     /* allocations the session arena sent
+                                     * to the heap */
+    SSH_METRIC_ARENA_PINNED,        /* ended with arena blocks still in
+                                     * use, so the arena was not reset */
+
+    /* written by the accept loop, into ssh_metrics as sessions merge */
+    SSH_METRIC_SESSIONS_REJECTED,   /* turned away, every slot in use */
+
+    /* shared by the write lock holders of every port */
+    SSH_METRIC_RX_RING_PEAK,        /* most bytes waiting for a UART */
+
+    SSH_METRIC_COUNT
+} SshMetricId;
+
+/* histograms of times in microseconds, in log2 buckets */
+typedef enum {
+    SSH_HIST_HS_VERSION,            /* handshake phases, see ssh_server.c */
+    SSH_HIST_HS_KEXINIT,
+    SSH_HIST_HS_KEXDH,
+    SSH_HIST_HS_NEWKEYS,
+    SSH_HIST_HS_USERAUTH,
+    SSH_HIST_HS_TOTAL,
+    SSH_HIST_KEYSTROKE_RTT,         /* client keystroke to the UART reply
+                                     * sent back, coalescing included */
+    SSH_HIST_UART_RX_LATENCY,       /* driver event to data in the ring;
+                                     * shared by every uart_rx_task */
+
+    SSH_HIST_COUNT
+} SshHistId;
+
+/* bucket b holds values below 2^b us, from 1 us to 2^22 us (4 s) and up */
+#define SSH_HIST_BUCKETS 24
+
+typedef struct SshMetrics {
+    _Atomic uint32_t counter[SSH_METRIC_COUNT];
+    _Atomic uint32_t bucket[SSH_HIST_COUNT][SSH_HIST_BUCKETS];
+    _Atomic uint32_t max[SSH_HIST_COUNT];
+} SshMetrics;
+
+/* since boot */
+extern SshMetrics ssh_metrics;
+
+static inline void ssh_metric_add(SshMetrics* m, SshMetricId id, uint32_t n)
+{
+    uint32_t v = atomic_load_explicit(&m->counter[id], memory_order_relaxed);
+
+    atomic_store_explicit(&m->counter[id], v + n, memory_order_relaxed);
+}
+
+/* for a value several tasks add to, see SshMetricId */
+static inline void ssh_metric_add_shared(SshMetrics* m, SshMetricId id,
+                                         uint32_t n)
+{
+    atomic_fetch_add_explicit(&m->counter[id], n, memory_order_relaxed);
+}
+
+/* raise [max] to v; for a value several tasks update */
+static inline void ssh_max_shared(_Atomic uint32_t* max, uint32_t v)
+{
+    uint32_t old = atomic_load_explicit(max, memory_order_relaxed);
+
+    while ((v > old) &&
+           !atomic_compare_exchange_weak_explicit(max, &old, v,
+                                                  memory_order_relaxed,
+                                                  memory_order_relaxed))
+        ;
+}
+
+/* for a high-water mark rather than a count */
+static inline void ssh_metric_max(SshMetrics* m, SshMetricId id, uint32_t v)
+{
+    if (v > atomic_load_explicit(&m->counter[id], memory_order_relaxed)) {
+        atomic_store_explicit(&m->counter[id], v, memory_order_relaxed);
+    }
+}
+
+static inline void ssh_metric_max_shared(SshMetrics* m, SshMetricId id,
+                                         uint32_t v)
+{
+    ssh_max_shared(&m->counter[id], v);
+}
+
+static inline uint32_t ssh_metric_get(SshMetrics* m, SshMetricId id)
+{
+    return atomic_load_explicit(&m->counter[id], memory_order_relaxed);
+}
+
+/* the bucket of [us] */
+static inline int ssh_hist_bucket(uint32_t us)
+{
+    /* the number of significant bits: a single instruction on Xtensa */
+    int b = (us == 0) ? 0 : 32 - __builtin_clz(us);
+
+    return (b < SSH_HIST_BUCKETS) ? b : SSH_HIST_BUCKETS - 1;
+}
+
+static inline void ssh_hist_record(SshMetrics* m, SshHistId id, uint32_t us)
+{
+    int b = ssh_hist_bucket(us);
+    uint32_t v;
+
+    v = atomic_load_explicit(&m->bucket[id][b], memory_order_relaxed);
+    atomic_store_explicit(&m->bucket[id][b], v + 1, memory_order_relaxed);
+
+    if (us > atomic_load_explicit(&m->max[id], memory_order_relaxed)) {
+        atomic_store_explicit(&m->max[id], us, memory_order_relaxed);
+    }
+}
+
+static inline void ssh_hist_record_shared(SshMetrics* m, SshHistId id,
+                                          uint32_t us)
+{
+    atomic_fetch_add_explicit(&m->bucket[id][ssh_hist_bucket(us)], 1,
+                              memory_order_relaxed);
+    ssh_max_shared(&m->max[id], us);
+}
+
+/* zero [m]; only while no task updates it */
+void ssh_metrics_reset(SshMetrics* m);
+
+/* add the counters and histograms of [from] to [into] */
+void ssh_metrics_merge(SshMetrics* into, SshMetrics* from);
+
+/* print the non-zero values of [m] into buf as "  name = value" lines
+ * ending in CR LF, as the rest of the Ctrl-E statistics. Returns the
+ * length, truncated to fit bufSz. */
+int ssh_metrics_format(SshMetrics* m, char* buf, int bufSz);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _SSH_METRICS_H_ */
@@ -47,15 +47,13 @@
 /* the main SSH Server demo*/
 void server_test(void *arg);
 
-/* External buffer functions used between RTOS tasks. (typically the UART)
- * TODO: Implement interrupts rather than polling */
-volatile char* __attribute__((optimize("O0"))) ExternalTransmitBuffer(void);
-volatile char* __attribute__((optimize("O0"))) ExternalReceiveBuffer(void);
-
-int ExternalTransmitBufferSz(void);
-int ExternalReceiveBufferSz(void);
-
-int Set_ExternalTransmitBufferSz(int n);
-int Set_ExternalReceiveBufferSz(int n);
+/* Channel window and maximum packet size offered to new sessions, see
+ * SSH_SERVER_WINDOW_SZ. Zero keeps a size as it is; adaptive is 0 or 1,
+ * or -1 to keep it. Returns zero on success. */
+int ssh_server_set_window(uint32_t windowSz, uint32_t maxPacketSz,
+                          int adaptive);
+
+void ssh_server_get_window(uint32_t* windowSz, uint32_t* maxPacketSz,
+                           int* adaptive);
 
 #endif /* _SSH_SERVER_H_ */
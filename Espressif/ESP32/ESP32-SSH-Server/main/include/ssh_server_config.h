@@ -43,12 +43,72 @@
 
 /* EdgeRouter-X is 57600, others are typically 115200
  * This is the UART baud rate to use in SSH server, NOT the monitor baud rate!
+ * It is the rate each route starts at: "ssh ... baud 57600 8N1" changes
+ * the rate, data bits, parity and stop bits at run time, "baud auto" or
+ * Ctrl-B in a session looks for the rate, see uart_line_set().
  **/
 #define BAUD_RATE (115200)
 
+/* What SSH clients type goes through this translation table on its way to
+ * each UART, see uart_xlate.h: "bs" sends DEL as a real backspace, "crlf"
+ * also sends CR as CR LF, "lf" sends CR as LF, and "raw" sends everything
+ * as is. "ssh ... map uart2 crlf" changes it at run time. */
+#define UART_XLATE_DEFAULT "bs"
+
+/* The UART driver receive ring holds UART_RX_RING_MS of data at the rate
+ * in use, at least UART_RX_RING_SZ and at most UART_RX_RING_MAX_SZ bytes;
+ * changing the rate resizes it. */
+#define UART_RX_RING_MS     50
+#define UART_RX_RING_MAX_SZ (16 * 1024)
+
+/* Auto-baud listens at each of these rates for UART_AUTOBAUD_SAMPLE_MS,
+ * and keeps the one that received the most printable text without framing
+ * errors; at least UART_AUTOBAUD_MIN_BYTES must arrive. The device must be
+ * talking meanwhile, e.g. booting, or press [Enter] first. */
+#define UART_AUTOBAUD_RATES     921600, 460800, 230400, 115200, \
+                                57600, 38400, 19200, 9600
+#define UART_AUTOBAUD_SAMPLE_MS 300
+#define UART_AUTOBAUD_MIN_BYTES 8
+
+/* The UART Rx task sleeps on the driver event queue rather than polling.
+ * UART_RX_RING_SZ is the driver receive ring, UART_EVENT_QUEUE_SZ the
+ * depth of its event queue. */
+#define UART_RX_RING_SZ     2048
+#define UART_EVENT_QUEUE_SZ 20
+
+/* Idle time, in UART symbol times, before a partly filled Rx FIFO is
+ * reported. Lower values give faster echo at the cost of more events. */
+#define UART_RX_TIMEOUT_SYMBOLS 2
+
+/* Optionally report a pattern character (typically a newline) as its own
+ * UART event, so complete lines are forwarded at once: */
+/* #define UART_PATTERN_CHR '\n' */
+
+/* Flow control toward the attached device, so that output the session
+ * typing cannot keep up with waits in the device rather than being
+ * skipped. Once that session has more than UART_FLOW_HIGH_WATER bytes of
+ * UART output unsent, the UART Rx task stops reading the driver; when the
+ * driver ring fills, the UART hardware deasserts RTS or sends XOFF.
+ * With XON/XOFF the device can also pause our Tx; it suits text only, as
+ * those two bytes can no longer be sent as data.
+ * Typing in the other direction always waits for the UART: a session
+ * stops reading the client while the SSH to UART ring is full, which
+ * holds back the SSH channel window. */
+#define UART_FLOW_NONE       0
+#define UART_FLOW_RTS_CTS    1
+#define UART_FLOW_XON_XOFF   2
+#define UART_FLOW_CONTROL    UART_FLOW_NONE
+#define UART_FLOW_HIGH_WATER (SSH_SERVER_SCROLLBACK_SZ / 2)
+
 
 /* SSH is usually on port 22, but for our example it lives at port 22222 */
-#define SSH_UART_PORT 22222
+#ifndef SSH_UART_PORT
+    #define SSH_UART_PORT 22222
+#endif
+
+/* The whole handshake, including the user typing a password, must finish
+ * within this time, in milliseconds. */
+#define SSH_SERVER_ACCEPT_TIMEOUT_MS 60000
 
 /* in the case of wired ethernet on the ESN28J60 we need to
  * manually assign an IP address: MY_MAC_ADDRESS see init_ENC28J60() */
@@ -116,6 +176,38 @@
     #define TXD_PIN (GPIO_NUM_17)
 #endif
 
+/* for UART_FLOW_RTS_CTS: RTS is our output, CTS our input */
+#ifndef RTS_PIN
+    #define RTS_PIN (18)
+#endif
+#ifndef CTS_PIN
+    #define CTS_PIN (19)
+#endif
+
+/* The UART ports bridged to SSH, each with its own rings, scrollback and
+ * UART tasks. A client picks one by its name, as the command or subsystem
+ * it asks for ("ssh -t -p 22222 user@host uart2", or "-s" for a subsystem)
+ * or as its user name; otherwise it gets the first. Within a session,
+ * Ctrl-] moves on to the next port, so several consoles share one
+ * handshake.
+ *
+ *   SSH_SERVER_UART_ROUTE(name, uart, txPin, rxPin, rtsPin, ctsPin, baud)
+ *
+ * rtsPin and ctsPin are used with UART_FLOW_RTS_CTS only; baud is the rate
+ * the port starts at. Each port costs SSH_SERVER_SCROLLBACK_SZ +
+ * EXT_RX_BUF_MAX_SZ bytes of RAM and two tasks.
+ * SSH_SERVER_UART_PORTS must be the number of routes. For example:
+ *
+ *   SSH_SERVER_UART_ROUTE("uart2", UART_NUM_2, 4, 5,
+ *                         UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE, 57600)
+ */
+#ifndef SSH_SERVER_UART_ROUTES
+    #define SSH_SERVER_UART_ROUTES                                         \
+        SSH_SERVER_UART_ROUTE("uart1", UART_NUM_1, TXD_PIN, RXD_PIN,       \
+                              RTS_PIN, CTS_PIN, BAUD_RATE)
+    #define SSH_SERVER_UART_PORTS 1
+#endif
+
 /* Optionally disable the entire UART component: */
 /* #define DISABLE_SSH_UART */ 
 
@@ -130,6 +222,87 @@
  */
 #define SSH_SERVER_ECHO 0
 
+/* Number of concurrent SSH sessions. Each session slot is reserved at build
+ * time: SSH_SERVER_SESSION_STACK_SZ bytes of task stack plus one Rx and one
+ * Tx buffer (EXT_RX_BUF_MAX_SZ, and the larger of EXT_TX_BUF_MAX_SZ and
+ * SSH_SERVER_SCROLLBACK_REPLAY_SZ), and it keeps one WOLFSSH object
+ * allocated. The first session to connect owns the UART; clients
+ * beyond SSH_SERVER_MAX_SESSIONS are turned away with a busy message. */
+#define SSH_SERVER_MAX_SESSIONS     2
+#define SSH_SERVER_SESSION_STACK_SZ (23 * 1024)
+
+/* The wolfSSH and wolfCrypt allocations of each session (the WOLFSSH
+ * object, its packet buffers, keys and crypto scratch) come from an arena
+ * of this many bytes in the session slot rather than the shared heap, so
+ * sessions coming and going do not fragment it. An allocation that does
+ * not fit falls back to the heap; the peak use of the arena is logged at
+ * the end of each session. Every slot reserves its arena statically, so
+ * this costs SSH_SERVER_MAX_SESSIONS times as much RAM (64KB with the
+ * defaults) whether clients are connected or not. Comment out to allocate
+ * from the heap. */
+#define SSH_SERVER_SESSION_ARENA_SZ (32 * 1024)
+
+/* The SSH channel window is how much a client may send before it waits for
+ * the server to grant more, one round trip. A small window stalls bulk
+ * pastes and SCP on every round trip; a large one costs a buffer of that
+ * size in each session and can outrun the UART. New sessions are offered
+ * SSH_SERVER_WINDOW_SZ with packets of up to SSH_SERVER_MAX_PACKET_SZ;
+ * ssh_server_set_window() changes both at run time.
+ * With SSH_SERVER_WINDOW_ADAPTIVE each session is offered a window based on
+ * the sessions before it: doubled after a bulk transfer that the UART kept
+ * up with, halved when the UART dropped data or memory ran short, within
+ * SSH_SERVER_WINDOW_MIN_SZ and SSH_SERVER_WINDOW_MAX_SZ. */
+#define SSH_SERVER_WINDOW_SZ       (8 * 1024)
+#define SSH_SERVER_MAX_PACKET_SZ   (4 * 1024)
+#define SSH_SERVER_WINDOW_ADAPTIVE
+#define SSH_SERVER_WINDOW_MIN_SZ   (2 * 1024)
+#define SSH_SERVER_WINDOW_MAX_SZ   (16 * 1024)
+
+/* UART output is coalesced into larger SSH packets: each packet costs a MAC,
+ * cipher padding and a TCP segment, which a chatty console otherwise pays
+ * for every character. Output is held for up to SSH_SERVER_COALESCE_DELAY_MS
+ * after its first byte, and sent at once on a newline or when
+ * SSH_SERVER_COALESCE_MAX_SZ bytes are pending. The delay is rounded up to
+ * the RTOS tick by select(). Comment out the delay to send whatever the
+ * UART has as soon as it arrives. Ctrl-E shows the bytes per packet. */
+#define SSH_SERVER_COALESCE_DELAY_MS 2
+#define SSH_SERVER_COALESCE_MAX_SZ   1024
+
+/* Compile time log levels of the data path, see ssh_trace.h: traces above
+ * these levels are not built at all. At ESP_LOG_WARN only overruns are
+ * logged; ESP_LOG_INFO logs every read and write, ESP_LOG_VERBOSE also
+ * every UART event. ssh_trace_set_sample() thins out those built in. */
+#ifndef SSH_TRACE_LEVEL_UART_RX
+    #define SSH_TRACE_LEVEL_UART_RX ESP_LOG_WARN
+#endif
+#ifndef SSH_TRACE_LEVEL_UART_TX
+    #define SSH_TRACE_LEVEL_UART_TX ESP_LOG_WARN
+#endif
+#ifndef SSH_TRACE_LEVEL_SESSION
+    #define SSH_TRACE_LEVEL_SESSION ESP_LOG_WARN
+#endif
+
+/* UART output is always captured in a circular scrollback buffer shared by
+ * all sessions, also while no client is connected. On connect, the last
+ * SSH_SERVER_SCROLLBACK_REPLAY_SZ bytes (typically the boot log of the
+ * attached device) are replayed instead of the welcome text.
+ * The scrollback size must be a power of two. */
+#define SSH_SERVER_SCROLLBACK_SZ        (16 * 1024)
+#define SSH_SERVER_SCROLLBACK_REPLAY_SZ ( 4 * 1024)
+
+/* Optionally place the scrollback in external PSRAM: */
+/* #define SSH_SERVER_SCROLLBACK_PSRAM */
+
+/* wolfSSH creates each ephemeral KEX key inside the handshake, with no way
+ * to hand it a pre-generated one. Instead, a task generates and discards
+ * throwaway keys for each configured curve at start up, so the curve
+ * parameter cache (ECC_CACHE_CURVE), the fixed point tables (FP_ECC, see
+ * user_settings.h), the RNG and the crypto hardware are already set up
+ * when the first client connects. It stops as that client is accepted,
+ * so as not to share the CPU with its handshake. Comment out to disable. */
+#define SSH_SERVER_KEX_WARMUP
+#define SSH_SERVER_KEX_WARMUP_STACK_SZ (6 * 1024)
+
 /**
  ******************************************************************************
  ******************************************************************************
@@ -173,6 +346,35 @@ int ssh_server_config_init(void);
     #error "WOLFSSL_ESP8266 defined for ESP32 project. See user_settings.h"
 #endif
 
+#if (SSH_SERVER_SCROLLBACK_SZ & (SSH_SERVER_SCROLLBACK_SZ - 1)) != 0
+    #error "SSH_SERVER_SCROLLBACK_SZ must be a power of two"
+#endif
+
+#if SSH_SERVER_SCROLLBACK_REPLAY_SZ > SSH_SERVER_SCROLLBACK_SZ
+    #error "SSH_SERVER_SCROLLBACK_REPLAY_SZ exceeds SSH_SERVER_SCROLLBACK_SZ"
+#endif
+
+#if defined(SSH_SERVER_SCROLLBACK_PSRAM) && !defined(CONFIG_SPIRAM)
+    #error "SSH_SERVER_SCROLLBACK_PSRAM needs PSRAM enabled (CONFIG_SPIRAM)"
+#endif
+
+#if (SSH_SERVER_WINDOW_SZ < SSH_SERVER_WINDOW_MIN_SZ) || \
+    (SSH_SERVER_WINDOW_SZ > SSH_SERVER_WINDOW_MAX_SZ)
+    #error "SSH_SERVER_WINDOW_SZ must be within the MIN and MAX window sizes"
+#endif
+
+#if (SSH_SERVER_MAX_SESSIONS > 1) && defined(SINGLE_THREADED)
+    #error "SSH_SERVER_MAX_SESSIONS > 1 needs wolfSSL without SINGLE_THREADED"
+#endif
+
+#if UART_RX_RING_MAX_SZ < UART_RX_RING_SZ
+    #error "UART_RX_RING_MAX_SZ cannot be less than UART_RX_RING_SZ"
+#endif
+
+#if !defined(SSH_SERVER_UART_PORTS) || (SSH_SERVER_UART_PORTS < 1)
+    #error "SSH_SERVER_UART_PORTS must be the number of SSH_SERVER_UART_ROUTES"
+#endif
+
 #if defined(TXD_PIN) && defined(RXD_PIN)
     #if TXD_PIN == RXD_PIN
         #error "TXD_PIN cannot be the same as RXD_PIN"
@@ -0,0 +1,100 @@
+/* ssh_trace.h
+ *
+ * Copyright (C) 2014-2024 wolfSSL Inc.
+ *
+ * This file is part of wolfSSH.
+ *
+ * wolfSSH is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfSSH is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wolfSSH.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _SSH_TRACE_H_
+#define _SSH_TRACE_H_
+
+#include <esp_log.h>
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Tracing of the per-byte data path: uart_rx_task, uart_tx_task and the
+ * server_worker read loop. Logging every read there formats a message and
+ * sends it out the console UART, which at 115200 baud costs more than the
+ * data it describes.
+ *
+ * Each subsystem has a compile time level, SSH_TRACE_LEVEL_<subsystem>,
+ * from ssh_server_config.h (include it first) or else SSH_TRACE_LEVEL.
+ * SSH_TRACE calls above that level are removed by the compiler entirely.
+ * Those compiled in can be sampled at run time: ssh_trace_set_sample(n)
+ * logs one event in n per subsystem, and 0 turns them all off.
+ */
+
+#define SSH_TRACE_ID_UART_RX 0 /* uart_rx_task */
+#define SSH_TRACE_ID_UART_TX 1 /* uart_tx_task, sendData */
+#define SSH_TRACE_ID_SESSION 2 /* server_worker data path */
+#define SSH_TRACE_SUBSYSTEMS 3
+
+#ifndef SSH_TRACE_LEVEL
+    #define SSH_TRACE_LEVEL ESP_LOG_WARN
+#endif
+#ifndef SSH_TRACE_LEVEL_UART_RX
+    #define SSH_TRACE_LEVEL_UART_RX SSH_TRACE_LEVEL
+#endif
+#ifndef SSH_TRACE_LEVEL_UART_TX
+    #define SSH_TRACE_LEVEL_UART_TX SSH_TRACE_LEVEL
+#endif
+#ifndef SSH_TRACE_LEVEL_SESSION
+    #define SSH_TRACE_LEVEL_SESSION SSH_TRACE_LEVEL
+#endif
+
+/* log one event in this many, see ssh_trace_set_sample */
+extern volatile uint32_t ssh_trace_every;
+
+/* events seen per subsystem; not atomic, as a lost count only moves the
+ * next sample */
+extern uint32_t ssh_trace_count[SSH_TRACE_SUBSYSTEMS];
+
+/* is this event of subsystem [id] one to log? */
+static inline int ssh_trace_sample(int id)
+{
+    uint32_t every = ssh_trace_every;
+
+    if (every <= 1) {
+        return (int)every;
+    }
+    return (ssh_trace_count[id]++ % every) == 0;
+}
+
+/* the level is a constant, so a level above SSH_TRACE_LEVEL_<sub> leaves
+ * no code behind, not even the sample counter */
+#define SSH_TRACE(sub, level, tag, ...)                                \
+    do {                                                               \
+        if ((SSH_TRACE_LEVEL_##sub >= (level)) &&                      \
+            ssh_trace_sample(SSH_TRACE_ID_##sub)) {                    \
+            ESP_LOG_LEVEL((level), (tag), __VA_ARGS__);                \
+        }                                                              \
+    } while (0)
+
+/* log every event compiled in (1, the default), one in [every], or none
+ * (0); safe to call from any task at any time */
+void ssh_trace_set_sample(uint32_t every);
+
+uint32_t ssh_trace_get_sample(void);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _SSH_TRACE_H_ */
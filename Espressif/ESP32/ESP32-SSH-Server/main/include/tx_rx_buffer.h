@@ -1,46 +1,114 @@
-/* tx_rx_buffer.h
- *
- * Copyright (C) 2014-2024 wolfSSL Inc.
- *
- * This file is part of wolfSSH.
- *
- * wolfSSH is free software; you can redistribute it and/or modify
- * it under the terms of the GNU General Public License as published by
- * the Free Software Foundation; either version 3 of the License, or
- * (at your option) any later version.
- *
- * wolfSSH is distributed in the hope that it will be useful,
- * but WITHOUT ANY WARRANTY; without even the implied warranty of
- * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
- * GNU General Public License for more details.
- *
- * You should have received a copy of the GNU General Public License
- * along with wolfSSH.  If not, see <http://www.gnu.org/licenses/>.
- */
-#ifndef _TX_RX_BUFFER_H_
-#define _TX_RX_BUFFER_H_
-
-#include <freertos/FreeRTOS.h>
-#include <freertos/semphr.h>
-
-#include <string.h>
-
-/* TODO do these really need to be so big? probably not */
-/* Sizes for shared transmit and receive buffers, for
- * both external (typically UART) and SSH data streams */
-#define EXT_RX_BUF_MAX_SZ 2048
-#define EXT_TX_BUF_MAX_SZ 2048
-
-typedef uint8_t byte;
-
-int init_tx_rx_buffer(byte TxPin, byte RxPin);
-
-int Get_ExternalTransmitBuffer(byte **ToData);
-
-int Set_ExternalTransmitBuffer(byte *FromData, int sz);
-
-int Set_ExternalReceiveBuffer(byte *FromData, int sz);
-
-bool ExternalReceiveBuffer_IsChar(char charValue);
-
-#endif /* _TX_RX_BUFFER_H_ */
+/* tx_rx_buffer.h
+ *
+ * Copyright (C) 2014-2024 wolfSSL Inc.
+ *
+ * This file is part of wolfSSH.
+ *
+ * wolfSSH is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfSSH is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wolfSSH.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _TX_RX_BUFFER_H_
+#define _TX_RX_BUFFER_H_
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Size of the shared receive (SSH to UART) ring, a power of two, and of
+ * the chunks a session moves from the UART output at a time. The UART
+ * output ring itself is SSH_SERVER_SCROLLBACK_SZ, see ssh_server_config.h */
+#define EXT_RX_BUF_MAX_SZ 2048
+#define EXT_TX_BUF_MAX_SZ 2048
+
+#if (EXT_RX_BUF_MAX_SZ & (EXT_RX_BUF_MAX_SZ - 1))
+    #error "EXT_RX_BUF_MAX_SZ must be a power of two"
+#endif
+
+typedef uint8_t byte;
+
+/* One SSH session viewing the UART output of one port. Owned by the
+ * session; only that session's server_worker moves the cursor. Other tasks
+ * read the published copy, see ExternalTransmitBuffer_OwnerBacklog. */
+typedef struct ExternalTransmitReader {
+    int              port;      /* the UART port viewed, see AddReader */
+    uint32_t         cursor;    /* position in the Tx broadcast ring */
+    _Atomic uint32_t seen;      /* cursor, stored after each read */
+    uint32_t         skippedSz; /* bytes overwritten before this reader
+                                 * saw them */
+    int              notifyFd;  /* eventfd signalled when UART data
+                                 * arrives */
+} ExternalTransmitReader;
+
+int init_tx_rx_buffer(void);
+
+int tx_rx_buffer_welcome(const char* name, byte TxPin, byte RxPin,
+                         char* msg, int msgSz);
+
+/* Every function taking a [port] works on that UART port's own rings,
+ * see SSH_SERVER_UART_ROUTES; readers remember the port they view. */
+
+/* write lock: only the attached SSH session may write to the UART */
+int ExternalBuffers_Attach(int port, int id, ExternalTransmitReader* reader,
+                           int raw);
+
+void ExternalBuffers_Detach(int port, int id);
+
+/* UART -> SSH: producer uart_rx_task, one reader per server_worker */
+int Set_ExternalTransmitBuffer(int port, byte *FromData, int sz);
+
+int Get_ExternalTransmitBuffer(ExternalTransmitReader* reader,
+                               byte *ToData, int sz);
+
+int ExternalTransmitBufferSz(ExternalTransmitReader* reader);
+
+int ExternalTransmitBuffer_NewNotifyFd(void);
+
+int ExternalTransmitBuffer_AddReader(ExternalTransmitReader* reader,
+                                     int port, int notifyFd, int replaySz);
+
+void ExternalTransmitBuffer_RemoveReader(ExternalTransmitReader* reader);
+
+void ExternalTransmitBuffer_ClearNotify(ExternalTransmitReader* reader);
+
+int ExternalTransmitBuffer_OwnerBacklog(int port);
+
+/* SSH -> UART: producer server_worker, consumer uart_tx_task */
+int Set_ExternalReceiveBuffer(int port, byte *FromData, int sz);
+
+int ExternalReceiveBuffer_Reserve(int port, byte** span);
+
+void ExternalReceiveBuffer_Commit(int port, int n);
+
+int Get_ExternalReceiveBuffer(int port, byte *ToData, int sz);
+
+int ExternalReceiveBufferSz(int port);
+
+int ExternalReceiveBuffer_Free(int port);
+
+int ExternalReceiveBuffer_WaitForRoom(int port);
+
+uint32_t ExternalReceiveBuffer_DroppedSz(int port);
+
+void ExternalReceiveBuffer_SetNotifyTask(int port, TaskHandle_t task);
+
+int ExternalReceiveBuffer_Peek(int port, byte** span);
+
+int ExternalReceiveBuffer_Raw(int port);
+
+void ExternalReceiveBuffer_Consume(int port, int n);
+
+#endif /* _TX_RX_BUFFER_H_ */
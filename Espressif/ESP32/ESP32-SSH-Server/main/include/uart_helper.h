@@ -27,14 +27,73 @@
 #include <driver/uart.h>
 #include <driver/gpio.h>
 
+#include "uart_xlate.h"
+
+/* UART receive counters, see uart_get_rx_stats(); a view of ssh_metrics */
+typedef struct {
+    uint32_t events;          /* driver events handled */
+    uint32_t rx_bytes;        /* bytes moved to the External Tx ring */
+    uint32_t dropped_bytes;   /* overwritten before a session saw them,
+                               * summed over the sessions */
+    uint32_t fifo_overflows;  /* UART_FIFO_OVF: hardware FIFO overran */
+    uint32_t buffer_full;     /* UART_BUFFER_FULL: driver ring filled */
+    uint32_t pattern_detect;  /* UART_PATTERN_DET */
+    uint32_t frame_errors;    /* UART_FRAME_ERR */
+    uint32_t parity_errors;   /* UART_PARITY_ERR */
+    uint32_t breaks;          /* UART_BREAK */
+    uint32_t last_latency_us; /* driver wakeup to data in the ring */
+    uint32_t max_latency_us;
+} uart_rx_stats_t;
+
+/* one UART port bridged to SSH, see SSH_SERVER_UART_ROUTES; the index of
+ * a route is the port number the External buffers and UART tasks use */
+typedef struct {
+    const char* name;
+    uart_port_t uart;
+    int txPin;
+    int rxPin;
+    int rtsPin;
+    int ctsPin;
+    int baud;          /* the rate the port starts at */
+} uart_route_t;
+
+/* the line settings of a port, changed at run time with uart_line_set */
+typedef struct {
+    int baud;
+    uart_word_length_t dataBits;
+    uart_parity_t parity;
+    uart_stop_bits_t stopBits;
+} uart_line_t;
+
 void init_UART(void);
 
+const uart_route_t* uart_route_get(int port);
+
+int uart_route_find(const char* name);
+
+int uart_line_get(int port, uart_line_t* line);
+
+int uart_line_set(int port, const uart_line_t* line);
+
+int uart_line_autobaud(int port, uart_line_t* line);
+
+int uart_line_parse(const char* spec, uart_line_t* line);
+
+int uart_line_format(const uart_line_t* line, char* buf, int bufSz);
+
+int uart_map_set(int port, const UartXlate* map);
+
+const UartXlate* uart_map_get(int port);
+
+int uart_get_rx_stats(uart_rx_stats_t* stats);
+
 void uart_send_welcome(void);
 
+/* arg is the port, (void*)(intptr_t)port: one pair of tasks per route */
 void uart_tx_task(void *arg);
 
 void uart_rx_task(void *arg);
 
-int sendData(const char* logName, const char* data);
+int sendData(const char* logName, const char* data, int len);
 
 #endif /* _UART_HELPER_H_ */
@@ -0,0 +1,83 @@
+/* uart_xlate.h
+ *
+ * Copyright (C) 2014-2024 wolfSSL Inc.
+ *
+ * This file is part of wolfSSH.
+ *
+ * wolfSSH is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfSSH is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wolfSSH.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _UART_XLATE_H_
+#define _UART_XLATE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* what a CR or LF becomes after the byte map */
+typedef enum {
+    UART_XLATE_EOL_AS_IS = 0,
+    UART_XLATE_EOL_CR_CRLF,     /* CR is sent as CR LF */
+    UART_XLATE_EOL_LF_CRLF      /* LF is sent as CR LF */
+} UartXlateEol;
+
+/*
+ * The translation of what SSH clients type before it goes out of a UART:
+ * each byte b is sent as map[b], then the end of line policy applies.
+ * A table in use is only read, so it must not change or go away; select
+ * another one instead, see uart_map_set().
+ */
+typedef struct UartXlate {
+    const char* name;
+    uint8_t map[256];
+    UartXlateEol eol;
+
+    /* derived from map and eol by uart_xlate_update() */
+    uint8_t identity;           /* sends everything as is */
+    int16_t only;               /* the one byte map changes, else -1 */
+    int16_t eolIn;              /* the one byte eol expands, else -1 */
+} UartXlate;
+
+/* the most bytes uart_xlate_run() writes for sz in */
+#define UART_XLATE_OUT_SZ(sz) (2 * (sz))
+
+/* [t] as the identity map with [eol], to change entries of */
+void uart_xlate_init(UartXlate* t, const char* name, UartXlateEol eol);
+
+/* call after changing the map or eol of [t] */
+void uart_xlate_update(UartXlate* t);
+
+/*
+ * Translate sz bytes of in into out, which has room for
+ * UART_XLATE_OUT_SZ(sz); with UART_XLATE_EOL_AS_IS it is sz bytes, and out
+ * may be in. Returns the bytes written to out.
+ */
+size_t uart_xlate_run(const UartXlate* t, const uint8_t* in, size_t sz,
+                      uint8_t* out);
+
+/* the built in table called [name], or NULL: "raw" sends everything as is,
+ * "bs" DEL as BS, "crlf" also CR as CR LF, "lf" DEL as BS and CR as LF */
+const UartXlate* uart_xlate_find(const char* name);
+
+/* the built in table number [i], or NULL past the last */
+const UartXlate* uart_xlate_builtin(int i);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _UART_XLATE_H_ */
@@ -82,7 +82,7 @@ extern "C" {
          * of bytes in our log (typically 4) by 3 bits
          * (which multiplies by 8). (e.g. 32-1)
         */
-        if (n & ((unsigned long)(1 << ((sizeof(n) << 3) - 1)))) {
+        if (n & (1UL << ((sizeof(n) << 3) - 1))) {
             n = -n;
             m = 1;
         }
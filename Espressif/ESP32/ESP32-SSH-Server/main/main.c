@@ -325,6 +325,16 @@ void app_main(void)
 #ifdef ESP_ENABLE_WOLFSSH
     ESP_LOGI(TAG, "SSH DEFAULT_WINDOW_SZ:     %d bytes",
                    DEFAULT_WINDOW_SZ);
+    {
+        uint32_t windowSz, maxPacketSz;
+        int adaptive;
+
+        ssh_server_get_window(&windowSz, &maxPacketSz, &adaptive);
+        ESP_LOGI(TAG, "SSH session window:        %u bytes%s",
+                       (unsigned)windowSz, adaptive ? ", adaptive" : "");
+        ESP_LOGI(TAG, "SSH max packet:            %u bytes",
+                       (unsigned)maxPacketSz);
+    }
 #else
     #error "ESP_ENABLE_WOLFSSH ust be enabled for this project"
 #endif
@@ -343,13 +353,16 @@ void app_main(void)
      * there was an odd WDT timeout warning.
      */
 #ifndef DISABLE_SSH_UART
-    xTaskCreate(uart_rx_task, "uart_rx_task",
-                UART_RX_TASK_STACK_SIZE, NULL,
-                tskIDLE_PRIORITY, NULL);
-
-    xTaskCreate(uart_tx_task, "uart_tx_task",
-                UART_TX_TASK_STACK_SIZE, NULL,
-                tskIDLE_PRIORITY, NULL);
+    /* a pair of UART tasks for each of SSH_SERVER_UART_ROUTES */
+    for (int port = 0; port < SSH_SERVER_UART_PORTS; port++) {
+        xTaskCreate(uart_rx_task, "uart_rx_task",
+                    UART_RX_TASK_STACK_SIZE, (void*)(intptr_t)port,
+                    tskIDLE_PRIORITY, NULL);
+
+        xTaskCreate(uart_tx_task, "uart_tx_task",
+                    UART_TX_TASK_STACK_SIZE, (void*)(intptr_t)port,
+                    tskIDLE_PRIORITY, NULL);
+    }
 #endif
 
     xTaskCreate(server_session, "server_session",
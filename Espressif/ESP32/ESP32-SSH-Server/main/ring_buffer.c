@@ -0,0 +1,291 @@
+/* ring_buffer.c
+ *
+ * Copyright (C) 2014-2024 wolfSSL Inc.
+ *
+ * This file is part of wolfSSH.
+ *
+ * wolfSSH is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfSSH is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wolfSSH.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This file has no RTOS dependencies so that it can also be built on a host */
+#include "ring_buffer.h"
+
+#include <string.h>
+
+/*
+ * Memory ordering:
+ *
+ * The producer reads tail with acquire (so the consumer is done with the
+ * bytes it is about to overwrite), copies, then publishes head with release.
+ * The consumer reads head with acquire (so the copied bytes are visible),
+ * copies, then publishes tail with release. Each side reads its own index
+ * relaxed, since no one else ever stores it.
+ */
+
+int ring_buffer_init(RingBuffer* rb, uint8_t* storage, uint32_t size)
+{
+    int ret = 0;
+
+    if ((rb == NULL) || (storage == NULL) ||
+        (size == 0)  || ((size & (size - 1)) != 0)) {
+        ret = 1;
+    }
+    else {
+        rb->buf  = storage;
+        rb->size = size;
+        rb->mask = size - 1;
+        atomic_init(&rb->head, 0);
+        atomic_init(&rb->tail, 0);
+    }
+
+    return ret;
+}
+
+void ring_buffer_reset(RingBuffer* rb)
+{
+    atomic_store_explicit(&rb->tail,
+                          atomic_load_explicit(&rb->head,
+                                               memory_order_acquire),
+                          memory_order_release);
+}
+
+uint32_t ring_buffer_used(RingBuffer* rb)
+{
+    uint32_t tail = atomic_load_explicit(&rb->tail, memory_order_acquire);
+    uint32_t head = atomic_load_explicit(&rb->head, memory_order_acquire);
+
+    return head - tail;
+}
+
+uint32_t ring_buffer_free(RingBuffer* rb)
+{
+    return rb->size - ring_buffer_used(rb);
+}
+
+uint32_t ring_buffer_write(RingBuffer* rb, const uint8_t* data, uint32_t sz)
+{
+    uint32_t head = atomic_load_explicit(&rb->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&rb->tail, memory_order_acquire);
+    uint32_t space = rb->size - (head - tail);
+    uint32_t offset;
+    uint32_t first;
+
+    if (sz > space) {
+        sz = space;
+    }
+
+    if (sz > 0) {
+        /* at most two memcpy: up to the end of storage, then from the top */
+        offset = head & rb->mask;
+        first = rb->size - offset;
+        if (first > sz) {
+            first = sz;
+        }
+        memcpy(rb->buf + offset, data, first);
+        memcpy(rb->buf, data + first, sz - first);
+
+        atomic_store_explicit(&rb->head, head + sz, memory_order_release);
+    }
+
+    return sz;
+}
+
+uint32_t ring_buffer_read(RingBuffer* rb, uint8_t* data, uint32_t sz)
+{
+    uint32_t tail = atomic_load_explicit(&rb->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&rb->head, memory_order_acquire);
+    uint32_t avail = head - tail;
+    uint32_t offset;
+    uint32_t first;
+
+    if (sz > avail) {
+        sz = avail;
+    }
+
+    if (sz > 0) {
+        offset = tail & rb->mask;
+        first = rb->size - offset;
+        if (first > sz) {
+            first = sz;
+        }
+        memcpy(data, rb->buf + offset, first);
+        memcpy(data + first, rb->buf, sz - first);
+
+        atomic_store_explicit(&rb->tail, tail + sz, memory_order_release);
+    }
+
+    return sz;
+}
+
+uint32_t ring_buffer_peek(RingBuffer* rb, uint8_t** span)
+{
+    uint32_t tail = atomic_load_explicit(&rb->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&rb->head, memory_order_acquire);
+    uint32_t avail = head - tail;
+    uint32_t offset = tail & rb->mask;
+
+    /* only the part up to the end of storage is contiguous */
+    if (avail > rb->size - offset) {
+        avail = rb->size - offset;
+    }
+
+    *span = rb->buf + offset;
+    return avail;
+}
+
+void ring_buffer_consume(RingBuffer* rb, uint32_t n)
+{
+    uint32_t tail = atomic_load_explicit(&rb->tail, memory_order_relaxed);
+
+    atomic_store_explicit(&rb->tail, tail + n, memory_order_release);
+}
+
+uint32_t ring_buffer_reserve(RingBuffer* rb, uint8_t** span)
+{
+    uint32_t head = atomic_load_explicit(&rb->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&rb->tail, memory_order_acquire);
+    uint32_t space = rb->size - (head - tail);
+    uint32_t offset = head & rb->mask;
+
+    /* as with peek, only the part up to the end of storage */
+    if (space > rb->size - offset) {
+        space = rb->size - offset;
+    }
+
+    *span = rb->buf + offset;
+    return space;
+}
+
+void ring_buffer_commit(RingBuffer* rb, uint32_t n)
+{
+    uint32_t head = atomic_load_explicit(&rb->head, memory_order_relaxed);
+
+    atomic_store_explicit(&rb->head, head + n, memory_order_release);
+}
+
+/*
+ * Broadcast ring memory ordering:
+ *
+ * The producer publishes reserve before it overwrites any byte (relaxed
+ * store, then a release fence), and publishes head with release once the
+ * bytes are in place. A consumer reads head with acquire, copies, then
+ * reads reserve after an acquire fence: if reserve shows the producer may
+ * have reached the copied range, the copy is discarded and retried from
+ * the oldest byte that is still intact.
+ */
+
+int broadcast_ring_init(BroadcastRing* rb, uint8_t* storage, uint32_t size)
+{
+    int ret = 0;
+
+    if ((rb == NULL) || (storage == NULL) ||
+        (size == 0)  || ((size & (size - 1)) != 0)) {
+        ret = 1;
+    }
+    else {
+        rb->buf  = storage;
+        rb->size = size;
+        rb->mask = size - 1;
+        atomic_init(&rb->head, 0);
+        atomic_init(&rb->reserve, 0);
+    }
+
+    return ret;
+}
+
+uint32_t broadcast_ring_head(BroadcastRing* rb)
+{
+    return atomic_load_explicit(&rb->head, memory_order_acquire);
+}
+
+void broadcast_ring_write(BroadcastRing* rb, const uint8_t* data,
+                          uint32_t sz)
+{
+    uint32_t head = atomic_load_explicit(&rb->head, memory_order_relaxed);
+    uint32_t offset;
+    uint32_t first;
+
+    if (sz > rb->size) {
+        /* only the last size bytes can be kept; account for the rest */
+        head += sz - rb->size;
+        data += sz - rb->size;
+        sz = rb->size;
+    }
+
+    if (sz > 0) {
+        atomic_store_explicit(&rb->reserve, head + sz, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+
+        offset = head & rb->mask;
+        first = rb->size - offset;
+        if (first > sz) {
+            first = sz;
+        }
+        memcpy(rb->buf + offset, data, first);
+        memcpy(rb->buf, data + first, sz - first);
+
+        atomic_store_explicit(&rb->head, head + sz, memory_order_release);
+    }
+}
+
+uint32_t broadcast_ring_read(BroadcastRing* rb, uint32_t* cursor,
+                             uint8_t* data, uint32_t sz, uint32_t* skipped)
+{
+    uint32_t pos = *cursor;
+    uint32_t head;
+    uint32_t reserve;
+    uint32_t n;
+    uint32_t offset;
+    uint32_t first;
+
+    for (;;) {
+        head = atomic_load_explicit(&rb->head, memory_order_acquire);
+
+        if (head - pos > rb->size) {
+            /* lapped: the oldest data still present starts at head - size */
+            *skipped += head - rb->size - pos;
+            pos = head - rb->size;
+        }
+
+        n = head - pos;
+        if (n > sz) {
+            n = sz;
+        }
+        if (n == 0) {
+            break;
+        }
+
+        offset = pos & rb->mask;
+        first = rb->size - offset;
+        if (first > n) {
+            first = n;
+        }
+        memcpy(data, rb->buf + offset, first);
+        memcpy(data + first, rb->buf, n - first);
+
+        atomic_thread_fence(memory_order_acquire);
+        reserve = atomic_load_explicit(&rb->reserve, memory_order_relaxed);
+
+        if (reserve - pos <= rb->size) {
+            break;
+        }
+
+        /* overwritten while copying: resume at the oldest intact byte */
+        *skipped += reserve - rb->size - pos;
+        pos = reserve - rb->size;
+    }
+
+    *cursor = pos + n;
+    return n;
+}
@@ -0,0 +1,442 @@
+/* session_arena.c
+ *
+ * Copyright (C) 2014-2024 wolfSSL Inc.
+ *
+ * This file is part of wolfSSH.
+ *
+ * wolfSSH is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfSSH is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wolfSSH.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This file has no RTOS dependencies so that it can also be built on a host */
+#include <wolfssl/wolfcrypt/settings.h>
+#include <wolfssl/wolfcrypt/memory.h>
+
+#include "session_arena.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* as the C library malloc guarantees */
+#define ARENA_ALIGN  (2 * sizeof(void*))
+#define ARENA_NONE   0xFFFFFFFFu
+#define ARENA_FREE   1u
+
+/* in front of every block; a block's payload follows its header */
+typedef struct ArenaBlock {
+    uint32_t size; /* payload bytes, a multiple of ARENA_ALIGN; ARENA_FREE
+                    * is set in bit 0 while the block is free */
+    uint32_t prev; /* offset of the block before, ARENA_NONE for the first */
+} ArenaBlock;
+
+#define ARENA_ROUND(n) \
+    ((uint32_t)(((n) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1)))
+#define ARENA_HDR_SZ   ARENA_ROUND((uint32_t)sizeof(ArenaBlock))
+
+#define ARENA_BLOCK(arena, off) ((ArenaBlock*)((arena)->buf + (off)))
+#define ARENA_SIZE(block)       ((block)->size & ~ARENA_FREE)
+
+static _Atomic(SessionArena*) arenas[SESSION_ARENA_MAX];
+
+/* the arena of the calling thread, NULL to use the heap */
+static _Thread_local SessionArena* currentArena = NULL;
+
+#ifdef WOLFSSL_DEBUG_MEMORY
+    #define ARENA_DEBUG_PARAMS , const char* func, unsigned int line
+    #define ARENA_DEBUG_ARGS   , func, line
+#else
+    #define ARENA_DEBUG_PARAMS
+    #define ARENA_DEBUG_ARGS
+#endif
+
+/* the allocators in place before install, NULL for the C library */
+static wolfSSL_Malloc_cb  heapMalloc  = NULL;
+static wolfSSL_Free_cb    heapFree    = NULL;
+static wolfSSL_Realloc_cb heapRealloc = NULL;
+
+
+static SessionArena* arena_owner(const void* ptr)
+{
+    const uint8_t* p = (const uint8_t*)ptr;
+    SessionArena* arena;
+    int i;
+
+    for (i = 0; i < SESSION_ARENA_MAX; i++) {
+        arena = atomic_load_explicit(&arenas[i], memory_order_acquire);
+        if ((arena != NULL) && (p >= arena->buf) &&
+            (p < arena->buf + arena->size)) {
+            return arena;
+        }
+    }
+
+    return NULL;
+}
+
+/* the block that starts at offset [off], or NULL past the last one */
+static ArenaBlock* arena_next(SessionArena* arena, uint32_t off)
+{
+    off += ARENA_HDR_SZ + ARENA_SIZE(ARENA_BLOCK(arena, off));
+
+    return (off < arena->top) ? ARENA_BLOCK(arena, off) : NULL;
+}
+
+static void* arena_alloc(SessionArena* arena, size_t sz)
+{
+    ArenaBlock* block;
+    ArenaBlock* next;
+    uint32_t need;
+    uint32_t off;
+    uint32_t rest;
+
+    if (sz > arena->size) {
+        return NULL;
+    }
+    need = ARENA_ROUND((uint32_t)(sz > 0 ? sz : 1));
+
+    if (arena->size - arena->top >= ARENA_HDR_SZ + need) {
+        /* the common case: on top of the stack */
+        off = arena->top;
+        block = ARENA_BLOCK(arena, off);
+        block->size = need;
+        block->prev = arena->last;
+        arena->last = off;
+        arena->top = off + ARENA_HDR_SZ + need;
+        if (arena->top > arena->peak) {
+            arena->peak = arena->top;
+        }
+    }
+    else {
+        /* the top is full: first fit among the freed blocks below it */
+        for (off = 0; off < arena->top;
+             off += ARENA_HDR_SZ + ARENA_SIZE(block)) {
+            block = ARENA_BLOCK(arena, off);
+            if ((block->size & ARENA_FREE) && (ARENA_SIZE(block) >= need)) {
+                break;
+            }
+        }
+        if (off >= arena->top) {
+            return NULL;
+        }
+
+        rest = ARENA_SIZE(block) - need;
+        if (rest > ARENA_HDR_SZ) {
+            /* split off the remainder as a free block of its own */
+            next = ARENA_BLOCK(arena, off + ARENA_HDR_SZ + need);
+            next->size = (rest - ARENA_HDR_SZ) | ARENA_FREE;
+            next->prev = off;
+            block->size = need;
+            block = arena_next(arena, off + ARENA_HDR_SZ + need);
+            if (block != NULL) {
+                block->prev = off + ARENA_HDR_SZ + need;
+            }
+            block = ARENA_BLOCK(arena, off);
+        }
+        else {
+            block->size &= ~ARENA_FREE;
+        }
+    }
+
+    arena->live++;
+    arena->allocs++;
+
+    return (uint8_t*)block + ARENA_HDR_SZ;
+}
+
+static void arena_free(SessionArena* arena, void* ptr)
+{
+    uint32_t off = (uint32_t)((uint8_t*)ptr - arena->buf) - ARENA_HDR_SZ;
+    ArenaBlock* block = ARENA_BLOCK(arena, off);
+    ArenaBlock* other;
+
+    block->size |= ARENA_FREE;
+    arena->live--;
+
+    /* merge with a free block after it. The last block is never free, so
+     * that one cannot be the last. */
+    other = arena_next(arena, off);
+    if ((other != NULL) && (other->size & ARENA_FREE)) {
+        block->size += ARENA_HDR_SZ + ARENA_SIZE(other);
+        other = arena_next(arena, off);
+        if (other != NULL) {
+            other->prev = off;
+        }
+    }
+
+    /* and with a free block before it */
+    if (block->prev != ARENA_NONE) {
+        other = ARENA_BLOCK(arena, block->prev);
+        if (other->size & ARENA_FREE) {
+            if (off == arena->last) {
+                arena->last = block->prev;
+            }
+            other->size += ARENA_HDR_SZ + ARENA_SIZE(block);
+            off = block->prev;
+            block = other;
+            other = arena_next(arena, off);
+            if (other != NULL) {
+                other->prev = off;
+            }
+        }
+    }
+
+    /* the last block is now free: the top rolls back over it. The block
+     * before it is in use, or it would have been merged above. */
+    if (off == arena->last) {
+        arena->top = off;
+        arena->last = block->prev;
+    }
+}
+
+/* grow or shrink a block in place, when it is the last one */
+static int arena_resize(SessionArena* arena, void* ptr, size_t sz)
+{
+    uint32_t off = (uint32_t)((uint8_t*)ptr - arena->buf) - ARENA_HDR_SZ;
+    ArenaBlock* block = ARENA_BLOCK(arena, off);
+    uint32_t need;
+
+    if (sz > arena->size) {
+        return 0;
+    }
+    need = ARENA_ROUND((uint32_t)(sz > 0 ? sz : 1));
+
+    if (need <= ARENA_SIZE(block)) {
+        return 1;
+    }
+    if ((off != arena->last) ||
+        (arena->size - off - ARENA_HDR_SZ < need)) {
+        return 0;
+    }
+
+    block->size = need;
+    arena->top = off + ARENA_HDR_SZ + need;
+    if (arena->top > arena->peak) {
+        arena->peak = arena->top;
+    }
+
+    return 1;
+}
+
+
+/* a block of [arena] freed by a thread not bound to it: queue it for the
+ * bound thread, which alone changes the arena */
+static void arena_free_foreign(SessionArena* arena, void* ptr)
+{
+    void* head = atomic_load_explicit(&arena->foreign, memory_order_relaxed);
+
+    do {
+        *(void**)ptr = head;
+    } while (!atomic_compare_exchange_weak_explicit(&arena->foreign, &head,
+                                                    ptr,
+                                                    memory_order_release,
+                                                    memory_order_relaxed));
+}
+
+/* by the bound thread: free the blocks other threads have queued */
+static void arena_drain(SessionArena* arena)
+{
+    void* ptr;
+    void* next;
+
+    if (atomic_load_explicit(&arena->foreign, memory_order_relaxed) != NULL) {
+        ptr = atomic_exchange_explicit(&arena->foreign, NULL,
+                                       memory_order_acquire);
+        while (ptr != NULL) {
+            next = *(void**)ptr;
+            arena_free(arena, ptr);
+            ptr = next;
+        }
+    }
+}
+
+
+static void* heap_malloc(size_t sz ARENA_DEBUG_PARAMS)
+{
+    return (heapMalloc != NULL) ? heapMalloc(sz ARENA_DEBUG_ARGS) : malloc(sz);
+}
+
+static void heap_free(void* ptr ARENA_DEBUG_PARAMS)
+{
+    if (heapFree != NULL) {
+        heapFree(ptr ARENA_DEBUG_ARGS);
+    }
+    else {
+        free(ptr);
+    }
+}
+
+static void* session_arena_malloc(size_t sz ARENA_DEBUG_PARAMS)
+{
+    SessionArena* arena = currentArena;
+    void* ptr = NULL;
+
+    if (arena != NULL) {
+        arena_drain(arena);
+        ptr = arena_alloc(arena, sz);
+        if (ptr == NULL) {
+            arena->fallbacks++;
+        }
+    }
+    if (ptr == NULL) {
+        ptr = heap_malloc(sz ARENA_DEBUG_ARGS);
+    }
+
+    return ptr;
+}
+
+static void session_arena_free(void* ptr ARENA_DEBUG_PARAMS)
+{
+    SessionArena* arena;
+
+    if (ptr != NULL) {
+        arena = arena_owner(ptr);
+        if ((arena != NULL) && (arena == currentArena)) {
+            arena_free(arena, ptr);
+        }
+        else if (arena != NULL) {
+            arena_free_foreign(arena, ptr);
+        }
+        else {
+            heap_free(ptr ARENA_DEBUG_ARGS);
+        }
+    }
+}
+
+static void* session_arena_realloc(void* ptr, size_t sz ARENA_DEBUG_PARAMS)
+{
+    SessionArena* arena;
+    ArenaBlock* block;
+    void* moved;
+
+    if (ptr == NULL) {
+        return session_arena_malloc(sz ARENA_DEBUG_ARGS);
+    }
+
+    arena = arena_owner(ptr);
+    if (arena == NULL) {
+        /* a heap block stays on the heap */
+        return (heapRealloc != NULL) ? heapRealloc(ptr, sz ARENA_DEBUG_ARGS) :
+                                       realloc(ptr, sz);
+    }
+
+    /* only the bound thread may grow a block in place */
+    if ((arena == currentArena) && arena_resize(arena, ptr, sz)) {
+        return ptr;
+    }
+
+    moved = session_arena_malloc(sz ARENA_DEBUG_ARGS);
+    if (moved != NULL) {
+        block = (ArenaBlock*)((uint8_t*)ptr - ARENA_HDR_SZ);
+        memcpy(moved, ptr, ARENA_SIZE(block) < sz ? ARENA_SIZE(block) : sz);
+        if (arena == currentArena) {
+            arena_free(arena, ptr);
+        }
+        else {
+            arena_free_foreign(arena, ptr);
+        }
+    }
+
+    return moved;
+}
+
+
+int session_arena_install(void)
+{
+    static int installed = 0;
+    int ret = 0;
+
+#if defined(USE_WOLFSSL_MEMORY) && !defined(WOLFSSL_STATIC_MEMORY)
+    if (!installed) {
+        ret = wolfSSL_GetAllocators(&heapMalloc, &heapFree, &heapRealloc);
+        if (ret == 0) {
+            ret = wolfSSL_SetAllocators(session_arena_malloc,
+                                        session_arena_free,
+                                        session_arena_realloc);
+        }
+        installed = (ret == 0);
+    }
+#else
+    /* wolfSSL static memory or no allocator hooks: nothing to hook */
+    (void)installed;
+    ret = -1;
+#endif
+
+    return ret;
+}
+
+int session_arena_init(SessionArena* arena, uint8_t* storage, uint32_t size)
+{
+    uint32_t pad;
+    SessionArena* empty;
+    int i;
+
+    if ((arena == NULL) || (storage == NULL)) {
+        return 1;
+    }
+
+    pad = (uint32_t)(-(uintptr_t)storage & (ARENA_ALIGN - 1));
+    if (size < pad + ARENA_HDR_SZ + ARENA_ALIGN) {
+        return 1;
+    }
+
+    memset(arena, 0, sizeof(*arena));
+    arena->buf  = storage + pad;
+    arena->size = (size - pad) & ~(uint32_t)(ARENA_ALIGN - 1);
+    arena->last = ARENA_NONE;
+    atomic_init(&arena->foreign, NULL);
+
+    for (i = 0; i < SESSION_ARENA_MAX; i++) {
+        empty = NULL;
+        if (atomic_compare_exchange_strong(&arenas[i], &empty, arena)) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+void session_arena_deinit(SessionArena* arena)
+{
+    SessionArena* expected;
+    int i;
+
+    for (i = 0; i < SESSION_ARENA_MAX; i++) {
+        expected = arena;
+        atomic_compare_exchange_strong(&arenas[i], &expected, NULL);
+    }
+}
+
+SessionArena* session_arena_enter(SessionArena* arena)
+{
+    SessionArena* prev = currentArena;
+
+    currentArena = arena;
+    return prev;
+}
+
+uint32_t session_arena_release(SessionArena* arena)
+{
+    arena_drain(arena);
+
+    if (arena->live == 0) {
+        /* O(1), whatever was allocated */
+        arena->top  = 0;
+        arena->last = ARENA_NONE;
+    }
+
+    arena->peak      = arena->top;
+    arena->allocs    = 0;
+    arena->fallbacks = 0;
+
+    return arena->live;
+}
@@ -0,0 +1,178 @@
+/* ssh_metrics.c
+ *
+ * Copyright (C) 2014-2024 wolfSSL Inc.
+ *
+ * This file is part of wolfSSH.
+ *
+ * wolfSSH is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfSSH is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wolfSSH.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This file has no RTOS dependencies so that it can also be built on a host */
+#include "ssh_metrics.h"
+
+#include <stdio.h>
+#include <string.h>
+
+SshMetrics ssh_metrics;
+
+static const char* const metricNames[SSH_METRIC_COUNT] = {
+    "uart_events",
+    "uart_rx_bytes",
+    "uart_rx_dropped",
+    "uart_fifo_overflows",
+    "uart_buffer_full",
+    "uart_pattern_detect",
+    "uart_frame_errors",
+    "uart_parity_errors",
+    "uart_breaks",
+    "uart_flow_pauses",
+    "uart_line_changes",
+    "uart_tx_bytes",
+    "uart_tx_writes",
+    "sessions",
+    "handshake_failures",
+    "ssh_rx_bytes",
+    "ssh_rx_reads",
+    "ssh_tx_bytes",
+    "ssh_tx_packets",
+    "rx_dropped",
+    "rx_held",
+    "tx_skipped",
+    "lock_busy",
+    "arena_fallbacks",
+    "arena_pinned",
+    "sessions_rejected",
+    "rx_ring_peak",
+};
+
+static const char* const histNames[SSH_HIST_COUNT] = {
+    "hs_version_us",
+    "hs_kexinit_us",
+    "hs_kexdh_us",
+    "hs_newkeys_us",
+    "hs_userauth_us",
+    "hs_total_us",
+    "keystroke_rtt_us",
+    "uart_rx_latency_us",
+};
+
+void ssh_metrics_reset(SshMetrics* m)
+{
+    int i;
+    int b;
+
+    for (i = 0; i < SSH_METRIC_COUNT; i++) {
+        atomic_store_explicit(&m->counter[i], 0, memory_order_relaxed);
+    }
+    for (i = 0; i < SSH_HIST_COUNT; i++) {
+        for (b = 0; b < SSH_HIST_BUCKETS; b++) {
+            atomic_store_explicit(&m->bucket[i][b], 0, memory_order_relaxed);
+        }
+        atomic_store_explicit(&m->max[i], 0, memory_order_relaxed);
+    }
+}
+
+void ssh_metrics_merge(SshMetrics* into, SshMetrics* from)
+{
+    uint32_t v;
+    int i;
+    int b;
+
+    for (i = 0; i < SSH_METRIC_COUNT; i++) {
+        v = atomic_load_explicit(&from->counter[i], memory_order_relaxed);
+        if (v != 0) {
+            atomic_fetch_add_explicit(&into->counter[i], v,
+                                      memory_order_relaxed);
+        }
+    }
+    for (i = 0; i < SSH_HIST_COUNT; i++) {
+        for (b = 0; b < SSH_HIST_BUCKETS; b++) {
+            v = atomic_load_explicit(&from->bucket[i][b],
+                                     memory_order_relaxed);
+            if (v != 0) {
+                atomic_fetch_add_explicit(&into->bucket[i][b], v,
+                                          memory_order_relaxed);
+            }
+        }
+
+        ssh_max_shared(&into->max[i],
+                       atomic_load_explicit(&from->max[i],
+                                            memory_order_relaxed));
+    }
+}
+
+/* upper bound of the bucket holding the pct percentile of [bucket] */
+static uint32_t hist_pct(const uint32_t* bucket, uint32_t count, int pct)
+{
+    uint32_t rank = (uint32_t)(((uint64_t)count * pct + 99) / 100);
+    uint32_t seen = 0;
+    int b;
+
+    for (b = 0; b < SSH_HIST_BUCKETS - 1; b++) {
+        seen += bucket[b];
+        if (seen >= rank) {
+            break;
+        }
+    }
+
+    return (uint32_t)1 << b;
+}
+
+int ssh_metrics_format(SshMetrics* m, char* buf, int bufSz)
+{
+    uint32_t bucket[SSH_HIST_BUCKETS];
+    uint32_t count;
+    uint32_t v;
+    int pos = 0;
+    int i;
+    int b;
+
+    if ((buf == NULL) || (bufSz <= 0)) {
+        return 0;
+    }
+    buf[0] = '\0';
+
+    for (i = 0; (i < SSH_METRIC_COUNT) && (pos < bufSz); i++) {
+        v = atomic_load_explicit(&m->counter[i], memory_order_relaxed);
+        if (v != 0) {
+            pos += snprintf(buf + pos, bufSz - pos, "  %s = %u\r\n",
+                            metricNames[i], (unsigned)v);
+        }
+    }
+
+    for (i = 0; (i < SSH_HIST_COUNT) && (pos < bufSz); i++) {
+        count = 0;
+        for (b = 0; b < SSH_HIST_BUCKETS; b++) {
+            bucket[b] = atomic_load_explicit(&m->bucket[i][b],
+                                             memory_order_relaxed);
+            count += bucket[b];
+        }
+        if (count == 0) {
+            continue;
+        }
+
+        /* percentiles to within a factor of two; the max is exact */
+        pos += snprintf(buf + pos, bufSz - pos,
+                        "  %s: n = %u, p50 < %u, p90 < %u, p99 < %u,"
+                        " max = %u\r\n",
+                        histNames[i], (unsigned)count,
+                        (unsigned)hist_pct(bucket, count, 50),
+                        (unsigned)hist_pct(bucket, count, 90),
+                        (unsigned)hist_pct(bucket, count, 99),
+                        (unsigned)atomic_load_explicit(&m->max[i],
+                                                       memory_order_relaxed));
+    }
+
+    return (pos < bufSz) ? pos : bufSz - 1;
+}
@@ -24,10 +24,13 @@
 #ifndef WOLFSSL_USER_SETTINGS
     #error "WOLFSSL_USER_SETTINGS should have been defined in project cmake"
 #endif
-#include <wolfssl/wolfcrypt/port/Espressif/esp32-crypt.h>
+#ifdef ESP_PLATFORM
+    #include <wolfssl/wolfcrypt/port/Espressif/esp32-crypt.h>
+#endif
 #include <wolfssl/wolfcrypt/types.h>
 #include <wolfssl/wolfcrypt/logging.h>
-#ifndef WOLFSSL_ESPIDF
+/* the host build (see ../host) uses the make-testsuite user_settings.h */
+#if defined(ESP_PLATFORM) && !defined(WOLFSSL_ESPIDF)
     #error "Problem with wolfSSL user_settings."
     #error "Check [project]/components/wolfssl/include"
 #endif
@@ -36,28 +39,56 @@
 #include <wolfssl/ssl.h>
 #include <wolfssl/wolfcrypt/ecc.h>
 #include <wolfssl/wolfcrypt/logging.h>
-#include <wolfssl/wolfcrypt/coding.h>
 #include <wolfssl/wolfcrypt/sha256.h>
+#include <wolfssl/wolfcrypt/random.h>
+#ifdef HAVE_CURVE25519
+    #include <wolfssl/wolfcrypt/curve25519.h>
+#endif
 
 /* wolfSSH */
 #include <wolfssh/ssh.h>
+#include <wolfssh/internal.h> /* clientState, for handshake phase timing */
 #include <wolfssh/test.h>
+#include <wolfssh/version.h>
 
 /* Espressif */
 #include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_task_wdt.h>
+#ifdef ESP_PLATFORM
+    #include <esp_heap_caps.h>
+#endif
+
+/* POSIX */
+#include <errno.h>
+#include <sys/select.h>
 
 /* Project */
 #include "ssh_server_config.h"
 #include "ssh_server.h"
 #include "tx_rx_buffer.h"
+#include "credential_store.h"
+#include "authorized_keys.h"
+#include "session_arena.h"
+#include "ssh_trace.h"
+#include "ssh_metrics.h"
+#include "escape_scan.h"
 
 
-/* note our actual buffer is used by RTOS threads, and eventually interrupts */
-static volatile byte sshStreamTransmitBufferArray[EXT_TX_BUF_MAX_SZ];
-static volatile byte sshStreamReceiveBufferArray[EXT_RX_BUF_MAX_SZ];
-
 static const char* TAG = "ssh_server";
 
+/* sent as plain text ahead of the SSH version string when the pool is full;
+ * SSH clients may display lines that precede the version string */
+#define SSH_SERVER_BUSY_MESSAGE "Server busy: all sessions are in use.\r\n"
+
+#define SSH_SERVER_UART_BUSY_MESSAGE "\r\nViewing the UART read-only; "      \
+                                     "another session is typing.\r\n"       \
+                                     "Press [Enter] to take over once it "   \
+                                     "leaves, Ctrl-C to exit.\r\n"
+
+#define SSH_SERVER_UART_RAW_BUSY_MESSAGE "UART busy: another session is " \
+                                         "typing.\r\n"
+
 static const char samplePasswordBuffer[] =
     "jill:upthehill\n"
     "jack:fetchapail\n";
@@ -89,140 +120,282 @@ static const char samplePublicKeyRsaBuffer[] =
     "biE57dK6BrH5iZwVLTQKux31uCJLPhiktI3iLbdlGZEctJkTasfVSsUizwVIyRjhVKmbdI"
     "RGwkU38D043AR1h0mUoGCPIKuqcFMf gretel\n";
 
-/* #define SSH_SERVER_PROFILE */
-
-#ifdef SSH_SERVER_PROFILE
-    static int MaxSeenRxSize = 0;
-    static int MaxSeenTxSize = 0;
-#endif
-
 /* Show HW lockdepth. Oddities here are often a symptom of stack overflow. */
 #if !defined(NO_WOLFSSL_ESP32_CRYPT_HASH) && \
      defined(WOLFSSL_ESP32_HW_LOCK_DEBUG)
     #define SSH_SERVER_DEBUG_LOCKDEPTH
 #endif
-/* Map user names to passwords */
-/* Use arrays for username and p. The password or public key can
- * be hashed and the hash stored here. Then I won't need the type. */
-typedef struct PwMap {
-    byte type;
-    byte username[32];
-    word32 usernameSz;
-    byte p[WC_SHA256_DIGEST_SIZE];
-    struct PwMap* next;
-} PwMap;
+/* large enough to replay the scrollback with a single send */
+#if SSH_SERVER_SCROLLBACK_REPLAY_SZ > EXT_TX_BUF_MAX_SZ
+    #define SESSION_TX_BUF_SZ SSH_SERVER_SCROLLBACK_REPLAY_SZ
+#else
+    #define SESSION_TX_BUF_SZ EXT_TX_BUF_MAX_SZ
+#endif
 
+#if defined(SSH_SERVER_SESSION_ARENA_SZ) && \
+    (SSH_SERVER_MAX_SESSIONS > SESSION_ARENA_MAX)
+    #error "SSH_SERVER_MAX_SESSIONS exceeds SESSION_ARENA_MAX"
+#endif
+
+/* older wolfSSH can only use its build time DEFAULT_WINDOW_SZ, and
+ * cannot tell us the command of an exec session */
+#if defined(LIBWOLFSSH_VERSION_HEX) && (LIBWOLFSSH_VERSION_HEX >= 0x01004015)
+    #define SSH_SERVER_HAVE_WINDOW_SZ
+    #define SSH_SERVER_HAVE_EXEC
+#endif
 
-typedef struct PwMapList {
-    PwMap* head;
-} PwMapList;
+#if (SSH_SERVER_COALESCE_MAX_SZ > EXT_TX_BUF_MAX_SZ)
+    #error "SSH_SERVER_COALESCE_MAX_SZ cannot exceed EXT_TX_BUF_MAX_SZ"
+#endif
 
+/* free heap the adaptive window leaves for everything else */
+#define SESSION_WINDOW_HEAP_RESERVE (16 * 1024)
 
+/* One slot of the session pool. All slots are allocated at build time;
+ * each keeps a WOLFSSH object ready for its next client. */
 typedef struct {
     WOLFSSH* ssh;
     int fd;
     word32 id;
     char nonBlock;
+    char uartOwner;            /* this session holds the UART write lock */
+    char uartSwitch;           /* Ctrl-] was typed: move on to the next UART */
+    char uartAutobaud;         /* Ctrl-B was typed: find the UART baud rate */
+    char raw;                  /* exec "raw": a binary pipe to the UART */
+    volatile char inUse;       /* set by the accept loop, cleared by the slot */
+    int port;                  /* the UART viewed, see SSH_SERVER_UART_ROUTES */
+    int rxSwitchSz;            /* typed after Ctrl-], kept for the next UART */
+
+    word32 windowSz;           /* channel window offered to this session */
+
+    word32 txPending;          /* UART output held back in txBuf */
+    int txBlocked;             /* why the client cannot take it yet, or 0 */
+    int64_t txDeadline;        /* esp_timer time it must be sent by */
+    int64_t keyTime;           /* when a keystroke awaiting a reply came */
+
+    /* this session only; added to ssh_metrics as it ends */
+    SshMetrics metrics;
+
+    WOLFSSH_CTX* ctx;          /* used to replace ssh after each session */
+    void* authCtx;
+
+    /* our actual buffers are not on the task stack, to keep the
+     * RTOS stack requirements down */
+    byte rxBuf[EXT_RX_BUF_MAX_SZ];
+    byte txBuf[SESSION_TX_BUF_SZ];
+
+    /* every session views the UART output through its own cursor */
+    ExternalTransmitReader uartReader;
+    int uartNotifyFd;
+
+#ifdef SSH_SERVER_SESSION_ARENA_SZ
+    /* everything wolfSSH allocates for this slot */
+    SessionArena arena;
+    byte arenaBuf[SSH_SERVER_SESSION_ARENA_SZ];
+#endif
+
+    TaskHandle_t task;
+    StaticTask_t taskBuffer;
+    StackType_t  stack[SSH_SERVER_SESSION_STACK_SZ];
 } thread_ctx_t;
 
+static thread_ctx_t sessionPool[SSH_SERVER_MAX_SESSIONS];
 
-/* find a byte character [str] of length [bufSz] within [buf];
- * returns byte position if found, otherwise zero
- */
-static byte find_char(const byte* str, const byte* buf, word32 bufSz)
+
+/* the control characters a client types to the server itself:
+ * Ctrl-C exits, Ctrl-E shows statistics, Ctrl-F rekeys, Ctrl-B finds the
+ * baud rate of the device, and with more than one UART, Ctrl-] moves on to
+ * the next */
+#if (SSH_SERVER_UART_PORTS > 1)
+    #define SESSION_ESCAPE_SWITCH ESCAPE_BIT(0x1d)
+#else
+    #define SESSION_ESCAPE_SWITCH 0
+#endif
+#define SESSION_ESCAPES (ESCAPE_BIT(0x02) | ESCAPE_BIT(0x03) | \
+                         ESCAPE_BIT(0x05) | ESCAPE_BIT(0x06) | \
+                         SESSION_ESCAPE_SWITCH)
+
+
+/* send [title] and the values of [m] to the client, a line at a time */
+static int send_metrics(thread_ctx_t* ctx, const char* title, SshMetrics* m)
 {
-    int ret = 0;
-    const byte* cur;
-    while (bufSz && (ret == 0) && (ret < 255)) {
-        cur = str;
-        while (*cur != '\0') {
-            if (*cur == *buf) {
-                ret = *cur;
-            }
-            cur++;
-        }
-        buf++;
-        bufSz--;
-    }
-    if (ret == 255) {
-        ESP_LOGE(TAG, "find_char not found in 254 chars");
-    }
+    char stats[1536];
+    int statsSz;
 
-    return ret;
-}
+    statsSz = WSNPRINTF(stats, sizeof(stats), "%s\r\n", title);
+    statsSz += ssh_metrics_format(m, stats + statsSz,
+                                  (int)sizeof(stats) - statsSz);
 
+    fprintf(stderr, "%s", stats);
+    return wolfSSH_stream_send(ctx->ssh, (byte*)stats, (word32)statsSz);
+}
 
 static int dump_stats(thread_ctx_t* ctx)
 {
     ESP_LOGE(TAG,"dumpstats");
-    char stats[1024];
+    char stats[256];
     word32 statsSz;
     word32 txCount, rxCount, seq, peerSeq;
+    word32 txBytes, txPackets;
+    int ret;
 
     wolfSSH_GetStats(ctx->ssh, &txCount, &rxCount, &seq, &peerSeq);
+    txBytes = ssh_metric_get(&ctx->metrics, SSH_METRIC_SSH_TX_BYTES);
+    txPackets = ssh_metric_get(&ctx->metrics, SSH_METRIC_SSH_TX_PACKETS);
 
     WSNPRINTF(stats,
         sizeof(stats),
         "Statistics for Thread #%u:\r\n"
         "  txCount = %u\r\n  rxCount = %u\r\n"
-        "  seq = %u\r\n  peerSeq = %u\r\n",
+        "  seq = %u\r\n  peerSeq = %u\r\n"
+        "  bytesPerPacket = %u\r\n",
         ctx->id,
         txCount,
         rxCount,
         seq,
-        peerSeq);
+        peerSeq,
+        txPackets ? txBytes / txPackets : 0);
     statsSz = (word32)strlen(stats);
 
     fprintf(stderr, "%s", stats);
-    return wolfSSH_stream_send(ctx->ssh, (byte*)stats, statsSz);
+    ret = wolfSSH_stream_send(ctx->ssh, (byte*)stats, statsSz);
+    if (ret > 0) {
+        ret = send_metrics(ctx, "This session:", &ctx->metrics);
+    }
+    if (ret > 0) {
+        /* sessions still open are not in it yet */
+        ret = send_metrics(ctx, "Since boot, ended sessions:", &ssh_metrics);
+    }
+
+    return ret;
+}
+
+/* handshake phases timed by NonBlockSSH_accept, in the order they complete,
+ * with the wolfSSH clientState reached at the end of each */
+static const struct {
+    byte        clientState;
+    const char* name;
+    SshHistId   hist;
+} acceptPhases[] = {
+    { CLIENT_VERSION_DONE,    "version",  SSH_HIST_HS_VERSION  },
+    { CLIENT_KEXINIT_DONE,    "KEXINIT",  SSH_HIST_HS_KEXINIT  },
+    { CLIENT_KEXDH_INIT_DONE, "KEXDH",    SSH_HIST_HS_KEXDH    },
+    { CLIENT_USING_KEYS,      "NEWKEYS",  SSH_HIST_HS_NEWKEYS  },
+    { CLIENT_USERAUTH_DONE,   "userauth", SSH_HIST_HS_USERAUTH },
+};
+#define ACCEPT_PHASE_COUNT \
+    ((int)(sizeof(acceptPhases) / sizeof(acceptPhases[0])))
+
+/* log how long each handshake phase took, from the times it completed,
+ * and add the completed phases to the session histograms */
+static void accept_phase_report(thread_ctx_t* threadCtx, int64_t start,
+                                const int64_t* done, int phases)
+{
+    char report[160];
+    int64_t prev = start;
+    int pos;
+    int i;
+
+    pos = WSNPRINTF(report, sizeof(report), "Handshake #%u:", threadCtx->id);
+    for (i = 0; (i < ACCEPT_PHASE_COUNT) && (pos < (int)sizeof(report)); i++) {
+        if (i < phases) {
+            ssh_hist_record(&threadCtx->metrics, acceptPhases[i].hist,
+                            (uint32_t)(done[i] - prev));
+            pos += WSNPRINTF(report + pos, sizeof(report) - pos, " %s %d ms,",
+                             acceptPhases[i].name,
+                             (int)((done[i] - prev) / 1000));
+            prev = done[i];
+        }
+        else {
+            pos += WSNPRINTF(report + pos, sizeof(report) - pos, " %s -,",
+                             acceptPhases[i].name);
+        }
+    }
+    if (pos < (int)sizeof(report)) {
+        WSNPRINTF(report + pos, sizeof(report) - pos, " total %d ms",
+                  (int)((esp_timer_get_time() - start) / 1000));
+    }
+    ESP_LOGI(TAG, "%s", report);
 }
 
-static int NonBlockSSH_accept(WOLFSSH* ssh)
+/*
+ * Drive wolfSSH_accept on a non-blocking socket. Each time wolfSSH needs
+ * more data, or room to write, we sleep in select() until the socket is
+ * ready, so every round trip costs only the network time. The handshake,
+ * including the user typing a password, must finish within
+ * SSH_SERVER_ACCEPT_TIMEOUT_MS.
+ */
+static int NonBlockSSH_accept(thread_ctx_t* threadCtx)
 {
+    WOLFSSH* ssh = threadCtx->ssh;
+    int sockfd = threadCtx->fd;
+    int64_t start = esp_timer_get_time();
+    int64_t deadline = start + (int64_t)SSH_SERVER_ACCEPT_TIMEOUT_MS * 1000;
+    int64_t done[ACCEPT_PHASE_COUNT];
+    int64_t now;
+    int phases = 0;
     int ret;
     int error;
-    int sockfd;
-    int select_ret = 0;
-    int max_wait = 100;
+
     ESP_LOGI(TAG,"Start NonBlockSSH_accept");
 
-    ret = wolfSSH_accept(ssh);
-    error = wolfSSH_get_error(ssh);
-    sockfd = (int)wolfSSH_get_fd(ssh);
+    for (;;) {
+        fd_set fds;
+        struct timeval tv;
+        int64_t wait;
+        int select_ret;
 
-    while (ret != WS_SUCCESS &&
-            (error == WS_WANT_READ || error == WS_WANT_WRITE)) {
+        ret = wolfSSH_accept(ssh);
+        error = wolfSSH_get_error(ssh);
+        now = esp_timer_get_time();
 
-        max_wait--;
-        if (max_wait < 0) {
-            error = WS_FATAL_ERROR;
+        /* note every phase completed by this call */
+        while ((phases < ACCEPT_PHASE_COUNT) &&
+               (ssh->clientState >= acceptPhases[phases].clientState)) {
+            done[phases++] = now;
         }
-#if (0)
-        /* Some optional debugging verbosity: */
-        if (error == WS_WANT_READ)
-            ESP_LOGE(TAG,"... client would read block\n");
-        else if (error == WS_WANT_WRITE)
-            ESP_LOGE(TAG,"... client would write block\n");
-#endif
-        select_ret = tcp_select(sockfd, 1);
-        if (select_ret == WS_SELECT_RECV_READY  ||
-            select_ret == WS_SELECT_ERROR_READY ||
-            error == WS_WANT_WRITE) {
-            ret = wolfSSH_accept(ssh);
-            error = wolfSSH_get_error(ssh);
-        }
-        else if (select_ret == WS_SELECT_TIMEOUT)
-            error = WS_WANT_READ;
-        else
-            error = WS_FATAL_ERROR;
-
-        /* RTOS yield */
-        vTaskDelay(100 / portTICK_PERIOD_MS);
-        #ifdef SSH_SERVER_WDT_RESET
-        {
-            esp_task_wdt_reset();
+
+        if ((ret == WS_SUCCESS) ||
+            (error != WS_WANT_READ && error != WS_WANT_WRITE)) {
+            break;
         }
-        #endif
+
+        if (now >= deadline) {
+            ESP_LOGE(TAG, "Handshake #%u timed out after %d ms.",
+                          threadCtx->id, SSH_SERVER_ACCEPT_TIMEOUT_MS);
+            ret = WS_FATAL_ERROR;
+            break;
+        }
+
+        wait = deadline - now;
+    #ifdef SSH_SERVER_WDT_RESET
+        /* wake up at least once a second, only to feed the watchdog */
+        if (wait > 1000000) {
+            wait = 1000000;
+        }
+        esp_task_wdt_reset();
+    #endif
+        tv.tv_sec  = (long)(wait / 1000000);
+        tv.tv_usec = (long)(wait % 1000000);
+
+        FD_ZERO(&fds);
+        FD_SET(sockfd, &fds);
+        select_ret = select(sockfd + 1,
+                            (error == WS_WANT_READ)  ? &fds : NULL,
+                            (error == WS_WANT_WRITE) ? &fds : NULL,
+                            NULL, &tv);
+        if ((select_ret < 0) && (errno != EINTR)) {
+            ESP_LOGE(TAG, "ERROR: select failed, errno = %d", errno);
+            ret = WS_FATAL_ERROR;
+            break;
+        }
+        /* on timeout, the deadline check above ends the handshake */
+    }
+
+    accept_phase_report(threadCtx, start, done, phases);
+    if (ret == WS_SUCCESS) {
+        ssh_hist_record(&threadCtx->metrics, SSH_HIST_HS_TOTAL,
+                        (uint32_t)(esp_timer_get_time() - start));
     }
     ESP_LOGI(TAG,"Exit NonBlockSSH_accept");
 
@@ -230,12 +403,820 @@ static int NonBlockSSH_accept(WOLFSSH* ssh)
 }
 
 
+/*
+ * Describe the line settings of [port] as e.g. "uart1: 115200 8N1", noting
+ * why when [ret], the result of changing them, is not ESP_OK.
+ * Returns the length written to buf.
+ */
+static int session_line_text(int port, int ret, char* buf, int bufSz)
+{
+    uart_line_t line;
+    int sz;
+
+    sz = WSNPRINTF(buf, bufSz, "%s: ", uart_route_get(port)->name);
+    if (uart_line_get(port, &line) == ESP_OK) {
+        sz += uart_line_format(&line, buf + sz, bufSz - sz);
+    }
+    if (ret == ESP_ERR_NOT_FOUND) {
+        sz += WSNPRINTF(buf + sz, bufSz - sz, ", no rate fit");
+    }
+    else if (ret == ESP_ERR_INVALID_STATE) {
+        sz += WSNPRINTF(buf + sz, bufSz - sz, ", write lock busy");
+    }
+    else if (ret == ESP_ERR_INVALID_ARG) {
+        sz += WSNPRINTF(buf + sz, bufSz - sz,
+                        "; usage: baud [uart] [rate] [8N1] | auto");
+    }
+    else if (ret != ESP_OK) {
+        sz += WSNPRINTF(buf + sz, bufSz - sz, ", unchanged (error %d)", ret);
+    }
+
+    return (sz < bufSz) ? sz : bufSz - 1;
+}
+
+#ifdef SSH_SERVER_HAVE_EXEC
+/*
+ * The UART named by the first word of *args, which is then skipped along
+ * with the spaces around it, else the first UART.
+ */
+static int session_exec_port(const char** args)
+{
+    char name[16];
+    size_t len;
+    int port;
+
+    *args += strspn(*args, " ");
+    len = strcspn(*args, " ");
+    if ((len == 0) || (len >= sizeof(name))) {
+        return 0;
+    }
+
+    memcpy(name, *args, len);
+    name[len] = '\0';
+    port = uart_route_find(name);
+    if (port < 0) {
+        return 0;
+    }
+    *args += len + strspn(*args + len, " ");
+
+    return port;
+}
+
+/*
+ * "baud [uart] [rate] [frame]" shows or changes the line settings of a
+ * UART, e.g. "baud uart2 57600 7E1"; "baud [uart] auto" finds the rate.
+ * A change needs the write lock of the port, like typing to it.
+ * Returns the exit status for the client.
+ */
+static int session_exec_baud(thread_ctx_t* threadCtx, const char* args)
+{
+    char reply[80];
+    uart_line_t line;
+    size_t len;
+    int port = session_exec_port(&args);
+    int ret = ESP_OK;
+
+    if (*args == '\0') {
+        /* only shown */
+    }
+    else if (!ExternalBuffers_Attach(port, (int)threadCtx->id, NULL, 0)) {
+        ssh_metric_add(&threadCtx->metrics, SSH_METRIC_LOCK_BUSY, 1);
+        ret = ESP_ERR_INVALID_STATE;
+    }
+    else {
+        if (strcmp(args, "auto") == 0) {
+            ret = uart_line_autobaud(port, &line);
+        }
+        else {
+            uart_line_get(port, &line);
+            if (uart_line_parse(args, &line) != 0) {
+                ret = ESP_ERR_INVALID_ARG;
+            }
+            else {
+                ret = uart_line_set(port, &line);
+            }
+        }
+        ExternalBuffers_Detach(port, (int)threadCtx->id);
+    }
+
+    len = (size_t)session_line_text(port, ret, reply, sizeof(reply) - 2);
+    memcpy(reply + len, "\r\n", 2);
+    wolfSSH_stream_send(threadCtx->ssh, (byte*)reply, (word32)len + 2);
+
+    return (ret == ESP_OK) ? 0 : 1;
+}
+
+/*
+ * "map [uart] [name]" shows or selects the translation table of what is
+ * typed to a UART, e.g. "map uart2 crlf"; see uart_xlate.h. Selecting one
+ * needs the write lock of the port, like typing to it.
+ * Returns the exit status for the client.
+ */
+static int session_exec_map(thread_ctx_t* threadCtx, const char* args)
+{
+    char reply[80];
+    const UartXlate* map;
+    int port = session_exec_port(&args);
+    int ret = 0;
+    int sz;
+    int i;
+
+    if (*args == '\0') {
+        /* only shown */
+    }
+    else if (!ExternalBuffers_Attach(port, (int)threadCtx->id, NULL, 0)) {
+        ssh_metric_add(&threadCtx->metrics, SSH_METRIC_LOCK_BUSY, 1);
+        ret = ESP_ERR_INVALID_STATE;
+    }
+    else {
+        map = uart_xlate_find(args);
+        if ((map == NULL) || (uart_map_set(port, map) != ESP_OK)) {
+            ret = ESP_ERR_INVALID_ARG;
+        }
+        ExternalBuffers_Detach(port, (int)threadCtx->id);
+    }
+
+    map = uart_map_get(port);
+    sz = WSNPRINTF(reply, sizeof(reply), "%s: map %s",
+                   uart_route_get(port)->name,
+                   (map != NULL) ? map->name : "?");
+    if (ret == ESP_ERR_INVALID_STATE) {
+        sz += WSNPRINTF(reply + sz, sizeof(reply) - sz, ", write lock busy");
+    }
+    else if (ret != 0) {
+        /* the names to choose from */
+        sz += WSNPRINTF(reply + sz, sizeof(reply) - sz, "; try:");
+        for (i = 0; (map = uart_xlate_builtin(i)) != NULL; i++) {
+            sz += WSNPRINTF(reply + sz, sizeof(reply) - sz, " %s", map->name);
+        }
+    }
+    sz += WSNPRINTF(reply + sz, sizeof(reply) - sz, "\r\n");
+    wolfSSH_stream_send(threadCtx->ssh, (byte*)reply, (word32)sz);
+
+    return (ret == 0) ? 0 : 1;
+}
+
+/*
+ * Run the command of an exec session, "ssh -p 22222 user@host stats",
+ * in place of the UART bridge.
+ * Returns the exit status for the client.
+ */
+static int session_exec(thread_ctx_t* threadCtx, const char* command)
+{
+    char title[48];
+    int i;
+
+    ESP_LOGI(TAG, "Session #%u exec: %s", threadCtx->id,
+                  (command != NULL) ? command : "(none)");
+
+    if ((command != NULL) && (strcmp(command, "stats") == 0)) {
+        send_metrics(threadCtx, "Since boot, ended sessions:", &ssh_metrics);
+
+        for (i = 0; i < SSH_SERVER_MAX_SESSIONS; i++) {
+            thread_ctx_t* other = &sessionPool[i];
+
+            if (other->inUse && (other != threadCtx)) {
+                WSNPRINTF(title, sizeof(title), "Session #%u:", other->id);
+                send_metrics(threadCtx, title, &other->metrics);
+            }
+        }
+        return 0;
+    }
+
+    if ((command != NULL) && (strncmp(command, "baud", 4) == 0) &&
+        ((command[4] == ' ') || (command[4] == '\0'))) {
+        return session_exec_baud(threadCtx, command + 4);
+    }
+
+    if ((command != NULL) && (strncmp(command, "map", 3) == 0) &&
+        ((command[3] == ' ') || (command[3] == '\0'))) {
+        return session_exec_map(threadCtx, command + 3);
+    }
+
+    WSNPRINTF(title, sizeof(title),
+              "Unknown command; try: stats, baud, map, raw");
+    wolfSSH_stream_send(threadCtx->ssh, (byte*)title, (word32)strlen(title));
+
+    /* or the name of a UART, see session_uart_port */
+    for (i = 0; i < SSH_SERVER_UART_PORTS; i++) {
+        WSNPRINTF(title, sizeof(title), ", %s", uart_route_get(i)->name);
+        wolfSSH_stream_send(threadCtx->ssh, (byte*)title,
+                            (word32)strlen(title));
+    }
+    wolfSSH_stream_send(threadCtx->ssh, (byte*)"\r\n", 2);
+
+    return 1;
+}
+#endif /* SSH_SERVER_HAVE_EXEC */
+
+/*
+ * The UART port a new session views: the route named by the command or
+ * subsystem the client asked for, else by its user name, else the first.
+ * "raw [uart]" makes the session a binary pipe, see threadCtx->raw.
+ * Returns -1 for a command that names no route, see session_exec.
+ */
+static int session_uart_port(thread_ctx_t* threadCtx)
+{
+    int port;
+#ifdef SSH_SERVER_HAVE_EXEC
+    WS_SessionType type = wolfSSH_GetSessionType(threadCtx->ssh);
+    const char* command;
+
+    if ((type == WOLFSSH_SESSION_EXEC) ||
+        (type == WOLFSSH_SESSION_SUBSYSTEM)) {
+        command = wolfSSH_GetSessionCommand(threadCtx->ssh);
+
+        if ((command != NULL) && (strncmp(command, "raw", 3) == 0) &&
+            ((command[3] == ' ') || (command[3] == '\0'))) {
+            threadCtx->raw = 1;
+            command += 3 + strspn(command + 3, " ");
+            if (*command == '\0') {
+                return 0;
+            }
+        }
+        return uart_route_find(command);
+    }
+#endif
+
+    port = uart_route_find(wolfSSH_GetUsername(threadCtx->ssh));
+
+    return (port >= 0) ? port : 0;
+}
+
+
+/*
+ * Handle rxSz bytes just read from the SSH client into buf + *backlogSz, or
+ * straight into the span reserved in the ring (queued): queue or commit them
+ * for the UART, optionally echo them, and act on the Ctrl-B, Ctrl-C, Ctrl-E
+ * and Ctrl-F control characters.
+ * Ctrl-] ends what goes to this UART: the bytes after it are kept in rxBuf
+ * behind the backlog, threadCtx->rxSwitchSz of them, for server_worker to
+ * hand to the next port once it has switched.
+ * Returns non-zero when the session should stop.
+ */
+static int client_data_received(thread_ctx_t* threadCtx, byte* buf,
+                                int rxSz, int* backlogSz, int queued)
+{
+    byte* data = queued ? buf : buf + *backlogSz;
+    int stop = 0;
+    int txSum = 0;
+    int txSz = 0;
+
+    if (!threadCtx->raw && (SESSION_ESCAPE_SWITCH != 0)) {
+        size_t at = escape_scan(data, (size_t)rxSz, SESSION_ESCAPE_SWITCH);
+
+        if (at < (size_t)rxSz) {
+            /* a queued read has no backlog, nothing is echoed */
+            byte* keep = queued ? threadCtx->rxBuf : data + at;
+
+            threadCtx->rxSwitchSz = rxSz - (int)at - 1;
+            memmove(keep, data + at + 1, (size_t)threadCtx->rxSwitchSz);
+            rxSz = (int)at;
+            threadCtx->uartSwitch = 1;
+        }
+    }
+
+    if (queued) {
+        ExternalReceiveBuffer_Commit(threadCtx->port, rxSz);
+    }
+    else if (threadCtx->uartOwner) {
+        /* Append external data, for something such as UART forwarding.
+         * Returns the bytes accepted; uart_tx_task is notified. */
+        int accepted = Set_ExternalReceiveBuffer(threadCtx->port, data, rxSz);
+
+        if (accepted < rxSz) {
+            ssh_metric_add(&threadCtx->metrics, SSH_METRIC_RX_DROPPED,
+                           (uint32_t)(rxSz - (accepted > 0 ? accepted : 0)));
+        }
+    }
+
+    *backlogSz += rxSz;
+
+    while (*backlogSz != txSum && txSz >= 0 && !stop) {
+        /* we typically do NOT want to re-echo TTY data
+         * but it can be configured to do so by setting
+         * SSH_SERVER_ECHO to a value of 1
+         **/
+        if ((SSH_SERVER_ECHO == 1) && !threadCtx->raw) {
+            txSz = wolfSSH_stream_send(threadCtx->ssh,
+                                       buf + txSum,
+                                       *backlogSz - txSum);
+        }
+        else {
+            txSz = *backlogSz - txSum;
+        }
+
+        if (txSz > 0) {
+            /* every command in a paste, in order; the bytes around them
+             * have been queued for the UART above */
+            const byte* cur = buf + txSum;
+            size_t left = (size_t)txSz;
+            size_t at;
+
+            /* a raw session passes every byte through */
+            while (!stop && !threadCtx->raw &&
+                   (at = escape_scan(cur, left, SESSION_ESCAPES)) < left) {
+                switch (cur[at]) {
+
+                case 0x03:
+                    stop = 1;
+                    break;
+
+                case 0x06:
+                    if (wolfSSH_TriggerKeyExchange(threadCtx->ssh)
+                            != WS_SUCCESS) {
+                        stop = 1;
+                    }
+                    break;
+
+                case 0x05:
+                    if (dump_stats(threadCtx) <= 0) {
+                        stop = 1;
+                    }
+                    break;
+
+                case 0x02:
+                    /* likewise, as it takes a few seconds */
+                    threadCtx->uartAutobaud = 1;
+                    break;
+                }
+
+                cur += at + 1;
+                left -= at + 1;
+            }
+
+            txSum += txSz;
+        }
+        else if (txSz != WS_REKEYING) {
+            stop = 1;
+        }
+    } /* while */
+
+    if (txSum > 0) {
+        /* what is left to echo and what is kept for the next port */
+        memmove(buf, buf + txSum, *backlogSz - txSum +
+                (queued ? 0 : threadCtx->rxSwitchSz));
+    }
+    *backlogSz -= txSum;
+
+    return stop;
+}
+
+
+/*
+ * Try to take the UART write lock for this session.
+ * Returns 1 when this session holds the lock.
+ */
+static int session_attach_uart(thread_ctx_t* threadCtx)
+{
+    if (!threadCtx->uartOwner &&
+        ExternalBuffers_Attach(threadCtx->port, (int)threadCtx->id,
+                               &threadCtx->uartReader, threadCtx->raw)) {
+        threadCtx->uartOwner = 1;
+        ESP_LOGI(TAG, "Session #%u has the write lock of %s.",
+                      threadCtx->id, uart_route_get(threadCtx->port)->name);
+    }
+
+    return threadCtx->uartOwner;
+}
+
+/*
+ * Send the UART output held in txBuf to the client, as one packet where the
+ * window allows. What the client cannot take yet stays at the front of
+ * txBuf and threadCtx->txBlocked says why; nothing is discarded.
+ * Returns non-zero when the session should stop.
+ */
+static int session_flush_uart(thread_ctx_t* threadCtx)
+{
+    int stop = 0;
+    int sent;
+
+    threadCtx->txBlocked = 0;
+
+    while ((threadCtx->txPending > 0) && !threadCtx->txBlocked && !stop) {
+        sent = wolfSSH_stream_send(threadCtx->ssh, threadCtx->txBuf,
+                                   threadCtx->txPending);
+        if (sent > 0) {
+            ssh_metric_add(&threadCtx->metrics, SSH_METRIC_SSH_TX_BYTES,
+                           (uint32_t)sent);
+            ssh_metric_add(&threadCtx->metrics, SSH_METRIC_SSH_TX_PACKETS, 1);
+
+            /* a partial send: keep the tail for the next one */
+            threadCtx->txPending -= (word32)sent;
+            if (threadCtx->txPending > 0) {
+                memmove(threadCtx->txBuf, threadCtx->txBuf + sent,
+                        threadCtx->txPending);
+            }
+
+            /* the device answered the last keystroke, or is talking anyway */
+            if (threadCtx->keyTime != 0) {
+                ssh_hist_record(&threadCtx->metrics, SSH_HIST_KEYSTROKE_RTT,
+                                (uint32_t)(esp_timer_get_time()
+                                           - threadCtx->keyTime));
+                threadCtx->keyTime = 0;
+            }
+        }
+        else if ((sent == 0) || (sent == WS_WINDOW_FULL)) {
+            /* backpressure: try again once the client adjusts the window */
+            threadCtx->txBlocked = WS_WINDOW_FULL;
+        }
+        else if ((sent == WS_WANT_WRITE) || (sent == WS_REKEYING)) {
+            /* or once the socket is writable, or the key exchange done */
+            threadCtx->txBlocked = sent;
+        }
+        else {
+            ESP_LOGE(TAG, "wolfSSH_stream_send error %d", sent);
+            stop = 1;
+        }
+    }
+
+    return stop;
+}
+
+/*
+ * Queue sz bytes of data behind the UART output held in txBuf, and send
+ * them all. Used for the notices that belong in the same stream; when there
+ * is no room they are sent on their own.
+ * Returns non-zero when the session should stop.
+ */
+static int session_queue_uart(thread_ctx_t* threadCtx, const byte* data,
+                              word32 sz)
+{
+    int stop = 0;
+
+    if (threadCtx->txPending + sz <= sizeof(threadCtx->txBuf)) {
+        memcpy(threadCtx->txBuf + threadCtx->txPending, data, sz);
+        threadCtx->txPending += sz;
+        stop = session_flush_uart(threadCtx);
+    }
+    else {
+        wolfSSH_stream_send(threadCtx->ssh, (byte*)data, sz);
+    }
+
+    return stop;
+}
+
+/*
+ * Move the UART output this session has not seen yet into txBuf, and send
+ * it when it is due: see SSH_SERVER_COALESCE_DELAY_MS.
+ * While the client cannot take what is already in txBuf, our cursor stays
+ * where it is: the backlog builds up in the broadcast ring, and a client
+ * that falls a full ring behind is told what it missed.
+ * Returns non-zero when the session should stop.
+ */
+static int session_drain_uart(thread_ctx_t* threadCtx)
+{
+    int flush = 0;
+    int stop = 0;
+    int room;
+    int sz;
+
+    if (threadCtx->txBlocked) {
+        stop = session_flush_uart(threadCtx);
+    }
+
+    while (!stop && !threadCtx->txBlocked) {
+        byte* dst = threadCtx->txBuf + threadCtx->txPending;
+
+        room = SSH_SERVER_COALESCE_MAX_SZ - (int)threadCtx->txPending;
+        if (room <= 0) {
+            /* a replay larger than a packet is still being sent */
+            stop = session_flush_uart(threadCtx);
+            continue;
+        }
+
+        /* lock-free: only we move our cursor, and the UART Rx task
+         * never waits for us */
+        sz = Get_ExternalTransmitBuffer(&threadCtx->uartReader, dst, room);
+        if (sz < 0) {
+            /* this is an error as our buffer is never null */
+            stop = 1;
+        }
+        else if (sz == 0) {
+            break;
+        }
+        else {
+            if (threadCtx->txPending == 0) {
+                threadCtx->txDeadline = esp_timer_get_time()
+#ifdef SSH_SERVER_COALESCE_DELAY_MS
+                                      + SSH_SERVER_COALESCE_DELAY_MS * 1000
+#endif
+                                      ;
+            }
+            threadCtx->txPending += (word32)sz;
+
+            /* a complete line is what an interactive user waits for */
+            if (memchr(dst, '\n', (size_t)sz) != NULL) {
+                flush = 1;
+            }
+            if (threadCtx->txPending == SSH_SERVER_COALESCE_MAX_SZ) {
+                stop = session_flush_uart(threadCtx);
+            }
+        }
+    }
+
+    if (!stop && !threadCtx->txBlocked &&
+        (flush || (threadCtx->txPending > 0 &&
+                   esp_timer_get_time() >= threadCtx->txDeadline))) {
+        stop = session_flush_uart(threadCtx);
+    }
+
+    return stop;
+}
+
+/*
+ * Start viewing the UART output, first sending the recent scrollback to the
+ * client with a single send, or the welcome message when there is none.
+ * A raw session gets neither, only what the UART receives from now on.
+ * Returns the notification fd to select() on, or -1.
+ */
+static int session_view_uart(thread_ctx_t* threadCtx)
+{
+    const uart_route_t* route = uart_route_get(threadCtx->port);
+    /* behind whatever of the previous port is still held back */
+    byte* dst = threadCtx->txBuf + threadCtx->txPending;
+    int room = (int)sizeof(threadCtx->txBuf) - (int)threadCtx->txPending;
+    int uartFd = -1;
+    int sz = 0;
+
+    if ((threadCtx->uartNotifyFd >= 0) &&
+        (ExternalTransmitBuffer_AddReader(&threadCtx->uartReader,
+                                          threadCtx->port,
+                                          threadCtx->uartNotifyFd,
+                                          threadCtx->raw ? 0 :
+                                          SSH_SERVER_SCROLLBACK_REPLAY_SZ)
+                                          == 0)) {
+        uartFd = threadCtx->uartNotifyFd;
+
+        /* typically the boot log of the attached device; what does not
+         * fit behind the held output follows with the next drain */
+        sz = Get_ExternalTransmitBuffer(&threadCtx->uartReader, dst, room);
+        if (sz > 0) {
+            ESP_LOGI(TAG, "Session #%u: replaying %d bytes of %s "
+                          "scrollback.", threadCtx->id, sz, route->name);
+        }
+    }
+    else {
+        ESP_LOGE(TAG, "Session #%u cannot view the UART.", threadCtx->id);
+    }
+
+    if ((sz <= 0) && !threadCtx->raw) {
+        /* the welcome message goes straight to this client, since
+         * only the UART Rx task may write to the Tx ring */
+        sz = tx_rx_buffer_welcome(route->name, (byte)route->txPin,
+                                  (byte)route->rxPin, (char*)dst, room);
+    }
+
+    if (sz > 0) {
+        threadCtx->txPending += (word32)sz;
+        /* an error shows up again at the next read */
+        (void)session_flush_uart(threadCtx);
+    }
+
+    return uartFd;
+}
+
+/*
+ * View the UART of threadCtx->port and take its write lock, or tell the
+ * client another session has it.
+ * Returns the notification fd to select() on, or -1.
+ */
+static int session_open_uart(thread_ctx_t* threadCtx)
+{
+    int uartFd = session_view_uart(threadCtx);
+
+    if (!session_attach_uart(threadCtx)) {
+        ssh_metric_add(&threadCtx->metrics, SSH_METRIC_LOCK_BUSY, 1);
+        if (threadCtx->raw) {
+            wolfSSH_stream_send(threadCtx->ssh,
+                                (byte*)SSH_SERVER_UART_RAW_BUSY_MESSAGE,
+                                sizeof(SSH_SERVER_UART_RAW_BUSY_MESSAGE) - 1);
+        }
+        else {
+            wolfSSH_stream_send(threadCtx->ssh,
+                                (byte*)SSH_SERVER_UART_BUSY_MESSAGE,
+                                sizeof(SSH_SERVER_UART_BUSY_MESSAGE) - 1);
+        }
+    }
+
+    return uartFd;
+}
+
+/*
+ * Leave the UART this session views, giving up its write lock.
+ */
+static void session_close_uart(thread_ctx_t* threadCtx)
+{
+    ExternalTransmitBuffer_RemoveReader(&threadCtx->uartReader);
+
+    if (threadCtx->uartOwner) {
+        ExternalBuffers_Detach(threadCtx->port, (int)threadCtx->id);
+        threadCtx->uartOwner = 0;
+    }
+}
+
+/*
+ * Ctrl-]: move on to the next UART port within the same SSH session, so
+ * several consoles share one handshake. Whatever of the current port's
+ * output is held back is sent first.
+ * Returns the notification fd to select() on, or -1.
+ */
+static int session_switch_uart(thread_ctx_t* threadCtx)
+{
+    threadCtx->uartSwitch = 0;
+
+    session_flush_uart(threadCtx);
+    session_close_uart(threadCtx);
+
+    threadCtx->port = (threadCtx->port + 1) % SSH_SERVER_UART_PORTS;
+    ESP_LOGI(TAG, "Session #%u switched to %s.", threadCtx->id,
+                  uart_route_get(threadCtx->port)->name);
+
+    return session_open_uart(threadCtx);
+}
+
+/*
+ * Ctrl-B: find the baud rate of the device on the UART this session has the
+ * write lock of, and tell the client the result. Sessions viewing the port
+ * see nothing of it while the rates are tried.
+ */
+static void session_autobaud_uart(thread_ctx_t* threadCtx)
+{
+    char msg[96];
+    uart_line_t line;
+    int ret = ESP_ERR_INVALID_STATE;
+    int sz;
+
+    threadCtx->uartAutobaud = 0;
+    session_flush_uart(threadCtx);
+
+    if (threadCtx->uartOwner) {
+        ESP_LOGI(TAG, "Session #%u: auto-baud on %s.", threadCtx->id,
+                      uart_route_get(threadCtx->port)->name);
+        ret = uart_line_autobaud(threadCtx->port, &line);
+    }
+
+    sz = WSNPRINTF(msg, sizeof(msg), "\r\n[");
+    sz += session_line_text(threadCtx->port, ret, msg + sz,
+                            (int)sizeof(msg) - sz - 3);
+    memcpy(msg + sz, "]\r\n", 3);
+    wolfSSH_stream_send(threadCtx->ssh, (byte*)msg, (word32)sz + 3);
+}
+
+
+/* offered to the next session; a session task updates it as it ends, and a
+ * change lost to a race with another session only delays adapting */
+static struct {
+    word32 windowSz;
+    word32 maxPacketSz;
+    byte   adaptive;
+} sessionWindow = {
+    SSH_SERVER_WINDOW_SZ,
+    SSH_SERVER_MAX_PACKET_SZ,
+#ifdef SSH_SERVER_WINDOW_ADAPTIVE
+    1
+#else
+    0
+#endif
+};
+
+int ssh_server_set_window(uint32_t windowSz, uint32_t maxPacketSz,
+                          int adaptive)
+{
+#ifdef SSH_SERVER_HAVE_WINDOW_SZ
+    if (windowSz == 0) {
+        windowSz = sessionWindow.windowSz;
+    }
+    if (maxPacketSz == 0) {
+        maxPacketSz = sessionWindow.maxPacketSz;
+    }
+    if ((windowSz < SSH_SERVER_WINDOW_MIN_SZ) ||
+        (windowSz > SSH_SERVER_WINDOW_MAX_SZ) ||
+        (maxPacketSz > SSH_SERVER_WINDOW_MAX_SZ)) {
+        return -1;
+    }
+
+    sessionWindow.windowSz = windowSz;
+    sessionWindow.maxPacketSz = maxPacketSz;
+    if (adaptive >= 0) {
+        sessionWindow.adaptive = (adaptive != 0);
+    }
+
+    return 0;
+#else
+    (void)windowSz;
+    (void)maxPacketSz;
+    (void)adaptive;
+    ESP_LOGW(TAG, "wolfSSH %s has a fixed window, DEFAULT_WINDOW_SZ",
+                  LIBWOLFSSH_VERSION_STRING);
+    return -1;
+#endif
+}
+
+void ssh_server_get_window(uint32_t* windowSz, uint32_t* maxPacketSz,
+                           int* adaptive)
+{
+#ifdef SSH_SERVER_HAVE_WINDOW_SZ
+    *windowSz = sessionWindow.windowSz;
+    *maxPacketSz = sessionWindow.maxPacketSz;
+    *adaptive = sessionWindow.adaptive;
+#else
+    *windowSz = DEFAULT_WINDOW_SZ;
+    *maxPacketSz = DEFAULT_MAX_PACKET_SZ;
+    *adaptive = 0;
+#endif
+}
+
+/* set the window the client is offered when it opens its channel; called
+ * by the session task before the handshake */
+static void session_window_apply(thread_ctx_t* threadCtx)
+{
+    word32 windowSz = sessionWindow.windowSz;
+    word32 maxPacketSz = sessionWindow.maxPacketSz;
+
+#if defined(ESP_PLATFORM) && !defined(SSH_SERVER_SESSION_ARENA_SZ)
+    /* the channel buffer comes from the heap: leave room for the rest.
+     * With the arena, running out shows up as arena fallbacks instead. */
+    if (sessionWindow.adaptive) {
+        size_t largest = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+
+        while ((windowSz > SSH_SERVER_WINDOW_MIN_SZ) &&
+               (largest < windowSz + SESSION_WINDOW_HEAP_RESERVE)) {
+            windowSz /= 2;
+        }
+        if (windowSz < SSH_SERVER_WINDOW_MIN_SZ) {
+            windowSz = SSH_SERVER_WINDOW_MIN_SZ;
+        }
+    }
+#endif
+
+    if (maxPacketSz > windowSz) {
+        maxPacketSz = windowSz;
+    }
+
+#ifdef SSH_SERVER_HAVE_WINDOW_SZ
+    /* the CTX is shared: a session starting at the same time may open its
+     * channel with the other's sizes, which are just as valid */
+    wolfSSH_CTX_SetWindowPacketSize(threadCtx->ctx, windowSz, maxPacketSz);
+    threadCtx->windowSz = windowSz;
+    ESP_LOGI(TAG, "Session #%u window %u bytes, packets up to %u bytes.",
+                  threadCtx->id, windowSz, maxPacketSz);
+#else
+    (void)windowSz;
+    (void)maxPacketSz;
+    threadCtx->windowSz = DEFAULT_WINDOW_SZ;
+#endif
+}
+
+/* the adaptive step, as a session ends: how did its window do? */
+static void session_window_update(thread_ctx_t* threadCtx)
+{
+    word32 windowSz = sessionWindow.windowSz;
+    const char* reason = NULL;
+
+    if (!sessionWindow.adaptive) {
+        return;
+    }
+
+    if (ssh_metric_get(&threadCtx->metrics, SSH_METRIC_RX_DROPPED) > 0) {
+        windowSz /= 2;
+        reason = "the UART could not keep up";
+    }
+#ifdef SSH_SERVER_SESSION_ARENA_SZ
+    else if (threadCtx->arena.fallbacks > 0) {
+        windowSz /= 2;
+        reason = "the session arena overflowed";
+    }
+#endif
+    else if (ssh_metric_get(&threadCtx->metrics, SSH_METRIC_SSH_RX_BYTES) / 4
+             >= threadCtx->windowSz) {
+        /* several windows' worth arrived, so the window set the pace */
+        windowSz *= 2;
+        reason = "bulk transfer";
+    }
+
+    if (windowSz < SSH_SERVER_WINDOW_MIN_SZ) {
+        windowSz = SSH_SERVER_WINDOW_MIN_SZ;
+    }
+    if (windowSz > SSH_SERVER_WINDOW_MAX_SZ) {
+        windowSz = SSH_SERVER_WINDOW_MAX_SZ;
+    }
+
+    if (windowSz != sessionWindow.windowSz) {
+        ESP_LOGI(TAG, "Window for new sessions %u -> %u bytes, %s.",
+                      sessionWindow.windowSz, windowSz, reason);
+        sessionWindow.windowSz = windowSz;
+    }
+}
+
+
 /*
  * server_worker is the main thread for a given SSH connection
  */
 static THREAD_RETURN WOLFSSH_THREAD server_worker(void* vArgs)
 {
     int ret;
+    int exitStatus = 0;
 
     /* we'll create a local instance of threadCtx since it will be
      * handed off to potentially multiple separate threads
@@ -263,258 +1244,343 @@ static THREAD_RETURN WOLFSSH_THREAD server_worker(void* vArgs)
     wolfSSH_SetScpSendCtx(threadCtx->ssh, (void*)&scpBufferSend);
 #endif
 
+    ssh_metrics_reset(&threadCtx->metrics);
+    session_window_apply(threadCtx);
+
     if (!threadCtx->nonBlock)
         ret = wolfSSH_accept(threadCtx->ssh);
     else
-        ret = NonBlockSSH_accept(threadCtx->ssh);
+        ret = NonBlockSSH_accept(threadCtx);
+
+    if ((ret != WS_SUCCESS) && (ret != WS_SCP_COMPLETE) &&
+        (ret != WS_SFTP_COMPLETE)) {
+        ssh_metric_add(&threadCtx->metrics, SSH_METRIC_HANDSHAKE_FAILURES, 1);
+    }
+
+    if (ret == WS_SUCCESS) {
+        threadCtx->raw = 0;
+        threadCtx->port = session_uart_port(threadCtx);
+        threadCtx->uartSwitch = 0;
+        threadCtx->rxSwitchSz = 0;
+        threadCtx->uartAutobaud = 0;
+    }
 
+#ifdef SSH_SERVER_HAVE_EXEC
+    if ((ret == WS_SUCCESS) && (threadCtx->port < 0)) {
+        threadCtx->port = 0;
+        exitStatus = session_exec(threadCtx,
+                                  wolfSSH_GetSessionCommand(threadCtx->ssh));
+    }
+    else
+#endif
     if (ret == WS_SUCCESS) {
-        byte* this_rx_buf = NULL;
+        byte* this_rx_buf = threadCtx->rxBuf;
+
+        int backlogSz = 0, rxSz, stop = 0;
 
-        int backlogSz = 0, rxSz, txSz, stop = 0, txSum;
+        /* UART output this session was too slow to see, last reported */
+        word32 skippedSz = 0;
 
-        init_tx_rx_buffer(TXD_PIN, RXD_PIN);
+        /* stopped reading the client while the UART ring is full */
+        int rxHeld = 0;
+
+        /* becomes readable whenever uart_rx_task adds data to the Tx ring.
+         * Note txBuf is a *different* buffer from the external (UART) ring,
+         * it holds this session's coalesced output. */
+        int uartFd;
+
+        threadCtx->txPending = 0;
+        threadCtx->txBlocked = 0;
+        threadCtx->keyTime = 0;
+        uartFd = session_open_uart(threadCtx);
+
+        if (threadCtx->raw && !threadCtx->uartOwner) {
+            /* a binary pipe is of no use read-only */
+            exitStatus = 1;
+            stop = 1;
+        }
 
         /*
-         * we'll stay in this loop then entire time this worker thread has
-         * a valid SSH connection open
+         * we'll stay in this loop the entire time this worker thread has
+         * a valid SSH connection open. Each pass sleeps in select() until
+         * the client socket or the UART notification is readable, so there
+         * is no polling delay and an idle session uses no CPU.
          */
-        do {
-            /* int show_msg = 0;
-             * TODO optionally disable echo of text to USB port */
-            int has_err = 0;
-            this_rx_buf = (byte*)&sshStreamReceiveBufferArray;
-            vTaskDelay(10);
-
-            if (!stop) {
+        while (!stop) {
+            fd_set readFds;
+            fd_set writeFds;
+            int maxFd = threadCtx->fd;
+            int selectRet;
+            int rxRoom = 1;
+            struct timeval tv = { 1, 0 };
+        #ifdef SSH_SERVER_WDT_RESET
+            /* wake up periodically, only to feed the watchdog */
+            struct timeval* timeout = &tv;
+        #else
+            struct timeval* timeout = NULL;
+        #endif
+
+            if ((threadCtx->txPending > 0) && !threadCtx->txBlocked) {
+                /* wake up when the held UART output is due; once the
+                 * client cannot take it, the socket wakes us instead */
+                int64_t wait = threadCtx->txDeadline - esp_timer_get_time();
+
+                if (wait < 0) {
+                    wait = 0;
+                }
+                if (wait < 1000000) {
+                    tv.tv_sec = 0;
+                    tv.tv_usec = (long)wait;
+                    timeout = &tv;
+                }
+            }
+
+            if (rxHeld) {
+                /* uart_tx_task signals uartFd when it makes room; until
+                 * then wolfSSH keeps the data, and the client runs out of
+                 * window rather than us dropping it */
+                rxRoom = (ExternalReceiveBuffer_WaitForRoom(threadCtx->port)
+                          > 0);
+                if (rxRoom) {
+                    /* wolfSSH may already hold the data: don't wait */
+                    tv.tv_sec = 0;
+                    tv.tv_usec = 0;
+                    timeout = &tv;
+                }
+                else if (uartFd < 0) {
+                    /* nothing to be signalled on; look again shortly */
+                    tv.tv_sec = 0;
+                    tv.tv_usec = 10000;
+                    timeout = &tv;
+                }
+            }
+
+            FD_ZERO(&readFds);
+            if (rxRoom) {
+                FD_SET(threadCtx->fd, &readFds);
+            }
+            if (uartFd >= 0) {
+                FD_SET(uartFd, &readFds);
+                if (uartFd > maxFd) {
+                    maxFd = uartFd;
+                }
+            }
+
+            FD_ZERO(&writeFds);
+            if (threadCtx->txBlocked == WS_WANT_WRITE) {
+                FD_SET(threadCtx->fd, &writeFds);
+            }
+
+            selectRet = select(maxFd + 1, &readFds, &writeFds, NULL, timeout);
+            if (selectRet < 0) {
+                if (errno != EINTR) {
+                    ESP_LOGE(TAG, "ERROR: select failed, errno = %d", errno);
+                    stop = 1;
+                }
+                continue;
+            }
+
+            /*
+             * Data from the SSH client: keep reading until wolfSSH has
+             * consumed everything that arrived on the socket, storing it in
+             * the External Received Buffer for later sending to the UART,
+             * or until that is full.
+             */
+            if (rxRoom && (rxHeld || FD_ISSET(threadCtx->fd, &readFds))) {
+                rxHeld = 0;
                 do {
-                    int error = 0;
-                    socklen_t len = sizeof(error);
-                    int retval = getsockopt(threadCtx->fd,
-                                           SOL_SOCKET, SO_ERROR, &error, &len);
+                    byte* readBuf = this_rx_buf + backlogSz;
+                    int readSz = (int)sizeof(threadCtx->rxBuf) - backlogSz;
+                    int queued = 0;
 
-                    if (retval != 0) {
-                        /* if we can't even call getsockopt, give up */
-                        stop = 1;
-                        ESP_LOGE(TAG,"ERROR: getsockopt "
-                                     "unable to query socket fd!");
-                    }
-                    if (error != 0) {
-                        /* socket has a non zero error status */
-                        ESP_LOGE(TAG,"ERROR: getsockopt "
-                                     "returned error socket fd!");
-                        stop = 1;
+#if defined(DISABLE_SSH_UART)
+                    readSz--; /* room for the terminator */
+                    (void)queued;
+#else
+                    if (session_attach_uart(threadCtx)) {
+                        int roomSz;
+    #if (SSH_SERVER_ECHO == 0)
+                        /* zero-copy: wolfSSH decrypts straight into the
+                         * UART ring, uart_tx_task hands the same bytes to
+                         * the driver. Only to the end of the ring at a
+                         * time, the rest stays in wolfSSH for the next
+                         * pass. No more than rxBuf holds, where what
+                         * follows a Ctrl-] is kept. */
+                        byte* span;
+
+                        roomSz = ExternalReceiveBuffer_Reserve(threadCtx->port,
+                                                               &span);
+                        if (roomSz > 0) {
+                            readBuf = span;
+                            if (readSz > roomSz) {
+                                readSz = roomSz;
+                            }
+                            queued = 1;
+                        }
+    #else
+                        roomSz = ExternalReceiveBuffer_Free(threadCtx->port);
+                        if (readSz > roomSz) {
+                            readSz = roomSz;
+                        }
+    #endif
+                        if (roomSz == 0) {
+                            /* backpressure: leave it in wolfSSH, which
+                             * withholds the window until we read */
+                            ssh_metric_add(&threadCtx->metrics,
+                                           SSH_METRIC_RX_HELD, 1);
+                            rxHeld = 1;
+                            break;
+                        }
                     }
+#endif
 
-                    /* when polling, debugging can be verbose, turn it off */
-                    #ifdef DEBUG_WOLFSSH
-                        ESP_LOGV(TAG, "wolfSSH debugging off.");
-                        wolfSSH_Debugging_OFF();
-                    #endif
-
-                    /* this is a blocking call, awaiting an SSH keypress
-                     * unless nonBlock = 1 (normally we are NOT blocking) */
+                    /* blocks only when nonBlock = 0; select() said there is
+                     * data, normally we are NOT blocking. Never more than
+                     * fits behind the backlog, whatever the window. */
                     rxSz = wolfSSH_stream_read(threadCtx->ssh,
-                                               this_rx_buf + backlogSz,
-                                               EXAMPLE_BUFFER_SZ);
+                                               readBuf, (word32)readSz);
 
                     if (rxSz <= 0) {
-                        rxSz = wolfSSH_get_error(threadCtx->ssh);
-                        if (rxSz == WS_WANT_READ || rxSz == WS_WANT_WRITE)
-                        {
-                            /* WS_WANT_READ or WS_WANT_WRITE but no data yet */
-                            rxSz = 0;
-                        }
-                        else
-                        {
-                            /*  any other negative value is an error */
-                            has_err = 1;
-                            ESP_LOGE(TAG, "wolfSSH_stream_read error!");
+                        int error = wolfSSH_get_error(threadCtx->ssh);
+                        if (error != WS_WANT_READ && error != WS_WANT_WRITE) {
+                            /* any other value is an error, or the peer
+                             * closed the connection */
+                            ESP_LOGE(TAG, "wolfSSH_stream_read error %d",
+                                     error);
+                            stop = 1;
                         }
                     }
                     else {
+                        ssh_metric_add(&threadCtx->metrics,
+                                       SSH_METRIC_SSH_RX_BYTES, (uint32_t)rxSz);
+                        ssh_metric_add(&threadCtx->metrics,
+                                       SSH_METRIC_SSH_RX_READS, 1);
+                        /* a few bytes at a time are typing; time the
+                         * first until output is sent back */
+                        if ((rxSz <= 4) && (threadCtx->keyTime == 0)) {
+                            threadCtx->keyTime = esp_timer_get_time();
+                        }
 #if defined(DISABLE_SSH_UART)
                         this_rx_buf[rxSz] = 0;
-                        rxSz = 0;
                         /* printf is not ideal for embedded, but here for demo
                          * output only. setvbuf should have been set to flush
                          * output immediately:*/
                         printf("%s", this_rx_buf);
 #else
-                        ESP_LOGI(TAG, "Received %d bytes from client.", rxSz);
-#endif
-                    }
-
+                        SSH_TRACE(SESSION, ESP_LOG_INFO, TAG,
+                                  "Received %d bytes from client.", rxSz);
 
-                    /* turn debugging back on */
-                    #ifdef DEBUG_WOLFSSH
-                        ESP_LOGV(TAG, "wolfSSH debugging on.");
-                        wolfSSH_Debugging_ON();
-                    #endif
+                        if (queued) {
+                            /* hand the bytes to uart_tx_task and act on
+                             * control characters */
+                            int none = 0;
 
-                    taskYIELD();
-                    #ifdef SSH_SERVER_WDT_RESET
-                    {
-                        esp_task_wdt_reset();
-                    }
-                    #endif
-
-                } while ((WOLFSSL_NONBLOCK == 0) /* We'll wait only when
-                                                  * not using non-blocking
-                                                  * socket. */
-                         &&
-                         (rxSz == WS_WANT_READ || rxSz == WS_WANT_WRITE));
-
-                /*
-                 * if there's data in the external transmit buffer, typically
-                 * from UART, we'll send that to the SSH client.
-                 */
-                if (ExternalTransmitBufferSz() > 0) {
-                    ESP_LOGI(TAG,"Tx UART!");
-
-                    /* our actual transit buffer array is not on the local
-                     * stack to minimize RTOS requirements; we'll setup a
-                     * pointer to it.
-                     *
-                     * Note this is a *different* buffer from the
-                     * external (UART) which may change during RTOS threads,
-                     * and future interrupt code.
-                     * */
-                    byte* sshStreamTransmitBuffer =
-                          (byte*)(&sshStreamTransmitBufferArray);
-
-                    /* We'll get a copy of the buffer and
-                     * set _ExternalTransmitBufferSz to zero
-                     *
-                     * Note this is thread safe, getting both data and size.
-                     */
-                    int thisSize = Get_ExternalTransmitBuffer(
-                                       &sshStreamTransmitBuffer
-                                   );
-
-                    if (sshStreamTransmitBuffer == NULL) {
-                        /* TODO this is an error as the buffer should never
-                         * be null if the size was larger than zero */
-                        stop = 1;
-                    }
-                    else {
-                        /* note thisSize will not have changed from any other
-                         *  thread, since we have a copy and fixed size */
-                        wolfSSH_stream_send(threadCtx->ssh,
-                                            sshStreamTransmitBuffer,
-                                            thisSize);
-                    }
-                } /* ExternalTransmitBufferSz() > 0 */
-
-                /*
-                 * If we received any data from the SSH client,
-                 * we'll store it in the External Received Buffer
-                 * for later sending to the UART.
-                 *
-                 * Reminder negative values for WS_WANT_READ || WS_WANT_WRITE
-                 */
-                if (rxSz > 0) {
-                    /* Append external data, for something such as
-                     * UART forwarding.
-                     *
-                     * Note any prior data saved in the buffer
-                     * was _ExternalReceiveBufferSz.
-                     *
-                     * Here we perform the thread-safe equivalent of:
-                     *
-                        memcpy(
-                            &_ExternalReceiveBuffer[_ExternalReceiveBufferSz],
-                            buf,
-                            rxSz);
-                        _ExternalReceiveBufferSz = rxSz;
-                     */
-                    Set_ExternalReceiveBuffer(this_rx_buf, rxSz);
-
-                    backlogSz += rxSz;
-                    txSum = 0;
-                    txSz = 0;
-
-                    while (backlogSz != txSum && txSz >= 0 && !stop) {
-                        /* we typically do NOT want to re-echo TTY data
-                         * but it can be configured to do so by setting
-                         * SSH_SERVER_ECHO to a value of 1
-                         **/
-                        if (SSH_SERVER_ECHO == 1) {
-                            /* reminder we moved data from external buffer
-                             * to our local buf, and this is ECHO
-                             */
-                            txSz = wolfSSH_stream_send(threadCtx->ssh,
-                                                       this_rx_buf + txSum,
-                                                       backlogSz - txSum);
+                            if (client_data_received(threadCtx, readBuf,
+                                                     rxSz, &none, 1) != 0) {
+                                stop = 1;
+                            }
                         }
                         else {
-                            txSz = backlogSz - txSum;
+                            /* the write lock may have been released since */
+                            session_attach_uart(threadCtx);
+                            if (client_data_received(threadCtx, this_rx_buf,
+                                                     rxSz, &backlogSz,
+                                                     0) != 0) {
+                                stop = 1;
+                            }
                         }
+#endif
+                    }
+                } while (!stop && rxSz > 0 && threadCtx->nonBlock &&
+                         !threadCtx->uartSwitch && !threadCtx->uartAutobaud);
+            }
 
-                        if (txSz > 0) {
-                            byte c;
-                            const byte matches[] = { 0x03, 0x05, 0x06, 0x00 };
-
-                            c = find_char(matches, this_rx_buf + txSum, txSz);
-
-                            switch (c) {
+            while (!stop && threadCtx->uartSwitch) {
+                /* only the bytes typed before Ctrl-] went to the old port;
+                 * those after it go to the new one, which replays its
+                 * scrollback, as if just read. wolfSSH may hold more of
+                 * what was typed: read it as if held. */
+                int switchSz;
+
+                uartFd = session_switch_uart(threadCtx);
+                skippedSz = 0;
+                rxHeld = 1;
+
+                switchSz = threadCtx->rxSwitchSz;
+                threadCtx->rxSwitchSz = 0;
+                if (switchSz > 0) {
+                    session_attach_uart(threadCtx);
+                    stop = client_data_received(threadCtx, this_rx_buf,
+                                                switchSz, &backlogSz, 0);
+                }
+            }
 
-                            case 0x03:
-                                stop = 1;
-                                break;
-
-                            case 0x06:
-                                if (wolfSSH_TriggerKeyExchange(threadCtx->ssh)
-                                        != WS_SUCCESS) {
-                                    stop = 1;
-                                }
-                                break;
-
-                            case 0x05:
-                                if (dump_stats(threadCtx) <= 0) {
-                                    stop = 1;
-                                }
-                                break;
-                            }
+            if (!stop && threadCtx->uartAutobaud) {
+                session_autobaud_uart(threadCtx);
+                rxHeld = 1;
+            }
 
-                            txSum += txSz;
-                        }
-                        else if (txSz != WS_REKEYING) {
-                            stop = 1;
-                        }
+            /*
+             * Data from the UART: clear the notification first, so that
+             * anything arriving while we drain signals the fd again.
+             * The ring is cheap to check, so drain it on every pass.
+             */
+            if ((uartFd >= 0) && FD_ISSET(uartFd, &readFds)) {
+                ExternalTransmitBuffer_ClearNotify(&threadCtx->uartReader);
+            }
 
-                        taskYIELD();
-                        #ifdef SSH_SERVER_WDT_RESET
-                        {
-                            esp_task_wdt_reset();
-                        }
-                        #endif
-                    } /* while */
+            if (!stop && (uartFd >= 0)) {
+                stop = session_drain_uart(threadCtx);
+            }
 
-                    if (txSum < backlogSz) {
-                        memmove(this_rx_buf,
-                                this_rx_buf + txSum,
-                                backlogSz - txSum);
-                    }
-                    backlogSz -= txSum;
+            if (!stop && (threadCtx->uartReader.skippedSz != skippedSz)) {
+                /* this client fell a full ring behind; tell it what it
+                 * missed rather than hold up the UART */
+                char notice[64];
+                int noticeSz;
+
+                noticeSz = WSNPRINTF(notice, sizeof(notice),
+                                     "\r\n[%u bytes of UART output skipped]"
+                                     "\r\n",
+                                     (unsigned)(threadCtx->uartReader.skippedSz
+                                                - skippedSz));
+                ssh_metric_add(&threadCtx->metrics, SSH_METRIC_TX_SKIPPED,
+                               threadCtx->uartReader.skippedSz - skippedSz);
+                skippedSz = threadCtx->uartReader.skippedSz;
+                ESP_LOGW(TAG, "Session #%u is too slow: %s",
+                              threadCtx->id, notice + 2);
+                if (!threadCtx->raw) {
+                    /* in order, but not into a binary stream */
+                    stop = session_queue_uart(threadCtx, (byte*)notice,
+                                              (word32)noticeSz);
                 }
                 else {
-                    /* we might have negative values for non-blocking Rx
-                     * during WS_WANT_READ || WS_WANT_WRITE */
-                    if (has_err == 1)
-                    {
-                        stop = 1;
-                    }
+                    /* a binary stream with a hole in it is corrupt */
+                    exitStatus = 1;
+                    stop = 1;
                 }
             }
 
+            #ifdef SSH_SERVER_WDT_RESET
+            {
+                esp_task_wdt_reset();
+            }
+            #endif
+
         #ifdef DEBUG_WDT
             /* if we get panic faults, perhaps the watchdog needs attention? */
             taskYIELD();
             vTaskDelay(pdMS_TO_TICKS(10));
             esp_task_wdt_reset();
         #endif
-        } while (!stop);
+        } /* while (!stop) */
+
+        ESP_LOGI(TAG, "Session #%u sent %u bytes of UART output in %u "
+                      "packets.", threadCtx->id,
+                      (unsigned)ssh_metric_get(&threadCtx->metrics,
+                                               SSH_METRIC_SSH_TX_BYTES),
+                      (unsigned)ssh_metric_get(&threadCtx->metrics,
+                                               SSH_METRIC_SSH_TX_PACKETS));
     } /* if (ret == WS_SUCCESS) */
 
     else if (ret == WS_SCP_COMPLETE) {
@@ -540,17 +1606,15 @@ static THREAD_RETURN WOLFSSH_THREAD server_worker(void* vArgs)
         ESP_LOGE(TAG,"Use example/echoserver/echoserver for SFTP\n");
     }
 
-    wolfSSH_stream_exit(threadCtx->ssh, 0);
+    wolfSSH_stream_exit(threadCtx->ssh, exitStatus);
 
     /* check if open before closing */
     if (threadCtx->fd != SOCKET_INVALID) {
         ESP_LOGI(TAG,"Close sockfd socket");
         close(threadCtx->fd);
+        threadCtx->fd = SOCKET_INVALID;
     }
 
-    wolfSSH_free(threadCtx->ssh);
-    free(threadCtx);
-
     return 0;
 }
 
@@ -635,83 +1699,88 @@ static WC_INLINE void c32toa(word32 u32, byte* c)
     c[3] =  u32 & 0xff;
 }
 
-static PwMap* PwMapNew(PwMapList* list,
-                       byte type,
-                       const byte* username,
-                       word32 usernameSz,
-                       const byte* p,
-                       word32 pSz) {
-    PwMap* map = NULL;
-
-    map = (PwMap*)malloc(sizeof(PwMap));
-    if (map != NULL) {
-        wc_Sha256 sha = { };
-        byte flatSz[4];
-        int fsz = 0;
-
-        map->type = type;
-        if (usernameSz >= sizeof(map->username))
-            usernameSz = sizeof(map->username) - 1;
-        memcpy(map->username, username, usernameSz + 1);
-        map->username[usernameSz] = 0;
-        map->usernameSz = usernameSz;
-
-        ESP_LOGI(TAG, "map->username = %s", map->username);
+/* the SHA-256 of [p] prefixed with its length, as stored and compared */
+static void CredentialDigest(const byte* p, word32 pSz,
+                             byte digest[WC_SHA256_DIGEST_SIZE])
+{
+    wc_Sha256 sha = { };
+    byte flatSz[4];
+    int fsz = 0;
 
-        wc_InitSha256(&sha);
-        c32toa(pSz, flatSz);
+    wc_InitSha256(&sha);
+    c32toa(pSz, flatSz);
 
-        fsz = sizeof(flatSz);
+    fsz = sizeof(flatSz);
 
-    #ifdef DEBUG_WOLFSSH
-        ESP_LOGI(TAG, "map->username = %s", map->username);
-        ESP_LOGI(TAG, "SHA256 flatSz: 0x%02x%02x%02x%02x; size = %d",
-                      flatSz[0], flatSz[1], flatSz[2], flatSz[3], fsz);
-        ESP_LOGI(TAG, "SHA256 sample password: '%s': size = %d bytes", p, pSz);
-    #endif
-    #if defined(SSH_SERVER_DEBUG_LOCKDEPTH)
-        ESP_LOGW(TAG, "PwMapNew sha256 final ctx->lockDepth = %d",
-                       (&sha.ctx)->lockDepth);
-        ESP_LOGW(TAG, "calling wc_Sha256Update(1) ctx->lockDepth = %d",
-                       (&sha.ctx)->lockDepth);
-    #endif
-        wc_Sha256Update((wc_Sha256*)&sha, flatSz, fsz);
-    #if defined(SSH_SERVER_DEBUG_LOCKDEPTH) && \
-       !defined(NO_WOLFSSL_ESP32_CRYPT_HASH_SHA256)
-        ESP_LOGW(TAG, "calling wc_Sha256Update(2) ctx->lockDepth = %d",
-                      (&sha.ctx)->lockDepth);
-    #endif
-        wc_Sha256Update((wc_Sha256*)&sha, p, pSz);
-    #if defined(SSH_SERVER_DEBUG_LOCKDEPTH) && \
-       !defined(NO_WOLFSSL_ESP32_CRYPT_HASH_SHA256)
+#ifdef DEBUG_WOLFSSH
+    ESP_LOGI(TAG, "SHA256 flatSz: 0x%02x%02x%02x%02x; size = %d",
+                  flatSz[0], flatSz[1], flatSz[2], flatSz[3], fsz);
+#endif
+#if defined(SSH_SERVER_DEBUG_LOCKDEPTH)
+    ESP_LOGW(TAG, "calling wc_Sha256Update(1) ctx->lockDepth = %d",
+                   (&sha.ctx)->lockDepth);
+#endif
+    wc_Sha256Update((wc_Sha256*)&sha, flatSz, fsz);
+#if defined(SSH_SERVER_DEBUG_LOCKDEPTH) && \
+   !defined(NO_WOLFSSL_ESP32_CRYPT_HASH_SHA256)
+    ESP_LOGW(TAG, "calling wc_Sha256Update(2) ctx->lockDepth = %d",
+                  (&sha.ctx)->lockDepth);
+#endif
+    wc_Sha256Update((wc_Sha256*)&sha, p, pSz);
+#if defined(SSH_SERVER_DEBUG_LOCKDEPTH) && \
+   !defined(NO_WOLFSSL_ESP32_CRYPT_HASH_SHA256)
+    ESP_LOGW(TAG, "calling wc_Sha256Final ctx->lockDepth = %d",
+                  (&sha.ctx)->lockDepth);
+#endif
+    wc_Sha256Final((wc_Sha256*)&sha, digest);
+}
 
-        ESP_LOGW(TAG, "calling wc_Sha256Final ctx->lockDepth = %d",
-                      (&sha.ctx)->lockDepth);
-    #endif
-        wc_Sha256Final((wc_Sha256*)&sha, (byte*)map->p);
+/* store the digest of password or public key [p] for [username] */
+static int CredentialNew(CredentialStore* store,
+                         byte type,
+                         const byte* username,
+                         word32 usernameSz,
+                         const byte* p,
+                         word32 pSz)
+{
+    byte digest[WC_SHA256_DIGEST_SIZE];
+    int ret;
 
-        map->next = list->head;
-        list->head = map;
+    ESP_LOGI(TAG, "credential for user = %.*s", (int)usernameSz, username);
+
+    CredentialDigest(p, pSz, digest);
+    ret = credential_store_add(store, type, username, usernameSz, digest);
+    if ((ret != 0) && (usernameSz > CREDENTIAL_NAME_MAX_SZ)) {
+        ESP_LOGE(TAG, "User name longer than %d characters.",
+                      CREDENTIAL_NAME_MAX_SZ);
+    }
+    else if (ret != 0) {
+        ESP_LOGE(TAG, "Credential store full.");
     }
 
-    return map;
+    return ret;
 }
 
-static void PwMapListDelete(PwMapList* list)
+/* one credential per non-empty line of [buf] */
+static word32 CredentialCount(const char* buf)
 {
-    if (list != NULL) {
-        PwMap* head = list->head;
+    word32 count = 0;
 
-        while (head != NULL) {
-            PwMap* cur = head;
-            head = head->next;
-            memset(cur, 0, sizeof(PwMap));
-            free(cur);
+    while (buf != NULL && *buf != 0) {
+        if (*buf != '\n') {
+            count++;
+        }
+        buf = strchr(buf, '\n');
+        if (buf != NULL) {
+            buf++;
         }
     }
+
+    return count;
 }
 
-static int LoadPasswordBuffer(byte* buf, word32 bufSz, PwMapList* list)
+static int LoadPasswordBuffer(byte* buf, word32 bufSz,
+                              CredentialStore* store)
 {
     char* str = (char*)buf;
     char* delimiter;
@@ -722,7 +1791,7 @@ static int LoadPasswordBuffer(byte* buf, word32 bufSz, PwMapList* list)
      *     username:password\n
      * This function modifies the passed-in buffer. */
 
-    if (list == NULL)
+    if (store == NULL)
         return -1;
 
     if (buf == NULL || bufSz == 0) {
@@ -744,12 +1813,12 @@ static int LoadPasswordBuffer(byte* buf, word32 bufSz, PwMapList* list)
         }
         *str = 0;
         str++;
-        if (PwMapNew(list,
-                     WOLFSSH_USERAUTH_PASSWORD,
-                     (byte*)username,
-                     (word32)strlen(username),
-                     (byte*)password,
-                     (word32)strlen(password)) == NULL) {
+        if (CredentialNew(store,
+                          WOLFSSH_USERAUTH_PASSWORD,
+                          (byte*)username,
+                          (word32)strlen(username),
+                          (byte*)password,
+                          (word32)strlen(password)) != 0) {
 
             return -1;
         }
@@ -759,81 +1828,42 @@ static int LoadPasswordBuffer(byte* buf, word32 bufSz, PwMapList* list)
 }
 
 
-static int LoadPublicKeyBuffer(byte* buf, word32 bufSz, PwMapList* list)
+/* feed [buf] to the authorized_keys parser in flash-read sized chunks, as
+ * a file or upload would arrive */
+static int LoadPublicKeyBuffer(const byte* buf, word32 bufSz,
+                               CredentialStore* store)
 {
-    char* str = (char*)buf;
-    char* delimiter;
-    byte* publicKey64;
-    word32 publicKey64Sz;
-    byte* username;
-    word32 usernameSz;
-    byte  publicKey[300];
-    word32 publicKeySz;
+    AuthorizedKeys ak;
+    word32 chunkSz;
+    int ret;
 
-    /* Each line of passwd.txt is in the format
-     *     ssh-rsa AAAB3BASE64ENCODEDPUBLICKEYBLOB username\n
-     * This function modifies the passed-in buffer. */
-    if (list == NULL)
-        return -1;
+    ret = authorized_keys_init(&ak, store, WOLFSSH_USERAUTH_PUBLICKEY);
 
-    if (buf == NULL || bufSz == 0) {
-        ESP_LOGW(TAG, "Warning: LoadPublicKeyBuffer buffer size is zero!");
-        return 0;
+    while ((ret == 0) && (bufSz > 0)) {
+        chunkSz = (bufSz > 64) ? 64 : bufSz;
+        ret = authorized_keys_update(&ak, buf, chunkSz);
+        buf += chunkSz;
+        bufSz -= chunkSz;
     }
 
-    while (*str != 0) {
-        /* Skip the public key type. This example will always be ssh-rsa. */
-        delimiter = strchr(str, ' ');
-        if (delimiter == NULL) {
-            return -1;
-        }
-        str = delimiter + 1;
-        delimiter = strchr(str, ' ');
-        if (delimiter == NULL) {
-            return -1;
-        }
-        publicKey64 = (byte*)str;
-        *delimiter = 0;
-        publicKey64Sz = (word32)(delimiter - str);
-        str = delimiter + 1;
-        delimiter = strchr(str, '\n');
-        if (delimiter == NULL) {
-            return -1;
-        }
-        username = (byte*)str;
-        *delimiter = 0;
-        usernameSz = (word32)(delimiter - str);
-        str = delimiter + 1;
-        publicKeySz = sizeof(publicKey);
-
-        if (Base64_Decode(publicKey64,
-            publicKey64Sz,
-            publicKey,
-            &publicKeySz) != 0) {
-
-            return -1;
-        }
-
-        if (PwMapNew(list,
-            WOLFSSH_USERAUTH_PUBLICKEY,
-            username,
-            usernameSz,
-            publicKey,
-            publicKeySz) == NULL) {
+    if (ret == 0) {
+        ret = authorized_keys_final(&ak);
+    }
 
-            return -1;
-        }
+    if (ak.errors > 0) {
+        ESP_LOGW(TAG, "Skipped %u malformed authorized key line(s), "
+                      "first at line %u", ak.errors, ak.errorLine);
     }
+    ESP_LOGI(TAG, "Loaded %u authorized key(s)", ak.keys);
 
-    return 0;
+    return ret;
 }
 
 static int wsUserAuth(byte authType,
                       WS_UserAuthData* authData,
                       void* ctx)
 {
-    PwMapList* list;
-    PwMap* map;
+    int ret;
     byte authHash[WC_SHA256_DIGEST_SIZE];
 
     if (ctx == NULL) {
@@ -848,83 +1878,254 @@ static int wsUserAuth(byte authType,
     }
 
     /* Hash the password or public key with its length. */
-    {
+    if (authType == WOLFSSH_USERAUTH_PASSWORD) {
+        CredentialDigest(authData->sf.password.password,
+                         authData->sf.password.passwordSz,
+                         authHash);
+    }
+    else {
+        /* keys are stored by their plain SHA-256, as the authorized_keys
+         * parser sees them */
         wc_Sha256 sha;
-        byte flatSz[4];
+
         wc_InitSha256(&sha);
-        if (authType == WOLFSSH_USERAUTH_PASSWORD) {
-            c32toa(authData->sf.password.passwordSz, flatSz);
-            wc_Sha256Update(&sha, flatSz, sizeof(flatSz));
-            wc_Sha256Update(&sha,
-                authData->sf.password.password,
-                authData->sf.password.passwordSz);
-        }
-        else if (authType == WOLFSSH_USERAUTH_PUBLICKEY) {
-            c32toa(authData->sf.publicKey.publicKeySz, flatSz);
-            wc_Sha256Update(&sha, flatSz, sizeof(flatSz));
-            wc_Sha256Update(&sha,
-                authData->sf.publicKey.publicKey,
-                authData->sf.publicKey.publicKeySz);
-        }
+        wc_Sha256Update(&sha,
+                        authData->sf.publicKey.publicKey,
+                        authData->sf.publicKey.publicKeySz);
         wc_Sha256Final(&sha, authHash);
+        wc_Sha256Free(&sha);
+    }
+
+    ret = credential_store_check((CredentialStore*)ctx,
+                                 authData->type,
+                                 authData->username,
+                                 authData->usernameSz,
+                                 authHash);
+    switch (ret) {
+        case CREDENTIAL_MATCH:
+            return WOLFSSH_USERAUTH_SUCCESS;
+
+        case CREDENTIAL_MISMATCH:
+            return (authType == WOLFSSH_USERAUTH_PASSWORD ?
+                    WOLFSSH_USERAUTH_INVALID_PASSWORD :
+                    WOLFSSH_USERAUTH_INVALID_PUBLICKEY);
+
+        case CREDENTIAL_NO_TYPE:
+            return WOLFSSH_USERAUTH_INVALID_AUTHTYPE;
+
+        default:
+            return WOLFSSH_USERAUTH_INVALID_USER;
     }
+}
 
-    list = (PwMapList*)ctx;
-    map = list->head;
 
-    while (map != NULL) {
-        if (authData->usernameSz == map->usernameSz &&
-            memcmp(authData->username, map->username, map->usernameSz) == 0) {
+/* a new WOLFSSH object for [threadCtx], ready for its next client */
+static WOLFSSH* session_ssh_new(thread_ctx_t* threadCtx)
+{
+    WOLFSSH* ssh;
+#ifdef SSH_SERVER_SESSION_ARENA_SZ
+    /* also called from the accept loop, for a slot that is not in use */
+    SessionArena* prevArena = session_arena_enter(&threadCtx->arena);
+#endif
 
-            if (authData->type == map->type) {
-                if (memcmp(map->p, authHash, WC_SHA256_DIGEST_SIZE) == 0) {
-                    return WOLFSSH_USERAUTH_SUCCESS;
-                }
-                else {
-                    return (authType == WOLFSSH_USERAUTH_PASSWORD ?
-                            WOLFSSH_USERAUTH_INVALID_PASSWORD :
-                            WOLFSSH_USERAUTH_INVALID_PUBLICKEY);
-                }
-            }
-            else {
-                return WOLFSSH_USERAUTH_INVALID_AUTHTYPE;
-            }
+    ssh = wolfSSH_new(threadCtx->ctx);
+
+#ifdef SSH_SERVER_SESSION_ARENA_SZ
+    session_arena_enter(prevArena);
+#endif
+
+    if (ssh == NULL) {
+        ESP_LOGE(TAG,"Failed to create ssh object during wolfSSH_new.\n");
+    }
+    else {
+        wolfSSH_SetUserAuthCtx(ssh, threadCtx->authCtx);
+        /* Use the session object for its own highwater callback ctx */
+        if (EXAMPLE_HIGHWATER_MARK > 0) {
+            wolfSSH_SetHighwaterCtx(ssh, (void*)ssh);
+            wolfSSH_SetHighwater(ssh, EXAMPLE_HIGHWATER_MARK);
         }
-        map = map->next;
     }
 
-    return WOLFSSH_USERAUTH_INVALID_USER;
+    return ssh;
 }
 
+/* return a slot to the pool once its session has ended */
+static void session_release(thread_ctx_t* threadCtx)
+{
+    session_close_uart(threadCtx);
 
-#ifdef WOLFSSH_TEST_THREADING
+    /* wolfSSH has no reset; replace the object now, rather than while
+     * the next client waits */
+    wolfSSH_free(threadCtx->ssh);
 
-typedef THREAD_RETURN WOLFSSH_THREAD THREAD_FUNC(void*);
+    session_window_update(threadCtx);
+
+#ifdef SSH_SERVER_SESSION_ARENA_SZ
+    ESP_LOGI(TAG, "Session #%u arena: peak %u of %u bytes in %u allocations,"
+                  " %u went to the heap.", threadCtx->id,
+                  (unsigned)threadCtx->arena.peak,
+                  (unsigned)threadCtx->arena.size,
+                  (unsigned)threadCtx->arena.allocs,
+                  (unsigned)threadCtx->arena.fallbacks);
+    ssh_metric_add(&threadCtx->metrics, SSH_METRIC_ARENA_FALLBACKS,
+                   threadCtx->arena.fallbacks);
+    if (session_arena_release(&threadCtx->arena) != 0) {
+        /* e.g. a cache wolfCrypt filled on first use; kept, not reclaimed */
+        ESP_LOGW(TAG, "Session #%u: %u arena blocks outlived the session.",
+                      threadCtx->id, (unsigned)threadCtx->arena.live);
+        ssh_metric_add(&threadCtx->metrics, SSH_METRIC_ARENA_PINNED, 1);
+    }
+#endif
 
+    ssh_metric_add(&threadCtx->metrics, SSH_METRIC_SESSIONS, 1);
+    ssh_metrics_merge(&ssh_metrics, &threadCtx->metrics);
 
-static WC_INLINE void ThreadDetach(THREAD_TYPE thread) {
-#ifdef SINGLE_THREADED
-    (void)thread;
-#elif defined(_POSIX_THREADS) && !defined(__MINGW32__)
-    pthread_detach(thread);
-#elif defined(WOLFSSL_TIRTOS)
-#if 0
-    while (1) {
-        if (Task_getMode(thread) == Task_Mode_TERMINATED) {
-            Task_sleep(5);
-            break;
-        }
-        Task_yield();
+    threadCtx->ssh = session_ssh_new(threadCtx);
+
+    threadCtx->inUse = 0;
+}
+
+/* each slot runs one session at a time, for as long as the device is up */
+static void session_task(void* arg)
+{
+    thread_ctx_t* threadCtx = (thread_ctx_t*)arg;
+
+#ifdef SSH_SERVER_SESSION_ARENA_SZ
+    /* all this task allocates through wolfSSL comes from the slot arena */
+    session_arena_enter(&threadCtx->arena);
+#endif
+
+    for (;;) {
+        /* wait for session_pool_assign */
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        ESP_LOGI(TAG,"server_worker #%u started.", threadCtx->id);
+        server_worker(threadCtx);
+        ESP_LOGI(TAG,"server_worker #%u completed.", threadCtx->id);
+
+        session_release(threadCtx);
+    }
+}
+
+/*
+ * Prepare every slot of the session pool: a WOLFSSH object and a task.
+ * Can be called repeatedly; tasks are only created once.
+ */
+static int session_pool_init(WOLFSSH_CTX* ctx, void* authCtx)
+{
+    int ret = WOLFSSL_SUCCESS;
+    int i;
+
+#ifdef SSH_SERVER_SESSION_ARENA_SZ
+    if (session_arena_install() != 0) {
+        /* the arenas are then simply never used */
+        ESP_LOGW(TAG, "Could not hook the wolfSSL allocators, sessions "
+                      "allocate from the heap.");
     }
 #endif
-#else
-    int res = CloseHandle((HANDLE)thread);
-    assert(res);
-    (void)res; /* Suppress un-used variable warning */
+
+    for (i = 0; i < SSH_SERVER_MAX_SESSIONS; i++) {
+        thread_ctx_t* threadCtx = &sessionPool[i];
+
+        if (threadCtx->inUse) {
+            continue;
+        }
+
+#ifdef SSH_SERVER_SESSION_ARENA_SZ
+        /* once, like the task; the arena outlives every server_test */
+        if ((threadCtx->arena.buf == NULL) &&
+            (session_arena_init(&threadCtx->arena, threadCtx->arenaBuf,
+                                sizeof(threadCtx->arenaBuf)) != 0)) {
+            ret = WOLFSSL_FAILURE;
+        }
 #endif
+
+        threadCtx->ctx      = ctx;
+        threadCtx->authCtx  = authCtx;
+        threadCtx->fd       = SOCKET_INVALID;
+        threadCtx->nonBlock = WOLFSSL_NONBLOCK;
+
+        if (threadCtx->ssh != NULL) {
+            wolfSSH_free(threadCtx->ssh);
+        }
+        threadCtx->ssh = session_ssh_new(threadCtx);
+
+        if (threadCtx->task == NULL) {
+            char name[configMAX_TASK_NAME_LEN];
+
+            /* kept for the life of the slot, like the task */
+            threadCtx->uartNotifyFd = ExternalTransmitBuffer_NewNotifyFd();
+
+            WSNPRINTF(name, sizeof(name), "ssh_session_%d", i);
+            threadCtx->task = xTaskCreateStatic(session_task, name,
+                                                SSH_SERVER_SESSION_STACK_SZ,
+                                                threadCtx, tskIDLE_PRIORITY,
+                                                threadCtx->stack,
+                                                &threadCtx->taskBuffer);
+        }
+
+        if ((threadCtx->ssh == NULL) || (threadCtx->task == NULL)) {
+            ret = WOLFSSL_FAILURE;
+        }
+    }
+
+    ESP_LOGI(TAG, "Session pool: %d slots of %d bytes each.",
+                  SSH_SERVER_MAX_SESSIONS, (int)sizeof(thread_ctx_t));
+    return ret;
+}
+
+/* free the WOLFSSH objects of idle slots, before the CTX goes away */
+static void session_pool_free(void)
+{
+    int i;
+
+    for (i = 0; i < SSH_SERVER_MAX_SESSIONS; i++) {
+        if (!sessionPool[i].inUse && (sessionPool[i].ssh != NULL)) {
+            wolfSSH_free(sessionPool[i].ssh);
+            sessionPool[i].ssh = NULL;
+        }
+    }
 }
 
-#endif /* WOLFSSH_TEST_THREADING */
+/*
+ * Hand clientFd to a free slot and wake its task. The handshake runs in the
+ * slot task, so the accept loop is never held up by a slow client.
+ * Returns the slot, or NULL when all slots are busy.
+ */
+static thread_ctx_t* session_pool_assign(int clientFd, word32 id)
+{
+    thread_ctx_t* ret = NULL;
+    int i;
+
+    for (i = 0; (i < SSH_SERVER_MAX_SESSIONS) && (ret == NULL); i++) {
+        thread_ctx_t* threadCtx = &sessionPool[i];
+
+        if (threadCtx->inUse || (threadCtx->task == NULL)) {
+            continue;
+        }
+
+        /* replacing the object failed at the end of the last session */
+        if (threadCtx->ssh == NULL) {
+            threadCtx->ssh = session_ssh_new(threadCtx);
+            if (threadCtx->ssh == NULL) {
+                continue;
+            }
+        }
+
+        if (threadCtx->nonBlock)
+            tcp_set_nonblocking(&clientFd);
+
+        wolfSSH_set_fd(threadCtx->ssh, clientFd);
+        threadCtx->fd = clientFd;
+        threadCtx->id = id;
+        threadCtx->inUse = 1;
+
+        xTaskNotifyGive(threadCtx->task);
+        ret = threadCtx;
+    }
+
+    return ret;
+}
 
 
 /*
@@ -966,6 +2167,99 @@ static int my_IOSend(WOLFSSH* ssh, void* buff, word32 sz, void* ctx) {
 }
 */
 
+#ifdef SSH_SERVER_KEX_WARMUP
+/* with FP_ECC the base point table is only built on its second use */
+#ifdef FP_ECC
+    #define KEX_WARMUP_ROUNDS 2
+#else
+    #define KEX_WARMUP_ROUNDS 1
+#endif
+
+/* Set by the accept loop once a client is handed to a session. Every task
+ * here runs at tskIDLE_PRIORITY, and higher priorities starve the UART
+ * tasks, so rather than time-slicing with that client's handshake the
+ * warm-up stops after the key it is generating. */
+static volatile int kexWarmupStop = 0;
+
+#ifdef HAVE_ECC
+static void kex_warmup_ecc(WC_RNG* rng, int curveId, int keySz)
+{
+    ecc_key key;
+    int i;
+
+    for (i = 0; (i < KEX_WARMUP_ROUNDS) && !kexWarmupStop; i++) {
+        if (wc_ecc_init(&key) == 0) {
+            if (wc_ecc_make_key_ex(rng, keySz, &key, curveId) != 0) {
+                ESP_LOGW(TAG, "KEX warm-up failed for ECC curve %d", curveId);
+            }
+            wc_ecc_free(&key);
+        }
+    }
+}
+#endif
+
+/*
+ * Generate and discard one key pair per configured KEX curve, so the
+ * lazily built caches and the RNG are ready before the first handshake
+ * has to wait for them. Runs once, then deletes itself.
+ */
+static void kex_warmup_task(void* arg)
+{
+    WC_RNG rng;
+    int64_t start = esp_timer_get_time();
+
+    (void)arg;
+
+    if (wc_InitRng(&rng) == 0) {
+#if defined(HAVE_ECC) && !defined(WOLFSSH_NO_ECDH_SHA2_NISTP256)
+        kex_warmup_ecc(&rng, ECC_SECP256R1, 32);
+#endif
+#if defined(HAVE_ECC384) && !defined(WOLFSSH_NO_ECDH_SHA2_NISTP384)
+        kex_warmup_ecc(&rng, ECC_SECP384R1, 48);
+#endif
+#if defined(HAVE_ECC521) && !defined(WOLFSSH_NO_ECDH_SHA2_NISTP521)
+        kex_warmup_ecc(&rng, ECC_SECP521R1, 66);
+#endif
+#if defined(HAVE_CURVE25519) && !defined(WOLFSSH_NO_CURVE25519_SHA256)
+        {
+            curve25519_key key;
+
+            if (!kexWarmupStop && (wc_curve25519_init(&key) == 0)) {
+                wc_curve25519_make_key(&rng, CURVE25519_KEYSIZE, &key);
+                wc_curve25519_free(&key);
+            }
+        }
+#endif
+        wc_FreeRng(&rng);
+    }
+
+    ESP_LOGI(TAG, "KEX warm-up %s in %d ms",
+                  kexWarmupStop ? "stopped for the first client" : "done",
+                  (int)((esp_timer_get_time() - start) / 1000));
+
+#if defined(FP_ECC) && defined(HAVE_THREAD_LS)
+    /* a per thread cache would only have served this task */
+    wc_ecc_fp_free();
+#endif
+    vTaskDelete(NULL);
+}
+
+/* start the warm-up once; server_test may run again after it exits */
+static void kex_warmup_start(void)
+{
+    static int started = 0;
+
+    if (!started) {
+        started = 1;
+        if (xTaskCreate(kex_warmup_task, "kex_warmup",
+                        SSH_SERVER_KEX_WARMUP_STACK_SZ, NULL,
+                        tskIDLE_PRIORITY, NULL) != pdPASS) {
+            ESP_LOGW(TAG, "Couldn't start the KEX warm-up task.");
+        }
+    }
+}
+#endif /* SSH_SERVER_KEX_WARMUP */
+
 void server_test(void *arg)
 {
     int DEFAULT_PORT = SSH_UART_PORT;
@@ -979,11 +2273,9 @@ void server_test(void *arg)
     /* declare wolfSSL objects */
     WOLFSSH_CTX *ctx = NULL; /* the wolfSSL context object*/
 
-    PwMapList pwMapList;
+    CredentialStore* credentials = NULL;
 
-    word32 defaultHighwater = EXAMPLE_HIGHWATER_MARK;
     word32 threadCount = 0;
-    char multipleConnections = 0;
     char useEcc = 0;
 
 #ifdef HAVE_SIGNAL
@@ -1329,7 +2621,15 @@ void server_test(void *arg)
     }
 
 
-    memset(&pwMapList, 0, sizeof(pwMapList));
+    /* sized once for every credential of the sample buffers */
+    credentials = credential_store_new(
+                      CredentialCount(samplePasswordBuffer) +
+                      CredentialCount(samplePublicKeyEccBuffer) +
+                      CredentialCount(samplePublicKeyRsaBuffer));
+    if (credentials == NULL) {
+        ESP_LOGE(TAG,"Couldn't allocate the credential store.\n");
+        exit(EXIT_FAILURE);
+    }
 
     /* authorization is a callback, so assign it here: wsUserAuth */
     wolfSSH_SetUserAuth(ctx, wsUserAuth);
@@ -1359,7 +2659,7 @@ void server_test(void *arg)
         bufSz = (word32)strlen(samplePasswordBuffer);
         memcpy(buf, samplePasswordBuffer, bufSz);
         buf[bufSz] = 0;
-        ret = LoadPasswordBuffer(buf, bufSz, &pwMapList);
+        ret = LoadPasswordBuffer(buf, bufSz, credentials);
         if (ret != 0) {
             ESP_LOGE(TAG, "Error: failed LoadPasswordBuffer %d", ret);
             exit(EXIT_FAILURE);
@@ -1367,38 +2667,36 @@ void server_test(void *arg)
 
         bufName = useEcc ? samplePublicKeyEccBuffer :
                            samplePublicKeyRsaBuffer;
-        bufSz = (word32)strlen(bufName);
-        memcpy(buf, bufName, bufSz);
-        buf[bufSz] = 0;
-        LoadPublicKeyBuffer(buf, bufSz, &pwMapList);
+        /* parsed in place, no copy needed */
+        ret = LoadPublicKeyBuffer((const byte*)bufName,
+                                  (word32)strlen(bufName), credentials);
         if (ret != 0) {
-            ESP_LOGE(TAG, "Error: failed LoadPasswordBuffer %d", ret);
+            ESP_LOGE(TAG, "Error: failed LoadPublicKeyBuffer %d", ret);
             exit(EXIT_FAILURE);
         }
     }
 
-    listen(sockfd, 5);
+    if (ret == WOLFSSL_SUCCESS) {
+        ret = session_pool_init(ctx, credentials);
+        if (ret != WOLFSSL_SUCCESS) {
+            ESP_LOGE(TAG,"Couldn't prepare the session pool.\n");
+        }
+    }
+
+#ifdef SSH_SERVER_KEX_WARMUP
+    if (ret == WOLFSSL_SUCCESS) {
+        kex_warmup_start();
+    }
+#endif
 
-    do {
+    /*
+     * The accept loop only hands each client to a free slot of the session
+     * pool, so it is ready for the next client at once.
+     */
+    while (ret == WOLFSSL_SUCCESS) {
         int      clientFd = 0;
         struct sockaddr_in clientAddr;
         socklen_t     clientAddrSz = sizeof(clientAddr);
-#ifndef SINGLE_THREADED
-        THREAD_TYPE   thread;
-        ESP_LOGI(TAG,"Did not find SINGLE_THREADED defined");
-#endif
-        WOLFSSH*      ssh;
-
-        /* We'll create a new instance of threadCtx since it will be
-         * handed off to potentially multiple separate threads.
-         */
-        thread_ctx_t* threadCtx;
-
-        threadCtx = (thread_ctx_t*)malloc(sizeof(thread_ctx_t));
-        if (threadCtx == NULL) {
-            ESP_LOGE(TAG,"Couldn't allocate thread context data.\n");
-            exit(EXIT_FAILURE);
-        }
 
         /*
          * optionally register some callbacks (these are not working)
@@ -1406,60 +2704,37 @@ void server_test(void *arg)
         wolfSSH_SetIOSend(ctx, my_IOSend);
          */
 
-        ssh = wolfSSH_new(ctx);
-        if (ssh == NULL) {
-            ESP_LOGE(TAG,"Failed to create ssh object during wolfSSH_new.\n");
-            exit(EXIT_FAILURE);
-        }
-        wolfSSH_SetUserAuthCtx(ssh, &pwMapList);
-        /* Use the session object for its own highwater callback ctx */
-        if (defaultHighwater > 0) {
-            wolfSSH_SetHighwaterCtx(ssh, (void*)ssh);
-            wolfSSH_SetHighwater(ssh, defaultHighwater);
-        }
-
         clientFd = accept(sockfd,
                           (struct sockaddr*)&clientAddr,
                           &clientAddrSz
                          );
 
         if (clientFd == -1) {
-            ESP_LOGI(TAG,"ERROR: failed accept");
-            exit(EXIT_FAILURE);
+            /* typically out of sockets; keep serving the others */
+            ESP_LOGE(TAG,"ERROR: failed accept, errno = %d", errno);
+            vTaskDelay(pdMS_TO_TICKS(100));
+            continue;
         }
 
-        if (WOLFSSL_NONBLOCK)
-            tcp_set_nonblocking(&clientFd);
-
-        wolfSSH_set_fd(ssh, (int)clientFd);
-
-        threadCtx->ssh = ssh;
-        threadCtx->fd = clientFd;
-        threadCtx->id = threadCount++;
-        threadCtx->nonBlock = WOLFSSL_NONBLOCK;
-
-        ESP_LOGI(TAG,"server_worker started.");
-#ifndef SINGLE_THREADED
-    #ifdef WOLFSSH_TEST_THREADING
-        ThreadStart(server_worker, threadCtx, &thread);
+#ifdef SSH_SERVER_KEX_WARMUP
+        /* the handshake about to start gets the CPU to itself */
+        kexWarmupStop = 1;
+#endif
 
-        if (multipleConnections)
-            ThreadDetach(thread);
-        else
-            ThreadJoin(thread);
-    #else
-        /* see "wolfssh/test.h" check user_settings.h */
-        #error "WOLFSSH_TEST_THREADING must be enabled unless SINGLE_THREADED"
-    #endif
-#else
-        server_worker(threadCtx);
-#endif /* SINGLE_THREADED */
-        ESP_LOGI(TAG,"server_worker completed.");
-        vTaskDelay(10);
-    } while (multipleConnections);
+        if (session_pool_assign(clientFd, threadCount++) == NULL) {
+            ESP_LOGW(TAG,"All %d sessions busy, rejecting client.",
+                         SSH_SERVER_MAX_SESSIONS);
+            ssh_metric_add_shared(&ssh_metrics, SSH_METRIC_SESSIONS_REJECTED,
+                                  1);
+            send(clientFd, SSH_SERVER_BUSY_MESSAGE,
+                 sizeof(SSH_SERVER_BUSY_MESSAGE) - 1, 0);
+            close(clientFd);
+        }
+    }
     ESP_LOGI(TAG,"all servers exited.");
 
-    PwMapListDelete(&pwMapList);
+    session_pool_free();
+    credential_store_free(credentials);
     wolfSSH_CTX_free(ctx);
     if (wolfSSH_Cleanup() != WS_SUCCESS) {
         ESP_LOGE(TAG,"Couldn't clean up wolfSSH.\n");
@@ -0,0 +1,42 @@
+/* ssh_trace.c
+ *
+ * Copyright (C) 2014-2024 wolfSSL Inc.
+ *
+ * This file is part of wolfSSH.
+ *
+ * wolfSSH is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfSSH is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wolfSSH.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This file has no RTOS dependencies so that it can also be built on a host */
+#include "ssh_trace.h"
+
+volatile uint32_t ssh_trace_every = 1;
+
+uint32_t ssh_trace_count[SSH_TRACE_SUBSYSTEMS];
+
+void ssh_trace_set_sample(uint32_t every)
+{
+    uint32_t i;
+
+    /* start each subsystem's next sample with its next event */
+    for (i = 0; i < SSH_TRACE_SUBSYSTEMS; i++) {
+        ssh_trace_count[i] = 0;
+    }
+    ssh_trace_every = every;
+}
+
+uint32_t ssh_trace_get_sample(void)
+{
+    return ssh_trace_every;
+}
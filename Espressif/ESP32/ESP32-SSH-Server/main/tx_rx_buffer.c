@@ -1,4 +1,4 @@
-/* uart_hlper.c
+/* tx_rx_buffer.c
  *
  * Copyright (C) 2014-2024 wolfSSL Inc.
  *
@@ -18,10 +18,23 @@
  * along with wolfSSH.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "tx_rx_buffer.h"
+#include "ring_buffer.h"
 #include "int_to_string.h"
+#include "ssh_server_config.h"
+#include "ssh_metrics.h"
 
+#include <freertos/task.h>
 #include <esp_log.h>
-#include <task.h>
+#ifdef SSH_SERVER_SCROLLBACK_PSRAM
+    #include <esp_heap_caps.h>
+#endif
+
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#ifdef ESP_PLATFORM
+    #include <esp_vfs_eventfd.h>
+#endif
 
 #ifdef DISABLE_SSH_UART
 
@@ -32,310 +45,519 @@
     #define SSH_GPIO_MESSAGE    "You are now connected to UART "
     #define SSH_GPIO_MESSAGE_TX "Tx GPIO "
     #define SSH_GPIO_MESSAGE_RX ", Rx GPIO "
+    #if (SSH_SERVER_UART_PORTS > 1)
+    #define SSH_READY_MESSAGE   ".\r\n\r\n"                                 \
+                                "Press [Enter] to start. Ctrl-C to exit, "  \
+                                "Ctrl-] for the next UART."                 \
+                                "\r\n\r\n"
+    #else
     #define SSH_READY_MESSAGE   ".\r\n\r\n"                                 \
                                 "Press [Enter] to start. Ctrl-C to exit."   \
                                 "\r\n\r\n"
+    #endif
 #endif
 
 static const char *TAG = "tx_rx_buf";
 
+/* Shared external, non ssh buffers, one set per UART port: see
+ * SSH_SERVER_UART_ROUTES.
+ *
+ * Neither direction needs a mutex to move data between the UART tasks and
+ * the SSH server_worker tasks:
+ *
+ *   rxRing: SSH client -> UART, single-producer ring
+ *       producer: the attached server_worker, consumer: uart_tx_task.
+ *       wolfSSH decrypts into reserved ring space and the UART driver is
+ *       handed spans of the ring, so the bytes are not copied in between.
+ *
+ *   txRing: UART -> SSH clients, broadcast ring
+ *       producer: uart_rx_task, consumers: every registered server_worker,
+ *       each with its own cursor. The producer never waits for a reader,
+ *       so the ring doubles as the scrollback of the UART output.
+ *
+ * Backpressure: the session holding the write lock stops reading its
+ * client while the Rx ring is full, and uart_tx_task signals it when there
+ * is room again. With UART flow control, uart_rx_task stops reading the
+ * UART while that session has too much of the Tx ring unsent.
+ */
+typedef struct ExternalBuffers {
+    RingBuffer rxRing;
+    BroadcastRing txRing;
+
+    byte rxBuffer[EXT_RX_BUF_MAX_SZ];
+#ifdef SSH_SERVER_SCROLLBACK_PSRAM
+    /* allocated once in PSRAM, see InitExternalBuffers */
+    byte* txBuffer;
+#else
+    byte txBuffer[SSH_SERVER_SCROLLBACK_SZ];
+#endif
 
-/* TODO define size and check when assigning */
-/* Shared external, non ssh buffers. typically the UART */
-volatile static char  _ExternalReceiveBuffer[EXT_RX_BUF_MAX_SZ];
-volatile static char  _ExternalTransmitBuffer[EXT_TX_BUF_MAX_SZ];
-volatile static int _ExternalReceiveBufferSz = 0;
-volatile static int _ExternalTransmitBufferSz = 0;
+    /* uart_tx_task, notified whenever data is added to the Rx ring */
+    volatile TaskHandle_t rxTask;
 
+    /* id of the SSH session holding the write lock, the only producer
+     * into the Rx ring, or -1 when no session is attached to the port */
+    _Atomic int owner;
 
-static SemaphoreHandle_t _xExternalReceiveBuffer_Semaphore = NULL;
-static SemaphoreHandle_t _xExternalTransmitBuffer_Semaphore = NULL;
+    /* the write lock holder's view of the UART output, which it is
+     * signalled on, or NULL */
+    ExternalTransmitReader* _Atomic ownerReader;
 
+    /* the bytes in the Rx ring go out untranslated: they were queued by a
+     * raw session, see ExternalBuffers_Attach. Kept after it detaches
+     * until the ring has drained. */
+    atomic_int raw;
 
-/*
- * initialize the external buffer (typically a UART) Receive Semaphore.
- */
-int InitReceiveSemaphore(void)
-{
-    int ret = ESP_OK;
-    if (_xExternalReceiveBuffer_Semaphore == NULL) {
-        ESP_LOGV(TAG, "Enter InitReceiveSemaphore.");
-
-        /* the case of recursive mutexes is interesting, so alert */
-    #ifdef configUSE_RECURSIVE_MUTEXES
-        /* see semphr.h */
-        ESP_LOGI(TAG,"InitSemaphore UART Rx "
-                     "configUSE_RECURSIVE_MUTEXES enabled");
-    #endif
+    /* set by the write lock holder when it found the Rx ring full */
+    atomic_int rxWaiting;
 
-        _xExternalReceiveBuffer_Semaphore =  xSemaphoreCreateMutex();
-    #ifdef configUSE_RECURSIVE_MUTEXES
-        /* see semphr.h */
-        ESP_LOGV(TAG,"_xExternalReceiveBuffer_Semaphore complete");
-        #ifdef INCLUDE_uxTaskGetStackHighWaterMark
-            ESP_LOGV(TAG, "1 rx Stack HWM: %d\n",
-            uxTaskGetStackHighWaterMark(NULL));
-        #endif
-    #endif
-    }
-    else {
-        ESP_LOGV(TAG, "Rx _xExternalTransmitBuffer_Semaphore "
-                      "already initialized");
+    /* sessions viewing the UART output; each one's eventfd is signalled
+     * whenever data is added to the Tx ring */
+    ExternalTransmitReader* _Atomic readers[SSH_SERVER_MAX_SESSIONS];
+
+    /* bytes that did not fit in the Rx ring and were discarded */
+    volatile uint32_t rxDroppedSz;
+} ExternalBuffers;
+
+static ExternalBuffers _ExternalBuffers[SSH_SERVER_UART_PORTS];
+
+static volatile int _ExternalBuffersReady = 0;
+
+static volatile int _ExternalEventFdReady = 0;
+
+/* the buffers of [port], or NULL when there is no such port */
+static ExternalBuffers* ExternalBuffers_Get(int port)
+{
+    if ((port < 0) || (port >= SSH_SERVER_UART_PORTS)) {
+        return NULL;
     }
-    return ret;
+
+    return &_ExternalBuffers[port];
 }
 
 /*
- * initialize the external buffer (typically a UART) Transmit Semaphore.
+ * initialize the external buffer (typically a UART) rings of every port.
+ * Called once before any task uses the buffers; can be called repeatedly.
  */
-int InitTransmitSemaphore(void)
+static int InitExternalBuffers(void)
 {
     int ret = ESP_OK;
-    if (_xExternalTransmitBuffer_Semaphore == NULL) {
+    int port;
 
-        /* the case of recursive mutexes is interesting, so alert */
-    #ifdef configUSE_RECURSIVE_MUTEXES
-        /* see semphr.h */
-        ESP_LOGI(TAG, "InitSemaphore Tx configUSE_RECURSIVE_MUTEXES enabled");
-    #endif
-    #ifdef INCLUDE_uxTaskGetStackHighWaterMark
-        ESP_LOGV(TAG, "Tx Stack HWM: %d\n", uxTaskGetStackHighWaterMark(NULL));
-    #endif
+    if (_ExternalBuffersReady == 0) {
+        ESP_LOGV(TAG, "Enter InitExternalBuffers.");
+        for (port = 0; (port < SSH_SERVER_UART_PORTS) && (ret == ESP_OK);
+             port++) {
+            ExternalBuffers* ext = &_ExternalBuffers[port];
 
-        _xExternalTransmitBuffer_Semaphore =  xSemaphoreCreateMutex();
+            atomic_store(&ext->owner, -1);
 
-#ifdef configUSE_RECURSIVE_MUTEXES
-        /* see semphr.h */
-        ESP_LOGV(TAG, "_xExternalReceiveBuffer_Semaphore complete");
-    #endif
-    }
-    else {
-        ESP_LOGV(TAG, "Tx _xExternalTransmitBuffer_Semaphore"
-                      "already initialized");
+            if (ring_buffer_init(&ext->rxRing, ext->rxBuffer,
+                                 sizeof(ext->rxBuffer)) != 0) {
+                ESP_LOGE(TAG, "EXT_RX_BUF_MAX_SZ must be a power of two");
+                ret = ESP_FAIL;
+            }
+#ifdef SSH_SERVER_SCROLLBACK_PSRAM
+            if (ext->txBuffer == NULL) {
+                ext->txBuffer = heap_caps_malloc(SSH_SERVER_SCROLLBACK_SZ,
+                                                 MALLOC_CAP_SPIRAM |
+                                                 MALLOC_CAP_8BIT);
+            }
+            if (ext->txBuffer == NULL) {
+                ESP_LOGE(TAG, "No PSRAM for the %d byte scrollback",
+                              SSH_SERVER_SCROLLBACK_SZ);
+                ret = ESP_FAIL;
+            }
+#endif
+            if ((ret == ESP_OK) &&
+                (broadcast_ring_init(&ext->txRing, ext->txBuffer,
+                                     SSH_SERVER_SCROLLBACK_SZ) != 0)) {
+                ESP_LOGE(TAG, "SSH_SERVER_SCROLLBACK_SZ must be a power "
+                              "of two");
+                ret = ESP_FAIL;
+            }
+        }
+        if (ret == ESP_OK) {
+            _ExternalBuffersReady = 1;
+        }
     }
+
     return ret;
 }
 
 /*
- * return true if the Rx buffer is exactly 1 char long and contains charValue
+ * Give session [id] the write lock of [port], so that it becomes the single
+ * SSH side producer into that port's Rx ring (SSH to UART). Any session can
+ * view the UART output, see ExternalTransmitBuffer_AddReader; [reader] is
+ * this session's, the one UART flow control follows and that is signalled
+ * when the Rx ring has room again. It may be NULL.
+ * With [raw] set, what the session queues goes out untranslated, whatever
+ * the map of the port; the lock is not given while bytes the previous
+ * holder queued the other way are still in the ring.
+ * Returns 1 when [id] holds the lock (including if it already did),
+ * 0 when another session does or there is no such port.
  */
-bool __attribute__((optimize("O0")))
-ExternalReceiveBuffer_IsChar(char charValue)
+int ExternalBuffers_Attach(int port, int id, ExternalTransmitReader* reader,
+                           int raw)
 {
-    bool ret = false; /* assume not a match unless proven otherwise */
-    char thisChar; /* typically looking at position 0, e.g. user typing */
-
-    InitReceiveSemaphore();
-    if (xSemaphoreTake(_xExternalReceiveBuffer_Semaphore,
-                       (TickType_t) 10) == pdTRUE) {
-
-        /* the entire thread-safety wrapper is for this code segment */
-        {
-            if (_ExternalReceiveBufferSz == 1)
-            {
-                thisChar =  _ExternalReceiveBuffer[0];
-                ret = (thisChar == charValue);
-           }
-        }
-        xSemaphoreGive(_xExternalReceiveBuffer_Semaphore);
+    ExternalBuffers* ext = ExternalBuffers_Get(port);
+    int expected = -1;
+
+    if ((ext == NULL) || (_ExternalBuffersReady == 0)) {
+        return 0;
     }
-    else {
-        /* we could not get the semaphore to update the value!
-         * TODO how to handle this? */
-        ret = false;
+
+    if (atomic_compare_exchange_strong(&ext->owner, &expected, id)) {
+        if ((atomic_load(&ext->raw) != (raw != 0)) &&
+            (ring_buffer_used(&ext->rxRing) != 0)) {
+            /* uart_tx_task has yet to send them as they were meant */
+            atomic_store(&ext->owner, -1);
+            return 0;
+        }
+        /* before any byte of ours is committed to the ring */
+        atomic_store(&ext->raw, raw != 0);
+        atomic_store(&ext->ownerReader, reader);
+        return 1;
     }
 
-    return ret;
+    return (expected == id);
 }
 
-volatile char* __attribute__((optimize("O0"))) ExternalReceiveBuffer()
+/*
+ * Release the write lock of [port]; no effect unless session [id] holds it.
+ */
+void ExternalBuffers_Detach(int port, int id)
 {
-    return _ExternalReceiveBuffer;
-}
+    ExternalBuffers* ext = ExternalBuffers_Get(port);
+    int expected = id;
 
-volatile char* __attribute__((optimize("O0"))) ExternalTransmitBuffer()
-{
-    return _ExternalTransmitBuffer;
+    if (ext == NULL) {
+        return;
+    }
+
+    if (atomic_load(&ext->owner) == id) {
+        atomic_store(&ext->ownerReader, NULL);
+    }
+    atomic_compare_exchange_strong(&ext->owner, &expected, -1);
 }
 
-/* RTOS-safe positional value of current receive buffer position.
- * care should be take when using the number as more chars may have arrived!
+/*
+ * Create an eventfd for ExternalTransmitBuffer_AddReader, that a session
+ * can select() on together with its client socket. Each session pool
+ * slot creates one and keeps it. Returns the fd, or -1 on failure.
  */
-int ExternalReceiveBufferSz(void)
+int ExternalTransmitBuffer_NewNotifyFd(void)
 {
-    int ret = 0;
+    int ret = -1;
 
-    InitReceiveSemaphore();
-    if (xSemaphoreTake(_xExternalReceiveBuffer_Semaphore,
-                       (TickType_t) 10) == pdTRUE) {
+    if (_ExternalEventFdReady == 0) {
+#ifdef ESP_PLATFORM
+        esp_vfs_eventfd_config_t config = ESP_VFS_EVENTD_CONFIG_DEFAULT();
 
-        /* the entire thread-safety wrapper is for this code statement */
-        {
-            ret = _ExternalReceiveBufferSz;
+        /* ESP_ERR_INVALID_STATE: someone already registered it */
+        if (esp_vfs_eventfd_register(&config) == ESP_ERR_NO_MEM) {
+            ESP_LOGE(TAG, "esp_vfs_eventfd_register failed");
+            return -1;
         }
-        xSemaphoreGive(_xExternalReceiveBuffer_Semaphore);
-    }
-    else {
-        /* we could not get the semaphore to update the value!
-         * TODO how to handle this?  */
-        ret = 0;
+#endif
+        _ExternalEventFdReady = 1;
     }
 
-#ifdef SSH_SERVER_PROFILE
-    if (ret > MaxSeenRxSize) {
-        MaxSeenRxSize = ret;
+    ret = eventfd(0, 0);
+    if (ret < 0) {
+        ESP_LOGE(TAG, "eventfd for the Tx ring failed");
     }
-#endif
+
     return ret;
 }
 
-/* RTOS-safe positional value of current transmit buffer position.
- * care should be take when using the number as more chars may have been sent!
+/*
+ * Register [reader] to view the UART output of [port], starting with up to
+ * the last replaySz bytes of its scrollback, signalling notifyFd whenever
+ * data is added to that port's Tx (UART to SSH) ring. A reader views one
+ * port at a time: remove it before adding it for another.
+ * Returns 0 on success, -1 when all reader slots are taken or there is no
+ * such port.
  */
-int ExternalTransmitBufferSz(void)
+int ExternalTransmitBuffer_AddReader(ExternalTransmitReader* reader,
+                                     int port, int notifyFd, int replaySz)
 {
-    int ret;
+    ExternalBuffers* ext = ExternalBuffers_Get(port);
+    int ret = -1;
+    int i;
+    uint32_t head;
 
-    InitTransmitSemaphore();
-    if (xSemaphoreTake(_xExternalTransmitBuffer_Semaphore,
-                      (TickType_t) 10) == pdTRUE) {
+    if ((reader == NULL) || (ext == NULL) || (replaySz < 0)) {
+        return -1;
+    }
 
-        /* the entire thread-safety wrapper is for this code statement */
-        {
-            ret = _ExternalTransmitBufferSz;
-        }
+    InitExternalBuffers();
 
-        xSemaphoreGive(_xExternalTransmitBuffer_Semaphore);
+    /* the scrollback holds at most SSH_SERVER_SCROLLBACK_SZ bytes, and
+     * no more than have been written since boot */
+    head = broadcast_ring_head(&ext->txRing);
+    if ((uint32_t)replaySz > SSH_SERVER_SCROLLBACK_SZ) {
+        replaySz = SSH_SERVER_SCROLLBACK_SZ;
     }
-    else {
-        /* we could not get the semaphore to update the value!
-         * TODO how to handle this? */
-        ret = 0;
+    if ((uint32_t)replaySz > head) {
+        replaySz = (int)head;
     }
 
-#ifdef SSH_SERVER_PROFILE
-    if (ret > MaxSeenTxSize) {
-        MaxSeenTxSize = ret;
+    reader->port = port;
+    reader->cursor = head - (uint32_t)replaySz;
+    atomic_store_explicit(&reader->seen, reader->cursor,
+                          memory_order_relaxed);
+    reader->skippedSz = 0;
+    reader->notifyFd = notifyFd;
+
+    for (i = 0; (i < SSH_SERVER_MAX_SESSIONS) && (ret != 0); i++) {
+        ExternalTransmitReader* expected = NULL;
+
+        if (atomic_compare_exchange_strong(&ext->readers[i],
+                                           &expected, reader)) {
+            ret = 0;
+        }
     }
-#endif
 
     return ret;
 }
 
 /*
- * returns zero if ExternalReceiveBufferSz successfully assigned
+ * Stop signalling [reader]; its cursor is no longer used.
  */
-int Set_ExternalReceiveBufferSz(int n)
+void ExternalTransmitBuffer_RemoveReader(ExternalTransmitReader* reader)
 {
-    int ret = 0; /* we assume success unless proven otherwise */
+    ExternalBuffers* ext;
+    int i;
 
-    InitReceiveSemaphore();
-    if ((n >= 0) && (n < EXT_RX_BUF_MAX_SZ - 1)) {
-        /* only assign valid buffer sizes */
-        if (xSemaphoreTake(_xExternalReceiveBuffer_Semaphore,
-            (TickType_t) 10) == pdTRUE) {
+    if ((reader == NULL) || ((ext = ExternalBuffers_Get(reader->port))
+                             == NULL)) {
+        return;
+    }
 
-            /* the entire thread-safety wrapper is for this code statement */
-            {
-                _ExternalReceiveBufferSz = n;
+    for (i = 0; i < SSH_SERVER_MAX_SESSIONS; i++) {
+        ExternalTransmitReader* expected = reader;
 
-                /* ensure the next char is zero, in case the stuffer of data
-                 * does not do it */
-                _ExternalReceiveBuffer[n + 1] = 0;
-            }
+        atomic_compare_exchange_strong(&ext->readers[i], &expected, NULL);
+    }
+}
+
+/*
+ * Reset the notification of [reader]. Call when select() reports its fd as
+ * readable, before draining the ring, so that data added during the
+ * drain signals the fd again rather than being missed.
+ */
+void ExternalTransmitBuffer_ClearNotify(ExternalTransmitReader* reader)
+{
+    uint64_t count;
 
-            xSemaphoreGive(_xExternalReceiveBuffer_Semaphore);
+    if ((reader != NULL) && (reader->notifyFd >= 0)) {
+        if (read(reader->notifyFd, &count, sizeof(count)) < 0) {
+            ESP_LOGW(TAG, "Tx ring eventfd read failed");
         }
-        else {
-            /* we could not get the semaphore to update the value! */
-            ret = 1;
+    }
+}
+
+/*
+ * Register the task to be notified when data is added to the Rx ring of
+ * [port]. The task waits with ulTaskNotifyTake; the notification count
+ * means a write between its last drain and its next wait is never missed.
+ */
+void ExternalReceiveBuffer_SetNotifyTask(int port, TaskHandle_t task)
+{
+    ExternalBuffers* ext = ExternalBuffers_Get(port);
+
+    if (ext != NULL) {
+        ext->rxTask = task;
+    }
+}
+
+/*
+ * Point [span] at the contiguous pending Rx (SSH to UART) bytes of [port]
+ * and return the span length. When the data wraps around the end of the
+ * ring, a second call after ExternalReceiveBuffer_Consume returns the rest.
+ * Consumer: the uart_tx_task of [port] only.
+ */
+int ExternalReceiveBuffer_Peek(int port, byte** span)
+{
+    ExternalBuffers* ext = ExternalBuffers_Get(port);
+
+    if (ext == NULL) {
+        return -1;
+    }
+
+    return (int)ring_buffer_peek(&ext->rxRing, span);
+}
+
+/*
+ * Whether the pending Rx bytes of [port] are to go out untranslated. Call
+ * after ExternalReceiveBuffer_Peek; it holds for the whole span.
+ * Consumer: the uart_tx_task of [port] only.
+ */
+int ExternalReceiveBuffer_Raw(int port)
+{
+    ExternalBuffers* ext = ExternalBuffers_Get(port);
+
+    return (ext != NULL) ? atomic_load(&ext->raw) : 0;
+}
+
+/*
+ * Release n bytes previously returned by ExternalReceiveBuffer_Peek, and
+ * wake the write lock holder if it is waiting for room.
+ * Consumer: the uart_tx_task of [port] only.
+ */
+void ExternalReceiveBuffer_Consume(int port, int n)
+{
+    ExternalBuffers* ext = ExternalBuffers_Get(port);
+    ExternalTransmitReader* owner;
+
+    if ((ext != NULL) && (n > 0)) {
+        ring_buffer_consume(&ext->rxRing, (uint32_t)n);
+
+        /* pairs with the fence in ExternalReceiveBuffer_WaitForRoom */
+        atomic_thread_fence(memory_order_seq_cst);
+        if (atomic_load_explicit(&ext->rxWaiting, memory_order_relaxed) &&
+            atomic_exchange(&ext->rxWaiting, 0)) {
+            owner = atomic_load(&ext->ownerReader);
+            if ((owner != NULL) && (owner->notifyFd >= 0)) {
+                uint64_t one = 1;
+                if (write(owner->notifyFd, &one, sizeof(one)) < 0) {
+                    ESP_LOGW(TAG, "Rx ring eventfd write failed");
+                }
+            }
         }
     }
-    else {
-        /* the new length must be between zero and maximum length! */
-        ret = 1;
+}
+
+/*
+ * Lock-free snapshot of the room in the Rx (SSH to UART) ring of [port].
+ */
+int ExternalReceiveBuffer_Free(int port)
+{
+    ExternalBuffers* ext = ExternalBuffers_Get(port);
+
+    return (ext != NULL) ? (int)ring_buffer_free(&ext->rxRing) : 0;
+}
+
+/*
+ * Called by the write lock holder when it finds the Rx ring of [port]
+ * full: have uart_tx_task signal its reader's notifyFd once it frees some
+ * room. Returns the room there is now; when non-zero, go ahead rather than
+ * wait.
+ */
+int ExternalReceiveBuffer_WaitForRoom(int port)
+{
+    ExternalBuffers* ext = ExternalBuffers_Get(port);
+    int ret;
+
+    if (ext == NULL) {
+        return 0;
     }
+
+    atomic_store(&ext->rxWaiting, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    ret = (int)ring_buffer_free(&ext->rxRing);
+    if (ret > 0) {
+        atomic_store(&ext->rxWaiting, 0);
+    }
+
     return ret;
 }
 
-/*
- * returns zero if ExternalTransmitBufferSz successfully assigned
+/* Lock-free snapshot of the pending receive (SSH to UART) byte count of
+ * [port].
+ * care should be take when using the number as more chars may have arrived!
  */
-int Set_ExternalTransmitBufferSz(int n)
+int ExternalReceiveBufferSz(int port)
 {
-    int ret = 0; /* we assume success unless proven otherwise */
+    ExternalBuffers* ext = ExternalBuffers_Get(port);
 
-    InitTransmitSemaphore();
+    return (ext != NULL) ? (int)ring_buffer_used(&ext->rxRing) : 0;
+}
 
-    /* we look at ByteExternalTransmitBufferSz + 1
-     * since we also append our own zero string termination
-     */
-    if ( (n < 0) || (n > EXT_TX_BUF_MAX_SZ + 1) ) {
-        /* New buffer size length must be between zero and maximum length! */
-        ret = 1;
+/* Lock-free snapshot of the transmit (UART to SSH) bytes pending for
+ * [reader], at most the ring size.
+ * care should be take when using the number as more chars may have arrived!
+ */
+int ExternalTransmitBufferSz(ExternalTransmitReader* reader)
+{
+    ExternalBuffers* ext = ExternalBuffers_Get(reader->port);
+    uint32_t pending;
+
+    if (ext == NULL) {
+        return 0;
     }
-    else {
-        /* only assign valid buffer sizes */
-        if (xSemaphoreTake(_xExternalTransmitBuffer_Semaphore,
-            (TickType_t) 10) == pdTRUE) {
 
-            /* the entire thread-safety wrapper is for this code statement */
-            {
-                _ExternalTransmitBufferSz = n;
+    pending = broadcast_ring_head(&ext->txRing) - reader->cursor;
+    return (int)((pending > SSH_SERVER_SCROLLBACK_SZ) ?
+                 SSH_SERVER_SCROLLBACK_SZ : pending);
+}
 
-                /* ensure the next char is zero,
-                 * in case the stuffer of data does not do it */
-                _ExternalTransmitBuffer[n + 1] = 0;
-            }
+/* Lock-free snapshot of the UART output of [port] the write lock holder
+ * has not seen yet, what UART flow control goes by. Zero when no session
+ * holds the lock, or it is not viewing this port's output.
+ */
+int ExternalTransmitBuffer_OwnerBacklog(int port)
+{
+    ExternalBuffers* ext = ExternalBuffers_Get(port);
+    ExternalTransmitReader* owner;
+    uint32_t pending = 0;
+    uint32_t seen;
+    int i;
+
+    if (ext == NULL) {
+        return 0;
+    }
 
-            xSemaphoreGive(_xExternalTransmitBuffer_Semaphore);
+    /* the reader may be idle: registered is what counts */
+    owner = atomic_load(&ext->ownerReader);
+    for (i = 0; (owner != NULL) && (i < SSH_SERVER_MAX_SESSIONS); i++) {
+        if (atomic_load_explicit(&ext->readers[i],
+                                 memory_order_acquire) == owner) {
+            /* before the head, so the head is at least as far along */
+            seen = atomic_load_explicit(&owner->seen, memory_order_acquire);
+            pending = broadcast_ring_head(&ext->txRing) - seen;
+            break;
         }
-        else {
-            /* we could not get the semaphore to update the value! */
-            ret = 1;
-        }
-    } /* valid value of n */
-    return ret;
+    }
+
+    return (int)((pending > SSH_SERVER_SCROLLBACK_SZ) ?
+                 SSH_SERVER_SCROLLBACK_SZ : pending);
 }
 
-/* Set the length of the external (typiclly UART) Rx buffer */
-int Set_ExternalReceiveBuffer(byte *FromData, int sz)
+/* Bytes discarded so far because the receive (SSH to UART) ring of [port]
+ * was full */
+uint32_t ExternalReceiveBuffer_DroppedSz(int port)
 {
-    /* TODO this block has not yet been fully tested */
-    int ret = ESP_OK; /* we assume success unless proven otherwise */
+    ExternalBuffers* ext = ExternalBuffers_Get(port);
+
+    return (ext != NULL) ? ext->rxDroppedSz : 0;
+}
 
-    if ( (sz < 0) || (sz > EXT_RX_BUF_MAX_SZ) ) {
-        /* we'll only do a copy for valid sizes, otherwise return an error */
-        ret = 1;
+/*
+ * Append sz bytes of FromData (typically from the SSH client) to the
+ * external Rx ring of [port] for its UART. Producer: server_worker only.
+ * Returns the number of bytes accepted, negative values are errors.
+ */
+int Set_ExternalReceiveBuffer(int port, byte *FromData, int sz)
+{
+    ExternalBuffers* ext = ExternalBuffers_Get(port);
+    int ret;
+
+    if ((ext == NULL) || (FromData == NULL) || (sz < 0)) {
+        ret = -1;
     }
     else {
-        InitReceiveSemaphore();
-        if (xSemaphoreTake(_xExternalReceiveBuffer_Semaphore,
-            (TickType_t) 10) == pdTRUE) {
-
-            /* The entire thread-safety wrapper is for this code statement.
-             * in a multi-threaded environment, a different thread may be
-             * reading or writing from the data. We need to ensure it is
-             * static at the time of copy.
-             */
-            {
-                memcpy(
-                      (byte*)&_ExternalReceiveBuffer[_ExternalReceiveBufferSz],
-                      FromData,
-                      sz);
-
-                _ExternalReceiveBufferSz = sz;
-            } /* thread safe */
-
-            xSemaphoreGive(_xExternalReceiveBuffer_Semaphore);
+        ret = (int)ring_buffer_write(&ext->rxRing, FromData, (uint32_t)sz);
+        if (ret < sz) {
+            ext->rxDroppedSz += (uint32_t)(sz - ret);
         }
-        else {
-            /* we could not get the semaphore to update the value!
-             * TODO how to handle this? Will this ever occur?
-             * If so, adjust wait time, above. */
-            ESP_LOGW(TAG, "Warning: Set_ExternalReceiveBuffer failed to "
-                          "take semaphore. Consisder wait time adjustment." );
-            ret = 1;
+        ssh_metric_max_shared(&ssh_metrics, SSH_METRIC_RX_RING_PEAK,
+                              ring_buffer_used(&ext->rxRing));
+        if ((ret > 0) && (ext->rxTask != NULL)) {
+            /* wake uart_tx_task; it sleeps with no timeout otherwise */
+            xTaskNotifyGive(ext->rxTask);
         }
     }
 
@@ -343,107 +565,135 @@ int Set_ExternalReceiveBuffer(byte *FromData, int sz)
 }
 
 /*
- * Thread safe populate ToData with the contents of _ExternalTransmitBuffer
- * returns the size of the data, negative values are errors.
+ * Point [span] at contiguous free space in the external Rx ring of [port]
+ * and return its length, so that the SSH client data can be read straight
+ * into the ring instead of being copied in with Set_ExternalReceiveBuffer.
+ * When the free space wraps around the end of the ring, a second call
+ * after ExternalReceiveBuffer_Commit returns the rest.
+ * Producer: server_worker.
  */
-int Get_ExternalTransmitBuffer(byte **ToData)
+int ExternalReceiveBuffer_Reserve(int port, byte** span)
 {
-    int ret = 0;
-    InitTransmitSemaphore();
+    ExternalBuffers* ext = ExternalBuffers_Get(port);
 
-    if (xSemaphoreTake(_xExternalTransmitBuffer_Semaphore,
-        (TickType_t) 10) == pdTRUE) {
+    if (ext == NULL) {
+        return 0;
+    }
 
-        int thisSize = _ExternalTransmitBufferSz;
-        if (thisSize == 0) {
-            /* nothing to do */
-            ESP_LOGI(TAG,"Get_ExternalTransmitBuffer size is already zero");
-        }
+    return (int)ring_buffer_reserve(&ext->rxRing, span);
+}
 
-        else {
-            if (*ToData == NULL) {
-                /* we could not allocate memory, so fail */
-                ret = -1;
-                ESP_LOGI(TAG,"Get_ExternalTransmitBuffer *ToData == NULL");
-            }
-            else {
-                memcpy(*ToData,
-                       (byte*)_ExternalTransmitBuffer,
-                       thisSize
-                      );
-
-                _ExternalTransmitBufferSz = 0;
-                ret = thisSize;
-            }
+/*
+ * Publish n bytes written into the span from ExternalReceiveBuffer_Reserve
+ * to the uart_tx_task of [port]. Producer: server_worker only.
+ */
+void ExternalReceiveBuffer_Commit(int port, int n)
+{
+    ExternalBuffers* ext = ExternalBuffers_Get(port);
+
+    if ((ext != NULL) && (n > 0)) {
+        ring_buffer_commit(&ext->rxRing, (uint32_t)n);
+        ssh_metric_max_shared(&ssh_metrics, SSH_METRIC_RX_RING_PEAK,
+                              ring_buffer_used(&ext->rxRing));
+        if (ext->rxTask != NULL) {
+            xTaskNotifyGive(ext->rxTask);
         }
-        xSemaphoreGive(_xExternalTransmitBuffer_Semaphore);
     }
-    else {
-        /* We could not get the semaphore to update the value!
-         * TODO how to handle this? Wait time adjust? */
+}
+
+/*
+ * Move up to sz bytes of pending external Rx data of [port] (typically
+ * destined for its UART) into ToData. Consumer: uart_tx_task only.
+ * Returns the size of the data, negative values are errors.
+ */
+int Get_ExternalReceiveBuffer(int port, byte *ToData, int sz)
+{
+    ExternalBuffers* ext = ExternalBuffers_Get(port);
+    int ret;
+
+    if ((ext == NULL) || (ToData == NULL) || (sz < 0)) {
         ret = -1;
-        ESP_LOGE(TAG,"ERROR: Get_ExternalTransmitBuffer SemaphoreTake "
-                     "_xExternalTransmitBuffer_Semaphore failed.");
+    }
+    else {
+        ret = (int)ring_buffer_read(&ext->rxRing, ToData, (uint32_t)sz);
     }
 
     return ret;
 }
 
-
 /*
- * Thread safe populate FromData with the contents of _ExternalTransmitBuffer
- * returns the size of the data, negative values are errors.
+ * Copy up to sz bytes of external Tx data (typically from the UART) that
+ * [reader] has not seen yet into ToData. Data the reader was too slow to
+ * see before it was overwritten is skipped, and counted in its skippedSz.
+ * Consumer: the server_worker that owns [reader].
+ * Returns the size of the data, negative values are errors.
  */
-int Set_ExternalTransmitBuffer(byte *FromData, int sz)
+int Get_ExternalTransmitBuffer(ExternalTransmitReader* reader,
+                               byte *ToData, int sz)
 {
-    int ret = 0;
+    ExternalBuffers* ext = NULL;
+    uint32_t skippedSz;
+    int ret;
 
-    /* here we need to call the thread-safe ExternalTransmitBufferSz() */
-    int thisNewSize = sz + ExternalTransmitBufferSz();
+    if (reader != NULL) {
+        ext = ExternalBuffers_Get(reader->port);
+    }
 
-    if ( (sz < 0) || (thisNewSize > EXT_TX_BUF_MAX_SZ) ) {
-        /* we'll only do a copy for valid sizes, otherwise return an error */
+    if ((ext == NULL) || (ToData == NULL) || (sz < 0)) {
         ret = -1;
+        ESP_LOGE(TAG, "Get_ExternalTransmitBuffer ToData == NULL");
     }
     else {
-        InitTransmitSemaphore();
-        if (xSemaphoreTake(_xExternalTransmitBuffer_Semaphore,
-                           (TickType_t) 10) == pdTRUE) {
-
-            /* Trim any trailing zeros from existing data by
-             * adjusting our array pointer. */
-            int thisStart = _ExternalTransmitBufferSz;
-            while (thisStart > 0
-                   &&
-                   (_ExternalTransmitBuffer[thisStart - 1] == 0x0)) {
-                thisStart--;
-            }
+        skippedSz = reader->skippedSz;
+        ret = (int)broadcast_ring_read(&ext->txRing,
+                                       &reader->cursor,
+                                       ToData, (uint32_t)sz,
+                                       &reader->skippedSz);
+        atomic_store_explicit(&reader->seen, reader->cursor,
+                              memory_order_release);
+
+        /* this is where UART output is lost: the ring never refuses it */
+        if (reader->skippedSz != skippedSz) {
+            ssh_metric_add_shared(&ssh_metrics, SSH_METRIC_UART_RX_DROPPED,
+                                  reader->skippedSz - skippedSz);
+        }
+    }
+
+    return ret;
+}
 
-            /* Actual new size may be smaller than above
-             * if we trimmed some zeros. */
-            thisNewSize = thisStart + sz;
-
-            /* The entire thread-safety wrapper is for this code statement.
-             * In a multi-threaded environment, a different thread may be
-             * reading writing from the data. We need to ensure it is static
-             * at the time of copy.
-             */
-            {
-                memcpy((byte*)&_ExternalTransmitBuffer[thisStart],
-                    FromData,
-                    sz);
-
-                _ExternalTransmitBufferSz = thisNewSize;
-                ret = thisNewSize;
+/*
+ * Append sz bytes of FromData (typically from the UART) to the external
+ * Tx ring of [port] for the SSH clients, overwriting the oldest data.
+ * Producer: the uart_rx_task of [port] only.
+ * Returns the number of bytes accepted (always sz), negative values are
+ * errors.
+ */
+int Set_ExternalTransmitBuffer(int port, byte *FromData, int sz)
+{
+    ExternalBuffers* ext = ExternalBuffers_Get(port);
+    int ret;
+    int i;
+
+    if ((ext == NULL) || (FromData == NULL) || (sz < 0)) {
+        ret = -1;
+    }
+    else {
+        broadcast_ring_write(&ext->txRing, FromData, (uint32_t)sz);
+        ret = sz;
+
+        for (i = 0; (i < SSH_SERVER_MAX_SESSIONS) && (ret > 0); i++) {
+            ExternalTransmitReader* reader =
+                atomic_load_explicit(&ext->readers[i],
+                                     memory_order_acquire);
+
+            if ((reader != NULL) && (reader->notifyFd >= 0)) {
+                /* wake that server_worker; it sleeps in select() otherwise */
+                uint64_t one = 1;
+                if (write(reader->notifyFd, &one, sizeof(one)) < 0) {
+                    ESP_LOGW(TAG, "Tx ring eventfd write failed");
+                }
             }
-            xSemaphoreGive(_xExternalTransmitBuffer_Semaphore);
-        }
-        else {
-            /* we could not get the semaphore to update the value!
-             * TODO how to handle this? */
-            ESP_LOGW(TAG, "xSemaphoreTake failed in "
-                          "Set_ExternalTransmitBuffer");
-            ret = -1;
         }
     }
 
@@ -452,40 +702,68 @@ int Set_ExternalTransmitBuffer(byte *FromData, int sz)
 
 
 /*
- * Initialize external buffers and show welcome message.
- * TxPin and RxPin are for display purposes only.
+ * Initialize external buffers. Call once before the UART tasks start;
+ * can be repeatedly called as needed.
  */
-int  init_tx_rx_buffer(byte TxPin, byte RxPin)
+int init_tx_rx_buffer(void)
 {
-    int ret = 0;
+    int ret = InitExternalBuffers();
 
-    char numStr[3] = { ' ', ' ', ' ' }; /* printable 2-digit GPIO numbers */
+#ifdef INCLUDE_uxTaskGetStackHighWaterMark
+    ESP_LOGI(TAG, "Stack HWM: %d\n", uxTaskGetStackHighWaterMark(NULL));
+#endif
+    return ret;
+}
 
-    /* These inits need to be called only once,
-     * but can be repeatedly called as needed. */
-    InitReceiveSemaphore();
-    InitTransmitSemaphore();
+/* append the zero-terminated string str to [msg] at position [pos] */
+static int welcome_append(char* msg, int msgSz, int pos, const char* str)
+{
+    int len = (int)strlen(str);
 
-    /*
-     *  Init and stuff startup message in buffer.
-     */
-    Set_ExternalReceiveBufferSz(0);
-    Set_ExternalTransmitBufferSz(0);
+    if (pos + len > msgSz) {
+        len = msgSz - pos;
+    }
+    memcpy(msg + pos, str, len);
+    return pos + len;
+}
+
+/*
+ * Compose the welcome message into [msg], returning the message length.
+ * Negative values are errors.
+ *
+ * Called by server_worker when it takes the write lock; the caller sends
+ * the message directly to its client, as only uart_rx_task may write to
+ * the Tx ring.
+ * name, TxPin and RxPin are those of the route, for display purposes only;
+ * name may be NULL.
+ */
+int tx_rx_buffer_welcome(const char* name, byte TxPin, byte RxPin,
+                         char* msg, int msgSz)
+{
+    int ret = 0;
+    int pos = 0;
+
+    /* int_to_dec needs 13 chars of scratch space */
+    char numStr[13] = { 0 }; /* printable GPIO numbers */
+
+    if ((msg == NULL) || (msgSz <= 0)) {
+        return -1;
+    }
 
     /* Typically prints: "Welcome to wolfSSL ESP32 SSH UART Server!" */
-    Set_ExternalTransmitBuffer((byte*)SSH_WELCOME_MESSAGE,
-                               sizeof(SSH_WELCOME_MESSAGE)
-                              );
+    pos = welcome_append(msg, msgSz, pos, SSH_WELCOME_MESSAGE);
 
     /* Typically prints "You are now connected to UART " */
-    Set_ExternalTransmitBuffer((byte*)SSH_GPIO_MESSAGE,
-                               sizeof(SSH_GPIO_MESSAGE)
-                              );
+    pos = welcome_append(msg, msgSz, pos, SSH_GPIO_MESSAGE);
+
+    /* the route name, e.g. "uart1, " */
+    if (name != NULL) {
+        pos = welcome_append(msg, msgSz, pos, name);
+        pos = welcome_append(msg, msgSz, pos, ", ");
+    }
 
     /* "Tx GPIO " */
-    Set_ExternalTransmitBuffer((byte*)SSH_GPIO_MESSAGE_TX,
-                               sizeof(SSH_GPIO_MESSAGE_TX)
-                              );
+    pos = welcome_append(msg, msgSz, pos, SSH_GPIO_MESSAGE_TX);
 
     /* The number of the Tx pin, converted to a string.
      *
@@ -494,37 +772,32 @@ int  init_tx_rx_buffer(byte TxPin, byte RxPin)
      * the next one compares RxPin. */
     if (TxPin <= 0x40) {
         int_to_dec((char*)&numStr, TxPin);
-        numStr[2] = 0;
-        Set_ExternalTransmitBuffer((byte*)&numStr, sizeof(numStr));
+        pos = welcome_append(msg, msgSz, pos, numStr);
     }
     else {
         ESP_LOGE(TAG,"ERROR: bad value for TxPin");
-        ret = 1;
+        ret = -1;
     }
 
     /* ", Rx GPIO " */
-    Set_ExternalTransmitBuffer((byte*)SSH_GPIO_MESSAGE_RX,
-                               sizeof(SSH_GPIO_MESSAGE_RX)
-                              );
+    pos = welcome_append(msg, msgSz, pos, SSH_GPIO_MESSAGE_RX);
 
     /* the number of the Rx pin, converted to a string */
     if (RxPin <= 0x40)
     {
         int_to_dec((char*)&numStr, RxPin);
-        numStr[2] = 0;
-        Set_ExternalTransmitBuffer((byte*)&numStr, sizeof(numStr));
+        pos = welcome_append(msg, msgSz, pos, numStr);
     }
     else {
         ESP_LOGE(TAG,"ERROR: bad value for RxPin");
-        ret = 1;
+        ret = -1;
     }
 
     /* typically "Press [Enter] to start. Ctrl-C to exit" */
-    Set_ExternalTransmitBuffer((byte*)SSH_READY_MESSAGE,
-                               sizeof(SSH_READY_MESSAGE)
-                              );
-#ifdef INCLUDE_uxTaskGetStackHighWaterMark
-    ESP_LOGI(TAG, "Stack HWM: %d\n", uxTaskGetStackHighWaterMark(NULL));
-#endif
+    pos = welcome_append(msg, msgSz, pos, SSH_READY_MESSAGE);
+
+    if (ret == 0) {
+        ret = pos;
+    }
     return ret;
 }
@@ -31,28 +31,105 @@
 #include "tx_rx_buffer.h"
 #include "ssh_server_config.h"
 #include "ssh_server.h"
+#include "ssh_trace.h"
+#include "ssh_metrics.h"
 
+#include <freertos/semphr.h>
+#include <freertos/queue.h>
 #include <esp_task_wdt.h>
+#include <esp_timer.h>
 #include <driver/uart.h>
 #include <driver/gpio.h>
 #include <esp_log.h>
 
-/* portTICK_PERIOD_MS is ( ( TickType_t ) 1000 / configTICK_RATE_HZ )
- * configTICK_RATE_HZ is CONFIG_FREERTOS_HZ
- * CONFIG_FREERTOS_HZ is 100
- **/
-#define UART_TICKS_TO_WAIT (20 / portTICK_PERIOD_MS)
+#if (UART_FLOW_CONTROL != UART_FLOW_NONE) && \
+    (UART_FLOW_HIGH_WATER + EXT_RX_BUF_MAX_SZ > SSH_SERVER_SCROLLBACK_SZ)
+    /* a paused session could otherwise still miss output */
+    #error "UART_FLOW_HIGH_WATER is too close to SSH_SERVER_SCROLLBACK_SZ"
+#endif
+
+/* hardware flow control deasserts RTS at this many bytes in the 128 byte
+ * Rx FIFO; software flow control sends XOFF and XON at these levels */
+#define UART_FLOW_RTS_THRESH  100
+#define UART_FLOW_XOFF_THRESH 100
+#define UART_FLOW_XON_THRESH  32
+
+/* while paused by flow control, how often uart_rx_task looks again */
+#define UART_FLOW_POLL_MS 10
+
+/* the rates uart_line_set accepts; the ESP32 UART goes up to 5 Mbaud */
+#define UART_BAUD_MIN 300
+#define UART_BAUD_MAX 5000000
+
+/* A line change is posted to the driver event queue as this event type:
+ * only uart_rx_task, which waits on the queue, reconfigures the driver. */
+#define UART_LINE_EVENT ((uart_event_type_t)UART_EVENT_MAX)
+
+/* how long uart_line_set waits for uart_rx_task, and for the UART to send
+ * what it has at the old rate */
+#define UART_LINE_TIMEOUT_MS 1000
+
+/* uart_tx_task translates this much at a time, the size of the Tx FIFO */
+#define UART_XLATE_CHUNK_SZ 128
 
 /*
  * see examples: https://github.com/espressif/esp-idf/blob/master/examples/peripherals/uart/uart_echo/main/uart_echo_example_main.c
+ * and the event-driven https://github.com/espressif/esp-idf/blob/master/examples/peripherals/uart/uart_events/main/uart_events_example_main.c
  */
 
 
-/* we are going to use a real backspace instead of 0x7f observed */
-const char backspace[1] = { (char)0x08 };
 static SemaphoreHandle_t xUART_Semaphore = NULL;
 static const char* TAG = "uart_helper";
 
+/* the UART ports bridged to SSH, indexed by port number */
+#undef  SSH_SERVER_UART_ROUTE
+#define SSH_SERVER_UART_ROUTE(name, uart, txPin, rxPin, rtsPin, ctsPin,   \
+                              baud)                                        \
+    { (name), (uart), (txPin), (rxPin), (rtsPin), (ctsPin), (baud) },
+
+static const uart_route_t uart_routes[] = {
+    SSH_SERVER_UART_ROUTES
+};
+
+_Static_assert(sizeof(uart_routes) / sizeof(uart_routes[0]) ==
+               SSH_SERVER_UART_PORTS,
+               "SSH_SERVER_UART_PORTS must be the number of routes");
+
+/* the run time state of each port, indexed by port number */
+typedef struct {
+    /* The UART driver posts data, overflow, and error events here;
+     * uart_rx_task blocks on it instead of polling. A new queue comes with
+     * each driver install. */
+    QueueHandle_t queue;
+    int ringSz;                 /* receive ring of the installed driver */
+
+    uart_line_t line;           /* the line settings in effect */
+    uart_line_t settled;        /* and those outside of auto-baud trials */
+    uart_line_t request;        /* a change handed to uart_rx_task */
+    int requestProbing;         /* whether it is an auto-baud trial */
+    esp_err_t result;           /* set by uart_rx_task for the requester */
+    TaskHandle_t requester;     /* notified by uart_rx_task when done */
+    SemaphoreHandle_t change;   /* one line change at a time */
+    SemaphoreHandle_t write;    /* uart_tx_task holds it to write */
+
+    /* the translation of what is sent, see uart_map_set */
+    _Atomic(const UartXlate*) map;
+
+    /* uart_rx_task left data in the driver for flow control */
+    int rxHeld;
+
+    /* while auto-baud listens, the data is counted and discarded */
+    volatile int probing;
+    atomic_uint probeBytes;
+    atomic_uint probeText;
+    atomic_uint probeErrors;
+} uart_port_state_t;
+
+static uart_port_state_t uart_ports[SSH_SERVER_UART_PORTS];
+
+/* the rest of the UART counters are in ssh_metrics */
+static volatile uint32_t uart_rx_last_latency_us = 0;
+
 /*
  * startupMessage is the message before actually connecting to UART in
  * server task thread.
@@ -63,65 +140,545 @@ static char startupMessage[] =
       "\n\n"
       "Press [Enter]\n\n";
 
-void init_UART(void)
+/*
+ * The route of [port], or NULL when there is no such port.
+ */
+const uart_route_t* uart_route_get(int port)
 {
-#if defined(CONFIG_IDF_TARGET_ESP8266)
-    /* TODO */
-    ESP_LOGE(TAG, "Error: init_UART not implemented for ESP8266.");
-#else
-    /* not ESP8266 */
-    ESP_LOGI(TAG, "Begin init_UART.");
+    if ((port < 0) || (port >= SSH_SERVER_UART_PORTS)) {
+        return NULL;
+    }
+
+    return &uart_routes[port];
+}
+
+/*
+ * The port of the route called [name], or -1 when there is none.
+ */
+int uart_route_find(const char* name)
+{
+    int port;
+
+    for (port = 0; (name != NULL) && (port < SSH_SERVER_UART_PORTS); port++) {
+        if (strcmp(uart_routes[port].name, name) == 0) {
+            return port;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * The driver receive ring for [baud]: UART_RX_RING_MS of data at 10 bits a
+ * byte, within UART_RX_RING_SZ and UART_RX_RING_MAX_SZ.
+ */
+static int uart_rx_ring_size(int baud)
+{
+    int sz = (int)((int64_t)baud / 10 * UART_RX_RING_MS / 1000);
+
+    if (sz < UART_RX_RING_SZ) {
+        sz = UART_RX_RING_SZ;
+    }
+    if (sz > UART_RX_RING_MAX_SZ) {
+        sz = UART_RX_RING_MAX_SZ;
+    }
+
+    return sz;
+}
+
+/*
+ * Install the driver for the UART of [route] with a receive ring of
+ * [ringSz] bytes, at the settings of [line]; its events go to [queue].
+ */
+static esp_err_t init_UART_port(const uart_route_t* route,
+                                const uart_line_t* line, int ringSz,
+                                QueueHandle_t* queue)
+{
+    esp_err_t ret;
     int intr_alloc_flags = 0;
     const uart_config_t uart_config = {
-        .baud_rate = BAUD_RATE,
-        .data_bits = UART_DATA_8_BITS,
-        .parity = UART_PARITY_DISABLE,
-        .stop_bits = UART_STOP_BITS_1,
+        .baud_rate = line->baud,
+        .data_bits = line->dataBits,
+        .parity = line->parity,
+        .stop_bits = line->stopBits,
+    #if (UART_FLOW_CONTROL == UART_FLOW_RTS_CTS)
+        .flow_ctrl = UART_HW_FLOWCTRL_CTS_RTS,
+        .rx_flow_ctrl_thresh = UART_FLOW_RTS_THRESH,
+    #else
         .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
+    #endif
     #if !defined(CONFIG_IDF_TARGET_ESP8266)
         .source_clk = UART_SCLK_DEFAULT,
     #endif
     };
 
+    ESP_LOGI(TAG, "UART %d is %s, Tx GPIO %d, Rx GPIO %d, %d baud, "
+                  "%d byte ring.", (int)route->uart, route->name,
+                  route->txPin, route->rxPin, line->baud, ringSz);
+
     #if CONFIG_UART_ISR_IN_IRAM
         intr_alloc_flags = ESP_INTR_FLAG_IRAM;
     #endif
-    /* We won't use a buffer for sending UART_NUM_1 data. */
-    ESP_ERROR_CHECK(uart_driver_install(UART_NUM_1, 2048, 0, 0,
-                                        NULL, intr_alloc_flags));
-    ESP_ERROR_CHECK(uart_param_config(UART_NUM_1, &uart_config));
-    ESP_ERROR_CHECK(uart_set_pin(UART_NUM_1, TXD_PIN, RXD_PIN,
-                                 UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE));
+    /* We won't use a buffer for sending UART data.
+     * The event queue is what lets uart_rx_task sleep until data arrives. */
+    ret = uart_driver_install(route->uart, ringSz, 0,
+                              UART_EVENT_QUEUE_SZ,
+                              queue,
+                              intr_alloc_flags);
+    if (ret == ESP_OK) {
+        ret = uart_param_config(route->uart, &uart_config);
+    }
+    if (ret == ESP_OK) {
+    #if (UART_FLOW_CONTROL == UART_FLOW_RTS_CTS)
+        ret = uart_set_pin(route->uart, route->txPin, route->rxPin,
+                           route->rtsPin, route->ctsPin);
+    #else
+        ret = uart_set_pin(route->uart, route->txPin, route->rxPin,
+                           UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE);
+    #endif
+    }
+    #if (UART_FLOW_CONTROL == UART_FLOW_XON_XOFF)
+    if (ret == ESP_OK) {
+        ret = uart_set_sw_flow_ctrl(route->uart, true,
+                                    UART_FLOW_XON_THRESH,
+                                    UART_FLOW_XOFF_THRESH);
+    }
+    #endif
+
+    /* A partly filled FIFO is reported after this many idle symbol times,
+     * rather than waiting for the FIFO full threshold. */
+    if (ret == ESP_OK) {
+        ret = uart_set_rx_timeout(route->uart, UART_RX_TIMEOUT_SYMBOLS);
+    }
+
+    #ifdef UART_PATTERN_CHR
+    /* Report each UART_PATTERN_CHR (typically a newline) as its own
+     * event, so a complete line is forwarded at once. */
+    if (ret == ESP_OK) {
+        ret = uart_enable_pattern_det_baud_intr(route->uart,
+                                                UART_PATTERN_CHR,
+                                                1, 9, 0, 0);
+    }
+    if (ret == ESP_OK) {
+        ret = uart_pattern_queue_reset(route->uart, UART_EVENT_QUEUE_SZ);
+    }
+    #endif
+
+    return ret;
+}
+
+void init_UART(void)
+{
+#if defined(CONFIG_IDF_TARGET_ESP8266)
+    /* TODO */
+    ESP_LOGE(TAG, "Error: init_UART not implemented for ESP8266.");
+#else
+    /* not ESP8266 */
+    int port;
+
+    ESP_LOGI(TAG, "Begin init_UART.");
+
+    for (port = 0; port < SSH_SERVER_UART_PORTS; port++) {
+        uart_port_state_t* st = &uart_ports[port];
+
+        st->line.baud = uart_routes[port].baud;
+        st->line.dataBits = UART_DATA_8_BITS;
+        st->line.parity = UART_PARITY_DISABLE;
+        st->line.stopBits = UART_STOP_BITS_1;
+        st->settled = st->line;
+        atomic_init(&st->map, uart_xlate_find(UART_XLATE_DEFAULT));
+        if (atomic_load(&st->map) == NULL) {
+            ESP_LOGE(TAG, "No UART_XLATE_DEFAULT %s, sending raw.",
+                          UART_XLATE_DEFAULT);
+            atomic_init(&st->map, uart_xlate_find("raw"));
+        }
+        st->ringSz = uart_rx_ring_size(st->line.baud);
+
+        st->change = xSemaphoreCreateMutex();
+        st->write = xSemaphoreCreateMutex();
+        if ((st->change == NULL) || (st->write == NULL)) {
+            ESP_ERROR_CHECK(ESP_ERR_NO_MEM);
+        }
+
+        ESP_ERROR_CHECK(init_UART_port(&uart_routes[port], &st->line,
+                                       st->ringSz, &st->queue));
+    }
+
+    /* The rings between the UART tasks and SSH must exist before the
+     * UART tasks are started. */
+    ESP_ERROR_CHECK(init_tx_rx_buffer());
 #endif /* CONFIG_IDF_TARGET_ESP8266 */
     ESP_LOGI(TAG, "End init_UART.");
 }
 
+/*
+ * Put the line change requested of [port] into effect. Called by its
+ * uart_rx_task only, the one task waiting on the driver queue, so the
+ * driver can be reinstalled with a ring sized for the new rate; what the
+ * old ring still held is lost with it. uart_tx_task is held off meanwhile,
+ * and what it already wrote is sent at the old rate.
+ */
+static esp_err_t uart_line_apply(int port)
+{
+    uart_port_state_t* st = &uart_ports[port];
+    const uart_route_t* route = &uart_routes[port];
+    const uart_line_t* line = &st->request;
+    int ringSz = uart_rx_ring_size(line->baud);
+    esp_err_t ret;
+
+    xSemaphoreTake(st->write, portMAX_DELAY);
+    uart_wait_tx_done(route->uart, pdMS_TO_TICKS(UART_LINE_TIMEOUT_MS));
+
+    if (ringSz != st->ringSz) {
+        uart_driver_delete(route->uart);
+        st->queue = NULL;
+
+        ret = init_UART_port(route, line, ringSz, &st->queue);
+        if (ret == ESP_OK) {
+            st->ringSz = ringSz;
+        }
+        else {
+            /* back to the settings that worked */
+            ESP_LOGE(TAG, "UART %d reinstall failed, error %d",
+                          (int)route->uart, ret);
+            uart_driver_delete(route->uart);
+            st->queue = NULL;
+            if (init_UART_port(route, &st->line, st->ringSz,
+                               &st->queue) != ESP_OK) {
+                st->queue = NULL;
+            }
+        }
+    }
+    else {
+        ret = uart_set_baudrate(route->uart, (uint32_t)line->baud);
+        if (ret == ESP_OK) {
+            ret = uart_set_word_length(route->uart, line->dataBits);
+        }
+        if (ret == ESP_OK) {
+            ret = uart_set_parity(route->uart, line->parity);
+        }
+        if (ret == ESP_OK) {
+            ret = uart_set_stop_bits(route->uart, line->stopBits);
+        }
+        if (st->probing) {
+            /* received at the rate before */
+            uart_flush_input(route->uart);
+        }
+    }
+
+    if (ret == ESP_OK) {
+        st->line = *line;
+        if (!st->probing) {
+            /* counted here, as uart_rx_task writes the UART counters */
+            if (memcmp(&st->settled, line, sizeof(*line)) != 0) {
+                ssh_metric_add_shared(&ssh_metrics,
+                                      SSH_METRIC_UART_LINE_CHANGES, 1);
+            }
+            st->settled = *line;
+        }
+    }
+
+    xSemaphoreGive(st->write);
+
+    return ret;
+}
+
+/*
+ * Hand [line] to the uart_rx_task of [port] and wait for it to take
+ * effect. With [probing] it is an auto-baud trial: from the change on, the
+ * data is counted rather than forwarded. The caller holds the change lock
+ * of the port.
+ */
+static esp_err_t uart_line_request(int port, const uart_line_t* line,
+                                   int probing)
+{
+    uart_port_state_t* st = &uart_ports[port];
+    uart_event_t event;
+
+    memset(&event, 0, sizeof(event));
+    event.type = UART_LINE_EVENT;
+
+    st->request = *line;
+    st->requestProbing = probing;
+    st->result = ESP_ERR_TIMEOUT;
+    st->requester = xTaskGetCurrentTaskHandle();
+
+    /* a late answer to an earlier request that timed out */
+    ulTaskNotifyTake(pdTRUE, 0);
+
+    if ((st->queue == NULL) ||
+        (xQueueSend(st->queue, &event,
+                    pdMS_TO_TICKS(UART_LINE_TIMEOUT_MS)) != pdTRUE) ||
+        (ulTaskNotifyTake(pdTRUE,
+                          pdMS_TO_TICKS(2 * UART_LINE_TIMEOUT_MS)) == 0)) {
+        return ESP_ERR_TIMEOUT;
+    }
+
+    return st->result;
+}
+
+/*
+ * The line settings of [port] in effect.
+ */
+int uart_line_get(int port, uart_line_t* line)
+{
+    if ((uart_route_get(port) == NULL) || (line == NULL)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    *line = uart_ports[port].line;
+
+    return ESP_OK;
+}
+
+/*
+ * Change the rate, data bits, parity and stop bits of [port] at run time.
+ * Sessions viewing the port carry on; bytes on the wire during the change
+ * may be lost or garbled, as with any line change.
+ */
+int uart_line_set(int port, const uart_line_t* line)
+{
+    uart_port_state_t* st;
+    esp_err_t ret;
+
+    if ((uart_route_get(port) == NULL) || (line == NULL) ||
+        (line->baud < UART_BAUD_MIN) || (line->baud > UART_BAUD_MAX) ||
+        (line->dataBits < UART_DATA_5_BITS) ||
+        (line->dataBits > UART_DATA_8_BITS) ||
+        ((line->parity != UART_PARITY_DISABLE) &&
+         (line->parity != UART_PARITY_EVEN) &&
+         (line->parity != UART_PARITY_ODD)) ||
+        ((line->stopBits != UART_STOP_BITS_1) &&
+         (line->stopBits != UART_STOP_BITS_1_5) &&
+         (line->stopBits != UART_STOP_BITS_2))) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    st = &uart_ports[port];
+
+    xSemaphoreTake(st->change, portMAX_DELAY);
+    ret = uart_line_request(port, line, 0);
+    xSemaphoreGive(st->change);
+
+    if (ret == ESP_OK) {
+        ESP_LOGI(TAG, "%s now %d baud.", uart_routes[port].name, line->baud);
+    }
+    else {
+        ESP_LOGE(TAG, "%s line change failed, error %d",
+                      uart_routes[port].name, ret);
+    }
+
+    return ret;
+}
+
+/*
+ * Find the rate of the device on [port]: listen at each of
+ * UART_AUTOBAUD_RATES in turn, with the data bits, parity and stop bits in
+ * effect, and keep the rate that received the most printable text without
+ * framing errors. A wrong rate garbles most bytes and errs on many.
+ * The settings chosen, or those before when none fit, are in [line].
+ * Returns ESP_ERR_NOT_FOUND when no rate fit.
+ */
+int uart_line_autobaud(int port, uart_line_t* line)
+{
+    static const int rates[] = { UART_AUTOBAUD_RATES };
+    uart_port_state_t* st;
+    uart_line_t trial;
+    uart_line_t best;
+    int bestScore = -1;
+    uint32_t bytes;
+    uint32_t text;
+    uint32_t errors;
+    size_t i;
+    esp_err_t ret;
+
+    if ((uart_route_get(port) == NULL) || (line == NULL)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    st = &uart_ports[port];
+
+    xSemaphoreTake(st->change, portMAX_DELAY);
+    trial = st->line;
+    best = st->line;
+
+    for (i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+        trial.baud = rates[i];
+        /* the first trial starts probing, as it takes effect */
+        if (uart_line_request(port, &trial, 1) != ESP_OK) {
+            continue;
+        }
+
+        atomic_store(&st->probeBytes, 0);
+        atomic_store(&st->probeText, 0);
+        atomic_store(&st->probeErrors, 0);
+        vTaskDelay(pdMS_TO_TICKS(UART_AUTOBAUD_SAMPLE_MS));
+        bytes = atomic_load(&st->probeBytes);
+        text = atomic_load(&st->probeText);
+        errors = atomic_load(&st->probeErrors);
+
+        ESP_LOGI(TAG, "Auto-baud %s %d: %u bytes, %u text, %u errors.",
+                      uart_routes[port].name, trial.baud, (unsigned)bytes,
+                      (unsigned)text, (unsigned)errors);
+
+        if ((bytes >= UART_AUTOBAUD_MIN_BYTES) && (errors * 16 <= bytes) &&
+            (text * 8 >= bytes * 7) &&
+            ((int)text - 16 * (int)errors > bestScore)) {
+            bestScore = (int)text - 16 * (int)errors;
+            best = trial;
+        }
+    }
+
+    ret = uart_line_request(port, &best, 0);
+    if (ret != ESP_OK) {
+        /* uart_rx_task did not get to it: forward the data regardless */
+        st->probing = 0;
+    }
+    xSemaphoreGive(st->change);
+
+    *line = st->line;
+    if ((ret == ESP_OK) && (bestScore < 0)) {
+        ret = ESP_ERR_NOT_FOUND;
+    }
+
+    return ret;
+}
+
+/* the data bits, parity and stop bits of "8N1", "7E2" or "8O1.5" */
+static int uart_line_parse_frame(const char* tok, size_t len,
+                                 uart_line_t* line)
+{
+    if ((len != 3) && !((len == 5) && (strncmp(tok + 2, "1.5", 3) == 0))) {
+        return -1;
+    }
+
+    if ((tok[0] < '5') || (tok[0] > '8')) {
+        return -1;
+    }
+    line->dataBits = (uart_word_length_t)(UART_DATA_5_BITS + (tok[0] - '5'));
+
+    switch (tok[1]) {
+        case 'N': case 'n': line->parity = UART_PARITY_DISABLE; break;
+        case 'E': case 'e': line->parity = UART_PARITY_EVEN;    break;
+        case 'O': case 'o': line->parity = UART_PARITY_ODD;     break;
+        default: return -1;
+    }
+
+    if (len == 5) {
+        line->stopBits = UART_STOP_BITS_1_5;
+    }
+    else if (tok[2] == '1') {
+        line->stopBits = UART_STOP_BITS_1;
+    }
+    else if (tok[2] == '2') {
+        line->stopBits = UART_STOP_BITS_2;
+    }
+    else {
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Update [line] from [spec], a rate and/or a frame such as "57600",
+ * "8E1" or "921600 8N1", separated by spaces or commas; what is not given
+ * is left as it was. Returns 0 on success, -1 when spec has anything else.
+ */
+int uart_line_parse(const char* spec, uart_line_t* line)
+{
+    const char* tok = spec;
+    size_t len;
+
+    if ((spec == NULL) || (line == NULL)) {
+        return -1;
+    }
+
+    for (;;) {
+        tok += strspn(tok, " ,");
+        len = strcspn(tok, " ,");
+        if (len == 0) {
+            break;
+        }
+
+        if (strspn(tok, "0123456789") == len) {
+            line->baud = atoi(tok);
+        }
+        else if (uart_line_parse_frame(tok, len, line) != 0) {
+            return -1;
+        }
+        tok += len;
+    }
+
+    return 0;
+}
+
+/*
+ * Write [line] as e.g. "115200 8N1" to buf. Returns the length.
+ */
+int uart_line_format(const uart_line_t* line, char* buf, int bufSz)
+{
+    static const char parity[] = { 'N', '?', 'E', 'O' };
+
+    return snprintf(buf, (size_t)bufSz, "%d %d%c%s", line->baud,
+                    5 + (int)(line->dataBits - UART_DATA_5_BITS),
+                    parity[line->parity & 3],
+                    (line->stopBits == UART_STOP_BITS_2)   ? "2" :
+                    (line->stopBits == UART_STOP_BITS_1_5) ? "1.5" : "1");
+}
+
+/*
+ * Translate what is sent to [port] with [map] from the next write on: see
+ * uart_xlate.h. Takes no lock; uart_tx_task may still be using the table
+ * before, so a table must never change or be freed once selected.
+ */
+int uart_map_set(int port, const UartXlate* map)
+{
+    if ((uart_route_get(port) == NULL) || (map == NULL)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    atomic_store_explicit(&uart_ports[port].map, map, memory_order_release);
+    ESP_LOGI(TAG, "%s now sends with map %s.", uart_routes[port].name,
+                  map->name);
+
+    return ESP_OK;
+}
+
+/*
+ * The translation table of [port], or NULL.
+ */
+const UartXlate* uart_map_get(int port)
+{
+    if (uart_route_get(port) == NULL) {
+        return NULL;
+    }
+
+    return atomic_load_explicit(&uart_ports[port].map, memory_order_acquire);
+}
+
 /*
  * welcome message
  */
 void uart_send_welcome() {
     static const char *TX_TASK_TAG = "TX_TASK_WELCOME";
-    sendData(TX_TASK_TAG, startupMessage);
+    sendData(TX_TASK_TAG, startupMessage, sizeof(startupMessage) - 1);
 }
 
 
 /*
- *  send character string at char* data to UART
+ * Write len bytes of data, which may hold any byte value, to the first UART.
  */
-int sendData(const char* logName, const char* data) {
-    const int len = strlen(data);
+int sendData(const char* logName, const char* data, int len) {
+    /* note the GPIO pins of that UART may vary */
+    const int txBytes = uart_write_bytes(uart_routes[0].uart, data, len);
 
-    /* note we are always using UART_NUM_1 but the GPIO pins may vary */
-    const int txBytes = uart_write_bytes(UART_NUM_1, data, len);
-
-    ESP_LOGI(logName, "Wrote %d bytes", txBytes);
+    SSH_TRACE(UART_TX, ESP_LOG_INFO, logName, "Wrote %d bytes", txBytes);
 
     return txBytes;
 }
 
 /*
- *  if the external Receive Buffer has data (e.g. from SSH client)
- *  then send that data to the UART (ExternalReceiveBufferSz bytes)
+ *  whenever the external Receive Buffer gets data (e.g. from SSH client)
+ *  send that data to the UART, draining everything pending at once.
  */
 void uart_tx_task(void *arg) {
     /*
@@ -130,32 +687,76 @@ void uart_tx_task(void *arg) {
     static const char *TX_TASK_TAG = "TX_TASK";
     esp_log_level_set(TX_TASK_TAG, ESP_LOG_INFO);
 
+    const int port = (int)(intptr_t)arg;
+    const uart_route_t* route = uart_route_get(port);
+    const UartXlate* map;
+    byte* span = NULL;
+    byte out[UART_XLATE_OUT_SZ(UART_XLATE_CHUNK_SZ)];
+    int outSz;
+    int sz;
+    int i;
+    int n;
+
+    if (route == NULL) {
+        ESP_LOGE(TAG, "ERROR: uart_tx_task for unknown port %d", port);
+        vTaskDelete(NULL);
+        return;
+    }
+
+    /* Set_ExternalReceiveBuffer and ExternalReceiveBuffer_Commit wake us */
+    ExternalReceiveBuffer_SetNotifyTask(port, xTaskGetCurrentTaskHandle());
+
     /* this RTOS task will never exit */
     while (1) {
-        vTaskDelay(10);
+        /* No timeout: while idle this task is never scheduled. */
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        /* Drain the ring. The pending bytes are one contiguous span,
+         * or two when they wrap around the end of the ring. */
+        while ((sz = ExternalReceiveBuffer_Peek(port, &span)) > 0) {
+            SSH_TRACE(UART_TX, ESP_LOG_INFO, TAG, "UART Send Data, %d bytes",
+                      sz);
 
-        if (ExternalReceiveBufferSz() > 0)
-        {
-            ESP_LOGI(TAG,"UART Send Data");
+            /* the table in use for the whole span; uart_map_set may
+             * swap it at any time. None for what a raw session typed. */
+            map = ExternalReceiveBuffer_Raw(port) ? NULL :
+                  atomic_load_explicit(&uart_ports[port].map,
+                                       memory_order_acquire);
 
-            /* We don't want to send 0x7f as a backspace,
-             * we want a real backspace.
-             * TODO: optional character mapping */
-            if (ExternalReceiveBuffer_IsChar(0x7f)) {
-                sendData(TX_TASK_TAG, backspace);
+            /* a line change waits until the bytes are out */
+            xSemaphoreTake(uart_ports[port].write, portMAX_DELAY);
+            if ((map == NULL) || (map->eol == UART_XLATE_EOL_AS_IS)) {
+                /* one to one, e.g. DEL as a real backspace wherever it is
+                 * typed: in place, as the span is ours until consumed */
+                if (map != NULL) {
+                    uart_xlate_run(map, span, (size_t)sz, span);
+                }
+                uart_write_bytes(route->uart, (const char*)span, sz);
+                ssh_metric_add_shared(&ssh_metrics, SSH_METRIC_UART_TX_BYTES,
+                                      (uint32_t)sz);
+                ssh_metric_add_shared(&ssh_metrics, SSH_METRIC_UART_TX_WRITES,
+                                      1);
             }
-            else
-            {
-                sendData(TX_TASK_TAG, (char*)ExternalReceiveBuffer());
+            else {
+                /* an end of line policy adds bytes: a chunk at a time */
+                for (i = 0; i < sz; i += n) {
+                    n = (sz - i < UART_XLATE_CHUNK_SZ) ? sz - i
+                                                       : UART_XLATE_CHUNK_SZ;
+                    outSz = (int)uart_xlate_run(map, span + i, (size_t)n,
+                                                out);
+                    uart_write_bytes(route->uart, (const char*)out, outSz);
+                    ssh_metric_add_shared(&ssh_metrics,
+                                          SSH_METRIC_UART_TX_BYTES,
+                                          (uint32_t)outSz);
+                    ssh_metric_add_shared(&ssh_metrics,
+                                          SSH_METRIC_UART_TX_WRITES, 1);
+                }
             }
+            xSemaphoreGive(uart_ports[port].write);
 
-            /* Once we sent data, reset the pointer to zero to
-             * indicate empty queue. */
-            Set_ExternalReceiveBufferSz(0);
+            /* Releasing the span is what marks it sent. */
+            ExternalReceiveBuffer_Consume(port, sz);
         }
-
-        /* Yield. Let's not be greedy. */
-        taskYIELD();
     }
 }
 
@@ -176,17 +777,166 @@ void InitSemaphore()
 #endif
 }
 
+/*
+ * Snapshot of the UART receive counters.
+ */
+int uart_get_rx_stats(uart_rx_stats_t* stats)
+{
+    int ret = ESP_OK;
+
+    if (stats == NULL) {
+        ret = ESP_ERR_INVALID_ARG;
+    }
+    else {
+        SshMetrics* m = &ssh_metrics;
+
+        stats->events          = ssh_metric_get(m, SSH_METRIC_UART_EVENTS);
+        stats->rx_bytes        = ssh_metric_get(m, SSH_METRIC_UART_RX_BYTES);
+        stats->dropped_bytes   = ssh_metric_get(m,
+                                                SSH_METRIC_UART_RX_DROPPED);
+        stats->fifo_overflows  = ssh_metric_get(m,
+                                            SSH_METRIC_UART_FIFO_OVERFLOWS);
+        stats->buffer_full     = ssh_metric_get(m,
+                                                SSH_METRIC_UART_BUFFER_FULL);
+        stats->pattern_detect  = ssh_metric_get(m,
+                                            SSH_METRIC_UART_PATTERN_DETECT);
+        stats->frame_errors    = ssh_metric_get(m,
+                                                SSH_METRIC_UART_FRAME_ERRORS);
+        stats->parity_errors   = ssh_metric_get(m,
+                                               SSH_METRIC_UART_PARITY_ERRORS);
+        stats->breaks          = ssh_metric_get(m, SSH_METRIC_UART_BREAKS);
+        stats->last_latency_us = uart_rx_last_latency_us;
+        stats->max_latency_us  = atomic_load_explicit(
+                                     &m->max[SSH_HIST_UART_RX_LATENCY],
+                                     memory_order_relaxed);
+    }
+
+    return ret;
+}
+
+/*
+ * With UART flow control, whether to leave the data of [port] in the
+ * driver: the session typing to it has more of its output to send than
+ * UART_FLOW_HIGH_WATER. Once the driver ring is full, the UART holds off
+ * the device.
+ */
+static int uart_rx_paused(int port)
+{
+#if (UART_FLOW_CONTROL != UART_FLOW_NONE)
+    return ExternalTransmitBuffer_OwnerBacklog(port) > UART_FLOW_HIGH_WATER;
+#else
+    (void)port;
+    return 0;
+#endif
+}
+
+/*
+ * Auto-baud: count the [sz] bytes received at a trial rate, and how many
+ * of them look like text, instead of forwarding them.
+ */
+static void uart_rx_probe(uart_port_state_t* st, const uint8_t* data, int sz)
+{
+    uint32_t text = 0;
+    int i;
+
+    for (i = 0; i < sz; i++) {
+        if (((data[i] >= 0x20) && (data[i] < 0x7f)) ||
+            (data[i] == '\r') || (data[i] == '\n') || (data[i] == '\t')) {
+            text++;
+        }
+    }
+
+    atomic_fetch_add(&st->probeBytes, (uint32_t)sz);
+    atomic_fetch_add(&st->probeText, text);
+}
+
+/*
+ * Move everything the UART driver of [port] has buffered into its External
+ * Transmit ring, using [data] of [dataSz] bytes as a bounce buffer, unless
+ * flow control says to stop; rxHeld is then set for the port.
+ * Returns the number of bytes moved to the ring.
+ */
+static int uart_rx_forward(int port, uint8_t* data, int dataSz,
+                           int64_t wakeTime)
+{
+    uart_port_state_t* st = &uart_ports[port];
+    int total = 0;
+    int rxBytes;
+    uint32_t latency;
+
+    do {
+        if (!st->probing && uart_rx_paused(port)) {
+            if (!st->rxHeld) {
+                ssh_metric_add_shared(&ssh_metrics, SSH_METRIC_UART_FLOW_PAUSES,
+                                      1);
+                SSH_TRACE(UART_RX, ESP_LOG_INFO, TAG, "Flow control: pause");
+            }
+            st->rxHeld = 1;
+            break;
+        }
+        st->rxHeld = 0;
+
+        /* The data is already in the driver ring: don't wait for more. */
+        rxBytes = uart_read_bytes(uart_routes[port].uart, data, dataSz, 0);
+
+        if ((rxBytes > 0) && st->probing) {
+            uart_rx_probe(st, data, rxBytes);
+        }
+        else if (rxBytes > 0) {
+            SSH_TRACE(UART_RX, ESP_LOG_INFO, "RX_TASK", "Read %d bytes",
+                      rxBytes);
+
+            /* this can be helpful during debug, but causes a bit of
+             * sluggish performance as it is not very RTOS friendly:
+
+             ESP_LOG_BUFFER_HEXDUMP(RX_TASK_TAG, data, rxBytes, ESP_LOG_INFO);
+
+              *
+              */
+
+            /* the ring takes it all, overwriting the oldest data; a
+             * session too slow to see that counts the loss as it reads */
+            if (Set_ExternalTransmitBuffer(port, data, rxBytes) < 0) {
+                ESP_LOGE(TAG, "Tx ring of port %d is not set up, %d bytes "
+                              "lost", port, rxBytes);
+            }
+            else {
+                total += rxBytes;
+            }
+        }
+    } while (rxBytes == dataSz);
+
+    if (total > 0) {
+        ssh_metric_add_shared(&ssh_metrics, SSH_METRIC_UART_RX_BYTES,
+                              (uint32_t)total);
+
+        /* time from the driver waking us to the data being in the ring */
+        latency = (uint32_t)(esp_timer_get_time() - wakeTime);
+        uart_rx_last_latency_us = latency;
+        ssh_hist_record_shared(&ssh_metrics, SSH_HIST_UART_RX_LATENCY, latency);
+    }
+
+    return total;
+}
+
 /*
  * for any data received FROM the UART, put it in the External Transmit
  * buffer to SEND (typically out to the SSH client)
  */
 void uart_rx_task(void *arg) {
+    const int port = (int)(intptr_t)arg;
+    const uart_route_t* route = uart_route_get(port);
+    uart_port_state_t* st = NULL;
+    uart_event_t event;
+    int64_t wakeTime;
+    int run = 1;
+
     InitSemaphore();
 
     /* TODO do we really want malloc? probably not.
      * but in this thread, it only gets allocated once.
      **/
-    uint8_t* data = (uint8_t*) malloc(EXT_RX_BUF_MAX_SZ + 1);
+    uint8_t* data = (uint8_t*) malloc(EXT_RX_BUF_MAX_SZ);
 
     /*
      * when we receive chars from UART, we'll send them out SSH
@@ -194,41 +944,112 @@ void uart_rx_task(void *arg) {
     static const char *RX_TASK_TAG = "RX_TASK";
     esp_log_level_set(RX_TASK_TAG, ESP_LOG_INFO);
 
-    ESP_LOGW(TAG, "-- Start RX_TASK");
+    ESP_LOGW(TAG, "-- Start RX_TASK, port %d", port);
 
-    /* TODO this should be interrupt driven, rather than polling */
-    while (1) {
-        /* note some examples have UART_TICKS_TO_WAIT = 1000,
-         * which results in very sluggish response.
-         * a known good value is (20 / portTICK_RATE_MS) */
-        vTaskDelay(10);
-        const int rxBytes = uart_read_bytes(UART_NUM_1,
-                                            data,
-                                            EXT_RX_BUF_MAX_SZ,
-                                            UART_TICKS_TO_WAIT);
+    if (route != NULL) {
+        st = &uart_ports[port];
+    }
 
-        if (rxBytes > 0) {
-            ESP_LOGI(TAG,"UART Rx Data!");
-            data[rxBytes] = 0;
+    if ((data == NULL) || (st == NULL) || (st->queue == NULL)) {
+        ESP_LOGE(TAG, "ERROR: uart_rx_task needs a buffer and init_UART");
+        free(data);
+        vTaskDelete(NULL);
+        return;
+    }
 
-            ESP_LOGI(RX_TASK_TAG, "Read %d bytes:", rxBytes);
+    /* Sleep until the UART driver has something for us. There is no
+     * polling interval, so bytes are forwarded as soon as they arrive;
+     * only while flow control holds data in the driver do we look again
+     * every UART_FLOW_POLL_MS. */
+    while (run) {
+        if (xQueueReceive(st->queue, (void*)&event,
+                          st->rxHeld ? pdMS_TO_TICKS(UART_FLOW_POLL_MS)
+                                     : portMAX_DELAY) != pdTRUE) {
+            if (st->rxHeld) {
+                uart_rx_forward(port, data, EXT_RX_BUF_MAX_SZ,
+                                esp_timer_get_time());
+            }
+            continue;
+        }
+        wakeTime = esp_timer_get_time();
+        ssh_metric_add_shared(&ssh_metrics, SSH_METRIC_UART_EVENTS, 1);
 
-            /* this can be helpful during debug, but causes a bit of
-             * sluggish performance as it is not very RTOS friendly:
+        switch (event.type) {
+            case UART_DATA:
+                uart_rx_forward(port, data, EXT_RX_BUF_MAX_SZ, wakeTime);
+                break;
 
-             ESP_LOGI(RX_TASK_TAG, "Read %d bytes: '%s'", rxBytes, data);
-             ESP_LOG_BUFFER_HEXDUMP(RX_TASK_TAG, data, rxBytes, ESP_LOG_INFO);
+            case UART_BUFFER_FULL:
+                /* The driver ring is full but still valid: forward it
+                 * rather than discarding it, as the example does. */
+                ssh_metric_add_shared(&ssh_metrics, SSH_METRIC_UART_BUFFER_FULL,
+                                      1);
+                uart_rx_forward(port, data, EXT_RX_BUF_MAX_SZ, wakeTime);
+                break;
 
-              *
-              */
+            case UART_FIFO_OVF:
+                /* Hardware FIFO overflow: bytes were already lost and the
+                 * stream is out of step, so start over clean. */
+                ssh_metric_add_shared(&ssh_metrics,
+                                      SSH_METRIC_UART_FIFO_OVERFLOWS, 1);
+                ESP_LOGW(TAG, "UART FIFO overflow");
+                uart_flush_input(route->uart);
+                /* The queue is left alone: a line change may be waiting in
+                 * it, and the data events still queued find nothing. */
+                break;
+
+            case UART_PATTERN_DET:
+                ssh_metric_add_shared(&ssh_metrics,
+                                      SSH_METRIC_UART_PATTERN_DETECT, 1);
+            #ifdef UART_PATTERN_CHR
+                /* keep the driver pattern position queue from filling */
+                uart_pattern_pop_pos(route->uart);
+            #endif
+                uart_rx_forward(port, data, EXT_RX_BUF_MAX_SZ, wakeTime);
+                break;
 
-            Set_ExternalTransmitBuffer(data, rxBytes);
-        } /* (rxBytes > 0) */
+            case UART_FRAME_ERR:
+                ssh_metric_add_shared(&ssh_metrics,
+                                      SSH_METRIC_UART_FRAME_ERRORS, 1);
+                atomic_fetch_add(&st->probeErrors, 1);
+                break;
 
-        /* yield. let's not be greedy */
-        taskYIELD();
+            case UART_PARITY_ERR:
+                ssh_metric_add_shared(&ssh_metrics,
+                                      SSH_METRIC_UART_PARITY_ERRORS, 1);
+                atomic_fetch_add(&st->probeErrors, 1);
+                break;
+
+            case UART_BREAK:
+                /* also what a rate too fast makes of a start bit */
+                ssh_metric_add_shared(&ssh_metrics, SSH_METRIC_UART_BREAKS, 1);
+                atomic_fetch_add(&st->probeErrors, 1);
+                break;
+
+            case UART_LINE_EVENT:
+                /* from uart_line_request: forward what came at the old
+                 * settings, then change them; an auto-baud trial counts
+                 * only what arrives at its own */
+                uart_rx_forward(port, data, EXT_RX_BUF_MAX_SZ, wakeTime);
+                st->probing = st->requestProbing;
+                st->result = uart_line_apply(port);
+                if (st->requester != NULL) {
+                    xTaskNotifyGive(st->requester);
+                }
+                if (st->queue == NULL) {
+                    ESP_LOGE(TAG, "ERROR: %s has no driver", route->name);
+                    run = 0;
+                }
+                break;
+
+            default:
+                SSH_TRACE(UART_RX, ESP_LOG_VERBOSE, TAG,
+                          "UART event type: %d", event.type);
+                break;
+        }
     }
 
-    /* we never actually get here */
+    /* only when the driver could not be reinstalled */
     free(data);
+    vTaskDelete(NULL);
 }
@@ -0,0 +1,207 @@
+/* uart_xlate.c
+ *
+ * Copyright (C) 2014-2024 wolfSSL Inc.
+ *
+ * This file is part of wolfSSH.
+ *
+ * wolfSSH is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfSSH is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wolfSSH.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This file has no RTOS dependencies so that it can also be built on a host */
+#include "uart_xlate.h"
+
+#include <string.h>
+
+/* consecutive byte values, to spell out a 256 entry map */
+#define XLATE_SEQ4(n)  (n), (n) + 1, (n) + 2, (n) + 3
+#define XLATE_SEQ16(n) XLATE_SEQ4(n), XLATE_SEQ4((n) + 4), \
+                       XLATE_SEQ4((n) + 8), XLATE_SEQ4((n) + 12)
+#define XLATE_SEQ64(n) XLATE_SEQ16(n), XLATE_SEQ16((n) + 16), \
+                       XLATE_SEQ16((n) + 32), XLATE_SEQ16((n) + 48)
+
+/* the identity, but CR sent as [cr] and DEL as [del] */
+#define XLATE_MAP(cr, del)                                              \
+    XLATE_SEQ4(0x00), XLATE_SEQ4(0x04), XLATE_SEQ4(0x08), 0x0c, (cr),   \
+    0x0e, 0x0f, XLATE_SEQ16(0x10), XLATE_SEQ16(0x20), XLATE_SEQ16(0x30), \
+    XLATE_SEQ16(0x40), XLATE_SEQ16(0x50), XLATE_SEQ16(0x60),            \
+    XLATE_SEQ4(0x70), XLATE_SEQ4(0x74), XLATE_SEQ4(0x78), 0x7c, 0x7d,   \
+    0x7e, (del), XLATE_SEQ64(0x80), XLATE_SEQ64(0xc0)
+
+static const uint8_t xlateMapCheck[] = { XLATE_MAP(0x0d, 0x7f) };
+_Static_assert(sizeof(xlateMapCheck) == 256, "XLATE_MAP must be 256 bytes");
+
+/* in flash: each is only read */
+static const UartXlate xlateBuiltins[] = {
+    { .name = "raw",  .map = { XLATE_MAP(0x0d, 0x7f) },
+      .eol = UART_XLATE_EOL_AS_IS,   .identity = 1, .only = -1, .eolIn = -1 },
+    { .name = "bs",   .map = { XLATE_MAP(0x0d, 0x08) },
+      .eol = UART_XLATE_EOL_AS_IS,   .only = 0x7f,  .eolIn = -1 },
+    { .name = "crlf", .map = { XLATE_MAP(0x0d, 0x08) },
+      .eol = UART_XLATE_EOL_CR_CRLF, .only = 0x7f,  .eolIn = 0x0d },
+    { .name = "lf",   .map = { XLATE_MAP(0x0a, 0x08) },
+      .eol = UART_XLATE_EOL_AS_IS,   .only = -1,    .eolIn = -1 },
+};
+
+void uart_xlate_init(UartXlate* t, const char* name, UartXlateEol eol)
+{
+    int i;
+
+    t->name = name;
+    for (i = 0; i < 256; i++) {
+        t->map[i] = (uint8_t)i;
+    }
+    t->eol = eol;
+    uart_xlate_update(t);
+}
+
+void uart_xlate_update(UartXlate* t)
+{
+    int trigger = (t->eol == UART_XLATE_EOL_CR_CRLF) ? '\r' :
+                  (t->eol == UART_XLATE_EOL_LF_CRLF) ? '\n' : -1;
+    int changed = 0;
+    int expanded = 0;
+    int i;
+
+    t->only = -1;
+    t->eolIn = -1;
+    for (i = 0; i < 256; i++) {
+        if (t->map[i] != i) {
+            t->only = (int16_t)i;
+            changed++;
+        }
+        if (t->map[i] == trigger) {
+            t->eolIn = (int16_t)i;
+            expanded++;
+        }
+    }
+    if (changed != 1) {
+        t->only = -1;
+    }
+    if (expanded != 1) {
+        t->eolIn = -1;
+    }
+    t->identity = (changed == 0) && (trigger < 0);
+}
+
+/* the byte map alone, one to one; out may be in */
+static void uart_xlate_map(const UartXlate* t, const uint8_t* in, size_t sz,
+                           uint8_t* out)
+{
+    const uint8_t* map = t->map;
+    const uint8_t* at;
+    size_t i = 0;
+
+    if (t->only >= 0) {
+        /* typically DEL as BS: copy, then fix the few bytes found by
+         * memchr, which tests a word or more at a time */
+        if (out != in) {
+            memcpy(out, in, sz);
+        }
+        while ((i < sz) &&
+               (at = memchr(in + i, t->only, sz - i)) != NULL) {
+            i = (size_t)(at - in);
+            out[i++] = map[t->only];
+        }
+        return;
+    }
+
+    /* four independent loads and stores a step, which the compiler keeps
+     * in flight together */
+    for (; i + 4 <= sz; i += 4) {
+        out[i]     = map[in[i]];
+        out[i + 1] = map[in[i + 1]];
+        out[i + 2] = map[in[i + 2]];
+        out[i + 3] = map[in[i + 3]];
+    }
+    for (; i < sz; i++) {
+        out[i] = map[in[i]];
+    }
+}
+
+size_t uart_xlate_run(const UartXlate* t, const uint8_t* in, size_t sz,
+                      uint8_t* out)
+{
+    const uint8_t* at;
+    size_t run;
+    size_t i = 0;
+    size_t n = 0;
+    uint8_t b;
+
+    if (t->eol == UART_XLATE_EOL_AS_IS) {
+        if (!t->identity) {
+            uart_xlate_map(t, in, sz, out);
+        }
+        else if (out != in) {
+            memcpy(out, in, sz);
+        }
+        return sz;
+    }
+
+    if (t->eolIn >= 0) {
+        /* a line at a time: map the run up to the end of line byte, then
+         * send CR LF for it, whichever policy */
+        while (i < sz) {
+            at = memchr(in + i, t->eolIn, sz - i);
+            run = (at != NULL) ? (size_t)(at - in) - i : sz - i;
+            uart_xlate_map(t, in + i, run, out + n);
+            i += run;
+            n += run;
+            if (at != NULL) {
+                out[n++] = '\r';
+                out[n++] = '\n';
+                i++;
+            }
+        }
+        return n;
+    }
+
+    /* several bytes end a line: a byte at a time */
+    for (; i < sz; i++) {
+        b = t->map[in[i]];
+        if ((b == '\r') && (t->eol == UART_XLATE_EOL_CR_CRLF)) {
+            out[n++] = '\r';
+            b = '\n';
+        }
+        else if ((b == '\n') && (t->eol == UART_XLATE_EOL_LF_CRLF)) {
+            out[n++] = '\r';
+        }
+        out[n++] = b;
+    }
+
+    return n;
+}
+
+const UartXlate* uart_xlate_find(const char* name)
+{
+    size_t i;
+
+    for (i = 0; (name != NULL) &&
+                (i < sizeof(xlateBuiltins) / sizeof(xlateBuiltins[0])); i++) {
+        if (strcmp(xlateBuiltins[i].name, name) == 0) {
+            return &xlateBuiltins[i];
+        }
+    }
+
+    return NULL;
+}
+
+const UartXlate* uart_xlate_builtin(int i)
+{
+    if ((i < 0) ||
+        ((size_t)i >= sizeof(xlateBuiltins) / sizeof(xlateBuiltins[0]))) {
+        return NULL;
+    }
+
+    return &xlateBuiltins[i];
+}
@@ -0,0 +1,483 @@
+/* authorized_keys_test.c
+ *
+ * Copyright (C) 2014-2024 wolfSSL Inc.
+ *
+ * This file is part of wolfSSH.
+ *
+ * wolfSSH is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfSSH is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wolfSSH.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Host unit test of the incremental authorized_keys parser of the ESP32
+ * SSH server (authorized_keys.h there): base64 with and without padding
+ * and the partial quads at the end of a key, quoted options with escaped
+ * quotes and spaces, CRLF line ends, a key blob whose type is not the one
+ * the line names, key type and user names too long to keep, and a file fed
+ * split at every byte and in chunks of every size.
+ * Exits non-zero at the first failure.
+ */
+
+#include "authorized_keys.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* the credential type keys are stored as; any will do */
+#define AK_TEST_CRED_TYPE 2
+
+#define AK_TEST_BLOB_SZ 160
+#define AK_TEST_LINE_SZ 512
+#define AK_TEST_FILE_SZ 2048
+
+static int failures = 0;
+
+#define AK_CHECK(cond)                                                      \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);      \
+            failures++;                                                     \
+        }                                                                   \
+    } while (0)
+
+/* a key blob as OpenSSH writes it: the type as a 32-bit length and the
+ * name, then payloadSz bytes standing in for the key */
+typedef struct {
+    byte   data[AK_TEST_BLOB_SZ];
+    word32 sz;
+    byte   digest[CREDENTIAL_DIGEST_SZ];
+} AkTestBlob;
+
+/* what loading a text left behind */
+typedef struct {
+    CredentialStore* store;
+    word32 keys;
+    word32 errors;
+    word32 errorLine;
+} AkTestResult;
+
+static void ak_test_blob(AkTestBlob* blob, const char* type,
+                         word32 payloadSz, byte seed)
+{
+    word32 typeSz = (word32)strlen(type);
+    wc_Sha256 sha;
+    word32 i;
+
+    blob->data[0] = (byte)(typeSz >> 24);
+    blob->data[1] = (byte)(typeSz >> 16);
+    blob->data[2] = (byte)(typeSz >> 8);
+    blob->data[3] = (byte)typeSz;
+    memcpy(blob->data + 4, type, typeSz);
+    for (i = 0; i < payloadSz; i++) {
+        blob->data[4 + typeSz + i] = (byte)(seed + i * 7);
+    }
+    blob->sz = 4 + typeSz + payloadSz;
+
+    wc_InitSha256(&sha);
+    wc_Sha256Update(&sha, blob->data, blob->sz);
+    wc_Sha256Final(&sha, blob->digest);
+    wc_Sha256Free(&sha);
+}
+
+/* base64 of the blob into out, with the '=' padding or without; returns
+ * the length */
+static int ak_test_base64(const AkTestBlob* blob, int pad, char* out)
+{
+    static const char alphabet[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    word32 v;
+    word32 i;
+    int len = 0;
+
+    for (i = 0; i + 3 <= blob->sz; i += 3) {
+        v = ((word32)blob->data[i] << 16) | ((word32)blob->data[i + 1] << 8)
+            | blob->data[i + 2];
+        out[len++] = alphabet[(v >> 18) & 0x3F];
+        out[len++] = alphabet[(v >> 12) & 0x3F];
+        out[len++] = alphabet[(v >> 6) & 0x3F];
+        out[len++] = alphabet[v & 0x3F];
+    }
+    if (blob->sz - i == 1) {
+        v = (word32)blob->data[i] << 16;
+        out[len++] = alphabet[(v >> 18) & 0x3F];
+        out[len++] = alphabet[(v >> 12) & 0x3F];
+        if (pad) {
+            out[len++] = '=';
+            out[len++] = '=';
+        }
+    }
+    else if (blob->sz - i == 2) {
+        v = ((word32)blob->data[i] << 16) | ((word32)blob->data[i + 1] << 8);
+        out[len++] = alphabet[(v >> 18) & 0x3F];
+        out[len++] = alphabet[(v >> 12) & 0x3F];
+        out[len++] = alphabet[(v >> 6) & 0x3F];
+        if (pad) {
+            out[len++] = '=';
+        }
+    }
+    out[len] = '\0';
+
+    return len;
+}
+
+/* "<prefix><base64><suffix>" into line */
+static void ak_test_line(char* line, const char* prefix,
+                         const AkTestBlob* blob, int pad, const char* suffix)
+{
+    char key[AK_TEST_BLOB_SZ * 2];
+
+    ak_test_base64(blob, pad, key);
+    snprintf(line, AK_TEST_LINE_SZ, "%s%s%s", prefix, key, suffix);
+}
+
+/* parse text in chunks of chunkSz, or split once at split when chunkSz is
+ * 0, into a new store */
+static int ak_test_load(AkTestResult* r, const char* text, word32 textSz,
+                        word32 chunkSz, word32 split)
+{
+    AuthorizedKeys ak;
+    word32 pos = 0;
+    word32 n;
+    int ret;
+
+    r->store = credential_store_new(16);
+    ret = (r->store == NULL) ? -1 :
+          authorized_keys_init(&ak, r->store, AK_TEST_CRED_TYPE);
+
+    if ((ret == 0) && (chunkSz == 0)) {
+        ret = authorized_keys_update(&ak, (const byte*)text, split);
+        if (ret == 0) {
+            ret = authorized_keys_update(&ak, (const byte*)text + split,
+                                         textSz - split);
+        }
+    }
+    while ((ret == 0) && (chunkSz > 0) && (pos < textSz)) {
+        n = (textSz - pos < chunkSz) ? textSz - pos : chunkSz;
+        ret = authorized_keys_update(&ak, (const byte*)text + pos, n);
+        pos += n;
+    }
+    if (ret == 0) {
+        ret = authorized_keys_final(&ak);
+    }
+
+    r->keys = (ret == 0) ? ak.keys : 0;
+    r->errors = (ret == 0) ? ak.errors : 0;
+    r->errorLine = (ret == 0) ? ak.errorLine : 0;
+
+    return ret;
+}
+
+/* one line alone: whether it stored the blob for name, or was skipped */
+static int ak_test_one(const char* line, const char* name,
+                       const AkTestBlob* blob)
+{
+    AkTestResult r;
+    int match = -1;
+
+    if (ak_test_load(&r, line, (word32)strlen(line), 1024, 0) == 0) {
+        if ((r.keys == 1) && (r.errors == 0) &&
+            (credential_store_check(r.store, AK_TEST_CRED_TYPE,
+                                    (const byte*)name, (word32)strlen(name),
+                                    blob->digest) == CREDENTIAL_MATCH)) {
+            match = 1;
+        }
+        else if ((r.keys == 0) && (r.errors == 1) && (r.errorLine == 1)) {
+            match = 0;
+        }
+    }
+    credential_store_free(r.store);
+
+    return match;
+}
+
+static void ak_test_padding(void)
+{
+    char line[AK_TEST_LINE_SZ];
+    char key[AK_TEST_BLOB_SZ * 2];
+    AkTestBlob blob;
+    word32 payloadSz;
+    int len;
+    int pad;
+
+    /* blobs of every length mod 3, so the key ends on a whole quad, or
+     * two or three characters into one */
+    for (payloadSz = 30; payloadSz < 36; payloadSz++) {
+        ak_test_blob(&blob, "ssh-ed25519", payloadSz, (byte)payloadSz);
+        for (pad = 0; pad <= 1; pad++) {
+            ak_test_line(line, "ssh-ed25519 ", &blob, pad, " jill\n");
+            AK_CHECK(ak_test_one(line, "jill", &blob) == 1);
+        }
+
+        len = ak_test_base64(&blob, 1, key);
+        if (blob.sz % 3 == 0) {
+            /* a whole quad takes no padding */
+            snprintf(line, sizeof(line), "ssh-ed25519 %s= jill\n", key);
+            AK_CHECK(ak_test_one(line, "jill", &blob) == 0);
+            continue;
+        }
+
+        /* one '=' too many, or too few */
+        snprintf(line, sizeof(line), "ssh-ed25519 %s= jill\n", key);
+        AK_CHECK(ak_test_one(line, "jill", &blob) == 0);
+        key[len - 1] = '\0';
+        if (blob.sz % 3 == 1) {
+            snprintf(line, sizeof(line), "ssh-ed25519 %s jill\n", key);
+            AK_CHECK(ak_test_one(line, "jill", &blob) == 0);
+        }
+
+        /* a character after the padding */
+        key[len - 1] = '=';
+        snprintf(line, sizeof(line), "ssh-ed25519 %sA jill\n", key);
+        AK_CHECK(ak_test_one(line, "jill", &blob) == 0);
+    }
+
+    /* a single character left over holds no byte */
+    ak_test_blob(&blob, "ssh-ed25519", 33, 1);
+    ak_test_base64(&blob, 0, key);
+    snprintf(line, sizeof(line), "ssh-ed25519 %sA jill\n", key);
+    AK_CHECK(ak_test_one(line, "jill", &blob) == 0);
+
+    /* '=' where the key data is, and a character that is not base64 */
+    key[8] = '=';
+    snprintf(line, sizeof(line), "ssh-ed25519 %s jill\n", key);
+    AK_CHECK(ak_test_one(line, "jill", &blob) == 0);
+    key[8] = '*';
+    snprintf(line, sizeof(line), "ssh-ed25519 %s jill\n", key);
+    AK_CHECK(ak_test_one(line, "jill", &blob) == 0);
+}
+
+static void ak_test_options(void)
+{
+    char line[AK_TEST_LINE_SZ];
+    AkTestBlob blob;
+
+    ak_test_blob(&blob, "ecdsa-sha2-nistp256", 104, 3);
+
+    ak_test_line(line, "no-pty,no-agent-forwarding ecdsa-sha2-nistp256 ",
+                 &blob, 1, " jill\n");
+    AK_CHECK(ak_test_one(line, "jill", &blob) == 1);
+
+    /* spaces, escaped quotes and an escaped backslash inside the quotes */
+    ak_test_line(line, "command=\"echo \\\"a b\\\" \\\\\",no-pty "
+                 "ecdsa-sha2-nistp256 ", &blob, 1, " jill\n");
+    AK_CHECK(ak_test_one(line, "jill", &blob) == 1);
+
+    /* a key type inside the quotes is still the options */
+    ak_test_line(line, "from=\"10.0.0.1\",command=\"ssh-rsa x\" "
+                 "ecdsa-sha2-nistp256 ", &blob, 1, " jill\n");
+    AK_CHECK(ak_test_one(line, "jill", &blob) == 1);
+
+    /* the line ends before the closing quote */
+    ak_test_line(line, "command=\"echo \\\" ecdsa-sha2-nistp256 ",
+                 &blob, 1, " jill\n");
+    AK_CHECK(ak_test_one(line, "jill", &blob) == 0);
+
+    /* no user after the key */
+    ak_test_line(line, "ecdsa-sha2-nistp256 ", &blob, 1, "\n");
+    AK_CHECK(ak_test_one(line, "jill", &blob) == 0);
+}
+
+static void ak_test_crlf(void)
+{
+    char line[AK_TEST_LINE_SZ];
+    AkTestBlob blob;
+
+    ak_test_blob(&blob, "ssh-rsa", 140, 5);
+
+    /* the '\r' is not part of the user name or of the key */
+    ak_test_line(line, "ssh-rsa ", &blob, 1, " jill\r\n");
+    AK_CHECK(ak_test_one(line, "jill", &blob) == 1);
+    ak_test_line(line, "ssh-rsa ", &blob, 1, " jill laptop\r\n");
+    AK_CHECK(ak_test_one(line, "jill", &blob) == 1);
+    ak_test_line(line, "ssh-rsa ", &blob, 0, "\r jill\r\n");
+    AK_CHECK(ak_test_one(line, "jill", &blob) == 1);
+
+    /* a CRLF comment and blank line before it */
+    ak_test_line(line, "# keys\r\n\r\nssh-rsa ", &blob, 1, " jill\r\n");
+    AK_CHECK(ak_test_one(line, "jill", &blob) == 1);
+}
+
+static void ak_test_blob_type(void)
+{
+    char line[AK_TEST_LINE_SZ];
+    AkTestBlob blob;
+
+    /* the same length, another name */
+    ak_test_blob(&blob, "ssh-dss", 60, 7);
+    ak_test_line(line, "ssh-rsa ", &blob, 1, " jill\n");
+    AK_CHECK(ak_test_one(line, "jill", &blob) == 0);
+
+    /* another length */
+    ak_test_blob(&blob, "ssh-ed25519", 32, 7);
+    ak_test_line(line, "ssh-rsa ", &blob, 1, " jill\n");
+    AK_CHECK(ak_test_one(line, "jill", &blob) == 0);
+
+    /* a prefix of the line's type */
+    ak_test_blob(&blob, "ssh-ed", 32, 7);
+    ak_test_line(line, "ssh-ed25519 ", &blob, 1, " jill\n");
+    AK_CHECK(ak_test_one(line, "jill", &blob) == 0);
+
+    /* a blob that ends inside the type */
+    blob.sz = 4 + 3;
+    ak_test_line(line, "ssh-ed ", &blob, 1, " jill\n");
+    AK_CHECK(ak_test_one(line, "jill", &blob) == 0);
+}
+
+static void ak_test_long_type(void)
+{
+    char line[AK_TEST_LINE_SZ];
+    char type[AUTHORIZED_KEYS_TYPE_MAX_SZ + 2];
+    char prefix[AUTHORIZED_KEYS_TYPE_MAX_SZ + 16];
+    AkTestBlob blob;
+
+    /* the longest type kept, as the first word and after options */
+    memset(type, 'x', sizeof(type));
+    memcpy(type, "ssh-", 4);
+    type[AUTHORIZED_KEYS_TYPE_MAX_SZ] = '\0';
+    ak_test_blob(&blob, type, 32, 9);
+
+    snprintf(prefix, sizeof(prefix), "%s ", type);
+    ak_test_line(line, prefix, &blob, 1, " jill\n");
+    AK_CHECK(ak_test_one(line, "jill", &blob) == 1);
+    snprintf(prefix, sizeof(prefix), "no-pty %s ", type);
+    ak_test_line(line, prefix, &blob, 1, " jill\n");
+    AK_CHECK(ak_test_one(line, "jill", &blob) == 1);
+
+    /* one more character is skipped, wherever it is */
+    type[AUTHORIZED_KEYS_TYPE_MAX_SZ] = 'x';
+    type[AUTHORIZED_KEYS_TYPE_MAX_SZ + 1] = '\0';
+    ak_test_blob(&blob, type, 32, 9);
+
+    snprintf(prefix, sizeof(prefix), "%s ", type);
+    ak_test_line(line, prefix, &blob, 1, " jill\n");
+    AK_CHECK(ak_test_one(line, "jill", &blob) == 0);
+    snprintf(prefix, sizeof(prefix), "no-pty %s ", type);
+    ak_test_line(line, prefix, &blob, 1, " jill\n");
+    AK_CHECK(ak_test_one(line, "jill", &blob) == 0);
+}
+
+static void ak_test_long_name(void)
+{
+    char line[AK_TEST_LINE_SZ];
+    char name[CREDENTIAL_NAME_MAX_SZ + 2];
+    char suffix[CREDENTIAL_NAME_MAX_SZ + 16];
+    AkTestBlob blob;
+
+    ak_test_blob(&blob, "ssh-ed25519", 32, 17);
+
+    /* the longest name the store keeps */
+    memset(name, 'n', sizeof(name));
+    name[CREDENTIAL_NAME_MAX_SZ] = '\0';
+    snprintf(suffix, sizeof(suffix), " %s\n", name);
+    ak_test_line(line, "ssh-ed25519 ", &blob, 1, suffix);
+    AK_CHECK(ak_test_one(line, name, &blob) == 1);
+
+    /* one more character is skipped, not cut to a name that fits */
+    name[CREDENTIAL_NAME_MAX_SZ] = 'n';
+    name[CREDENTIAL_NAME_MAX_SZ + 1] = '\0';
+    snprintf(suffix, sizeof(suffix), " %s\n", name);
+    ak_test_line(line, "ssh-ed25519 ", &blob, 1, suffix);
+    AK_CHECK(ak_test_one(line, name, &blob) == 0);
+    snprintf(suffix, sizeof(suffix), " %s laptop\r\n", name);
+    ak_test_line(line, "ssh-ed25519 ", &blob, 1, suffix);
+    AK_CHECK(ak_test_one(line, name, &blob) == 0);
+}
+
+static void ak_test_chunks(void)
+{
+    static const char* const names[] = { "alice", "bob", "carol", "dave" };
+    char text[AK_TEST_FILE_SZ];
+    char line[AK_TEST_LINE_SZ];
+    AkTestBlob blobs[4];
+    AkTestBlob wrong;
+    AkTestResult r;
+    word32 textSz;
+    word32 k;
+    word32 i;
+    int ret;
+    int bad;
+
+    ak_test_blob(&blobs[0], "ssh-ed25519", 32, 11);
+    ak_test_blob(&blobs[1], "ecdsa-sha2-nistp256", 104, 12);
+    ak_test_blob(&blobs[2], "ssh-rsa", 139, 13);
+    ak_test_blob(&blobs[3], "ssh-ed25519", 33, 14);
+    ak_test_blob(&wrong, "ssh-dss", 40, 15);
+
+    /* keys on lines 2, 3, 6 and 8, which has no '\n'; 4 and 7 are bad */
+    strcpy(text, "# authorized_keys\n");
+    ak_test_line(line, "ssh-ed25519 ", &blobs[0], 1, " alice laptop\r\n");
+    strcat(text, line);
+    ak_test_line(line, "command=\"echo \\\"hi there\\\"\",no-pty "
+                 "ecdsa-sha2-nistp256 ", &blobs[1], 0, " bob\n");
+    strcat(text, line);
+    ak_test_line(line, "ssh-rsa ", &wrong, 1, " eve\n");
+    strcat(text, line);
+    strcat(text, "\r\n");
+    ak_test_line(line, "  ssh-rsa ", &blobs[2], 1, "\tcarol\n");
+    strcat(text, line);
+    ak_test_line(line, "ssh-ed25519 ", &blobs[0], 1, "= mallory\n");
+    strcat(text, line);
+    ak_test_line(line, "ssh-ed25519 ", &blobs[3], 1, " dave");
+    strcat(text, line);
+    textSz = (word32)strlen(text);
+
+    /* split in two at every byte, then in chunks of every size */
+    for (k = 0; k <= 2 * textSz; k++) {
+        if (k <= textSz) {
+            ret = ak_test_load(&r, text, textSz, 0, k);
+        }
+        else {
+            ret = ak_test_load(&r, text, textSz, k - textSz, 0);
+        }
+
+        bad = (ret != 0) || (r.keys != 4) || (r.errors != 2) ||
+              (r.errorLine != 4);
+        for (i = 0; (i < 4) && !bad; i++) {
+            bad = credential_store_check(r.store, AK_TEST_CRED_TYPE,
+                                         (const byte*)names[i],
+                                         (word32)strlen(names[i]),
+                                         blobs[i].digest) != CREDENTIAL_MATCH;
+        }
+        bad = bad || (credential_store_check(r.store, AK_TEST_CRED_TYPE,
+                                             (const byte*)"eve", 3,
+                                             wrong.digest)
+                      != CREDENTIAL_NO_USER);
+        credential_store_free(r.store);
+
+        if (bad) {
+            fprintf(stderr, "chunks: wrong at %s %u\n",
+                    (k <= textSz) ? "split" : "chunk size",
+                    (unsigned)((k <= textSz) ? k : k - textSz));
+            failures++;
+            break;
+        }
+    }
+}
+
+int main(void)
+{
+    ak_test_padding();
+    ak_test_options();
+    ak_test_crlf();
+    ak_test_blob_type();
+    ak_test_long_type();
+    ak_test_long_name();
+    ak_test_chunks();
+
+    if (failures == 0) {
+        printf("authorized_keys_test: all tests passed\n");
+    }
+
+    return (failures == 0) ? 0 : 1;
+}
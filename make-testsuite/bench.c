@@ -0,0 +1,1556 @@
+/* bench.c
+ *
+ * Copyright (C) 2014-2024 wolfSSL Inc.
+ *
+ * This file is part of wolfSSH.
+ *
+ * wolfSSH is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfSSH is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wolfSSH.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Host benchmark: an in-process wolfSSH server and client threads talking
+ * over socketpairs (or TCP loopback with -l). Every connection does a full
+ * handshake with password authentication, waits for one byte from the
+ * server (time to first byte), then streams -b bytes to the server.
+ *
+ * Each combination of the -x, -c and -m lists is run in turn and reported
+ * as a table, or with -j as one JSON object per line for regression
+ * tracking. The -w and -r lists repeat that for each server window size
+ * and round trip time; a relay thread between client and server delays
+ * each direction by half the round trip. -a benchmarks the credential
+ * store of the ESP32 SSH server instead, -g the cost of its data path
+ * logging, -e its scan of client data for control characters, and -s its
+ * lock-free UART ring against the mutex-guarded buffer it replaced.
+ */
+
+#include <wolfssl/wolfcrypt/settings.h>
+#include <wolfssl/wolfcrypt/types.h>
+#include <wolfssh/ssh.h>
+#include <wolfssh/error.h>
+#include <wolfssh/version.h>
+
+#include "credential_store.h"
+#include "session_arena.h"
+#include "escape_scan.h"
+#include "uart_xlate.h"
+#include "ring_buffer.h"
+
+/* for -g: the same trace compiled out, and compiled in */
+#define SSH_TRACE_LEVEL_UART_RX ESP_LOG_WARN
+#define SSH_TRACE_LEVEL_SESSION ESP_LOG_INFO
+#include "ssh_trace.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <esp_log.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+/* the algorithm list setters appeared in wolfSSH v1.4.15 */
+#if defined(LIBWOLFSSH_VERSION_HEX) && LIBWOLFSSH_VERSION_HEX >= 0x01004015
+    #define BENCH_HAVE_ALGO_LIST
+#endif
+
+#if defined(MATH_CHOICE_SP)
+    #define BENCH_MATH "sp"
+#elif defined(MATH_CHOICE_FAST)
+    #define BENCH_MATH "fast"
+#else
+    #define BENCH_MATH "normal"
+#endif
+
+#define BENCH_USER        "bench"
+#define BENCH_PASSWORD    "bench"
+#define BENCH_CHUNK_SZ    16384
+#define BENCH_LIST_MAX    16
+#define BENCH_KEY_MAX_SZ  4096
+
+/* what the delay relay can hold in flight, per direction */
+#define BENCH_RELAY_CHUNKS   256
+#define BENCH_RELAY_CHUNK_SZ 4096
+
+typedef struct BenchConfig {
+    int         connections;   /* per thread */
+    int         threads;
+    word32      bytes;         /* streamed per connection */
+    int         useTcp;
+    int         json;
+    word32      arenaSz;       /* per server session, 0 for the heap */
+    word32      maxPacketSz;   /* server side, 0 for the default */
+    word32      windowSz;      /* server side, of the run in progress */
+    int         rttMs;         /* of the run in progress */
+    const char* hostKey;       /* "ecc" or "rsa" */
+    char*       kex[BENCH_LIST_MAX];
+    char*       cipher[BENCH_LIST_MAX];
+    char*       mac[BENCH_LIST_MAX];
+    char*       window[BENCH_LIST_MAX];
+    char*       rtt[BENCH_LIST_MAX];
+    int         kexSz;
+    int         cipherSz;
+    int         macSz;
+    int         windowListSz;
+    int         rttListSz;
+} BenchConfig;
+
+/* what one connection measured, in seconds */
+typedef struct BenchSample {
+    double handshake;
+    double ttfb;
+    double transfer;
+    word32 arenaPeak;
+    word32 arenaFallbacks;
+    int    ok;
+} BenchSample;
+
+typedef struct BenchWorker {
+    pthread_t    thread;
+    WOLFSSH_CTX* clientCtx;
+    BenchSample* samples;      /* config.connections of them */
+    SessionArena arena;        /* for its server side, with -z */
+    byte*        arenaBuf;
+} BenchWorker;
+
+/* one server side connection */
+typedef struct BenchConn {
+    int           fd;
+    int           ok;
+    SessionArena* arena;
+    word32        arenaPeak;
+    word32        arenaFallbacks;
+} BenchConn;
+
+/* bytes one direction of a relay holds, due to leave at [due] */
+typedef struct BenchChunk {
+    double due;
+    word32 sz;
+    word32 done;
+    byte   data[BENCH_RELAY_CHUNK_SZ];
+} BenchChunk;
+
+/* delays the traffic between a client and its server connection */
+typedef struct BenchRelay {
+    pthread_t   thread;
+    int         fd[2];         /* client side, server side */
+    double      delay;         /* each way, in seconds */
+    BenchChunk* queue[2];      /* BENCH_RELAY_CHUNKS each, by source */
+} BenchRelay;
+
+static BenchConfig config = {
+    20, 1, 1024 * 1024, 0, 0, 0, 0, 0, 0, "ecc",
+    { NULL }, { NULL }, { NULL }, { NULL }, { NULL }, 0, 0, 0, 0, 0
+};
+
+static WOLFSSH_CTX* serverCtx = NULL;
+static int listenFd = -1;
+static struct sockaddr_in listenAddr;
+
+
+static double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int bench_cmp(const void* a, const void* b)
+{
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+
+    return (x > y) - (x < y);
+}
+
+/* nearest rank percentile of sorted [v] */
+static double bench_pct(const double* v, int n, int pct)
+{
+    int i;
+
+    if (n == 0) {
+        return 0;
+    }
+    i = (pct * n + 99) / 100 - 1;
+    if (i < 0) {
+        i = 0;
+    }
+    return v[i];
+}
+
+/* split a comma separated list in place */
+static int bench_split(char* list, char** out)
+{
+    int n = 0;
+    char* tok;
+
+    for (tok = strtok(list, ","); tok != NULL && n < BENCH_LIST_MAX;
+         tok = strtok(NULL, ",")) {
+        out[n++] = tok;
+    }
+
+    return n;
+}
+
+static int bench_load_file(const char* name, byte* buf, word32 bufSz)
+{
+    FILE* f = fopen(name, "rb");
+    size_t sz = 0;
+
+    if (f != NULL) {
+        sz = fread(buf, 1, bufSz, f);
+        fclose(f);
+    }
+
+    return (int)sz;
+}
+
+
+static int bench_server_auth(byte authType, WS_UserAuthData* authData,
+                             void* ctx)
+{
+    (void)ctx;
+
+    if (authType != WOLFSSH_USERAUTH_PASSWORD) {
+        return WOLFSSH_USERAUTH_INVALID_AUTHTYPE;
+    }
+    if (authData->sf.password.passwordSz != sizeof(BENCH_PASSWORD) - 1 ||
+        memcmp(authData->sf.password.password, BENCH_PASSWORD,
+               sizeof(BENCH_PASSWORD) - 1) != 0) {
+        return WOLFSSH_USERAUTH_INVALID_PASSWORD;
+    }
+
+    return WOLFSSH_USERAUTH_SUCCESS;
+}
+
+static int bench_client_auth(byte authType, WS_UserAuthData* authData,
+                             void* ctx)
+{
+    (void)ctx;
+
+    if (authType != WOLFSSH_USERAUTH_PASSWORD) {
+        return WOLFSSH_USERAUTH_FAILURE;
+    }
+    authData->sf.password.password = (byte*)BENCH_PASSWORD;
+    authData->sf.password.passwordSz = sizeof(BENCH_PASSWORD) - 1;
+
+    return WOLFSSH_USERAUTH_SUCCESS;
+}
+
+/* the server is our own, any host key will do */
+static int bench_public_key_check(const byte* pubKey, word32 pubKeySz,
+                                  void* ctx)
+{
+    (void)pubKey;
+    (void)pubKeySz;
+    (void)ctx;
+
+    return 0;
+}
+
+
+static int bench_send(WOLFSSH* ssh, const byte* data, word32 sz)
+{
+    int ret = WS_SUCCESS;
+
+    while (sz > 0) {
+        ret = wolfSSH_stream_send(ssh, (byte*)data, sz);
+        if (ret > 0) {
+            data += ret;
+            sz -= (word32)ret;
+            ret = WS_SUCCESS;
+        }
+        else if (ret == WS_WINDOW_FULL) {
+            /* wait for the peer's window adjust */
+            ret = wolfSSH_worker(ssh, NULL);
+            if (ret < 0 && ret != WS_CHAN_RXD && ret != WS_WANT_READ) {
+                break;
+            }
+        }
+        else if (ret != WS_WANT_WRITE) {
+            break;
+        }
+    }
+
+    return (sz == 0) ? WS_SUCCESS : ret;
+}
+
+static int bench_recv(WOLFSSH* ssh, byte* buf, word32 bufSz, word32 sz)
+{
+    int ret = WS_SUCCESS;
+
+    while (sz > 0) {
+        ret = wolfSSH_stream_read(ssh, buf, (sz < bufSz) ? sz : bufSz);
+        if (ret > 0) {
+            sz -= (word32)ret;
+            ret = WS_SUCCESS;
+        }
+        else if (ret != WS_WANT_READ) {
+            break;
+        }
+    }
+
+    return (sz == 0) ? WS_SUCCESS : ret;
+}
+
+
+static void* bench_server(void* arg)
+{
+    BenchConn* conn = (BenchConn*)arg;
+    WOLFSSH* ssh;
+    static byte mark = '!';
+    byte buf[BENCH_CHUNK_SZ];
+    int ret = WS_FATAL_ERROR;
+
+    if (conn->fd < 0) {
+        conn->fd = accept(listenFd, NULL, NULL);
+    }
+
+    /* as a session task of the ESP32 server does */
+    session_arena_enter(conn->arena);
+
+    ssh = wolfSSH_new(serverCtx);
+    if (ssh != NULL && conn->fd >= 0) {
+        wolfSSH_set_fd(ssh, conn->fd);
+
+        ret = wolfSSH_accept(ssh);
+        if (ret == WS_SUCCESS) {
+            ret = bench_send(ssh, &mark, 1);
+        }
+        if (ret == WS_SUCCESS && config.bytes > 0) {
+            ret = bench_recv(ssh, buf, sizeof(buf), config.bytes);
+            if (ret == WS_SUCCESS) {
+                ret = bench_send(ssh, &mark, 1);
+            }
+        }
+        if (ret == WS_SUCCESS) {
+            /* until the client hangs up */
+            while (wolfSSH_stream_read(ssh, buf, sizeof(buf)) > 0)
+                ;
+        }
+    }
+
+    conn->ok = (ret == WS_SUCCESS);
+    wolfSSH_free(ssh);
+    if (conn->fd >= 0) {
+        close(conn->fd);
+    }
+
+    if (conn->arena != NULL) {
+        conn->arenaPeak = conn->arena->peak;
+        conn->arenaFallbacks = conn->arena->fallbacks;
+        if (session_arena_release(conn->arena) != 0) {
+            fprintf(stderr, "%u arena blocks outlived the session\n",
+                    conn->arena->live);
+        }
+    }
+
+    return NULL;
+}
+
+static int bench_client(WOLFSSH_CTX* ctx, int fd, BenchSample* s)
+{
+    WOLFSSH* ssh;
+    static byte data[BENCH_CHUNK_SZ];
+    byte mark;
+    word32 left;
+    word32 sz;
+    double start;
+    int ret = WS_FATAL_ERROR;
+
+    ssh = wolfSSH_new(ctx);
+    if (ssh != NULL) {
+        wolfSSH_SetUsername(ssh, BENCH_USER);
+        wolfSSH_set_fd(ssh, fd);
+
+        start = bench_now();
+        ret = wolfSSH_connect(ssh);
+        s->handshake = bench_now() - start;
+
+        if (ret == WS_SUCCESS) {
+            ret = bench_recv(ssh, &mark, 1, 1);
+            s->ttfb = bench_now() - start;
+        }
+
+        if (ret == WS_SUCCESS && config.bytes > 0) {
+            start = bench_now();
+            for (left = config.bytes; ret == WS_SUCCESS && left > 0;
+                 left -= sz) {
+                sz = (left < sizeof(data)) ? left : sizeof(data);
+                ret = bench_send(ssh, data, sz);
+            }
+            if (ret == WS_SUCCESS) {
+                /* the server has all of it */
+                ret = bench_recv(ssh, &mark, 1, 1);
+            }
+            s->transfer = bench_now() - start;
+        }
+
+        wolfSSH_shutdown(ssh);
+        wolfSSH_free(ssh);
+    }
+
+    return ret;
+}
+
+static void* bench_relay(void* arg)
+{
+    BenchRelay* r = (BenchRelay*)arg;
+    struct pollfd pfd[2];
+    word32 head[2] = { 0, 0 };
+    word32 tail[2] = { 0, 0 };
+    int eof[2] = { 0, 0 };
+    int done[2] = { 0, 0 };
+    BenchChunk* c;
+    double now;
+    double wait;
+    int timeout;
+    int d;
+    ssize_t n;
+
+    while (!done[0] || !done[1]) {
+        now = bench_now();
+        timeout = -1;
+
+        for (d = 0; d < 2; d++) {
+            /* direction d reads fd[d] and writes fd[!d] */
+            pfd[d].fd = r->fd[d];
+            pfd[d].events = 0;
+            pfd[d].revents = 0;
+            if (!eof[d] && tail[d] - head[d] < BENCH_RELAY_CHUNKS) {
+                pfd[d].events |= POLLIN;
+            }
+        }
+        for (d = 0; d < 2; d++) {
+            if (head[d] == tail[d]) {
+                continue;
+            }
+            c = &r->queue[d][head[d] % BENCH_RELAY_CHUNKS];
+            wait = c->due - now;
+            if (wait <= 0) {
+                pfd[!d].events |= POLLOUT;
+            }
+            else {
+                int ms = (int)(wait * 1000) + 1;
+
+                if (timeout < 0 || ms < timeout) {
+                    timeout = ms;
+                }
+            }
+        }
+        for (d = 0; d < 2; d++) {
+            if (pfd[d].events == 0) {
+                /* not even a hang up is of interest now */
+                pfd[d].fd = -1;
+            }
+        }
+
+        if (poll(pfd, 2, timeout) < 0 && errno != EINTR) {
+            break;
+        }
+        now = bench_now();
+
+        for (d = 0; d < 2; d++) {
+            if ((pfd[d].events & POLLIN) &&
+                (pfd[d].revents & (POLLIN | POLLHUP | POLLERR))) {
+                c = &r->queue[d][tail[d] % BENCH_RELAY_CHUNKS];
+                n = read(r->fd[d], c->data, sizeof(c->data));
+                if (n > 0) {
+                    c->due = now + r->delay;
+                    c->sz = (word32)n;
+                    c->done = 0;
+                    tail[d]++;
+                }
+                else if (n == 0 || errno != EAGAIN) {
+                    eof[d] = 1;
+                }
+            }
+
+            while (!done[d] && head[d] != tail[d]) {
+                c = &r->queue[d][head[d] % BENCH_RELAY_CHUNKS];
+                if (c->due > now) {
+                    break;
+                }
+                n = write(r->fd[!d], c->data + c->done, c->sz - c->done);
+                if (n < 0 && errno == EAGAIN) {
+                    break;
+                }
+                if (n <= 0) {
+                    /* the other end is gone, drop the rest */
+                    head[d] = tail[d];
+                    eof[d] = 1;
+                    break;
+                }
+                c->done += (word32)n;
+                if (c->done == c->sz) {
+                    head[d]++;
+                }
+            }
+
+            if (!done[d] && eof[d] && head[d] == tail[d]) {
+                shutdown(r->fd[!d], SHUT_WR);
+                done[d] = 1;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/* put a relay between [*fd] and its peer; [*fd] becomes the relay's
+ * client end. Returns zero on success. */
+static int bench_relay_start(BenchRelay* r, int* fd)
+{
+    int fds[2];
+
+    memset(r, 0, sizeof(*r));
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        return -1;
+    }
+
+    r->fd[0] = fds[1];
+    r->fd[1] = *fd;
+    r->delay = config.rttMs / 2000.0;
+    r->queue[0] = (BenchChunk*)malloc(2 * BENCH_RELAY_CHUNKS *
+                                      sizeof(BenchChunk));
+    r->queue[1] = r->queue[0] + BENCH_RELAY_CHUNKS;
+    fcntl(r->fd[0], F_SETFL, fcntl(r->fd[0], F_GETFL) | O_NONBLOCK);
+    fcntl(r->fd[1], F_SETFL, fcntl(r->fd[1], F_GETFL) | O_NONBLOCK);
+
+    if (r->queue[0] == NULL ||
+        pthread_create(&r->thread, NULL, bench_relay, r) != 0) {
+        free(r->queue[0]);
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+
+    *fd = fds[0];
+    return 0;
+}
+
+/* after the client end was closed; also closes the server side */
+static void bench_relay_stop(BenchRelay* r)
+{
+    pthread_join(r->thread, NULL);
+    close(r->fd[0]);
+    close(r->fd[1]);
+    free(r->queue[0]);
+}
+
+static void* bench_worker(void* arg)
+{
+    BenchWorker* w = (BenchWorker*)arg;
+    BenchConn conn;
+    BenchRelay relay;
+    pthread_t server;
+    int fds[2];
+    int clientFd;
+    int i;
+
+    for (i = 0; i < config.connections; i++) {
+        BenchSample* s = &w->samples[i];
+
+        memset(s, 0, sizeof(*s));
+
+        if (config.useTcp) {
+            /* completes in the listen backlog; a server thread accepts it,
+             * or another worker's connection, either is fine */
+            conn.fd = -1;
+            clientFd = socket(AF_INET, SOCK_STREAM, 0);
+            if (clientFd < 0) {
+                continue;
+            }
+            if (connect(clientFd, (struct sockaddr*)&listenAddr,
+                        sizeof(listenAddr)) != 0) {
+                close(clientFd);
+                continue;
+            }
+        }
+        else if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0) {
+            conn.fd = fds[0];
+            clientFd = fds[1];
+        }
+        else {
+            continue;
+        }
+        if (config.rttMs > 0 && bench_relay_start(&relay, &clientFd) != 0) {
+            close(clientFd);
+            if (conn.fd >= 0) {
+                close(conn.fd);
+            }
+            continue;
+        }
+        conn.ok = 0;
+        conn.arena = (w->arenaBuf != NULL) ? &w->arena : NULL;
+        conn.arenaPeak = 0;
+        conn.arenaFallbacks = 0;
+
+        if (pthread_create(&server, NULL, bench_server, &conn) != 0) {
+            close(clientFd);
+            if (conn.fd >= 0) {
+                close(conn.fd);
+            }
+            if (config.rttMs > 0) {
+                bench_relay_stop(&relay);
+            }
+            continue;
+        }
+
+        s->ok = (bench_client(w->clientCtx, clientFd, s) == WS_SUCCESS);
+        close(clientFd);
+        if (config.rttMs > 0) {
+            bench_relay_stop(&relay);
+        }
+
+        pthread_join(server, NULL);
+        s->ok = s->ok && conn.ok;
+        s->arenaPeak = conn.arenaPeak;
+        s->arenaFallbacks = conn.arenaFallbacks;
+    }
+
+    return NULL;
+}
+
+
+static WOLFSSH_CTX* bench_client_ctx(const char* kex, const char* cipher,
+                                     const char* mac)
+{
+    WOLFSSH_CTX* ctx = wolfSSH_CTX_new(WOLFSSH_ENDPOINT_CLIENT, NULL);
+
+    if (ctx == NULL) {
+        return NULL;
+    }
+
+    wolfSSH_SetUserAuth(ctx, bench_client_auth);
+    wolfSSH_CTX_SetPublicKeyCheck(ctx, bench_public_key_check);
+
+#ifdef BENCH_HAVE_ALGO_LIST
+    /* the client only offers these, so they are what gets negotiated */
+    if ((kex != NULL && wolfSSH_CTX_SetAlgoListKex(ctx, kex) != WS_SUCCESS) ||
+        (cipher != NULL &&
+         wolfSSH_CTX_SetAlgoListCipher(ctx, cipher) != WS_SUCCESS) ||
+        (mac != NULL && wolfSSH_CTX_SetAlgoListMac(ctx, mac) != WS_SUCCESS)) {
+        wolfSSH_CTX_free(ctx);
+        ctx = NULL;
+    }
+#else
+    (void)kex;
+    (void)cipher;
+    (void)mac;
+#endif
+
+    return ctx;
+}
+
+static void bench_report(const char* kex, const char* cipher,
+                         const char* mac, BenchWorker* workers, double wall)
+{
+    int total = config.threads * config.connections;
+    double* hs = (double*)malloc(3 * sizeof(double) * total);
+    double* ttfb = hs + total;
+    double* rate = ttfb + total;
+    double bytes = 0;
+    double busy = 0;
+    word32 arenaPeak = 0;
+    word32 arenaFallbacks = 0;
+    int n = 0;
+    int i;
+    int j;
+
+    if (hs == NULL) {
+        return;
+    }
+
+    for (i = 0; i < config.threads; i++) {
+        for (j = 0; j < config.connections; j++) {
+            BenchSample* s = &workers[i].samples[j];
+
+            if (s->arenaPeak > arenaPeak) {
+                arenaPeak = s->arenaPeak;
+            }
+            arenaFallbacks += s->arenaFallbacks;
+
+            if (s->ok) {
+                hs[n]   = s->handshake * 1000;
+                ttfb[n] = s->ttfb * 1000;
+                rate[n] = (s->transfer > 0) ?
+                          config.bytes / s->transfer / 1e6 : 0;
+                bytes  += config.bytes;
+                busy   += s->transfer;
+                n++;
+            }
+        }
+    }
+    qsort(hs, n, sizeof(double), bench_cmp);
+    qsort(ttfb, n, sizeof(double), bench_cmp);
+    qsort(rate, n, sizeof(double), bench_cmp);
+
+    if (config.json) {
+        printf("{\"bench\":\"ssh\",\"math\":\"%s\",\"hostkey\":\"%s\","
+               "\"kex\":\"%s\",\"cipher\":\"%s\",\"mac\":\"%s\","
+               "\"threads\":%d,\"connections\":%d,\"failures\":%d,"
+               "\"bytes\":%u,\"hs_per_s\":%.2f,"
+               "\"hs_p50_ms\":%.3f,\"hs_p90_ms\":%.3f,\"hs_p99_ms\":%.3f,"
+               "\"hs_max_ms\":%.3f,"
+               "\"ttfb_p50_ms\":%.3f,\"ttfb_p90_ms\":%.3f,"
+               "\"ttfb_p99_ms\":%.3f,"
+               "\"mb_s_p50\":%.2f,\"mb_s\":%.2f,"
+               "\"window\":%u,\"max_packet\":%u,\"rtt_ms\":%d,"
+               "\"arena_sz\":%u,\"arena_peak\":%u,"
+               "\"arena_fallbacks\":%u}\n",
+               BENCH_MATH, config.hostKey, kex, cipher, mac,
+               config.threads, total, total - n, config.bytes,
+               n / wall,
+               bench_pct(hs, n, 50), bench_pct(hs, n, 90),
+               bench_pct(hs, n, 99), bench_pct(hs, n, 100),
+               bench_pct(ttfb, n, 50), bench_pct(ttfb, n, 90),
+               bench_pct(ttfb, n, 99),
+               bench_pct(rate, n, 50),
+               (busy > 0) ? bytes / busy / 1e6 * config.threads : 0,
+               config.windowSz, config.maxPacketSz, config.rttMs,
+               config.arenaSz, arenaPeak, arenaFallbacks);
+    }
+    else {
+        printf("%-24s %-24s %-16s %4d/%-4d %8.2f %8.2f %8.2f %8.2f "
+               "%8.2f %8.2f\n",
+               kex, cipher, mac, n, total, n / wall,
+               bench_pct(hs, n, 50), bench_pct(hs, n, 90),
+               bench_pct(hs, n, 99), bench_pct(ttfb, n, 50),
+               bench_pct(rate, n, 50));
+        if (config.arenaSz > 0) {
+            printf("  arena: peak %u of %u bytes, %u allocations went to "
+                   "the heap\n", arenaPeak, config.arenaSz, arenaFallbacks);
+        }
+    }
+    fflush(stdout);
+
+    free(hs);
+}
+
+static int bench_combination(const char* kex, const char* cipher,
+                             const char* mac)
+{
+    BenchWorker* workers;
+    WOLFSSH_CTX* clientCtx;
+    double start;
+    int ret = 0;
+    int i;
+
+    clientCtx = bench_client_ctx(kex, cipher, mac);
+    if (clientCtx == NULL) {
+        fprintf(stderr, "skipping %s %s %s: not supported\n",
+                kex, cipher, mac);
+        return 0;
+    }
+
+    workers = (BenchWorker*)calloc(config.threads, sizeof(BenchWorker));
+    if (workers == NULL) {
+        wolfSSH_CTX_free(clientCtx);
+        return -1;
+    }
+
+    start = bench_now();
+    for (i = 0; i < config.threads && ret == 0; i++) {
+        workers[i].clientCtx = clientCtx;
+        workers[i].samples = (BenchSample*)calloc(config.connections,
+                                                  sizeof(BenchSample));
+        if (config.arenaSz > 0) {
+            workers[i].arenaBuf = (byte*)malloc(config.arenaSz);
+            if (workers[i].arenaBuf == NULL ||
+                session_arena_init(&workers[i].arena, workers[i].arenaBuf,
+                                   config.arenaSz) != 0) {
+                fprintf(stderr, "Couldn't set up an arena per thread, "
+                                "at most %d\n", SESSION_ARENA_MAX);
+                free(workers[i].arenaBuf);
+                workers[i].arenaBuf = NULL;
+                ret = -1;
+            }
+        }
+        if (ret != 0 || workers[i].samples == NULL ||
+            pthread_create(&workers[i].thread, NULL, bench_worker,
+                           &workers[i]) != 0) {
+            /* no thread to join */
+            free(workers[i].samples);
+            workers[i].samples = NULL;
+            ret = -1;
+        }
+    }
+    for (i--; i >= 0; i--) {
+        if (workers[i].samples != NULL) {
+            pthread_join(workers[i].thread, NULL);
+        }
+    }
+
+    if (ret == 0) {
+        bench_report(kex, cipher, mac, workers, bench_now() - start);
+    }
+
+    for (i = 0; i < config.threads; i++) {
+        free(workers[i].samples);
+        if (workers[i].arenaBuf != NULL) {
+            session_arena_deinit(&workers[i].arena);
+            free(workers[i].arenaBuf);
+        }
+    }
+    free(workers);
+    wolfSSH_CTX_free(clientCtx);
+
+    return ret;
+}
+
+
+/* lookups in the ESP32 SSH server's credential store, 10 to 10,000 users */
+static int bench_auth(void)
+{
+    static const word32 users[] = { 10, 100, 1000, 10000 };
+    const long lookups = 1000000;
+    CredentialStore* store;
+    byte digest[CREDENTIAL_DIGEST_SZ];
+    char name[CREDENTIAL_NAME_MAX_SZ + 1];
+    double start;
+    double build;
+    double check;
+    word32 u;
+    long i;
+    int hits;
+    size_t k;
+
+    if (!config.json) {
+        printf("%-8s %12s %14s\n", "users", "build us", "ns/lookup");
+    }
+
+    for (k = 0; k < sizeof(users) / sizeof(users[0]); k++) {
+        start = bench_now();
+        store = credential_store_new(users[k]);
+        if (store == NULL) {
+            return -1;
+        }
+        memset(digest, 0, sizeof(digest));
+        for (u = 0; u < users[k]; u++) {
+            snprintf(name, sizeof(name), "user%u", u);
+            memcpy(digest, &u, sizeof(u));
+            credential_store_add(store, WOLFSSH_USERAUTH_PASSWORD,
+                                 (byte*)name, (word32)strlen(name), digest);
+        }
+        build = bench_now() - start;
+
+        hits = 0;
+        start = bench_now();
+        for (i = 0; i < lookups; i++) {
+            u = (word32)(i % users[k]);
+            snprintf(name, sizeof(name), "user%u", u);
+            memcpy(digest, &u, sizeof(u));
+            hits += credential_store_check(store, WOLFSSH_USERAUTH_PASSWORD,
+                        (byte*)name, (word32)strlen(name), digest) ==
+                    CREDENTIAL_MATCH;
+        }
+        check = bench_now() - start;
+        credential_store_free(store);
+
+        if (hits != lookups) {
+            fprintf(stderr, "credential store lookup failed\n");
+            return -1;
+        }
+
+        if (config.json) {
+            printf("{\"bench\":\"auth\",\"users\":%u,\"build_us\":%.1f,"
+                   "\"ns_per_lookup\":%.1f}\n",
+                   users[k], build * 1e6, check * 1e9 / lookups);
+        }
+        else {
+            printf("%-8u %12.1f %14.1f\n",
+                   users[k], build * 1e6, check * 1e9 / lookups);
+        }
+    }
+
+    return 0;
+}
+
+
+/* what each data path event costs with the logging of ssh_trace.h: the
+ * formatting, timed on this host, and the console UART of the device */
+static int bench_trace(void)
+{
+    static const struct {
+        const char* mode;
+        int         built;   /* compiled in */
+        uint32_t    every;   /* ssh_trace_set_sample */
+        long        events;
+    } modes[] = {
+        { "compiled-out", 0, 1,  10000000 },
+        { "off",          1, 0,  10000000 },
+        { "sampled-64",   1, 64, 1000000  },
+        { "every",        1, 1,  200000   },
+    };
+    char line[128];
+    volatile int rxBytes = 12;
+    double start;
+    double ns;
+    double consoleUs;
+    int lineSz;
+    int saved;
+    int devNull;
+    long i;
+    size_t k;
+
+    /* the line uart_rx_task logged for every read, as the device prints
+     * it; ten bits per byte on the 115200 baud console */
+    lineSz = snprintf(line, sizeof(line), "I (%d) %s: Read %d bytes\r\n",
+                      123456, "RX_TASK", rxBytes);
+
+    /* the shim logs to stderr */
+    fflush(stderr);
+    saved = dup(STDERR_FILENO);
+    devNull = open("/dev/null", O_WRONLY);
+    if (saved < 0 || devNull < 0) {
+        return -1;
+    }
+    esp_log_level_set("*", ESP_LOG_INFO);
+
+    if (!config.json) {
+        printf("%-14s %12s %14s\n", "trace", "ns/event", "console us");
+    }
+
+    for (k = 0; k < sizeof(modes) / sizeof(modes[0]); k++) {
+        ssh_trace_set_sample(modes[k].every);
+        dup2(devNull, STDERR_FILENO);
+
+        start = bench_now();
+        if (modes[k].built) {
+            for (i = 0; i < modes[k].events; i++) {
+                SSH_TRACE(SESSION, ESP_LOG_INFO, "RX_TASK",
+                          "Read %d bytes", rxBytes);
+            }
+        }
+        else {
+            for (i = 0; i < modes[k].events; i++) {
+                SSH_TRACE(UART_RX, ESP_LOG_INFO, "RX_TASK",
+                          "Read %d bytes", rxBytes);
+            }
+        }
+        ns = (bench_now() - start) * 1e9 / modes[k].events;
+
+        fflush(stderr);
+        dup2(saved, STDERR_FILENO);
+
+        consoleUs = (!modes[k].built || modes[k].every == 0) ? 0 :
+                    lineSz * 10 * 1e6 / 115200 / modes[k].every;
+
+        if (config.json) {
+            printf("{\"bench\":\"trace\",\"mode\":\"%s\","
+                   "\"ns_per_event\":%.1f,\"console_us_115200\":%.1f}\n",
+                   modes[k].mode, ns, consoleUs);
+        }
+        else {
+            printf("%-14s %12.1f %14.1f\n", modes[k].mode, ns, consoleUs);
+        }
+    }
+
+    ssh_trace_set_sample(1);
+    close(devNull);
+    close(saved);
+
+    return 0;
+}
+
+
+/* the control character scan of the ESP32 SSH server before escape_scan:
+ * returns the first of the characters of str in buf, otherwise zero */
+static byte bench_find_char(const byte* str, const byte* buf, word32 bufSz)
+{
+    int ret = 0;
+    const byte* cur;
+    while (bufSz && (ret == 0) && (ret < 255)) {
+        cur = str;
+        while (*cur != '\0') {
+            if (*cur == *buf) {
+                ret = *cur;
+            }
+            cur++;
+        }
+        buf++;
+        bufSz--;
+    }
+
+    return ret;
+}
+
+/* scanning what a client sends for Ctrl-C, Ctrl-E and Ctrl-F: text lines
+ * of a paste, with the command at the very end so both scan it all */
+static int bench_escape(void)
+{
+    static const byte matches[] = { 0x03, 0x05, 0x06, 0x00 };
+    static const word32 sizes[] = { 4, 64, 1024, 16384 };
+    const uint32_t set = ESCAPE_BIT(0x03) | ESCAPE_BIT(0x05) |
+                         ESCAPE_BIT(0x06);
+    static byte buf[16384];
+    volatile size_t sink = 0;
+    double start;
+    double nsOld;
+    double nsNew;
+    long rounds;
+    long i;
+    word32 k;
+    size_t j;
+
+    for (j = 0; j < sizeof(buf); j++) {
+        /* 60 printable characters and CR LF per line, as a log or script */
+        buf[j] = ((j % 62) == 60) ? '\r' :
+                 ((j % 62) == 61) ? '\n' : (byte)(' ' + (j * 7) % 95);
+    }
+
+    if (!config.json) {
+        printf("%-8s %14s %14s %9s\n", "bytes", "find_char ns",
+               "escape_scan ns", "speedup");
+    }
+
+    for (k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++) {
+        word32 sz = sizes[k];
+        byte saved = buf[sz - 1];
+
+        buf[sz - 1] = 0x05;
+        if ((bench_find_char(matches, buf, sz) != 0x05) ||
+            (escape_scan(buf, sz, set) != sz - 1)) {
+            fprintf(stderr, "escape scan mismatch at %u bytes\n", sz);
+            buf[sz - 1] = saved;
+            return -1;
+        }
+
+        rounds = 64L * 1024 * 1024 / sz;
+
+        start = bench_now();
+        for (i = 0; i < rounds; i++) {
+            sink += bench_find_char(matches, buf, sz);
+        }
+        nsOld = (bench_now() - start) * 1e9 / rounds;
+
+        start = bench_now();
+        for (i = 0; i < rounds; i++) {
+            sink += escape_scan(buf, sz, set);
+        }
+        nsNew = (bench_now() - start) * 1e9 / rounds;
+
+        buf[sz - 1] = saved;
+
+        if (config.json) {
+            printf("{\"bench\":\"escape\",\"bytes\":%u,"
+                   "\"find_char_ns\":%.1f,\"escape_scan_ns\":%.1f}\n",
+                   sz, nsOld, nsNew);
+        }
+        else {
+            printf("%-8u %14.1f %14.1f %8.1fx\n", sz, nsOld, nsNew,
+                   nsOld / nsNew);
+        }
+    }
+    (void)sink;
+
+    return 0;
+}
+
+/* translating what a client types on its way to the UART: the "bs" map
+ * one to one, and "crlf" with its end of line policy, against memcpy of
+ * the same text, which is what "raw" costs */
+static int bench_xlate(void)
+{
+    static const word32 sizes[] = { 4, 64, 1024, 16384 };
+    static byte in[16384];
+    static byte out[UART_XLATE_OUT_SZ(16384)];
+    const UartXlate* bs = uart_xlate_find("bs");
+    const UartXlate* crlf = uart_xlate_find("crlf");
+    volatile size_t sink = 0;
+    double start;
+    double nsCopy;
+    double nsMap;
+    double nsEol;
+    long rounds;
+    long i;
+    word32 k;
+    size_t j;
+
+    for (j = 0; j < sizeof(in); j++) {
+        /* typed lines ending in CR, with the odd DEL */
+        in[j] = ((j % 62) == 61) ? '\r' :
+                ((j % 62) == 30) ? 0x7f : (byte)(' ' + (j * 7) % 95);
+    }
+
+    if ((bs == NULL) || (crlf == NULL) ||
+        (uart_xlate_run(bs, in, 62, out) != 62) || (out[30] != 0x08) ||
+        (uart_xlate_run(crlf, in, 62, out) != 63) || (out[62] != '\n')) {
+        fprintf(stderr, "uart_xlate mismatch\n");
+        return -1;
+    }
+
+    if (!config.json) {
+        printf("%-8s %12s %12s %12s\n", "bytes", "memcpy ns", "bs ns",
+               "crlf ns");
+    }
+
+    for (k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++) {
+        word32 sz = sizes[k];
+
+        rounds = 64L * 1024 * 1024 / sz;
+
+        start = bench_now();
+        for (i = 0; i < rounds; i++) {
+            memcpy(out, in, sz);
+            sink += out[i % sz];
+        }
+        nsCopy = (bench_now() - start) * 1e9 / rounds;
+
+        start = bench_now();
+        for (i = 0; i < rounds; i++) {
+            sink += uart_xlate_run(bs, in, sz, out);
+        }
+        nsMap = (bench_now() - start) * 1e9 / rounds;
+
+        start = bench_now();
+        for (i = 0; i < rounds; i++) {
+            sink += uart_xlate_run(crlf, in, sz, out);
+        }
+        nsEol = (bench_now() - start) * 1e9 / rounds;
+
+        if (config.json) {
+            printf("{\"bench\":\"xlate\",\"bytes\":%u,\"memcpy_ns\":%.1f,"
+                   "\"bs_ns\":%.1f,\"crlf_ns\":%.1f}\n",
+                   sz, nsCopy, nsMap, nsEol);
+        }
+        else {
+            printf("%-8u %12.1f %12.1f %12.1f\n", sz, nsCopy, nsMap, nsEol);
+        }
+    }
+    (void)sink;
+
+    return 0;
+}
+
+/* the UART buffers of the ESP32 SSH server are this size */
+#define BENCH_RING_SZ    2048
+#define BENCH_RING_BYTES (64 * 1024 * 1024)
+
+/* the UART buffer of the ESP32 SSH server before ring_buffer.h: a flat
+ * array and its length behind one mutex. The producer appends only when
+ * everything fits, the consumer takes it all and empties it. */
+typedef struct BenchFlat {
+    pthread_mutex_t lock;
+    word32          sz;
+    byte            buf[BENCH_RING_SZ];
+} BenchFlat;
+
+typedef struct BenchRingRun {
+    RingBuffer ring;
+    BenchFlat  flat;
+    int        useRing;
+    word32     chunkSz;    /* what the producer writes at a time */
+} BenchRingRun;
+
+static word32 bench_flat_write(BenchFlat* f, const byte* data, word32 sz)
+{
+    word32 ret = 0;
+
+    pthread_mutex_lock(&f->lock);
+    if (f->sz + sz <= sizeof(f->buf)) {
+        memcpy(f->buf + f->sz, data, sz);
+        f->sz += sz;
+        ret = sz;
+    }
+    pthread_mutex_unlock(&f->lock);
+
+    return ret;
+}
+
+static word32 bench_flat_read(BenchFlat* f, byte* data)
+{
+    word32 ret;
+
+    pthread_mutex_lock(&f->lock);
+    ret = f->sz;
+    memcpy(data, f->buf, ret);
+    f->sz = 0;
+    pthread_mutex_unlock(&f->lock);
+
+    return ret;
+}
+
+/* the UART Rx task: a counting pattern, chunkSz bytes at a time */
+static void* bench_ring_producer(void* arg)
+{
+    BenchRingRun* run = (BenchRingRun*)arg;
+    byte chunk[BENCH_RING_SZ];
+    word32 sent = 0;
+    word32 n;
+    word32 i;
+
+    for (i = 0; i < run->chunkSz; i++) {
+        chunk[i] = (byte)i;
+    }
+
+    while (sent < BENCH_RING_BYTES) {
+        if (run->useRing) {
+            n = 0;
+            while (n < run->chunkSz) {
+                i = ring_buffer_write(&run->ring, chunk + n,
+                                      run->chunkSz - n);
+                if (i == 0) {
+                    sched_yield();
+                }
+                n += i;
+            }
+        }
+        else {
+            /* the old buffer takes a write whole or not at all */
+            while (bench_flat_write(&run->flat, chunk, run->chunkSz) == 0) {
+                sched_yield();
+            }
+        }
+        sent += run->chunkSz;
+    }
+
+    return NULL;
+}
+
+/* a session: takes whatever is there, as server_worker does */
+static int bench_ring_run(BenchRingRun* run, double* mbs)
+{
+    static byte out[BENCH_RING_SZ];
+    pthread_t producer;
+    word32 received = 0;
+    word32 sum = 0;
+    word32 expect = 0;
+    word32 n;
+    word32 i;
+    double start;
+
+    for (i = 0; i < BENCH_RING_BYTES; i++) {
+        expect += (byte)(i % run->chunkSz);
+    }
+
+    start = bench_now();
+    if (pthread_create(&producer, NULL, bench_ring_producer, run) != 0) {
+        return -1;
+    }
+    while (received < BENCH_RING_BYTES) {
+        if (run->useRing) {
+            n = ring_buffer_read(&run->ring, out, sizeof(out));
+        }
+        else {
+            n = bench_flat_read(&run->flat, out);
+        }
+        if (n == 0) {
+            sched_yield();
+        }
+        for (i = 0; i < n; i++) {
+            sum += out[i];
+        }
+        received += n;
+    }
+    pthread_join(producer, NULL);
+    *mbs = BENCH_RING_BYTES / (bench_now() - start) / (1024 * 1024);
+
+    if (sum != expect) {
+        fprintf(stderr, "%s lost data at %u byte writes\n",
+                run->useRing ? "ring" : "mutex buffer", run->chunkSz);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* UART data through the lock-free SPSC ring and through the mutex-guarded
+ * buffer it replaced, between a producer and a consumer thread */
+static int bench_ring(void)
+{
+    static const word32 sizes[] = { 1, 16, 128, 1024 };
+    static BenchRingRun run;
+    static byte storage[BENCH_RING_SZ];
+    double mbsFlat;
+    double mbsRing;
+    word32 k;
+
+    if (ring_buffer_init(&run.ring, storage, sizeof(storage)) != 0 ||
+        pthread_mutex_init(&run.flat.lock, NULL) != 0) {
+        return -1;
+    }
+
+    if (!config.json) {
+        printf("%-8s %14s %14s %9s\n", "write", "mutex MB/s", "ring MB/s",
+               "speedup");
+    }
+
+    for (k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++) {
+        run.chunkSz = sizes[k];
+
+        run.useRing = 0;
+        run.flat.sz = 0;
+        if (bench_ring_run(&run, &mbsFlat) != 0) {
+            return -1;
+        }
+
+        run.useRing = 1;
+        ring_buffer_reset(&run.ring);
+        if (bench_ring_run(&run, &mbsRing) != 0) {
+            return -1;
+        }
+
+        if (config.json) {
+            printf("{\"bench\":\"ring\",\"write_bytes\":%u,"
+                   "\"mutex_mbs\":%.1f,\"ring_mbs\":%.1f}\n",
+                   sizes[k], mbsFlat, mbsRing);
+        }
+        else {
+            printf("%-8u %14.1f %14.1f %8.1fx\n", sizes[k], mbsFlat,
+                   mbsRing, mbsRing / mbsFlat);
+        }
+    }
+    pthread_mutex_destroy(&run.flat.lock);
+
+    return 0;
+}
+
+
+static void bench_usage(void)
+{
+    printf("bench [options]\n"
+           " -n <num>   connections per thread (default %d)\n"
+           " -t <num>   client threads (default %d)\n"
+           " -b <bytes> bytes streamed per connection, 0 for handshakes "
+           "only (default %u)\n"
+           " -x <list>  comma separated KEX algorithms\n"
+           " -c <list>  comma separated ciphers\n"
+           " -m <list>  comma separated MACs\n"
+           " -k <type>  host key, ecc or rsa (default ecc)\n"
+           " -l         TCP loopback instead of socketpairs\n"
+           " -j         JSON lines output\n"
+           " -z <bytes> serve each server session from an arena of this "
+           "size\n"
+           " -w <list>  comma separated server window sizes, 0 for the "
+           "default\n"
+           " -p <bytes> largest packet the server accepts (default %u)\n"
+           " -r <list>  comma separated round trip times in ms, added by "
+           "a relay\n"
+           " -a         benchmark credential store lookups instead\n"
+           " -g         benchmark the data path logging instead\n"
+           " -e         benchmark the control character scan instead\n"
+           " -o         benchmark the UART output translation instead\n"
+           " -s         benchmark the UART ring against a mutex buffer "
+           "instead\n",
+           config.connections, config.threads, config.bytes,
+           config.maxPacketSz);
+}
+
+int main(int argc, char** argv)
+{
+    static char defKex[] = "ecdh-sha2-nistp256,ecdh-sha2-nistp384";
+    static char defCipher[] = "aes128-gcm@openssh.com,aes256-gcm@openssh.com,"
+                              "aes128-ctr";
+    static char defMac[] = "hmac-sha2-256";
+    char* kexList = defKex;
+    char* cipherList = defCipher;
+    char* macList = defMac;
+    char defWindow[] = "0";
+    char defRtt[] = "0";
+    char* windowList = defWindow;
+    char* rttList = defRtt;
+    byte key[BENCH_KEY_MAX_SZ];
+    int keySz;
+    int auth = 0;
+    int trace = 0;
+    int escape = 0;
+    int xlate = 0;
+    int ring = 0;
+    int ret = 0;
+    int opt;
+    int k, c, m, w, r;
+
+    while ((opt = getopt(argc, argv, "n:t:b:x:c:m:k:ljz:w:p:r:ageosh")) != -1) {
+        switch (opt) {
+            case 'n': config.connections = atoi(optarg); break;
+            case 't': config.threads = atoi(optarg); break;
+            case 'b': config.bytes = (word32)strtoul(optarg, NULL, 0); break;
+            case 'x': kexList = optarg; break;
+            case 'c': cipherList = optarg; break;
+            case 'm': macList = optarg; break;
+            case 'k': config.hostKey = optarg; break;
+            case 'l': config.useTcp = 1; break;
+            case 'j': config.json = 1; break;
+            case 'z': config.arenaSz = (word32)strtoul(optarg, NULL, 0); break;
+            case 'w': windowList = optarg; break;
+            case 'p':
+                config.maxPacketSz = (word32)strtoul(optarg, NULL, 0);
+                break;
+            case 'r': rttList = optarg; break;
+            case 'a': auth = 1; break;
+            case 'g': trace = 1; break;
+            case 'e': escape = 1; break;
+            case 'o': xlate = 1; break;
+            case 's': ring = 1; break;
+            default:
+                bench_usage();
+                return (opt == 'h') ? 0 : 1;
+        }
+    }
+    if (config.connections < 1 || config.threads < 1) {
+        bench_usage();
+        return 1;
+    }
+
+    if (auth) {
+        return (bench_auth() == 0) ? 0 : 1;
+    }
+    if (trace) {
+        return (bench_trace() == 0) ? 0 : 1;
+    }
+    if (escape) {
+        return (bench_escape() == 0) ? 0 : 1;
+    }
+    if (xlate) {
+        return (bench_xlate() == 0) ? 0 : 1;
+    }
+    if (ring) {
+        return (bench_ring() == 0) ? 0 : 1;
+    }
+
+#ifndef BENCH_HAVE_ALGO_LIST
+    /* older wolfSSH cannot restrict the algorithms, bench the defaults */
+    fprintf(stderr, "wolfSSH %s cannot select algorithms, "
+                    "benchmarking its defaults only\n",
+                    LIBWOLFSSH_VERSION_STRING);
+    strcpy(defKex, "default");
+    strcpy(defCipher, "default");
+    strcpy(defMac, "default");
+    kexList = defKex;
+    cipherList = defCipher;
+    macList = defMac;
+#endif
+
+    config.kexSz = bench_split(kexList, config.kex);
+    config.cipherSz = bench_split(cipherList, config.cipher);
+    config.macSz = bench_split(macList, config.mac);
+    config.windowListSz = bench_split(windowList, config.window);
+    config.rttListSz = bench_split(rttList, config.rtt);
+
+    signal(SIGPIPE, SIG_IGN);
+
+    if (wolfSSH_Init() != WS_SUCCESS) {
+        fprintf(stderr, "Couldn't initialize wolfSSH.\n");
+        return 1;
+    }
+
+    if (config.arenaSz > 0 && session_arena_install() != 0) {
+        fprintf(stderr, "Couldn't hook the wolfSSL allocators.\n");
+        return 1;
+    }
+
+    serverCtx = wolfSSH_CTX_new(WOLFSSH_ENDPOINT_SERVER, NULL);
+    keySz = bench_load_file(strcmp(config.hostKey, "rsa") == 0 ?
+                            "keys/server-key-rsa.der" :
+                            "keys/server-key-ecc.der",
+                            key, sizeof(key));
+    if (serverCtx == NULL || keySz <= 0 ||
+        wolfSSH_CTX_UsePrivateKey_buffer(serverCtx, key, keySz,
+                                         WOLFSSH_FORMAT_ASN1) < 0) {
+        fprintf(stderr, "Couldn't set up the server, run from the "
+                        "make-testsuite directory after make.\n");
+        ret = 1;
+    }
+    else {
+        wolfSSH_SetUserAuth(serverCtx, bench_server_auth);
+    }
+
+    if (ret == 0 && config.useTcp) {
+        socklen_t addrSz = sizeof(listenAddr);
+
+        memset(&listenAddr, 0, sizeof(listenAddr));
+        listenAddr.sin_family = AF_INET;
+        listenAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        listenFd = socket(AF_INET, SOCK_STREAM, 0);
+        if (listenFd < 0 ||
+            bind(listenFd, (struct sockaddr*)&listenAddr,
+                 sizeof(listenAddr)) != 0 ||
+            getsockname(listenFd, (struct sockaddr*)&listenAddr,
+                        &addrSz) != 0 ||
+            listen(listenFd, 128) != 0) {
+            fprintf(stderr, "Couldn't listen on loopback, errno %d\n", errno);
+            ret = 1;
+        }
+    }
+
+    if (ret == 0 && !config.json) {
+        printf("math %s, host key %s, %d thread(s) x %d connection(s), "
+               "%u bytes each, %s\n",
+               BENCH_MATH, config.hostKey, config.threads,
+               config.connections, config.bytes,
+               config.useTcp ? "TCP loopback" : "socketpair");
+        printf("%-24s %-24s %-16s %9s %8s %8s %8s %8s %8s %8s\n",
+               "kex", "cipher", "mac", "ok", "hs/s", "hs p50",
+               "hs p90", "hs p99", "ttfb p50", "MB/s p50");
+    }
+
+    for (w = 0; ret == 0 && w < config.windowListSz; w++) {
+        config.windowSz = (word32)strtoul(config.window[w], NULL, 0);
+#ifdef BENCH_HAVE_ALGO_LIST
+        /* zero keeps wolfSSH's DEFAULT_WINDOW_SZ and DEFAULT_MAX_PACKET_SZ */
+        if (wolfSSH_CTX_SetWindowPacketSize(serverCtx, config.windowSz,
+                                            config.maxPacketSz) != WS_SUCCESS) {
+            fprintf(stderr, "skipping window %u: not supported\n",
+                    config.windowSz);
+            continue;
+        }
+#else
+        if (config.windowSz != 0 || config.maxPacketSz != 0) {
+            fprintf(stderr, "wolfSSH %s has a fixed window, "
+                            "benchmarking its default only\n",
+                            LIBWOLFSSH_VERSION_STRING);
+            config.windowSz = 0;
+            config.maxPacketSz = 0;
+        }
+#endif
+
+        for (r = 0; ret == 0 && r < config.rttListSz; r++) {
+            config.rttMs = atoi(config.rtt[r]);
+            if (!config.json &&
+                (config.windowListSz > 1 || config.rttListSz > 1 ||
+                 config.windowSz > 0 || config.rttMs > 0)) {
+                printf("-- window %u, max packet %u, rtt %d ms\n",
+                       config.windowSz, config.maxPacketSz, config.rttMs);
+            }
+
+            for (k = 0; ret == 0 && k < config.kexSz; k++) {
+                for (c = 0; ret == 0 && c < config.cipherSz; c++) {
+                    for (m = 0; ret == 0 && m < config.macSz; m++) {
+                        ret = bench_combination(config.kex[k],
+                                                config.cipher[c],
+                                                config.mac[m]);
+                    }
+                }
+            }
+        }
+    }
+
+    if (listenFd >= 0) {
+        close(listenFd);
+    }
+    wolfSSH_CTX_free(serverCtx);
+    wolfSSH_Cleanup();
+
+    return (ret == 0) ? 0 : 1;
+}
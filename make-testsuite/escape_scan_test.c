@@ -0,0 +1,182 @@
+/* escape_scan_test.c
+ *
+ * Copyright (C) 2014-2024 wolfSSL Inc.
+ *
+ * This file is part of wolfSSH.
+ *
+ * wolfSSH is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfSSH is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wolfSSH.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Host unit test of the word at a time control character scan of the ESP32
+ * SSH server (escape_scan.h there), against a byte by byte loop: every
+ * start alignment and length through the unaligned head, the whole words
+ * and the tail, every control byte 0x00-0x1f and high byte 0x80-0xff at
+ * every offset, in and out of the set, and a control byte out of the set
+ * ahead of one in it, as the borrow of the word test would flag both.
+ * Exits non-zero at the first failure.
+ */
+
+#include "escape_scan.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* the word escape_scan reads */
+#define ESCAPE_TEST_WORD sizeof(unsigned long)
+
+/* longest buffer: a head, three words and a tail at any alignment */
+#define ESCAPE_TEST_MAX_SZ (4 * ESCAPE_TEST_WORD + 1)
+
+/* byte values tested, see escape_test_byte */
+#define ESCAPE_TEST_BYTES (0x20 + 0x80)
+
+/* the commands ssh_server.c scans for: Ctrl-C, Ctrl-E, Ctrl-F */
+#define ESCAPE_TEST_COMMANDS \
+    (ESCAPE_BIT(0x03) | ESCAPE_BIT(0x05) | ESCAPE_BIT(0x06))
+
+static int failures = 0;
+
+/* word aligned, so buf + align starts where the test wants it */
+static unsigned long storage[(ESCAPE_TEST_MAX_SZ / ESCAPE_TEST_WORD) + 2];
+
+/* what the bytes around the one tested are */
+static const uint8_t fillers[] = { 'a', ' ', 0x7f, 0x80, 0xff };
+
+static size_t escape_test_ref(const uint8_t* buf, size_t sz, uint32_t set)
+{
+    size_t i;
+
+    for (i = 0; i < sz; i++) {
+        if ((buf[i] < 0x20) && ((set >> buf[i]) & 1)) {
+            break;
+        }
+    }
+
+    return i;
+}
+
+static void escape_test_one(const uint8_t* buf, size_t sz, uint32_t set)
+{
+    size_t want = escape_test_ref(buf, sz, set);
+    size_t got = escape_scan(buf, sz, set);
+
+    if (got != want) {
+        /* the first few are enough to see the pattern */
+        if (failures < 10) {
+            fprintf(stderr, "align %u, size %u, set 0x%08x: %u, not %u\n",
+                    (unsigned)((uintptr_t)buf % ESCAPE_TEST_WORD),
+                    (unsigned)sz, (unsigned)set, (unsigned)got,
+                    (unsigned)want);
+        }
+        failures++;
+    }
+}
+
+/* the byte values tested: the controls, then 0x80-0xff */
+static uint8_t escape_test_byte(int i)
+{
+    return (i < 0x20) ? (uint8_t)i : (uint8_t)(0x80 + i - 0x20);
+}
+
+/* one byte c at each offset of every alignment and length */
+static void escape_test_single(void)
+{
+    uint8_t* buf;
+    uint32_t bit;
+    size_t align;
+    size_t sz;
+    size_t pos;
+    size_t f;
+    uint8_t c;
+    int i;
+
+    for (align = 0; align < ESCAPE_TEST_WORD; align++) {
+        buf = (uint8_t*)storage + align;
+
+        for (sz = 0; sz <= ESCAPE_TEST_MAX_SZ; sz++) {
+            for (f = 0; f < sizeof(fillers); f++) {
+                memset(buf, fillers[f], sz);
+                escape_test_one(buf, sz, 0xffffffff);
+
+                for (pos = 0; pos < sz; pos++) {
+                    for (i = 0; i < ESCAPE_TEST_BYTES; i++) {
+                        c = escape_test_byte(i);
+                        bit = ESCAPE_BIT(c & 0x1f);
+                        buf[pos] = c;
+
+                        escape_test_one(buf, sz, 0xffffffff);
+                        escape_test_one(buf, sz, bit);
+                        escape_test_one(buf, sz, ~bit);
+                        escape_test_one(buf, sz, ESCAPE_TEST_COMMANDS);
+                        escape_test_one(buf, sz, 0);
+                    }
+                    buf[pos] = fillers[f];
+                }
+            }
+        }
+    }
+}
+
+/* a byte out of the set, control or high, before a command at every pair
+ * of offsets through a head, two words and a tail */
+static void escape_test_pairs(void)
+{
+    static const uint8_t commands[] = { 0x03, 0x05, 0x06 };
+    uint8_t* buf;
+    size_t sz = 3 * ESCAPE_TEST_WORD;
+    size_t align;
+    size_t p;
+    size_t q;
+    size_t k;
+    uint8_t c;
+    int i;
+
+    for (align = 0; align < ESCAPE_TEST_WORD; align++) {
+        buf = (uint8_t*)storage + align;
+        memset(buf, 'a', sz);
+
+        for (p = 0; p < sz; p++) {
+            for (q = p + 1; q < sz; q++) {
+                for (k = 0; k < sizeof(commands); k++) {
+                    buf[q] = commands[k];
+                    for (i = 0; i < ESCAPE_TEST_BYTES; i++) {
+                        c = escape_test_byte(i);
+                        if ((c < 0x20) &&
+                            ((ESCAPE_TEST_COMMANDS >> c) & 1)) {
+                            continue;
+                        }
+                        buf[p] = c;
+                        escape_test_one(buf, sz, ESCAPE_TEST_COMMANDS);
+                    }
+                    buf[p] = 'a';
+                }
+                buf[q] = 'a';
+            }
+        }
+    }
+}
+
+int main(void)
+{
+    escape_test_single();
+    escape_test_pairs();
+
+    if (failures == 0) {
+        printf("escape_scan_test: all tests passed\n");
+    }
+
+    return (failures == 0) ? 0 : 1;
+}
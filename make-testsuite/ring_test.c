@@ -0,0 +1,350 @@
+/* ring_test.c
+ *
+ * Copyright (C) 2014-2024 wolfSSL Inc.
+ *
+ * This file is part of wolfSSH.
+ *
+ * wolfSSH is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfSSH is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with wolfSSH.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Host unit test of the lock-free rings of the ESP32 SSH server
+ * (ring_buffer.h there): empty and full, wrap around the end of storage,
+ * peek/consume and reserve/commit, a broadcast reader being lapped, and a
+ * producer and a consumer thread streaming through a small ring.
+ * Exits non-zero at the first failure.
+ */
+
+#include "ring_buffer.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* bytes the two threads of the stress test stream through the ring */
+#define RING_TEST_STRESS_SZ (64 * 1024 * 1024)
+
+static int failures = 0;
+
+#define RING_CHECK(cond)                                                    \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);      \
+            failures++;                                                     \
+        }                                                                   \
+    } while (0)
+
+static void ring_test_init(void)
+{
+    RingBuffer rb;
+    uint8_t storage[16];
+
+    RING_CHECK(ring_buffer_init(&rb, storage, 16) == 0);
+    RING_CHECK(ring_buffer_init(&rb, storage, 12) != 0);
+    RING_CHECK(ring_buffer_init(&rb, storage, 0) != 0);
+    RING_CHECK(ring_buffer_init(&rb, NULL, 16) != 0);
+}
+
+static void ring_test_full_empty(void)
+{
+    RingBuffer rb;
+    uint8_t storage[16];
+    uint8_t in[32];
+    uint8_t out[32];
+    int i;
+
+    for (i = 0; i < (int)sizeof(in); i++) {
+        in[i] = (uint8_t)i;
+    }
+    ring_buffer_init(&rb, storage, sizeof(storage));
+
+    RING_CHECK(ring_buffer_used(&rb) == 0);
+    RING_CHECK(ring_buffer_free(&rb) == 16);
+    RING_CHECK(ring_buffer_read(&rb, out, sizeof(out)) == 0);
+
+    /* the full size is usable, and no more */
+    RING_CHECK(ring_buffer_write(&rb, in, 20) == 16);
+    RING_CHECK(ring_buffer_used(&rb) == 16);
+    RING_CHECK(ring_buffer_free(&rb) == 0);
+    RING_CHECK(ring_buffer_write(&rb, in, 1) == 0);
+
+    RING_CHECK(ring_buffer_read(&rb, out, sizeof(out)) == 16);
+    RING_CHECK(memcmp(out, in, 16) == 0);
+    RING_CHECK(ring_buffer_used(&rb) == 0);
+
+    ring_buffer_write(&rb, in, 5);
+    ring_buffer_reset(&rb);
+    RING_CHECK(ring_buffer_used(&rb) == 0);
+    RING_CHECK(ring_buffer_free(&rb) == 16);
+}
+
+static void ring_test_wrap(void)
+{
+    RingBuffer rb;
+    uint8_t storage[16];
+    uint8_t in[16];
+    uint8_t out[16];
+    int round;
+    int i;
+
+    ring_buffer_init(&rb, storage, sizeof(storage));
+
+    /* 7 bytes at a time, so every offset of the storage is a start and
+     * most writes and reads are split in two */
+    for (round = 0; round < 64; round++) {
+        for (i = 0; i < 7; i++) {
+            in[i] = (uint8_t)(round * 7 + i);
+        }
+        RING_CHECK(ring_buffer_write(&rb, in, 7) == 7);
+        RING_CHECK(ring_buffer_read(&rb, out, 7) == 7);
+        RING_CHECK(memcmp(out, in, 7) == 0);
+    }
+
+    /* the free-running counters wrap around 2^32 as well */
+    atomic_store(&rb.head, 0xfffffffaU);
+    atomic_store(&rb.tail, 0xfffffffaU);
+    RING_CHECK(ring_buffer_write(&rb, in, 12) == 12);
+    RING_CHECK(ring_buffer_used(&rb) == 12);
+    RING_CHECK(ring_buffer_read(&rb, out, 12) == 12);
+    RING_CHECK(memcmp(out, in, 12) == 0);
+    RING_CHECK(ring_buffer_used(&rb) == 0);
+}
+
+static void ring_test_peek_consume(void)
+{
+    RingBuffer rb;
+    uint8_t storage[16];
+    uint8_t in[16];
+    uint8_t* span;
+    int i;
+
+    for (i = 0; i < (int)sizeof(in); i++) {
+        in[i] = (uint8_t)(0x40 + i);
+    }
+    ring_buffer_init(&rb, storage, sizeof(storage));
+
+    RING_CHECK(ring_buffer_peek(&rb, &span) == 0);
+
+    /* 12 bytes from offset 10: the span stops at the end of storage */
+    ring_buffer_write(&rb, in, 10);
+    ring_buffer_consume(&rb, 10);
+    ring_buffer_write(&rb, in, 12);
+
+    RING_CHECK(ring_buffer_peek(&rb, &span) == 6);
+    RING_CHECK(span == storage + 10);
+    RING_CHECK(memcmp(span, in, 6) == 0);
+
+    /* peeking again sees the same bytes until they are consumed */
+    RING_CHECK(ring_buffer_peek(&rb, &span) == 6);
+    ring_buffer_consume(&rb, 4);
+    RING_CHECK(ring_buffer_peek(&rb, &span) == 2);
+    RING_CHECK(memcmp(span, in + 4, 2) == 0);
+    ring_buffer_consume(&rb, 2);
+
+    RING_CHECK(ring_buffer_peek(&rb, &span) == 6);
+    RING_CHECK(span == storage);
+    RING_CHECK(memcmp(span, in + 6, 6) == 0);
+    ring_buffer_consume(&rb, 6);
+    RING_CHECK(ring_buffer_used(&rb) == 0);
+}
+
+static void ring_test_reserve_commit(void)
+{
+    RingBuffer rb;
+    uint8_t storage[16];
+    uint8_t out[16];
+    uint8_t* span;
+    uint32_t n;
+
+    ring_buffer_init(&rb, storage, sizeof(storage));
+
+    RING_CHECK(ring_buffer_reserve(&rb, &span) == 16);
+    RING_CHECK(span == storage);
+
+    /* nothing is visible before the commit */
+    memcpy(span, "abcdef", 6);
+    RING_CHECK(ring_buffer_used(&rb) == 0);
+    ring_buffer_commit(&rb, 6);
+    RING_CHECK(ring_buffer_used(&rb) == 6);
+
+    /* the span stops at the end of storage, then at the consumer */
+    RING_CHECK(ring_buffer_reserve(&rb, &span) == 10);
+    RING_CHECK(span == storage + 6);
+    memcpy(span, "ghijklmnop", 10);
+    ring_buffer_commit(&rb, 10);
+    RING_CHECK(ring_buffer_reserve(&rb, &span) == 0);
+
+    RING_CHECK(ring_buffer_read(&rb, out, 4) == 4);
+    RING_CHECK(ring_buffer_reserve(&rb, &span) == 4);
+    RING_CHECK(span == storage);
+    memcpy(span, "qrst", 4);
+    ring_buffer_commit(&rb, 4);
+
+    n = ring_buffer_read(&rb, out, sizeof(out));
+    RING_CHECK(n == 16);
+    RING_CHECK(memcmp(out, "efghijklmnopqrst", 16) == 0);
+}
+
+static void ring_test_broadcast(void)
+{
+    BroadcastRing rb;
+    uint8_t storage[16];
+    uint8_t in[64];
+    uint8_t out[64];
+    uint32_t fast;
+    uint32_t slow;
+    uint32_t fastSkipped = 0;
+    uint32_t slowSkipped = 0;
+    int i;
+
+    for (i = 0; i < (int)sizeof(in); i++) {
+        in[i] = (uint8_t)i;
+    }
+    RING_CHECK(broadcast_ring_init(&rb, storage, 12) != 0);
+    broadcast_ring_init(&rb, storage, sizeof(storage));
+
+    fast = broadcast_ring_head(&rb);
+    slow = fast;
+
+    /* both readers see the same bytes */
+    broadcast_ring_write(&rb, in, 10);
+    RING_CHECK(broadcast_ring_read(&rb, &fast, out, sizeof(out),
+                                   &fastSkipped) == 10);
+    RING_CHECK(memcmp(out, in, 10) == 0);
+
+    /* the slow reader is lapped: it gets the newest 16 and the rest is
+     * counted as skipped, the fast one keeping up loses nothing */
+    for (i = 10; i < 30; i += 10) {
+        broadcast_ring_write(&rb, in + i, 10);
+        RING_CHECK(broadcast_ring_read(&rb, &fast, out, sizeof(out),
+                                       &fastSkipped) == 10);
+        RING_CHECK(memcmp(out, in + i, 10) == 0);
+    }
+    RING_CHECK(fastSkipped == 0);
+
+    RING_CHECK(broadcast_ring_read(&rb, &slow, out, sizeof(out),
+                                   &slowSkipped) == 16);
+    RING_CHECK(memcmp(out, in + 14, 16) == 0);
+    RING_CHECK(slowSkipped == 14);
+    RING_CHECK(slow == fast);
+
+    /* a write larger than the ring keeps only its last 16 bytes */
+    broadcast_ring_write(&rb, in, 40);
+    RING_CHECK(broadcast_ring_read(&rb, &fast, out, sizeof(out),
+                                   &fastSkipped) == 16);
+    RING_CHECK(memcmp(out, in + 24, 16) == 0);
+    RING_CHECK(fastSkipped == 24);
+}
+
+/* producer: a counting byte pattern in writes of varying size */
+static void* ring_test_producer(void* arg)
+{
+    RingBuffer* rb = (RingBuffer*)arg;
+    uint8_t chunk[97];
+    uint32_t sent = 0;
+    uint32_t sz;
+    uint32_t n;
+    uint32_t i;
+
+    while (sent < RING_TEST_STRESS_SZ) {
+        sz = 1 + (sent % sizeof(chunk));
+        if (sz > RING_TEST_STRESS_SZ - sent) {
+            sz = RING_TEST_STRESS_SZ - sent;
+        }
+        for (i = 0; i < sz; i++) {
+            chunk[i] = (uint8_t)((sent + i) * 31);
+        }
+
+        n = ring_buffer_write(rb, chunk, sz);
+        while (n < sz) {
+            /* full: let the consumer run, even on a single core */
+            sched_yield();
+            n += ring_buffer_write(rb, chunk + n, sz - n);
+        }
+        sent += sz;
+    }
+
+    return NULL;
+}
+
+/* consumer: alternates read and peek/consume, and checks every byte */
+static int ring_test_stress(void)
+{
+    static uint8_t storage[256];
+    RingBuffer rb;
+    pthread_t producer;
+    uint8_t chunk[61];
+    uint8_t* span;
+    uint32_t received = 0;
+    uint32_t n;
+    uint32_t i;
+    int bad = 0;
+
+    ring_buffer_init(&rb, storage, sizeof(storage));
+    if (pthread_create(&producer, NULL, ring_test_producer, &rb) != 0) {
+        fprintf(stderr, "pthread_create failed\n");
+        return -1;
+    }
+
+    /* after a bad byte, keep draining so the producer can finish */
+    while (received < RING_TEST_STRESS_SZ) {
+        if (received & 1) {
+            n = ring_buffer_peek(&rb, &span);
+        }
+        else {
+            n = ring_buffer_read(&rb, chunk, sizeof(chunk));
+            span = chunk;
+        }
+        for (i = 0; (i < n) && !bad; i++) {
+            if (span[i] != (uint8_t)((received + i) * 31)) {
+                fprintf(stderr, "stress: byte %u is wrong\n", received + i);
+                bad = 1;
+            }
+        }
+        if (n == 0) {
+            sched_yield();
+        }
+        else if (received & 1) {
+            ring_buffer_consume(&rb, n);
+        }
+        received += n;
+    }
+
+    pthread_join(producer, NULL);
+    RING_CHECK(!bad);
+    RING_CHECK(ring_buffer_used(&rb) == 0);
+
+    return 0;
+}
+
+int main(void)
+{
+    ring_test_init();
+    ring_test_full_empty();
+    ring_test_wrap();
+    ring_test_peek_consume();
+    ring_test_reserve_commit();
+    ring_test_broadcast();
+    if (ring_test_stress() != 0) {
+        failures++;
+    }
+
+    if (failures == 0) {
+        printf("ring_test: all tests passed\n");
+    }
+
+    return (failures == 0) ? 0 : 1;
+}